@@ -5,6 +5,11 @@
 #include <cdefs.h>
 
 #include <sys/timer.h>
+#include <mem/pmm.h>
+#include <mem/slab.h>
+#include <mem/vmm_magazine.h>
+
+#include <x86_64/mem/tlb.h>
 
 #include "msr.h"
 #include "gdt.h"
@@ -65,6 +70,7 @@ struct cpu_features {
 
     bool syscall_supported : 1;
     bool x87_fpu_supported : 1;
+    bool pcid_supported : 1; // PCID and INVPCID, enabled in cr4 when present
 };
 
 struct cpu {
@@ -96,6 +102,11 @@ struct cpu {
 
     struct timer* timer;
     uintmax_t loadavg_ticks;
+
+    struct pmm_magazine pmm_magazine;
+    struct slab_cpu_cache slab_caches[SLAB_MAX_CPU_CACHES];
+    struct vmm_range_magazine vmm_range_magazine;
+    struct mmu_flush_queue tlb_queue;
 };
 
 struct cpu_context {
@@ -223,5 +234,11 @@ static __always_inline void pause(void) {
     __asm__ volatile("pause");
 }
 
+static __always_inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t) hi << 32) | lo;
+}
+
 #endif /* _AMETHYST_X86_64_CPU_H */
 
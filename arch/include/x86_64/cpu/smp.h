@@ -2,6 +2,7 @@
 #define _AMETHYST_X86_64_CPU_SMP_H
 
 #include <cpu/cpu.h>
+#include <cpu/smp.h>
 
 #include <stddef.h>
 
@@ -12,13 +13,9 @@ enum smp_ipi_target {
     SMP_IPI_OTHERCPUS
 };
 
-extern size_t smp_cpus_awake;
-
 void smp_init(void);
 
 void smp_send_ipi(struct cpu* cpu, struct isr* isr, enum smp_ipi_target target, bool nmi);
 
-struct cpu* smp_get_cpu(unsigned smp_id);
-
 #endif /* _AMETHYST_X86_64_CPU_SMP_H */
 
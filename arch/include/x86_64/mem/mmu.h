@@ -9,6 +9,9 @@
 
 #define PAGE_SIZE 0x1000
 
+#define MMU_PAGE_SIZE_2M 0x200000ul
+#define MMU_PAGE_SIZE_1G 0x40000000ul
+
 #define KERNELSPACE_START ((void*) 0xffff800000000000)
 #define KERNELSPACE_END   ((void*) 0xffffffffffffffff)
 #define USERSPACE_START   ((void*) 0x0000000000001000)
@@ -37,19 +40,56 @@ void mmu_apswitch(void);
 page_table_ptr_t mmu_new_table(void);
 void mmu_destroy_table(page_table_ptr_t table);
 
+// 4 KiB operations, huge pages covering `vaddr` get split as needed
 bool mmu_map(page_table_ptr_t table, void* paddr, void* vaddr, enum mmu_flags flags);
 void mmu_remap(page_table_ptr_t table, void* paddr, void* vaddr, enum mmu_flags flags);
 void mmu_unmap(page_table_ptr_t table, void* vaddr);
 
+// operations on a whole 2 MiB or 1 GiB page
+bool mmu_map_huge(page_table_ptr_t table, void* paddr, void* vaddr, size_t page_size, enum mmu_flags flags);
+void mmu_remap_huge(page_table_ptr_t table, void* paddr, void* vaddr, size_t page_size, enum mmu_flags flags);
+void mmu_unmap_huge(page_table_ptr_t table, void* vaddr, size_t page_size);
+
+// shares all pages mapped in [vaddr, vaddr + size) of `src` with `dst` copy-on-write: both sides
+// lose their write permission and every frame gains a reference. `pages` receives the number of shared pages.
+bool mmu_fork_range(page_table_ptr_t dst, page_table_ptr_t src, void* vaddr, size_t size, size_t* pages);
+
+bool mmu_page_size_supported(size_t page_size);
+
+// largest supported page size to map `size` bytes at `vaddr` -> `paddr` with
+size_t mmu_huge_page_size(void* vaddr, void* paddr, size_t size);
+
 void* mmu_get_physical(page_table_ptr_t table, void* vaddr);
 
+// size of the page mapping `vaddr`, 0 if unmapped
+size_t mmu_get_page_size(page_table_ptr_t table, void* vaddr);
+
 bool mmu_get_flags(page_table_ptr_t table, void* vaddr, enum mmu_flags* mmu_flags);
 bool mmu_is_present(page_table_ptr_t table, void* vaddr);
 bool mmu_is_writable(page_table_ptr_t table, void* vaddr);
 
-void mmu_tlb_shootdown(void* page);
+struct vmm_context;
+
+// `context` is the address space being changed, nullptr for kernel space
+void mmu_tlb_batch_init(struct mmu_tlb_batch* batch, struct vmm_context* context);
+// a nullptr `vaddr` flushes the whole address space
+void mmu_tlb_batch_add(struct mmu_tlb_batch* batch, void* vaddr, size_t size);
+// invalidates everything collected on this and all other affected cpus, then empties the batch
+void mmu_tlb_batch_flush(struct mmu_tlb_batch* batch);
+
+// single range shootdown in the current address space (or kernel space); nullptr flushes everything
 void mmu_invalidate_range(void* vaddr, size_t size);
 
+void mmu_tlb_stats(struct mmu_tlb_stats* stats);
+
+// true if address spaces are tagged with PCIDs and survive context switches in the TLB
+bool mmu_asids_enabled(void);
+uint16_t mmu_asid_alloc(void);
+void mmu_asid_free(uint16_t asid);
+
+// loads `table` tagged with `asid`, keeping the TLB entries the asid already has
+void mmu_switch_asid(page_table_ptr_t table, uint16_t asid);
+
 __noreturn void page_fault_handler(struct cpu_context* status);
 
 bool is_userspace_addr(const void* addr);
@@ -0,0 +1,79 @@
+#ifndef _AMETHYST_X86_64_TLB_H
+#define _AMETHYST_X86_64_TLB_H
+
+#include <sys/spinlock.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// cpus beyond this limit are not tracked per address space and receive every shootdown
+#define MMU_MAX_CPUS 256
+
+// ranges one batch can describe before it degrades to a full flush
+#define MMU_TLB_BATCH_RANGES 16
+
+// concurrent shootdowns a cpu can have queued
+#define MMU_FLUSH_QUEUE_SIZE 8
+
+// above this many pages, reloading cr3 is cheaper than invlpg
+#define MMU_FLUSH_ALL_PAGES 128
+
+// PCIDs tagging TLB entries, one per address space while they last
+#define MMU_ASID_COUNT 4096
+// the kernel context's
+#define MMU_ASID_KERNEL 0
+// shared by all address spaces allocated after the others ran out, flushed on every switch
+#define MMU_ASID_SHARED 1
+
+// set of cpus that currently have an address space loaded. With ASIDs, cpus stay in the set
+// after switching away until a shootdown makes them drop the space's entries.
+struct mmu_cpu_set {
+    uint64_t bits[MMU_MAX_CPUS / 64];
+};
+
+// invalidations collected over one unmap/mprotect operation, sent with a single IPI per target cpu
+struct mmu_tlb_batch {
+    struct mmu_cpu_set* cpus; // nullptr for kernel space: every cpu is a target
+    uint16_t asid;
+    bool full;                // the range list overflowed, flush everything
+    size_t count;
+    size_t pages;
+    struct {
+        uintptr_t start;
+        size_t size;
+    } ranges[MMU_TLB_BATCH_RANGES];
+
+    int pending; // targets that did not process the batch yet
+};
+
+// batches other cpus asked this cpu to flush, lives in `struct cpu`
+struct mmu_flush_queue {
+    spinlock_t lock;
+    size_t count;
+    struct mmu_tlb_batch* batches[MMU_FLUSH_QUEUE_SIZE];
+};
+
+static inline void mmu_cpu_set_add(struct mmu_cpu_set* set, int16_t cpu) {
+    if(cpu >= 0 && cpu < MMU_MAX_CPUS)
+        __atomic_or_fetch(&set->bits[cpu / 64], 1ul << (cpu % 64), __ATOMIC_SEQ_CST);
+}
+
+static inline void mmu_cpu_set_remove(struct mmu_cpu_set* set, int16_t cpu) {
+    if(cpu >= 0 && cpu < MMU_MAX_CPUS)
+        __atomic_and_fetch(&set->bits[cpu / 64], ~(1ul << (cpu % 64)), __ATOMIC_SEQ_CST);
+}
+
+static inline bool mmu_cpu_set_has(struct mmu_cpu_set* set, int16_t cpu) {
+    if(cpu < 0 || cpu >= MMU_MAX_CPUS)
+        return true;
+    return __atomic_load_n(&set->bits[cpu / 64], __ATOMIC_SEQ_CST) & (1ul << (cpu % 64));
+}
+
+struct mmu_tlb_stats {
+    uintmax_t batches;      // batches flushed
+    uintmax_t ipis;         // shootdown IPIs sent
+    uintmax_t pages;        // pages invalidated by address, summed over all cpus
+    uintmax_t full_flushes; // complete TLB flushes, summed over all cpus
+};
+
+#endif /* _AMETHYST_X86_64_TLB_H */
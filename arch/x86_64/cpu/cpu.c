@@ -6,12 +6,36 @@
 
 #define CPUID_SYSCALL (1 << 11)
 #define CPUID_SSE     (1 << 25)
+#define CPUID_PCID    (1 << 17)
+#define CPUID_INVPCID (1 << 10)
 #define EFER_SYSCALL_ENABLE 1
 
+#define CR4_PGE   (1 << 7)
+#define CR4_PCIDE (1 << 17)
+
 extern void _enable_sse(void);
 extern void _enable_x87_fpu(void);
 extern void _enable_fxsave(void);
 
+static void enable_pcid(void) {
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    bool pcid = ecx & CPUID_PCID;
+
+    eax = ebx = ecx = edx = 0;
+    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+
+    // without INVPCID, entries of address spaces other than the loaded one could not be invalidated
+    if(!(_cpu()->features.pcid_supported = pcid && (ebx & CPUID_INVPCID)))
+        return;
+
+    // cr3 still holds PCID 0 here, which PCIDE requires
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE | CR4_PCIDE;
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+}
+
 void cpu_enable_features(void) {
     uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
     __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
@@ -38,5 +62,7 @@ void cpu_enable_features(void) {
     _enable_fxsave();
 
     //klog(DEBUG, "x87 FPU support: %hhu", _cpu()->features.x87_fpu_supported);
+
+    enable_pcid();
 }
 
@@ -27,6 +27,10 @@
 size_t smp_cpus_awake = 1;
 static struct cpu* smp_cpus;
 
+// the bootstrap processor keeps its statically allocated `struct cpu`
+static struct cpu* bsp_cpu;
+static size_t bsp_index;
+
 static volatile struct limine_smp_request smp_request = {
     .id = LIMINE_SMP_REQUEST,
     .revision = 0
@@ -34,7 +38,14 @@ static volatile struct limine_smp_request smp_request = {
 
 struct cpu* smp_get_cpu(unsigned smp_id) {
     assert(smp_id < smp_cpus_awake);
-    return &smp_cpus[smp_id];
+    if(!smp_cpus)
+        return _cpu();
+    return smp_id == bsp_index ? bsp_cpu : &smp_cpus[smp_id];
+}
+
+bool smp_is_bsp(struct cpu* cpu) {
+    // before smp_init() (or without SMP) the bsp is the only cpu running
+    return !smp_cpus || cpu == bsp_cpu;
 }
 
 static __noreturn void cpu_wakeup(struct limine_smp_info* smp_info) {
@@ -60,6 +71,20 @@ static __noreturn void cpu_wakeup(struct limine_smp_info* smp_info) {
     sched_stop_thread();  
 }
 
+static void set_bsp_id(cpuid_t id) {
+    bool int_status = interrupt_set(false);
+    struct cpu* cpu = _cpu();
+
+    // the bsp already joined the address space set of its context under the default id
+    if(cpu->vmm_context) {
+        mmu_cpu_set_add(&cpu->vmm_context->active_cpus, id);
+        mmu_cpu_set_remove(&cpu->vmm_context->active_cpus, cpu->id);
+    }
+
+    cpu->id = id;
+    interrupt_set(int_status);
+}
+
 void smp_init(void) {
     if(!smp_request.response) {
         klog(WARN, "SMP is not available");
@@ -75,15 +100,20 @@ void smp_init(void) {
     assert(smp_cpus);
     smp_cpus = MAKE_HHDM(smp_cpus);
 
-    memset(smp_cpus, 0, sizeof(smp_cpu_size));
+    memset(smp_cpus, 0, smp_cpu_size);
 
     void (*wakeup_fn)(struct limine_smp_info*) = cpu_wakeup;
 
     for(size_t i = 0; i < cpu_count; i++) {
         if(smp_request.response->cpus[i]->lapic_id == smp_request.response->bsp_lapic_id) {
+            bsp_cpu = _cpu();
+            bsp_index = i;
+            set_bsp_id(smp_request.response->bsp_lapic_id);
             continue;
         }
 
+        // IPIs are addressed by `id`, so it has to be the lapic id
+        smp_cpus[i].id = smp_request.response->cpus[i]->lapic_id;
         smp_request.response->cpus[i]->extra_argument = (uint64_t) &smp_cpus[i];
 
         __atomic_store_n(&smp_request.response->cpus[i]->goto_address, wakeup_fn, __ATOMIC_SEQ_CST);
@@ -15,27 +15,27 @@
 #include <x86_64/dev/pic.h>
 
 #include <assert.h>
+#include <cpuid.h>
 #include <kernelio.h>
+#include <math.h>
 #include <stdint.h>
 #include <string.h>
 
 #define ADDRMASK 0x7ffffffffffff000ul
-#define   PTMASK 0b111111111000000000000ul
-#define   PDMASK 0b111111111000000000000000000000ul
-#define PDPTMASK 0b111111111000000000000000000000000000000ul
-#define PML4MASK 0b111111111000000000000000000000000000000000000000ul
+#define HUGEBIT  (1ul << 7)
+#define GLOBALBIT (1ul << 8)
+
+#define CR3_NOFLUSH (1ul << 63)
+
+#define PML4_SHIFT 39
+#define   PT_SHIFT 12
+
+#define CPUID_PDPE1GB (1 << 26)
 
 #define INTERMEDIATE_FLAGS (MMU_FLAGS_WRITE | MMU_FLAGS_READ | MMU_FLAGS_USER)
 
 #define FLAGS_MASK (MMU_FLAGS_WRITE | MMU_FLAGS_READ | MMU_FLAGS_NOEXEC | MMU_FLAGS_USER)
 
-enum paging_depth : int8_t {
-    DEPTH_PML4 = 0,
-    DEPTH_PDPT = 1,
-    DEPTH_PD = 2,
-    DEPTH_PT = 3
-};
-
 static page_table_ptr_t template;
 
 extern char _TEXT_START_[],   _TEXT_END_[],
@@ -70,106 +70,201 @@ static volatile struct limine_kernel_address_request kernel_address_request = {
     .revision = 0
 };
 
-static void* mmu_page = nullptr;
-static int remaining = 0;
-
-static spinlock_t shootdown_lock;
-static void* shootdown_page;
-static size_t shootdown_size;
-static int shootdown_remaining = 0;
+static struct mmu_tlb_stats tlb_stats;
 
 static void mmu_invalidate(void* vaddr, size_t size);
+static void process_flush_queue(void);
+
+static bool gib_pages_supported;
+
+// decided by the bsp, every ap is expected to support the same
+static bool asids_enabled;
+
+static spinlock_t asid_lock;
+static uint64_t asid_bitmap[MMU_ASID_COUNT / 64];
+static unsigned asid_next;
+
+enum invpcid_type {
+    INVPCID_ADDRESS = 0,
+    INVPCID_CONTEXT = 1,
+    INVPCID_ALL_GLOBAL = 2,
+    INVPCID_ALL = 3
+};
+
+static __always_inline void invpcid(enum invpcid_type type, uint16_t pcid, uintptr_t vaddr) {
+    struct {
+        uint64_t pcid;
+        uint64_t vaddr;
+    } desc = { pcid, vaddr };
+
+    __asm__ volatile("invpcid %0, %1" :: "m"(desc), "r"((uint64_t) type) : "memory");
+}
+
+// with ASIDs, kernel mappings are global so that they are shared by all PCIDs and invlpg reaches them everywhere
+static __always_inline uint64_t global_bit(void* vaddr) {
+    return asids_enabled && vaddr >= KERNELSPACE_START ? GLOBALBIT : 0;
+}
 
 static __always_inline void* next(uint64_t entry) {
     return entry ? MAKE_HHDM(entry & ADDRMASK) : nullptr;
 }
 
-static bool add_page(page_table_ptr_t top, void* vaddr, uint64_t entry, enum paging_depth depth) {
-    uint64_t* pml4 = MAKE_HHDM(top);
+static __always_inline unsigned size_to_shift(size_t page_size) {
+    return page_size == MMU_PAGE_SIZE_1G ? 30 : page_size == MMU_PAGE_SIZE_2M ? 21 : PT_SHIFT;
+}
+
+// replaces a huge page entry at level `shift` with a table of 512 entries of the next smaller size
+static bool split_entry(uint64_t* entry, unsigned shift) {
+    uint64_t* table = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
+    if(!table)
+        return false;
+
+    size_t child_size = 1ul << (shift - 9);
+    uintptr_t base = *entry & ADDRMASK & ~((1ul << shift) - 1);
+    uint64_t flags = *entry & ~ADDRMASK & ~HUGEBIT;
+    if(shift - 9 > PT_SHIFT)
+        flags |= HUGEBIT;
+
+    uint64_t* table_hhdm = MAKE_HHDM(table);
+    for(size_t i = 0; i < 512; i++)
+        table_hhdm[i] = (base + i * child_size) | flags;
+
+    *entry = (uint64_t) table | INTERMEDIATE_FLAGS;
+    return true;
+}
+
+// returns the entry mapping `vaddr` at level `shift`, splitting huge pages above it;
+// missing tables are only allocated when `create` is set
+static uint64_t* get_entry(page_table_ptr_t top, void* vaddr, unsigned shift, bool create) {
     uintptr_t addr = (uintptr_t) vaddr;
-    uintptr_t pt_offset = (addr & PTMASK) >> 12;
-    uintptr_t pd_offset = (addr & PDMASK) >> 21;
-    uintptr_t pdpt_offset = (addr & PDPTMASK) >> 30;
-    uintptr_t pml4_offset = (addr & PML4MASK) >> 39;
+    uint64_t* table = MAKE_HHDM(top);
 
-    if(depth == DEPTH_PDPT) {
-        pml4[pml4_offset] = entry;
-        return true;
-    }
+    for(unsigned level = PML4_SHIFT; level > shift; level -= 9) {
+        uint64_t* entry = &table[(addr >> level) & 0x1ff];
 
-    uint64_t* pdpt = next(pml4[pml4_offset]);
-    if(!pdpt) {
-        pdpt = pmm_alloc_page(PMM_SECTION_DEFAULT);
-        if(!pdpt)
-            return false;
-        pml4[pml4_offset] = (uint64_t) pdpt | INTERMEDIATE_FLAGS;
-        pdpt = MAKE_HHDM(pdpt);
-        memset(pdpt, 0, PAGE_SIZE);
+        if(!*entry) {
+            if(!create)
+                return nullptr;
+
+            void* new_table = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
+            if(!new_table)
+                return nullptr;
+            *entry = (uint64_t) new_table | INTERMEDIATE_FLAGS;
+        }
+        else if((*entry & HUGEBIT) && !split_entry(entry, level))
+            return nullptr;
+
+        table = next(*entry);
     }
 
-    if(depth == DEPTH_PD) {
-        pdpt[pdpt_offset] = entry;
-        return true;
+    return &table[(addr >> shift) & 0x1ff];
+}
+
+// returns the leaf entry mapping `vaddr` without modifying the table
+static uint64_t* get_page(page_table_ptr_t top, void* vaddr, size_t* page_size) {
+    uintptr_t addr = (uintptr_t) vaddr;
+    uint64_t* table = MAKE_HHDM(top);
+
+    for(unsigned level = PML4_SHIFT;; level -= 9) {
+        uint64_t* entry = &table[(addr >> level) & 0x1ff];
+        if(level == PT_SHIFT || (*entry & HUGEBIT)) {
+            if(page_size)
+                *page_size = 1ul << level;
+            return entry;
+        }
+
+        if(!(table = next(*entry)))
+            return nullptr;
     }
+}
+
+static bool is_empty_table(uint64_t* table, int depth) {
+    for(size_t i = 0; i < 512; i++) {
+        if(!table[i])
+            continue;
 
-    uint64_t* pd = next(pdpt[pdpt_offset]);
-    if(!pd) {
-        pd = pmm_alloc_page(PMM_SECTION_DEFAULT);
-        if(!pd)
+        if(depth == 0 || (table[i] & HUGEBIT) || !is_empty_table(next(table[i]), depth - 1))
             return false;
-        pdpt[pdpt_offset] = (uint64_t) pd | INTERMEDIATE_FLAGS;
-        pd = MAKE_HHDM(pd);
-        memset(pd, 0, PAGE_SIZE);
     }
 
-    if(depth == DEPTH_PT) {
-        pd[pd_offset] = entry;
-        return true;
-    }
+    return true;
+}
+
+static void _destroy(uint64_t* table, int depth);
 
-    uint64_t* pt = next(pd[pd_offset]);
-    if(!pt) {
-        pt = pmm_alloc_page(PMM_SECTION_DEFAULT);
-        if(!pt)
+static bool map_entry(page_table_ptr_t top, void* vaddr, uint64_t entry, size_t page_size) {
+    unsigned shift = size_to_shift(page_size);
+    uint64_t* entry_ptr = get_entry(top, vaddr, shift, true);
+    if(!entry_ptr)
+        return false;
+
+    // a huge page may only replace an empty table
+    if(shift > PT_SHIFT && *entry_ptr && !(*entry_ptr & HUGEBIT)) {
+        int depth = (shift - 9 - PT_SHIFT) / 9;
+        uint64_t* table = next(*entry_ptr);
+        if(!is_empty_table(table, depth))
             return false;
-        pd[pd_offset] = (uint64_t) pt | INTERMEDIATE_FLAGS;
-        pt = MAKE_HHDM(pt);
-        memset(pt, 0, PAGE_SIZE);
+
+        _destroy(table, depth);
+        pmm_free_page(FROM_HHDM(table));
     }
 
-    pt[pt_offset] = entry;
+    entry |= global_bit(vaddr);
+    *entry_ptr = shift > PT_SHIFT ? entry | HUGEBIT : entry;
     return true;
 }
 
-static uint64_t* get_page(page_table_ptr_t top, void* vaddr) {
-    uint64_t* pml4 = MAKE_HHDM(top);
-    uintptr_t addr = (uintptr_t) vaddr;
-    uintptr_t pt_offset = (addr & PTMASK) >> 12;
-    uintptr_t pd_offset = (addr & PDMASK) >> 21;
-    uintptr_t pdpt_offset = (addr & PDPTMASK) >> 30;
-    uintptr_t pml4_offset = (addr & PML4MASK) >> 39;
+// shares the present entries covering [start, end) of the table at level `shift` from `src` with `dst`,
+// write-protecting every leaf in both; only tables that actually contain mappings are visited
+static bool fork_table(uint64_t* dst, uint64_t* src, unsigned shift, uintptr_t start, uintptr_t end, size_t* pages) {
+    size_t entry_size = 1ul << shift;
 
-    uint64_t* pdpt = next(pml4[pml4_offset]);
-    if(!pdpt)
-        return nullptr;
+    for(uintptr_t addr = start; addr < end;) {
+        uintptr_t base = addr & ~(entry_size - 1);
+        uintptr_t top = MIN(base + entry_size, end);
+        size_t i = (addr >> shift) & 0x1ff;
+        addr = top;
 
-    uint64_t* pd = next(pdpt[pdpt_offset]);
-    if(!pd)
-        return nullptr;
+        if(!src[i])
+            continue;
 
-    uint64_t* pt = next(pd[pd_offset]);
-    if(!pt)
-        return nullptr;
+        bool covered = base >= start && top - base == entry_size;
+        if(shift > PT_SHIFT && (src[i] & HUGEBIT) && !covered && !split_entry(&src[i], shift))
+            return false;
+
+        if(shift == PT_SHIFT || (src[i] & HUGEBIT)) {
+            src[i] &= ~(uint64_t) MMU_FLAGS_WRITE;
+            dst[i] = src[i];
 
-    return pt + pt_offset;
+            uintptr_t phys = src[i] & ADDRMASK & ~(entry_size - 1);
+            for(size_t off = 0; off < entry_size; off += PAGE_SIZE)
+                pmm_hold((void*) (phys + off));
+
+            *pages += entry_size / PAGE_SIZE;
+            continue;
+        }
+
+        if(!dst[i]) {
+            void* table = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
+            if(!table)
+                return false;
+            dst[i] = (uint64_t) table | INTERMEDIATE_FLAGS;
+        }
+
+        if(!fork_table(next(dst[i]), next(src[i]), shift - 9, MAX(base, start), top, pages))
+            return false;
+    }
+
+    return true;
 }
 
 void mmu_tlbipi(struct cpu_context* status __unused) {
-    mmu_invalidate(shootdown_page, shootdown_size);
-    __atomic_sub_fetch(&remaining, 1, __ATOMIC_SEQ_CST);
+    process_flush_queue();
 }
 
 void mmu_apswitch(void) {
+    assert(!asids_enabled || _cpu()->features.pcid_supported);
+
     mmu_switch(FROM_HHDM(template));
     pagefault_init();
     protectionfault_init();
@@ -178,16 +273,24 @@ void mmu_apswitch(void) {
 }
 
 void mmu_init(struct mmap* mmap) {
-    template = pmm_alloc_page(PMM_SECTION_DEFAULT);
+    uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    gib_pages_supported = (edx & CPUID_PDPE1GB) != 0;
+
+    asids_enabled = _cpu()->features.pcid_supported;
+    spinlock_init(asid_lock);
+    // reserved ids are never handed out by mmu_asid_alloc()
+    asid_bitmap[0] = (1ul << MMU_ASID_KERNEL) | (1ul << MMU_ASID_SHARED);
+    klog(INFO, "address space ids: %s", asids_enabled ? "PCID + INVPCID" : "unsupported, flushing on every switch");
+
+    template = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
     assert(template);
 
     template = MAKE_HHDM(template);
-    memset(template, 0, PAGE_SIZE);
 
     for(unsigned i = 256; i < 512; i++) {
-        uint64_t* entry = pmm_alloc_page(PMM_SECTION_DEFAULT);
+        uint64_t* entry = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
         assert(entry);
-        memset(MAKE_HHDM(entry), 0, PAGE_SIZE);
         template[i] = (uint64_t) entry | INTERMEDIATE_FLAGS;
     }
 
@@ -196,9 +299,13 @@ void mmu_init(struct mmap* mmap) {
     klog_inl(INFO, "hhdm mapping... [\e[%zuC]\e[%zuD", mmap->map->entry_count * 2, mmap->map->entry_count * 2 + 1);
     for(size_t i = 0; i < mmap->map->entry_count; i++) {
         struct limine_memmap_entry* e = mmap->map->entries[i];
-        for(uint64_t i = 0; i < e->length; i += PAGE_SIZE) {
-            uint64_t entry = ((e->base + i) & ADDRMASK) | MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC;
-            assert(add_page(FROM_HHDM(template), MAKE_HHDM(e->base + i), entry, DEPTH_PML4));
+        for(uint64_t i = 0; i < e->length;) {
+            uintptr_t phys = e->base + i;
+            size_t page_size = mmu_huge_page_size(MAKE_HHDM(phys), (void*) phys, e->length - i);
+
+            uint64_t entry = (phys & ADDRMASK) | MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC;
+            assert(map_entry(FROM_HHDM(template), MAKE_HHDM(phys), entry, page_size));
+            i += page_size;
         }
         printk("==");
     }
@@ -215,7 +322,7 @@ void mmu_init(struct mmap* mmap) {
 
         for(uintptr_t off = 0; off < len; off += PAGE_SIZE) {
             uint64_t entry = ((phys_base + off) & ADDRMASK) | kernel_flags[i];
-            assert(add_page(FROM_HHDM(template), (void*) (base_ptr + off), entry, 0));
+            assert(map_entry(FROM_HHDM(template), (void*) (base_ptr + off), entry, PAGE_SIZE));
         }
     }
     printk("done.");
@@ -224,7 +331,7 @@ void mmu_init(struct mmap* mmap) {
 }
 
 page_table_ptr_t mmu_new_table(void) {
-    page_table_ptr_t table = pmm_alloc_page(PMM_SECTION_DEFAULT);
+    page_table_ptr_t table = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
     if(!table)
         return nullptr;
     memcpy(MAKE_HHDM(table), template, PAGE_SIZE);
@@ -234,7 +341,7 @@ page_table_ptr_t mmu_new_table(void) {
 static void _destroy(uint64_t* table, int depth) {
     for(size_t i = 0; i < (depth == 3 ? 256 : 512); i++) {
         void* addr = (void*) (table[i] & ADDRMASK);
-        if(!addr)
+        if(!addr || (depth > 0 && (table[i] & HUGEBIT)))
             continue;
 
         if(depth > 0)
@@ -252,28 +359,87 @@ void mmu_destroy_table(page_table_ptr_t table) {
     pmm_free_page(table);
 }
 
+bool mmu_fork_range(page_table_ptr_t dst, page_table_ptr_t src, void* vaddr, size_t size, size_t* pages) {
+    assert((uintptr_t) vaddr % PAGE_SIZE == 0 && size % PAGE_SIZE == 0);
+    *pages = 0;
+    return fork_table(MAKE_HHDM(dst), MAKE_HHDM(src), PML4_SHIFT, (uintptr_t) vaddr, (uintptr_t) vaddr + size, pages);
+}
+
+bool mmu_page_size_supported(size_t page_size) {
+    switch(page_size) {
+    case PAGE_SIZE:
+    case MMU_PAGE_SIZE_2M:
+        return true;
+    case MMU_PAGE_SIZE_1G:
+        return gib_pages_supported;
+    default:
+        return false;
+    }
+}
+
+size_t mmu_huge_page_size(void* vaddr, void* paddr, size_t size) {
+    static const size_t sizes[] = { MMU_PAGE_SIZE_1G, MMU_PAGE_SIZE_2M };
+
+    for(size_t i = 0; i < __len(sizes); i++) {
+        if(mmu_page_size_supported(sizes[i])
+            && size >= sizes[i]
+            && (uintptr_t) vaddr % sizes[i] == 0
+            && (uintptr_t) paddr % sizes[i] == 0)
+            return sizes[i];
+    }
+
+    return PAGE_SIZE;
+}
+
 bool mmu_map(page_table_ptr_t table, void* paddr, void* vaddr, enum mmu_flags flags) {
     uint64_t entry = ((uintptr_t) paddr & ADDRMASK) | flags;
-    return add_page(table, vaddr, entry, 0);
+    return map_entry(table, vaddr, entry, PAGE_SIZE);
+}
+
+bool mmu_map_huge(page_table_ptr_t table, void* paddr, void* vaddr, size_t page_size, enum mmu_flags flags) {
+    assert(mmu_page_size_supported(page_size));
+    assert((uintptr_t) paddr % page_size == 0 && (uintptr_t) vaddr % page_size == 0);
+
+    uint64_t entry = ((uintptr_t) paddr & ADDRMASK) | flags;
+    return map_entry(table, vaddr, entry, page_size);
 }
 
 void mmu_remap(page_table_ptr_t table, void* paddr, void* vaddr, enum mmu_flags flags) {
-    uint64_t* entry_ptr = get_page(table, vaddr);
+    uint64_t* entry_ptr = get_entry(table, vaddr, PT_SHIFT, false);
     if(!entry_ptr)
         return;
     uintptr_t addr = paddr ? (uintptr_t) paddr & ADDRMASK : *entry_ptr & ADDRMASK;
-    *entry_ptr = addr | flags;
+    *entry_ptr = addr | flags | global_bit(vaddr);
+}
+
+void mmu_remap_huge(page_table_ptr_t table, void* paddr, void* vaddr, size_t page_size, enum mmu_flags flags) {
+    uint64_t* entry_ptr = get_entry(table, vaddr, size_to_shift(page_size), false);
+    if(!entry_ptr)
+        return;
+
+    assert(*entry_ptr & HUGEBIT);
+    uintptr_t addr = paddr ? (uintptr_t) paddr & ADDRMASK : *entry_ptr & ADDRMASK;
+    *entry_ptr = addr | flags | HUGEBIT | global_bit(vaddr);
 }
 
 void mmu_unmap(page_table_ptr_t table, void* vaddr) {
-    uint64_t* entry = get_page(table, vaddr);
+    uint64_t* entry = get_entry(table, vaddr, PT_SHIFT, false);
     if(!entry)
         return;
     *entry = 0;
 }
 
+void mmu_unmap_huge(page_table_ptr_t table, void* vaddr, size_t page_size) {
+    uint64_t* entry = get_entry(table, vaddr, size_to_shift(page_size), false);
+    if(!entry)
+        return;
+
+    assert(!*entry || (*entry & HUGEBIT));
+    *entry = 0;
+}
+
 static void mmu_invalidate(void* vaddr, size_t size) {
-    if(!vaddr || size >= 128 * PAGE_SIZE)
+    if(!vaddr || size >= MMU_FLUSH_ALL_PAGES * PAGE_SIZE)
         __asm__ volatile (
             "mov %%cr3, %%rax;\n"
             "mov %%rax, %%cr3;\n"
@@ -286,79 +452,244 @@ static void mmu_invalidate(void* vaddr, size_t size) {
         }
 }
 
-void mmu_invalidate_range(void* vaddr, size_t size) {
-    assert(((uintptr_t) vaddr % PAGE_SIZE) == 0);
-    struct thread* thread = current_thread();
+static void flush_batch_local(struct mmu_tlb_batch* batch) {
+    bool full = batch->full || batch->pages >= MMU_FLUSH_ALL_PAGES;
 
-    bool shootdown = thread 
-        && smp_cpus_awake > 1 
-        && (vaddr >= KERNELSPACE_START
-            || ((!vaddr || (vaddr >= USERSPACE_START && vaddr < USERSPACE_END))
-                && thread->proc && thread->proc->running_thread_count > 1));
+    if(!asids_enabled) {
+        if(full)
+            mmu_invalidate(nullptr, 0);
+        else
+            for(size_t i = 0; i < batch->count; i++)
+                mmu_invalidate((void*) batch->ranges[i].start, batch->ranges[i].size);
+    }
+    // kernel mappings are global: invlpg drops them for every PCID, a full flush has to include them
+    else if(!batch->cpus) {
+        if(full)
+            invpcid(INVPCID_ALL_GLOBAL, 0, 0);
+        else
+            for(size_t i = 0; i < batch->count; i++)
+                mmu_invalidate((void*) batch->ranges[i].start, batch->ranges[i].size);
+    }
+    // the address space may not be the loaded one, address it by its PCID
+    else if(full)
+        invpcid(INVPCID_CONTEXT, batch->asid, 0);
+    else
+        for(size_t i = 0; i < batch->count; i++)
+            for(uintptr_t off = 0; off < batch->ranges[i].size; off += PAGE_SIZE)
+                invpcid(INVPCID_ADDRESS, batch->asid, batch->ranges[i].start + off);
+
+    if(full)
+        __atomic_add_fetch(&tlb_stats.full_flushes, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&tlb_stats.pages, batch->pages, __ATOMIC_RELAXED);
+}
+
+// handles the batches other cpus queued for this one; interrupts must be disabled
+static void process_flush_queue(void) {
+    struct mmu_flush_queue* queue = &_cpu()->tlb_queue;
 
-    int old_ipl = 0;
+    for(;;) {
+        spinlock_acquire(&queue->lock);
+        struct mmu_tlb_batch* batch = queue->count ? queue->batches[--queue->count] : nullptr;
+        spinlock_release(&queue->lock);
 
-    if(shootdown) {
-        here();
-        old_ipl = interrupt_raise_ipl(IPL_DPC);
-        spinlock_acquire(&shootdown_lock);
+        if(!batch)
+            return;
 
-        shootdown_page = vaddr;
-        shootdown_size = size;
-        shootdown_remaining = smp_cpus_awake - 1;
+        // a space this cpu switched away from: drop all of its entries and leave its set, so it gets no further shootdowns
+        if(asids_enabled && batch->cpus && batch->cpus != &_cpu()->vmm_context->active_cpus) {
+            invpcid(INVPCID_CONTEXT, batch->asid, 0);
+            mmu_cpu_set_remove(batch->cpus, _cpu()->id);
+            __atomic_add_fetch(&tlb_stats.full_flushes, 1, __ATOMIC_RELAXED);
+        }
+        else
+            flush_batch_local(batch);
+
+        // the initiator may reuse the batch (it lives on its stack) as soon as this drops to zero
+        __atomic_sub_fetch(&batch->pending, 1, __ATOMIC_RELEASE);
+    }
+}
 
-        for(unsigned i = 0; i < smp_cpus_awake; i++) {
-            struct cpu* cpu = smp_get_cpu(i);
-            if(cpu == _cpu())
-                continue;
+static void queue_batch(struct cpu* cpu, struct mmu_tlb_batch* batch) {
+    struct mmu_flush_queue* queue = &cpu->tlb_queue;
 
-            smp_send_ipi(cpu, &cpu->isr[0xfe], SMP_IPI_TARGET, false);
+    for(;;) {
+        spinlock_acquire(&queue->lock);
+        if(queue->count < MMU_FLUSH_QUEUE_SIZE) {
+            queue->batches[queue->count++] = batch;
+            spinlock_release(&queue->lock);
+            return;
         }
+        spinlock_release(&queue->lock);
+
+        // the target may itself be waiting for us to handle its shootdown
+        process_flush_queue();
+        pause();
     }
+}
+
+void mmu_tlb_batch_init(struct mmu_tlb_batch* batch, struct vmm_context* context) {
+    batch->cpus = context ? &context->active_cpus : nullptr;
+    batch->asid = context ? context->asid : MMU_ASID_KERNEL;
+    batch->full = false;
+    batch->count = 0;
+    batch->pages = 0;
+    batch->pending = 0;
+}
 
-    mmu_invalidate(vaddr, size);
+void mmu_tlb_batch_add(struct mmu_tlb_batch* batch, void* vaddr, size_t size) {
+    assert(((uintptr_t) vaddr % PAGE_SIZE) == 0);
+
+    if(!vaddr)
+        batch->full = true;
+
+    if(batch->full)
+        return;
+
+    batch->pages += ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE;
 
-    if(shootdown) {
-        while(__atomic_load_n(&shootdown_remaining, __ATOMIC_SEQ_CST) > 0)
-            pause();
+    // unmap and mprotect walk addresses in ascending order, so neighbours usually coalesce
+    if(batch->count) {
+        size_t last = batch->count - 1;
+        if(batch->ranges[last].start + batch->ranges[last].size == (uintptr_t) vaddr) {
+            batch->ranges[last].size += size;
+            return;
+        }
+    }
 
-        spinlock_release(&shootdown_lock);
-        interrupt_lower_ipl(old_ipl);
+    if(batch->count == MMU_TLB_BATCH_RANGES) {
+        batch->full = true;
+        return;
     }
+
+    batch->ranges[batch->count].start = (uintptr_t) vaddr;
+    batch->ranges[batch->count].size = size;
+    batch->count++;
 }
 
-void mmu_tlb_shootdown(void *page) {
-    struct proc* proc = current_proc();
-    if(!proc || smp_cpus_awake == 1)
+void mmu_tlb_batch_flush(struct mmu_tlb_batch* batch) {
+    if(!batch->count && !batch->full)
         return;
-    
-    if(page >= KERNELSPACE_START || 
-        (proc->running_thread_count > 1 && page >= USERSPACE_START && page < USERSPACE_END)) {
-        int old_ipl = interrupt_raise_ipl(IPL_DPC);
-        spinlock_acquire(&shootdown_lock);
 
-        mmu_page = page;
-        remaining = smp_cpus_awake - 1;
+    __atomic_add_fetch(&tlb_stats.batches, 1, __ATOMIC_RELAXED);
 
-        smp_send_ipi(NULL, &_cpu()->isr[0xfe], SMP_IPI_OTHERCPUS, false);
+    // stay on this cpu and keep our own queue serviced while waiting for the others
+    bool int_status = interrupt_set(false);
+    struct cpu* self = _cpu();
 
-        while(__atomic_load_n(&remaining, __ATOMIC_SEQ_CST))
-            pause();
+    batch->pending = 0;
 
-        spinlock_release(&shootdown_lock);
-        interrupt_lower_ipl(old_ipl);
+    for(unsigned i = 0; smp_cpus_awake > 1 && i < smp_cpus_awake; i++) {
+        struct cpu* cpu = smp_get_cpu(i);
+        if(cpu == self || (batch->cpus && !mmu_cpu_set_has(batch->cpus, cpu->id)))
+            continue;
+
+        __atomic_add_fetch(&batch->pending, 1, __ATOMIC_RELAXED);
+        queue_batch(cpu, batch);
+
+        smp_send_ipi(cpu, &cpu->isr[0xfe], SMP_IPI_TARGET, false);
+        __atomic_add_fetch(&tlb_stats.ipis, 1, __ATOMIC_RELAXED);
+    }
+
+    flush_batch_local(batch);
+
+    while(__atomic_load_n(&batch->pending, __ATOMIC_ACQUIRE) > 0) {
+        process_flush_queue();
+        pause();
     }
+
+    interrupt_set(int_status);
+
+    batch->count = 0;
+    batch->pages = 0;
+    batch->full = false;
+}
+
+void mmu_invalidate_range(void* vaddr, size_t size) {
+    assert(((uintptr_t) vaddr % PAGE_SIZE) == 0);
+
+    struct mmu_tlb_batch batch;
+    mmu_tlb_batch_init(&batch, vaddr >= KERNELSPACE_START ? nullptr : _cpu()->vmm_context);
+    mmu_tlb_batch_add(&batch, vaddr, size);
+    mmu_tlb_batch_flush(&batch);
+}
+
+bool mmu_asids_enabled(void) {
+    return asids_enabled;
+}
+
+uint16_t mmu_asid_alloc(void) {
+    if(!asids_enabled)
+        return MMU_ASID_KERNEL;
+
+    uint16_t asid = MMU_ASID_SHARED;
+
+    spinlock_acquire(&asid_lock);
+
+    for(unsigned i = 0; i < MMU_ASID_COUNT; i++) {
+        unsigned candidate = (asid_next + i) % MMU_ASID_COUNT;
+        if(asid_bitmap[candidate / 64] & (1ul << (candidate % 64)))
+            continue;
+
+        asid_bitmap[candidate / 64] |= 1ul << (candidate % 64);
+        asid_next = candidate + 1;
+        asid = candidate;
+        break;
+    }
+
+    spinlock_release(&asid_lock);
+    return asid;
+}
+
+void mmu_asid_free(uint16_t asid) {
+    if(asid == MMU_ASID_KERNEL || asid == MMU_ASID_SHARED)
+        return;
+
+    assert(asid < MMU_ASID_COUNT);
+
+    spinlock_acquire(&asid_lock);
+    asid_bitmap[asid / 64] &= ~(1ul << (asid % 64));
+    spinlock_release(&asid_lock);
+}
+
+void mmu_switch_asid(page_table_ptr_t table, uint16_t asid) {
+    if(!asids_enabled) {
+        mmu_switch(table);
+        return;
+    }
+
+    uint64_t cr3 = (uintptr_t) table | asid;
+    if(asid != MMU_ASID_SHARED)
+        cr3 |= CR3_NOFLUSH;
+
+    mmu_switch((page_table_ptr_t) cr3);
+}
+
+void mmu_tlb_stats(struct mmu_tlb_stats* stats) {
+    stats->batches = __atomic_load_n(&tlb_stats.batches, __ATOMIC_RELAXED);
+    stats->ipis = __atomic_load_n(&tlb_stats.ipis, __ATOMIC_RELAXED);
+    stats->pages = __atomic_load_n(&tlb_stats.pages, __ATOMIC_RELAXED);
+    stats->full_flushes = __atomic_load_n(&tlb_stats.full_flushes, __ATOMIC_RELAXED);
 }
 
 void* mmu_get_physical(page_table_ptr_t table, void* vaddr) {
-    uint64_t* entry = get_page(table, vaddr);
-    if(!entry)
+    size_t page_size;
+    uint64_t* entry = get_page(table, vaddr, &page_size);
+    if(!entry || !*entry)
         return nullptr;
-    return (void*) (*entry & ADDRMASK);
+
+    uintptr_t offset = (uintptr_t) vaddr & (page_size - 1) & ~(PAGE_SIZE - 1);
+    return (void*) ((*entry & ADDRMASK & ~(page_size - 1)) + offset);
+}
+
+size_t mmu_get_page_size(page_table_ptr_t table, void* vaddr) {
+    size_t page_size;
+    uint64_t* entry = get_page(table, vaddr, &page_size);
+    return entry && *entry ? page_size : 0;
 }
 
 bool mmu_get_flags(page_table_ptr_t table, void* vaddr, enum mmu_flags* mmu_flags) {
-    uint64_t* entry = get_page(table, vaddr);
+    uint64_t* entry = get_page(table, vaddr, nullptr);
     if(!entry)
         return false;
 
@@ -367,12 +698,12 @@ bool mmu_get_flags(page_table_ptr_t table, void* vaddr, enum mmu_flags* mmu_flag
 }
 
 bool mmu_is_present(page_table_ptr_t table, void* vaddr) {
-    uint64_t* entry = get_page(table, vaddr);
+    uint64_t* entry = get_page(table, vaddr, nullptr);
     return entry ? (bool) *entry : false;
 }
 
 bool mmu_is_writable(page_table_ptr_t table, void* vaddr) {
-    uint64_t* entry = get_page(table, vaddr);
+    uint64_t* entry = get_page(table, vaddr, nullptr);
     return entry ? (*entry & MMU_FLAGS_WRITE) != 0 : false;
 }
 
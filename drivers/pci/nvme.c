@@ -126,7 +126,7 @@ static int nvme_instantiate(struct pci_driver* driver) {
 }
 
 void nvme_init(void) {
-    driver_cache = slab_newcache(sizeof(struct nvme_device), alignof(struct nvme_device), nullptr, nullptr);
+    driver_cache = slab_newcache("nvme_device", sizeof(struct nvme_device), alignof(struct nvme_device), nullptr, nullptr);
     assert(driver_cache != nullptr);
 
     int err;
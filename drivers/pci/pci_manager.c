@@ -52,6 +52,6 @@ void pci_manager_init(void) {
     spinlock_init(drivers_lock);
 
     dynarr_init(&drivers, sizeof(struct pci_driver), 128);
-    driver_cache = slab_newcache(sizeof(struct pci_driver), alignof(struct pci_driver), nullptr, nullptr);
+    driver_cache = slab_newcache("pci_driver", sizeof(struct pci_driver), alignof(struct pci_driver), nullptr, nullptr);
     assert(driver_cache != nullptr);
 }
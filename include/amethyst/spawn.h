@@ -0,0 +1,37 @@
+#ifndef _AMETHYST_SPAWN_H
+#define _AMETHYST_SPAWN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _AMETHYST_KERNEL_SRC
+    #include <abi.h>
+#else
+    #include <bits/alltypes.h>
+#endif
+
+// upper bound of file actions passed to SYS_spawn
+#define SPAWN_ACTIONS_MAX 64
+
+enum spawn_action_type {
+    SPAWN_ACTION_OPEN,
+    SPAWN_ACTION_CLOSE,
+    SPAWN_ACTION_DUP2
+};
+
+// one step of setting up the child's descriptors, applied in order to a copy of the parent's table
+struct spawn_action {
+    int type;
+    int fd;
+    int new_fd; // SPAWN_ACTION_DUP2: descriptor `fd` gets duplicated to
+    int oflag;  // SPAWN_ACTION_OPEN: open(path, oflag, mode) lands on `fd`
+    mode_t mode;
+    const char* path;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AMETHYST_SPAWN_H */
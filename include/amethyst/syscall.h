@@ -26,16 +26,20 @@
 #define SYS_dup2            33
 #define SYS_getpid          39
 #define SYS_fork            57
+#define SYS_spawn           58
 #define SYS_execve          59
 #define SYS_exit            60
 #define SYS_waitpid         61
 #define SYS_uname           63
+#define SYS_fsync           74
+#define SYS_fdatasync       75
 #define SYS_getcwd          79
 #define SYS_chdir           80
 #define SYS_fchdir          81
 #define SYS_gettimeofday    96
 #define SYS_sysinfo         99
 #define SYS_finit_module    100
+#define SYS_sync            162
 #define SYS_knldebug        255
 
 #define __SYS_invalid       1000
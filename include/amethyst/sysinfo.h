@@ -1,6 +1,19 @@
 #ifndef _AMETHYST_SYSINFO_H
 #define _AMETHYST_SYSINFO_H
 
+enum sysinfo_zone_type {
+    SYSINFO_ZONE_1MB,     /* Physical memory below 1 MiB */
+    SYSINFO_ZONE_4GB,     /* Physical memory between 1 MiB and 4 GiB */
+    SYSINFO_ZONE_DEFAULT, /* Physical memory above 4 GiB */
+    SYSINFO_ZONE_COUNT
+};
+
+struct sysinfo_zone {
+    unsigned long total; /* Memory managed by the zone */
+    unsigned long free;  /* Memory available for allocation */
+    unsigned long used;  /* Memory currently allocated */
+};
+
 // taken from linux
 struct sysinfo {
     long uptime;             /* Seconds since boot */
@@ -16,6 +29,9 @@ struct sysinfo {
     unsigned long freehigh;  /* Available high memory size */
     unsigned int mem_unit;   /* Memory unit size in bytes */
     char _f[20 - 2 * sizeof(long) - sizeof(int)]; /* Padding to 64 bytes */
+    struct sysinfo_zone zones[SYSINFO_ZONE_COUNT]; /* amethyst extension: per-zone memory */
+    unsigned long self_rss;  /* amethyst extension: memory resident in the caller's address space */
+    unsigned long self_vsz;  /* amethyst extension: memory mapped in the caller's address space */
 };
 
 #endif /* _AMETHYST_SYSINFO_H */
@@ -0,0 +1,18 @@
+#ifndef _AMETHYST_CPU_SMP_H
+#define _AMETHYST_CPU_SMP_H
+
+#include <cpu/cpu.h>
+
+#include <stddef.h>
+
+// each arch must implement these:
+
+// cpus running, indices `0 .. smp_cpus_awake - 1` are valid for smp_get_cpu()
+extern size_t smp_cpus_awake;
+
+struct cpu* smp_get_cpu(unsigned smp_id);
+
+// `cpu->id` is the arch's own cpu number, which need not be 0 on the bootstrap processor
+bool smp_is_bsp(struct cpu* cpu);
+
+#endif /* _AMETHYST_CPU_SMP_H */
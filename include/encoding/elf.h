@@ -4338,6 +4338,7 @@ typedef struct {
     Elf64_auxv_t phnum;
     Elf64_auxv_t phent;
     Elf64_auxv_t entry;
+    Elf64_auxv_t base;
     Elf64_auxv_t null;
 } Elf64_auxv_list_t;
 
@@ -4345,6 +4346,9 @@ int elf_read_exact(struct vnode *node, void* buff, size_t count, uintmax_t offse
 bool elf_validate_ehdr(const Elf64_Ehdr* header, Elf64_Half type);
 
 int elf_load(struct vnode* node, void* base, void** entry, char** interpreter, Elf64_auxv_list_t* auxv, void** brk);
+// loads the program interpreter (PT_INTERP) at INTERPRETER_BASE and starts the program there
+// instead; the program's own entry point stays in `auxv`
+int elf_load_interpreter(const char* path, void** entry, Elf64_auxv_list_t* auxv);
 
 void* elf_prepare_stack(void* top, Elf64_auxv_list_t* auxv, char** argv, char** envp);
 
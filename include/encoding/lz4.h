@@ -0,0 +1,69 @@
+#ifndef _AMETHYST_ENCODING_LZ4_H
+#define _AMETHYST_ENCODING_LZ4_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ4_FRAME_MAGIC 0x184d2204u
+// skippable frames carry user data and have magics 0x184d2a50 to 0x184d2a5f
+#define LZ4_SKIPPABLE_MAGIC 0x184d2a50u
+#define LZ4_SKIPPABLE_MASK 0xfffffff0u
+// how far back a match can reach into the output
+#define LZ4_WINDOW_SIZE 65536
+
+// xxHash32, the checksum of headers, blocks and contents, computed over data given in pieces
+struct lz4_xxh32 {
+    uint32_t acc[4];
+    uint32_t seed;
+    uint64_t length;
+    uint8_t buffer[16]; // input not yet hashed, less than one stripe
+    size_t buffered;
+};
+
+struct lz4_frame {
+    bool block_checksum;
+    bool content_checksum;
+    bool has_content_size;
+    uint64_t content_size;
+    size_t block_max;
+    size_t start; // output offset the frame's content starts at
+    // hashed block by block, the output may be gone by the end of the frame
+    struct lz4_xxh32 content_hash;
+};
+
+// decoder of a sequence of LZ4 frames (the format of the `lz4` tool) into one contiguous buffer,
+// one block at a time
+struct lz4_stream {
+    const uint8_t* src;
+    size_t src_size;
+    size_t src_pos;
+
+    uint8_t* dst; // nullptr: only count the decoded size
+    size_t dst_size;
+    size_t dst_pos;
+
+    bool in_frame;
+    struct lz4_frame frame;
+};
+
+static inline bool lz4_is_frame(const void* src, size_t size) {
+    const uint8_t* p = src;
+    return size >= 4 && (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24) == LZ4_FRAME_MAGIC;
+}
+
+void lz4_xxh32_init(struct lz4_xxh32* state, uint32_t seed);
+void lz4_xxh32_update(struct lz4_xxh32* state, const void* data, size_t size);
+uint32_t lz4_xxh32_digest(const struct lz4_xxh32* state);
+
+uint32_t lz4_xxh32(const void* data, size_t size, uint32_t seed);
+
+void lz4_stream_init(struct lz4_stream* stream, const void* src, size_t src_size, void* dst, size_t dst_size);
+
+// decodes the next block, setting `done` once all input is consumed. Blocks may refer back up to
+// LZ4_WINDOW_SIZE bytes into the output, anything before that can be released in between.
+int lz4_stream_next(struct lz4_stream* stream, bool* done);
+
+// size of everything in `src` once decoded, from the frame headers if they record it
+int lz4_decoded_size(const void* src, size_t src_size, size_t* size);
+
+#endif /* _AMETHYST_ENCODING_LZ4_H */
@@ -55,5 +55,8 @@ struct tar_entry {
 
 const char* tar_entry_type_str(enum tar_entry_type type);
 
+// decodes the header at `addr`; it is the end of the archive if `indicator` is not "ustar"
+void tar_read_entry(struct tar_entry* entry, const void* addr);
+
 #endif /* _AMETHYST_FILEFORMAT_TAR_H */
 
@@ -0,0 +1,48 @@
+#ifndef _AMETHYST_FILESYSTEM_DCACHE_H
+#define _AMETHYST_FILESYSTEM_DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DCACHE_BUCKETS 4096
+
+// upper bound of cached names, the least recently used ones make room for new ones
+#define DCACHE_MAX_ENTRIES 16384
+
+// longer names are always looked up by the filesystem
+#define DCACHE_NAME_MAX 47
+
+struct dcache_stats {
+    uintmax_t hits;
+    uintmax_t negative_hits; // lookups answered with ENOENT from the cache
+    uintmax_t misses;
+    uintmax_t evictions;
+    uintmax_t invalidations;
+    size_t entries;
+    size_t negative;
+};
+
+struct vnode;
+struct vfs;
+struct cred;
+
+void dcache_init(void);
+
+// vop_lookup() through the cache of (directory, name) -> vnode translations, including names
+// known not to exist; lookups that hit the cache take no locks
+int dcache_lookup(struct vnode* parent, const char* name, struct vnode** result, struct cred* cred);
+
+// to be called after `name` was added to or removed from `parent`
+void dcache_invalidate(struct vnode* parent, const char* name);
+// drops all names cached below `parent`, which is going away
+void dcache_purge(struct vnode* parent);
+// drops all names of a filesystem that is being unmounted
+void dcache_purge_vfs(struct vfs* vfs);
+
+// finds a directory and name `node` is cached under, returning the held directory
+int dcache_reverse(struct vnode* node, struct vnode** parent, char* name, size_t size);
+
+void dcache_get_stats(struct dcache_stats* stats);
+void dcache_dump_info(void);
+
+#endif /* _AMETHYST_FILESYSTEM_DCACHE_H */
@@ -1,7 +1,9 @@
 #ifndef _AMETHYST_FILESYSTEM_INITRD_H
 #define _AMETHYST_FILESYSTEM_INITRD_H
 
-int initrd_unpack(void);
+// mounts `rootfs` on `/` with the initrd given by the `initrd=` flag in it: either as a tarfs,
+// a tmpfs overlaying one, or for other filesystems (and with `initrd-unpack`) by copying it over
+int initrd_mount_root(const char* rootfs);
 
 #endif /* _AMETHYST_FILESYSTEM_INITRD_H */
 
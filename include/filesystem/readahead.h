@@ -0,0 +1,51 @@
+#ifndef _AMETHYST_FILESYSTEM_READAHEAD_H
+#define _AMETHYST_FILESYSTEM_READAHEAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// prefetch window bounds, in pages
+#define READAHEAD_MIN_PAGES 4
+#define READAHEAD_MAX_PAGES 64
+
+// windows waiting for the prefetch thread, further ones are dropped
+#define READAHEAD_QUEUE_SIZE 32
+
+// sequential stream detection, one per open file
+struct readahead {
+    uintmax_t prev_end;  // byte offset the previous read ended at
+    size_t window;       // size of the last prefetched window, 0 while the file is read randomly
+    uintmax_t marker;    // first page of the last window: reading it prefetches the next one
+    uintmax_t ahead_end; // one past the last page prefetched
+};
+
+struct readahead_stats {
+    uintmax_t hits;    // pages read() found in the page cache
+    uintmax_t misses;  // pages read() had to fill synchronously
+    uintmax_t windows; // windows queued for prefetching
+    uintmax_t pages;   // pages the prefetch thread brought into the cache
+    uintmax_t dropped; // windows lost to a full queue
+};
+
+struct vnode;
+
+static inline void readahead_reset(struct readahead* ra) {
+    ra->prev_end = 0;
+    ra->window = 0;
+    ra->marker = 0;
+    ra->ahead_end = 0;
+}
+
+// starts the prefetch thread
+void readahead_init(void);
+
+// called for every read of [offset, offset + size) from a regular file of `file_size` bytes;
+// queues the next window in the background once the reads look sequential
+void readahead_update(struct readahead* ra, struct vnode* node, uintmax_t offset, size_t size, size_t file_size);
+
+void readahead_account(size_t hits, size_t misses);
+
+void readahead_get_stats(struct readahead_stats* stats);
+void readahead_dump_info(void);
+
+#endif /* _AMETHYST_FILESYSTEM_READAHEAD_H */
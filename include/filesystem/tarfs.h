@@ -0,0 +1,39 @@
+#ifndef _AMETHYST_FILESYSTEM_TARFS_H
+#define _AMETHYST_FILESYSTEM_TARFS_H
+
+#include <filesystem/vfs.h>
+#include <hashtable.h>
+
+// vfs_mount() data: a ustar archive in memory that stays in place for as long as it is mounted
+struct tarfs_image {
+    void* address; // page aligned kernel memory
+    size_t size;
+
+    // images still being written, e.g. decompressed: blocks until the first `needed` bytes are
+    // there or no more will come, returns how many there are. nullptr if all of it is there.
+    size_t (*wait)(size_t needed);
+};
+
+struct tarfs {
+    struct vfs vfs;
+    struct tarfs_image image;
+    uintmax_t inode_num;
+    uintmax_t id;
+
+    size_t entries;
+    size_t shared_pages; // image frames cached as they are instead of being copied
+};
+
+struct tarfs_node {
+    struct vnode vnode;
+    struct vattr vattr;
+    union {
+        hashtable_t children;
+        const void* data; // file contents inside the image
+        char* link;
+    };
+};
+
+void tarfs_init(void);
+
+#endif /* _AMETHYST_FILESYSTEM_TARFS_H */
@@ -4,10 +4,15 @@
 #include <filesystem/vfs.h>
 #include <hashtable.h>
 
+// vfs_mount() data making the tmpfs an overlay of the directory it is mounted on: its contents
+// show through and are copied up on first access, everything written stays in the tmpfs
+#define TMPFS_MOUNT_OVERLAY "overlay"
+
 struct tmpfs {
     struct vfs vfs;
     uintmax_t inode_num;
     uintmax_t id;
+    struct vnode* lower; // overlaid directory
 };
 
 struct tmpfs_node {
@@ -21,6 +26,11 @@ struct tmpfs_node {
         };
         char* link;
     };
+
+    // overlay: directory whose entries were not copied up yet, or file the first `lower_size`
+    // bytes are still read from
+    struct vnode* lower;
+    size_t lower_size;
 };
 
 void tmpfs_init(void);
@@ -6,6 +6,7 @@
 #include <time.h>
 #include <sys/mutex.h>
 
+#include <radix.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,7 +15,8 @@
 #define PATH_SEPARATOR '/'
 
 enum vflags {
-    V_FLAGS_ROOT = 1
+    V_FLAGS_ROOT     = 1,
+    V_FLAGS_DIRECTIO = 2, // getpage/putpage work on any frame, not only page cache pages
 };
 
 enum vfflags {
@@ -95,6 +97,9 @@ struct vfsops {
 	int (*root)(struct vfs *vfs, struct vnode **root);
 };
 
+struct page;
+struct readahead;
+
 struct vnode {
     struct vops* ops;
     mutex_t lock;
@@ -105,7 +110,24 @@ struct vnode {
     struct vfs* vfs;
     struct vfs* vfsmounted;
     void* socketbinding;
-    struct page* pages;
+
+    // page cache, indexed by offset / PAGE_SIZE
+    mutex_t pages_lock;
+    struct radix_tree pages;
+    size_t page_count;
+    // list of vnodes with cached pages, walked by the shrinker
+    struct vnode* cache_next;
+    struct vnode* cache_prev;
+
+    // writeback: dirty pages are tagged in `pages`, the vnode is on the dirty list while it has any
+    mutex_t writeback_lock;
+    size_t dirty_count;
+    struct timespec dirtied_when;
+    struct vnode* dirty_next;
+    struct vnode* dirty_prev;
+
+    // names cached in the dentry cache with this vnode as their directory
+    size_t dentry_count;
 };
 
 struct polldata;
@@ -146,6 +168,8 @@ enum vfs_lookup_flags {
 };
 
 extern struct vnode* vfs_root;
+// credentials of the kernel acting on its own behalf
+extern struct cred kernel_cred;
 
 int vfs_lookup(struct vnode** dest, struct vnode* src, const char* path, char* last_comp, enum vfs_lookup_flags flags);
 int vfs_realpath(struct vnode* node, char** dest_path, size_t* dest_size, enum vfs_lookup_flags flags);
@@ -165,9 +189,14 @@ int vfs_getattr(struct vnode* node, struct vattr* attr);
 int vfs_setattr(struct vnode* node, struct vattr* attr, int which);
 
 int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* written, int flags);
-int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* read, int flags);
+int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* read, int flags, struct readahead* ra);
 int vfs_getdents(struct vnode* node, struct amethyst_dirent *buffer, size_t count, uintmax_t offset, size_t *readcount);
 
+// writes the node's dirty pages back, and its metadata unless `data_only` is set
+int vfs_fsync(struct vnode* node, bool data_only);
+// writes back everything dirty and syncs every mounted filesystem
+int vfs_sync(void);
+
 int vfs_link(struct vnode* dest_ref, const char* dest_path, struct vnode* link_ref, const char* link_path, enum vtype type, struct vattr* attr);
 
 void vfs_inactive(struct vnode* node);
@@ -259,6 +288,19 @@ static inline void vop_init(struct vnode* node, struct vops* vops, enum vflags f
     node->type = type;
     node->vfs = vfs;
     node->vfsmounted = nullptr;
+
+    mutex_init(&node->pages_lock);
+    radix_init(&node->pages);
+    node->page_count = 0;
+    node->cache_next = nullptr;
+    node->cache_prev = nullptr;
+
+    mutex_init(&node->writeback_lock);
+    node->dirty_count = 0;
+    node->dirty_next = nullptr;
+    node->dirty_prev = nullptr;
+
+    node->dentry_count = 0;
 }
 
 static inline int vop_ioctl(struct vnode* node, unsigned long request, void* arg, int* result, struct cred* cred) {
@@ -280,6 +322,10 @@ static inline int vop_getpage(struct vnode* node, uintmax_t offset, struct page*
 static inline int vop_putpage(struct vnode* node, uintmax_t offset, struct page* page) {
     return node->ops->putpage(node, offset, page);
 }
+
+static inline int vop_sync(struct vnode* node) {
+    return node->ops->sync ? node->ops->sync(node) : 0;
+}
  
 static inline int vfs_get_root(struct vfs* vfs, struct vnode** r) {
     return vfs->ops->root(vfs, r);
@@ -3,8 +3,8 @@
 
 #include <stdint.h>
 #include <kernelio.h>
-#include <mem/slab.h>
 #include <mem/pmm.h>
+#include <mem/vmm.h>
 
 enum page_flags : uint8_t {
     PAGE_FLAGS_FREE      = 1,
@@ -13,54 +13,48 @@ enum page_flags : uint8_t {
     PAGE_FLAGS_ERROR     = 8,
     PAGE_FLAGS_READY     = 16,
     PAGE_FLAGS_PINNED    = 32,
+    PAGE_FLAGS_RESERVED  = 64, // not managed by the pmm (firmware, mmio, ...)
+    PAGE_FLAGS_SLAB      = 128,
 };
 
+// physical frame descriptor, one per frame in `pmm_pages`
 struct page {
-    void* physical_addr;
-    struct vnode* backing;
-    uintmax_t offset;
-
-    struct page* hash_next;
-    struct page* hash_prev;
-
-    struct page* vnode_next;
-    struct page* vnode_prev;
-
     union {
+        // page cache
         struct {
-            struct page* free_next;
-            struct page* free_prev;
-        };
-        struct {
-            struct page* write_next;
-            struct page* write_prev;
+            struct vnode* backing;
+            uintmax_t offset;
         };
+        // data page of an indirect slab (PAGE_FLAGS_SLAB)
+        struct slab* slab;
     };
 
-    uintmax_t refcount;
+    // buddy free lists (PAGE_FLAGS_FREE)
+    struct page* free_next;
+    struct page* free_prev;
+
+    uint32_t refcount;
     enum page_flags flags;
+    uint8_t order;
 };
 
-extern struct scache* page_meta_cache; // declared in vmm.c
+extern struct page* pmm_pages; // declared in pmm.c
 
-static inline void page_hold(struct page* page) {
-    __atomic_add_fetch(&page->refcount, 1, __ATOMIC_SEQ_CST);
+static __always_inline struct page* pmm_page(void* physical_addr) {
+    return &pmm_pages[(uintptr_t) physical_addr / PAGE_SIZE];
 }
 
-static inline void page_release(struct page* page) {
-    __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_SEQ_CST);
+static __always_inline void* page_get_physical(struct page* page) {
+    return (void*) ((uintptr_t) (page - pmm_pages) * PAGE_SIZE);
+}
 
-    // free page if not refrenced
-    if(page->refcount == 0) {
-        klog(INFO, "free page");
-        slab_free(page_meta_cache, page);
-        pmm_free_page(page->physical_addr);
-    }
+static inline void page_hold(struct page* page) {
+    __atomic_add_fetch(&page->refcount, 1, __ATOMIC_SEQ_CST);
 }
 
-static inline void* page_get_physical(struct page* page) {
-    return page->physical_addr;
+// frees the frame once the last reference is dropped
+static inline void page_release(struct page* page) {
+    pmm_release(page_get_physical(page));
 }
 
 #endif /* _AMETHYST_MEM_PAGE_H */
-
@@ -5,10 +5,26 @@
 #include <stdint.h>
 
 #include <mem/mmap.h>
+#include <sys/spinlock.h>
 
 #define MAKE_HHDM(x) ((void*) (((uintptr_t) (x)) + hhdm_base))
 #define FROM_HHDM(x) ((void*) (((uintptr_t) (x)) - hhdm_base))
 
+// largest buddy block: 2^PMM_MAX_ORDER pages (4 MiB)
+#define PMM_MAX_ORDER 10
+
+// per-cpu cache of free single pages
+#define PMM_MAGAZINE_SIZE 64
+#define PMM_MAGAZINE_BATCH (PMM_MAGAZINE_SIZE / 2)
+
+// upper bound of pages zeroed ahead of time by idle cpus
+#define PMM_ZERO_POOL_SIZE 256
+
+// the low watermark is 1/PMM_WATERMARK_DIVISOR of usable memory, but at least PMM_WATERMARK_MIN pages;
+// the high watermark is twice the low one
+#define PMM_WATERMARK_DIVISOR 64
+#define PMM_WATERMARK_MIN 256
+
 enum pmm_section_type : int8_t {
     PMM_SECTION_1MB,
     PMM_SECTION_4GB,
@@ -16,29 +32,81 @@ enum pmm_section_type : int8_t {
     PMM_SECTION_COUNT
 };
 
+// physical memory zone; blocks in the free lists never cross zone boundaries
 struct pmm_section {
-    uintmax_t base_id;
-    uintmax_t top_id;
-    uintmax_t search_start;
+    uintmax_t base_id; // first frame
+    uintmax_t top_id;  // one past the last frame
+
+    // counters in pages, updated atomically without holding the pmm lock
+    uintmax_t total;
+    uintmax_t free;
+    uintmax_t used;
+
+    struct page* free_lists[PMM_MAX_ORDER + 1];
+};
+
+// free page thresholds driving background reclaim (see mem/shrinker.h)
+enum pmm_watermark : uint8_t {
+    PMM_WATERMARK_LOW,
+    PMM_WATERMARK_HIGH,
+    PMM_WATERMARK_COUNT
+};
+
+struct pmm_section_stats {
+    uintmax_t total;
+    uintmax_t free;
+    uintmax_t used;
+};
+
+struct pmm_zero_pool_stats {
+    size_t size;
+    uintmax_t hits;
+    uintmax_t misses;
+};
+
+struct pmm_magazine {
+    spinlock_t lock; // only contended by pmm_alloc() draining all cpus before it gives up
+    size_t count;
+    void* pages[PMM_MAGAZINE_SIZE];
 };
 
 extern uintptr_t hhdm_base;
 extern void* pmm_zero_page;
 
-#define pmm_alloc_page(section) (pmm_alloc(1, (section)))
 #define pmm_free_page(addr) (pmm_free((addr), 1))
 
 void pmm_init(struct mmap* mmap);
 
 void* pmm_alloc(size_t size, enum pmm_section_type section);
 
+// like pmm_alloc(), but returns nullptr instead of panicking when out of memory
+void* pmm_try_alloc(size_t size, enum pmm_section_type section);
+
 void pmm_free(void* addr, size_t count);
 
+// gives memory the pmm never managed (bootloader reclaimable, modules) to the free lists
+void pmm_reclaim(void* addr, size_t count);
+
+// `zeroed` requests a zero-filled page, served from the pre-zeroed pool when possible
+void* pmm_alloc_page(enum pmm_section_type section, bool zeroed);
+
+// zeroes one free page into the pool; returns false if there was nothing to do
+bool pmm_zero_pool_fill(void);
+void pmm_zero_pool_stats(struct pmm_zero_pool_stats* stats);
+
 uintmax_t pmm_total_memory(void);
-uintmax_t pmm_free_memroy(void);
+uintmax_t pmm_free_memory(void);
+
+void pmm_section_stats(enum pmm_section_type section, struct pmm_section_stats* stats);
+
+// watermark in pages
+uintmax_t pmm_watermark(enum pmm_watermark watermark);
+bool pmm_under_watermark(enum pmm_watermark watermark);
 
 void pmm_hold(void* addr);
 void pmm_release(void* addr);
 
-#endif /* _AMETHYST_MEM_PMM_H */
+// true if the caller holds the only reference to the frame, so it may be written without copying
+bool pmm_is_exclusive(void* addr);
 
+#endif /* _AMETHYST_MEM_PMM_H */
@@ -0,0 +1,44 @@
+#ifndef _AMETHYST_MEM_SHRINKER_H
+#define _AMETHYST_MEM_SHRINKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct shrink_control {
+    size_t nr_to_scan; // pages the caller would like to get back
+    // set for reclaim on behalf of a failed allocation: the caller may hold arbitrary locks,
+    // shrinkers must not sleep and should only use try-locks
+    bool direct;
+};
+
+// a cache that can give memory back to the pmm under memory pressure
+struct shrinker {
+    const char* name;
+
+    // estimate of pages that could be freed right now
+    size_t (*count)(struct shrinker* shrinker);
+    // frees up to `sc->nr_to_scan` pages, returns the number of pages actually freed
+    size_t (*scan)(struct shrinker* shrinker, struct shrink_control* sc);
+
+    // statistics, updated by the reclaim code
+    uintmax_t calls;
+    uintmax_t freed;
+
+    struct shrinker* next;
+};
+
+void shrinker_register(struct shrinker* shrinker);
+void shrinker_unregister(struct shrinker* shrinker);
+
+// calls all shrinkers until `pages` were freed; returns the number of freed pages
+size_t reclaim_direct(size_t pages);
+
+// called by the pmm once free memory dropped below the low watermark
+void reclaim_wake(void);
+
+// starts the background reclaim thread
+void reclaim_init(void);
+
+void shrinker_dump_info(void);
+
+#endif /* _AMETHYST_MEM_SHRINKER_H */
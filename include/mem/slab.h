@@ -2,9 +2,20 @@
 #define _AMETHYST_MEM_SLAB_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <sys/spinlock.h>
 
+// objects per magazine
+#define SLAB_MAGAZINE_SIZE 16
+
+// full magazines kept in the depot before frees fall through to the slab layer
+#define SLAB_DEPOT_LIMIT 16
+
+// number of caches that get per-cpu magazines, the rest only use the slab layer
+#define SLAB_MAX_CPU_CACHES 64
+#define SLAB_NO_CPU_CACHE (-1)
+
 struct slab {
     struct slab* next;
     struct slab* prev;
@@ -14,8 +25,24 @@ struct slab {
     void* base;
 };
 
+struct slab_magazine {
+    struct slab_magazine* next;
+    size_t rounds;
+    void* objs[SLAB_MAGAZINE_SIZE];
+};
+
+// per-cpu state of a cache, stored in `struct cpu`
+struct slab_cpu_cache {
+    struct slab_magazine* loaded;
+    struct slab_magazine* previous;
+
+    uintmax_t hits;
+    uintmax_t misses;
+};
+
 struct scache {
     spinlock_t lock;
+    const char* name;
     
     void (*ctor)(struct scache* cache, void* obj);
     void (*dtor)(struct scache* cache, void* obj);
@@ -28,13 +55,32 @@ struct scache {
     size_t true_size;
     size_t align;
     size_t slab_obj_count;
+
+    // magazine depot shared by all cpus
+    spinlock_t depot_lock;
+    struct slab_magazine* depot_full;
+    struct slab_magazine* depot_empty;
+    size_t depot_full_count;
+    size_t depot_empty_count;
+
+    int cpu_index;
+
+    uintmax_t refills;
+    uintmax_t contention;
+
+    struct scache* next;
 };
 
 void* slab_alloc(struct scache* cache);
 void slab_free(struct scache* scache, void* addr);
 
-struct scache* slab_newcache(size_t size, size_t align, void (*ctor)(struct scache*, void*), void (*dtor)(struct scache*, void*));
+struct scache* slab_newcache(const char* name, size_t size, size_t align, void (*ctor)(struct scache*, void*), void (*dtor)(struct scache*, void*));
+// the cache must no longer be in use; objects still held in any cpu's magazines are returned first
 void slab_freecache(struct scache* cache);
 
-#endif /* _AMETHYST_MEM_SLAB_H */
+void slab_dump_info(void);
+
+// registers the shrinker returning empty slabs and depot magazines under memory pressure
+void slab_shrinker_init(void);
 
+#endif /* _AMETHYST_MEM_SLAB_H */
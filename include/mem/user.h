@@ -9,6 +9,13 @@ int memcpy_to_user(void* user_dest, const void* kernel_src, size_t size);
 
 int user_strlen(const char* str, size_t* size);
 
+struct page;
+
+// faults in and holds the frames behind `count` pages of a page aligned user buffer, so they can be
+// used for I/O without copying; ENOTSUP if part of it is mapped with huge pages
+int user_pin_pages(void* user_addr, size_t count, bool write, struct page** pages);
+void user_unpin_pages(struct page** pages, size_t count);
+
 // implemented in mmu.c
 bool is_userspace_addr(const void* a);
 
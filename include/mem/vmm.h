@@ -5,9 +5,11 @@
 #include <mem/slab.h>
 #include <mem/mmap.h>
 #include <mem/pmm.h>
+#include <mem/vmm_magazine.h>
 
 #include <sys/mutex.h>
 
+#include <rbtree.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -16,7 +18,26 @@
 #define VMM_RESERVED_SPACE_SIZE 0x14480000000
 #endif
 
-#define VMM_RANGES_PER_CACHE ((PAGE_SIZE - sizeof(struct vmm_cache_header)) / sizeof(struct vmm_range))
+// the writeback thread wakes up this often to write back expired vnodes
+#define VMM_WRITEBACK_INTERVAL_US 1'000'000ul
+// vnodes dirty for longer are written back completely
+#define VMM_WRITEBACK_EXPIRE_US 5'000'000ul
+// above this share of memory being dirty the writeback thread starts early
+#define VMM_WRITEBACK_BACKGROUND_PERCENT 10
+// pages written per vnode and pass while only the background threshold is exceeded
+#define VMM_WRITEBACK_CHUNK_PAGES 256
+// pages collected per vnode lock acquisition
+#define VMM_WRITEBACK_BATCH_PAGES 32
+
+struct vmm_writeback_stats {
+    size_t dirty_pages;
+    uintmax_t wakeups; // writeback thread passes
+    uintmax_t syncs;   // fsync()/sync() style complete writebacks
+    uintmax_t batches;
+    uintmax_t pages;   // pages written back
+    uintmax_t errors;  // failed putpage calls
+    uintmax_t ns;      // time spent writing
+};
 
 enum vmm_flags : uint8_t {
     VMM_FLAGS_PAGESIZE  = 1,
@@ -26,8 +47,9 @@ enum vmm_flags : uint8_t {
     VMM_FLAGS_EXACT     = 16,
     VMM_FLAGS_SHARED    = 32,
     VMM_FLAGS_CREDCHECK = 64,
+    VMM_FLAGS_HUGE      = 128, // map with 2 MiB/1 GiB pages where possible
 
-    VMM_PERMANENT_FLAGS_MASK = (VMM_FLAGS_FILE | VMM_FLAGS_SHARED)
+    VMM_PERMANENT_FLAGS_MASK = (VMM_FLAGS_FILE | VMM_FLAGS_SHARED | VMM_FLAGS_PHYSICAL)
 };
 
 enum vmm_action : uint8_t {
@@ -37,9 +59,15 @@ enum vmm_action : uint8_t {
 };
 
 struct vmm_range {
+    // address-ordered list, used for walking neighbouring ranges
     struct vmm_range* next;
     struct vmm_range* prev;
 
+    // node in vmm_space.tree, keyed by `start`
+    struct rb_node node;
+    size_t gap;         // free space between the previous range (or the start of the space) and this one
+    size_t subtree_gap; // largest `gap` in this subtree
+
     void* start;
     size_t size;
     enum vmm_flags flags;
@@ -49,24 +77,17 @@ struct vmm_range {
     size_t offset;
 };
 
-struct vmm_cache_header {
-    mutex_t lock;
-    struct vmm_cache* next;
-    size_t free_count;
-    uintmax_t first_free;
-};
-
-struct vmm_cache {
-    struct vmm_cache_header header;
-    struct vmm_range ranges[VMM_RANGES_PER_CACHE];
-};
-
 struct vmm_space {
     mutex_t lock;
     mutex_t pflock;
     struct vmm_range* ranges;
+    struct rb_tree tree;
     void* start;
     void* end;
+
+    // accounting, updated with `lock` held
+    size_t vsz; // bytes covered by ranges
+    size_t rss; // pages present in the page table
 };
 
 struct brk {
@@ -79,6 +100,8 @@ struct vmm_context {
     struct brk brk;
     struct vmm_space space;
     page_table_ptr_t page_table;
+    struct mmu_cpu_set active_cpus; // cpus that have `page_table` loaded, targets of shootdowns
+    uint16_t asid;                  // tags the TLB entries of this space
 };
 
 struct vmm_file_desc {
@@ -86,8 +109,6 @@ struct vmm_file_desc {
     uintmax_t offset;
 };
 
-static_assert(sizeof(struct vmm_cache) <= PAGE_SIZE);
-
 extern struct vmm_context vmm_kernel_context;
 extern struct vmm_space vmm_kernel_space;
 
@@ -108,13 +129,31 @@ int vmm_change_mmu_flags(void* addr, size_t size, enum mmu_flags mmu_flags, enum
 struct vmm_space* vmm_get_space(void* addr);
 struct vmm_range* vmm_get_range(struct vmm_space* space, void* addr);
 
-void vmm_cache_init(void);
+// range descriptor churn, summed over all cpus
+void vmm_range_stats(struct vmm_range_stats* stats);
 
-struct page* vmm_alloc_page_meta(void* physical_addr);
+void vmm_cache_init(void);
 
+// drops every cached page at or past `offset` and zeroes the tail of the page containing it
 int vmm_cache_truncate(struct vnode* vnode, uintmax_t offset);
+// drops all pages of a vnode that is going away
+void vmm_cache_forget(struct vnode* vnode);
 int vmm_cache_make_dirty(struct page* page);
+// writes back all dirty pages of a vnode, in offset order
+int vmm_cache_sync(struct vnode* vnode);
+int vmm_cache_sync_range(struct vnode* vnode, uintmax_t offset, size_t size);
+// `data` was written to `offset` bypassing the cache: drops the cached page or refreshes it
+void vmm_cache_overwrite(struct vnode* vnode, uintmax_t offset, struct page* data);
+// writes back every vnode of `vfs` that has dirty pages, or all of them if `vfs` is nullptr
+int vmm_cache_sync_all(struct vfs* vfs);
+void vmm_writeback_stats(struct vmm_writeback_stats* stats);
+void vmm_writeback_dump_info(void);
 int vmm_cache_get_page(struct vnode* vnode, uintptr_t offset, struct page** res);
+// like vmm_cache_get_page(), telling whether the page was already cached
+int vmm_cache_read_page(struct vnode* vnode, uintptr_t offset, struct page** res, bool* cached);
+// caches a frame that already holds the page at `offset`, e.g. one of a boot module, instead of
+// a copy. The frame stays pinned until truncated and is never written back.
+int vmm_cache_insert(struct vnode* vnode, uintptr_t offset, struct page* page);
 
 static inline enum mmu_flags vnode_to_mmu_flags(enum vfflags flags) {
     enum mmu_flags mmu_flags = MMU_FLAGS_USER;
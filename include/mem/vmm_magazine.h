@@ -0,0 +1,32 @@
+#ifndef _AMETHYST_MEM_VMM_MAGAZINE_H
+#define _AMETHYST_MEM_VMM_MAGAZINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// per-cpu cache of free range descriptors
+#define VMM_RANGE_MAGAZINE_SIZE 32
+#define VMM_RANGE_MAGAZINE_BATCH (VMM_RANGE_MAGAZINE_SIZE / 2)
+
+struct vmm_range;
+
+// lives in `struct cpu`, only touched by its own cpu with interrupts disabled
+struct vmm_range_magazine {
+    size_t count;
+    struct vmm_range* ranges[VMM_RANGE_MAGAZINE_SIZE];
+
+    uintmax_t allocs;
+    uintmax_t frees;
+    uintmax_t refills; // batches taken from the global free list
+    uintmax_t flushes; // batches returned to the global free list
+};
+
+struct vmm_range_stats {
+    uintmax_t allocs;
+    uintmax_t frees;
+    uintmax_t refills;
+    uintmax_t flushes;
+    size_t pages; // pages backing range descriptors
+};
+
+#endif /* _AMETHYST_MEM_VMM_MAGAZINE_H */
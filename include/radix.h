@@ -0,0 +1,60 @@
+#ifndef _AMETHYST_LIBK_RADIX_H
+#define _AMETHYST_LIBK_RADIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RADIX_SHIFT 6
+#define RADIX_SLOTS (1 << RADIX_SHIFT)
+
+// indices are limited to 60 bits, plenty for page numbers
+#define RADIX_INDEX_BITS 60
+#define RADIX_MAX_INDEX (((uintmax_t) 1 << RADIX_INDEX_BITS) - 1)
+
+// independent marks per item, an inner node's mark is set if any item below it carries it
+#define RADIX_TAGS 2
+
+struct radix_node {
+    struct radix_node* parent;
+    uint8_t shift;  // index bits below this node, 0 in nodes that hold items
+    uint8_t offset; // slot in `parent`
+    uint8_t count;  // used slots
+    uint64_t tags[RADIX_TAGS];
+    void* slots[RADIX_SLOTS];
+};
+
+// sparse array of non-null pointers, the caller provides the locking
+struct radix_tree {
+    struct radix_node* root;
+};
+
+static inline void radix_init(struct radix_tree* tree) {
+    tree->root = nullptr;
+}
+
+static inline bool radix_empty(struct radix_tree* tree) {
+    return tree->root == nullptr;
+}
+
+void* radix_lookup(struct radix_tree* tree, uintmax_t index);
+
+// returns EEXIST if `index` is already used, ENOMEM if a node could not be allocated
+int radix_insert(struct radix_tree* tree, uintmax_t index, void* item);
+// returns the removed item, nullptr if there was none
+void* radix_delete(struct radix_tree* tree, uintmax_t index);
+
+// first item with an index in [*index, last], storing its index in `*index`
+void* radix_next(struct radix_tree* tree, uintmax_t* index, uintmax_t last);
+void* radix_next_tagged(struct radix_tree* tree, uintmax_t* index, uintmax_t last, unsigned tag);
+
+// tag operations on an existing item, returning false if there is none
+bool radix_tag_set(struct radix_tree* tree, uintmax_t index, unsigned tag);
+bool radix_tag_clear(struct radix_tree* tree, uintmax_t index, unsigned tag);
+bool radix_tag_get(struct radix_tree* tree, uintmax_t index, unsigned tag);
+
+// true if any item in the tree carries `tag`
+static inline bool radix_tagged(struct radix_tree* tree, unsigned tag) {
+    return tree->root && tree->root->tags[tag];
+}
+
+#endif /* _AMETHYST_LIBK_RADIX_H */
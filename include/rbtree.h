@@ -0,0 +1,35 @@
+#ifndef _AMETHYST_LIBK_RBTREE_H
+#define _AMETHYST_LIBK_RBTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define rb_entry(ptr, type, member) ((type*) ((uintptr_t) (ptr) - __builtin_offsetof(type, member)))
+#define rb_entry_safe(ptr, type, member) ((ptr) ? rb_entry(ptr, type, member) : nullptr)
+
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    bool red;
+};
+
+struct rb_tree {
+    struct rb_node* root;
+};
+
+// recomputes the augmented data of a node from its own value and its children.
+// Called bottom-up for every node whose subtree changed; may be nullptr for plain trees.
+typedef void (*rb_update_t)(struct rb_node* node);
+
+// links `node` at `*link` below `parent` (found by the caller's own search) and rebalances
+void rb_insert(struct rb_tree* tree, struct rb_node* node, struct rb_node* parent, struct rb_node** link, rb_update_t update);
+void rb_erase(struct rb_tree* tree, struct rb_node* node, rb_update_t update);
+
+// re-runs `update` from `node` up to the root after the node's own value changed
+void rb_propagate(struct rb_node* node, rb_update_t update);
+
+struct rb_node* rb_first(struct rb_tree* tree);
+struct rb_node* rb_last(struct rb_tree* tree);
+
+#endif /* _AMETHYST_LIBK_RBTREE_H */
@@ -0,0 +1,41 @@
+#ifndef _AMETHYST_SYS_BENCH_H
+#define _AMETHYST_SYS_BENCH_H
+
+#include <cdefs.h>
+#include <cpu/cpu.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bench_entry {
+    const char* name;
+    const char* description;
+    void (*func)(void);
+};
+
+#define _BENCH_REGISTER(_name, _func, _desc)                                                                        \
+    __attribute__((section(".static_benchmarks"), used)) alignas(void*) struct bench_entry __bench_ent_##_func     \
+        = { .name = (_name), .description = (_desc), .func = (_func) }
+
+struct bench_timer {
+    uint64_t start;
+    uint64_t cycles;
+};
+
+// run all benchmarks listed in `which` (comma separated, "all" or "bench" for every benchmark)
+void bench_run(const char* which);
+
+void bench_report(const char* what, size_t iterations, uint64_t cycles);
+
+// like bench_report(), labelled "<prefix><n><suffix>" for runs over a varying size or count
+void bench_report_n(const char* prefix, size_t n, const char* suffix, size_t iterations, uint64_t cycles);
+
+static __always_inline void bench_start(struct bench_timer* timer) {
+    timer->start = rdtsc();
+}
+
+static __always_inline uint64_t bench_stop(struct bench_timer* timer) {
+    return timer->cycles = rdtsc() - timer->start;
+}
+
+#endif /* _AMETHYST_SYS_BENCH_H */
@@ -0,0 +1,25 @@
+#ifndef _AMETHYST_SYS_EXEC_H
+#define _AMETHYST_SYS_EXEC_H
+
+#include <stddef.h>
+
+struct vnode;
+struct vmm_context;
+
+// a program loaded into its own address space, ready to get a thread
+struct exec_image {
+    struct vmm_context* vmm_context;
+    void* entry;
+    void* stack;
+};
+
+// copy a path or a nullptr-terminated string vector (argv, envp) from user space into kernel memory
+int exec_copy_path(const char* u_path, char** path);
+int exec_copy_args(const char* const u_args[], char*** args);
+void exec_free_args(char** args);
+
+// loads `node` into a new vmm context and sets up its initial stack with `argv` and `envp`;
+// the caller's context stays active
+int exec_load(struct vnode* node, char** argv, char** envp, struct exec_image* image);
+
+#endif /* _AMETHYST_SYS_EXEC_H */
@@ -2,6 +2,7 @@
 #define _AMETHYST_SYS_FD_H
 
 #include <filesystem/vfs.h>
+#include <filesystem/readahead.h>
 
 #include <sys/mutex.h>
 #include <cdefs.h>
@@ -25,6 +26,7 @@ enum o_flags {
     O_APPEND   = 02000,
     O_NONBLOCK = 04000,
     // ...
+    O_DIRECT    = 040000,
     O_DIRECTORY = 0100000,
     O_CLOEXEC   = 02000000,
     // ...
@@ -39,6 +41,9 @@ struct file {
     mode_t mode;
 
     int flags;
+
+    // sequential read detection for this open file
+    struct readahead ra;
 };
 
 struct fd {
@@ -63,6 +68,14 @@ struct file* fd_get(size_t fd);
 int fd_new(int flags, struct file** file, int* fd);
 int fd_close(int fd);
 
+// opens `path` relative to the current process' root or cwd with the O_* flags `flags` into `file`
+int fd_open(struct file* file, const char* path, int flags, mode_t mode);
+
+// operate on the table of `proc`, which need not be the current process (e.g. a child under construction);
+// fd_install() takes over the caller's reference to `file` and replaces whatever `fd` referred to
+int fd_install(struct proc* proc, int fd, struct file* file, int flags);
+int fd_remove(struct proc* proc, int fd);
+
 static inline void fd_hold(struct file* file) {
     if(!file)
         return;
@@ -87,6 +100,8 @@ static inline enum vfflags file_to_vnode_flags(int flags) {
         vfflags |= V_FFLAGS_NONBLOCKING;
     if(flags & O_NOCTTY)
         vfflags |= V_FFLAGS_NOCTTY;
+    if(flags & O_DIRECT)
+        vfflags |= V_FFLAGS_NOCACHE;
     // TODO: no caching flags (O_SYNC, ...)
 
     return vfflags;
@@ -19,8 +19,9 @@ enum map_flags {
     MAP_PRIVATE   = 0x02,
     MAP_FIXED     = 0x10,
     MAP_ANONYMOUS = 0x20,
+    MAP_POPULATE  = 0x8000, // prefault anonymous mappings instead of populating them on first touch
 
-    _MAP_KNOWN = MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS
+    _MAP_KNOWN = MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_POPULATE
 };
 
 static inline enum mmu_flags prot_to_mmu_flags(enum map_prot prot) {
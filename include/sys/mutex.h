@@ -5,6 +5,8 @@
 
 typedef semaphore_t mutex_t;
 
+#define MUTEX_INITIALIZER { .i = 1 }
+
 #define mutex_init(m) semaphore_init(m, 1)
 #define mutex_acquire(m) (semaphore_wait((m), false))
 #define mutex_release(m) (semaphore_signal(m))
@@ -16,6 +16,8 @@
 void scheduler_init(void);
 void scheduler_apentry(void);
 __noreturn void sched_stop_thread(void);
+// ends the current thread, and its process once no other thread is left
+__noreturn void sched_thread_exit(void);
 
 void sched_pin(cpuid_t pin);
 void sched_sleep(size_t us);
@@ -1,6 +1,8 @@
 #ifndef _AMETHYST_SYS_SPINLOCK_H
 #define _AMETHYST_SYS_SPINLOCK_H
 
+#include <cpu/interrupts.h>
+
 typedef volatile bool spinlock_t;
 
 #define SPINLOCK_INIT ((spinlock_t) false)
@@ -20,5 +22,18 @@ static inline void spinlock_release(spinlock_t* lock) {
     *lock = false;
 }
 
+// for locks also taken with interrupts disabled: a holder preempted with interrupts enabled would
+// leave any other thread on its cpu spinning forever
+static inline bool spinlock_acquire_irqsave(spinlock_t* lock) {
+    bool istate = interrupt_set(false);
+    spinlock_acquire(lock);
+    return istate;
+}
+
+static inline void spinlock_release_irqrestore(spinlock_t* lock, bool istate) {
+    spinlock_release(lock);
+    interrupt_set(istate);
+}
+
 #endif /* _AMETHYST_SYS_SPINLOCK_H */
 
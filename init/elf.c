@@ -1,8 +1,11 @@
 #include <encoding/elf.h>
 
+#include <filesystem/vfs.h>
 #include <mem/heap.h>
 #include <mem/vmm.h>
 
+#include <abi.h>
+
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
@@ -23,7 +26,7 @@
 
 int elf_read_exact(struct vnode* node, void* buff, size_t count, uintmax_t offset) {
     size_t bytes_read;
-    int err = vfs_read(node, buff, count, offset, &bytes_read, 0);
+    int err = vfs_read(node, buff, count, offset, &bytes_read, 0, nullptr);
     if(err)
         return err;
     if(bytes_read != count)
@@ -43,97 +46,78 @@ static enum mmu_flags phdr_to_mmu_flags(Elf64_Word p_flags) {
         mmu_flags |= MMU_FLAGS_READ;
     if(p_flags & PF_W)
         mmu_flags |= MMU_FLAGS_WRITE;
-    if((p_flags & PF_R) & PF_X)
+    if(!(p_flags & PF_X))
         mmu_flags |= MMU_FLAGS_NOEXEC;
 
     return mmu_flags;
 };
 
-static int load(struct vnode* node, Elf64_Phdr* phdr, void** brk) {
-    int err = 0;
+// maps the pages holding the file part of a segment straight from the page cache. Text stays
+// shared by every process running the file, written data pages get copied on their first write.
+static int map_file(struct vnode* node, Elf64_Phdr* phdr, uintptr_t start, uintptr_t end, enum mmu_flags mmu_flags) {
+    struct vmm_file_desc desc = {
+        .node = node,
+        .offset = ROUND_DOWN(phdr->p_offset, PAGE_SIZE)
+    };
 
-    uintptr_t mem_address = phdr->p_vaddr;
+    if(!vmm_map((void*) start, end - start, VMM_FLAGS_EXACT | VMM_FLAGS_FILE, mmu_flags, &desc))
+        return ENOMEM;
 
-    uintmax_t offset = phdr->p_offset;
-    size_t file_size = phdr->p_filesz;
-    size_t mem_size = phdr->p_memsz;
+    return 0;
+}
 
-    enum mmu_flags mmu_flags = phdr_to_mmu_flags(phdr->p_flags) | MMU_FLAGS_USER | MMU_FLAGS_WRITE;
-    uintmax_t first_page_offset = mem_address % PAGE_SIZE;
+// segments whose address and file offset disagree within a page cannot come from the cache
+static int copy_file(struct vnode* node, Elf64_Phdr* phdr, uintptr_t start, uintptr_t end, enum mmu_flags mmu_flags) {
+    if(!vmm_map((void*) start, end - start, VMM_FLAGS_EXACT | VMM_FLAGS_ALLOCATE, mmu_flags | MMU_FLAGS_WRITE, nullptr))
+        return ENOMEM;
 
-    // unaligned first page
-    if(first_page_offset) {
-        size_t first_page_count = MIN(file_size, PAGE_SIZE - first_page_offset);
-        void* page = (void*) ROUND_DOWN(mem_address, PAGE_SIZE);
+    int err = elf_read_exact(node, (void*) phdr->p_vaddr, phdr->p_filesz, phdr->p_offset);
+    if(err)
+        return err;
 
-        if(!vmm_map(page, PAGE_SIZE, VMM_FLAGS_EXACT | VMM_FLAGS_ALLOCATE, mmu_flags, nullptr))
-            return ENOMEM;
+    return vmm_change_mmu_flags((void*) start, end - start, mmu_flags, 0);
+}
 
-        if((err = elf_read_exact(node, (void*) mem_address, first_page_count, offset)))
-            return err;
+static int load(struct vnode* node, Elf64_Phdr* phdr, void** brk) {
+    if(phdr->p_filesz > phdr->p_memsz)
+        return ENOEXEC;
 
-        memset(page, 0, first_page_offset);
-        mem_address += first_page_count;
-        file_size -= first_page_count;
-        mem_size -= first_page_count;
-        offset += first_page_count;
-
-        uintmax_t remaining = PAGE_SIZE - mem_address % PAGE_SIZE;
-        if(remaining && mem_size) {
-            size_t remaining_mem_size = MIN(remaining, mem_size);
-            size_t page_diff = ROUND_UP(mem_address, PAGE_SIZE) - mem_address;
-            if(remaining_mem_size > page_diff)
-                remaining_mem_size = page_diff;
-
-            memset((void*) mem_address, 0, remaining_mem_size);
-            mem_size -= remaining_mem_size;
-            mem_address += remaining_mem_size;
+    int err = 0;
+    enum mmu_flags mmu_flags = phdr_to_mmu_flags(phdr->p_flags);
+
+    uintptr_t start = ROUND_DOWN(phdr->p_vaddr, PAGE_SIZE);
+    uintptr_t file_end = phdr->p_vaddr + phdr->p_filesz;
+    uintptr_t file_pages_end = phdr->p_filesz ? ROUND_UP(file_end, PAGE_SIZE) : start;
+    uintptr_t mem_end = ROUND_UP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE);
+
+    if(file_pages_end > start) {
+        if(phdr->p_vaddr % PAGE_SIZE != phdr->p_offset % PAGE_SIZE)
+            err = copy_file(node, phdr, start, file_pages_end, mmu_flags);
+        else if(file_end == file_pages_end || phdr->p_memsz == phdr->p_filesz)
+            err = map_file(node, phdr, start, file_pages_end, mmu_flags);
+        else {
+            // the rest of the last file page is bss, only that page gets a private copy
+            if((err = map_file(node, phdr, start, file_pages_end, mmu_flags | MMU_FLAGS_WRITE)))
+                return err;
+
+            memset((void*) file_end, 0, file_pages_end - file_end);
+
+            if(!(mmu_flags & MMU_FLAGS_WRITE))
+                err = vmm_change_mmu_flags((void*) start, file_pages_end - start, mmu_flags, 0);
         }
-    }
-
-    // map middle of file
-    size_t file_page_count = file_size / PAGE_SIZE;
-    if(file_page_count) {
-        struct vmm_file_desc desc = {
-            .node = node,
-            .offset = offset
-        };
 
-        if(!vmm_map((void*) mem_address, file_page_count, VMM_FLAGS_EXACT | VMM_FLAGS_FILE | VMM_FLAGS_PAGESIZE, mmu_flags, &desc))
-            return ENOMEM;
-
-        size_t byte_size = file_page_count * PAGE_SIZE;
-        if((err = elf_read_exact(node, (void*) mem_address, byte_size, offset)))
+        if(err)
             return err;
-
-        mem_address += byte_size;
-        mem_size -= byte_size;
-        file_size -= byte_size;
-        offset += byte_size;
     }
 
-    // map end of file
-    size_t last_page_count = file_size % PAGE_SIZE;
-    if(last_page_count) {
-        if(!vmm_map((void*) mem_address, PAGE_SIZE, VMM_FLAGS_EXACT | VMM_FLAGS_ALLOCATE, mmu_flags, nullptr))
-            return ENOMEM;
-
-        if((err = elf_read_exact(node, (void*) mem_address, last_page_count, offset)))
-            return err;
-
-        memset((void*)(mem_address + last_page_count), 0, PAGE_SIZE - last_page_count);
-        mem_address += PAGE_SIZE;
-        mem_size -= MIN(mem_size, PAGE_SIZE);
-    }
-
-    // zero parts if needed
-    if(mem_size) {
-        if(!vmm_map((void*) mem_address, mem_size, VMM_FLAGS_EXACT, mmu_flags, nullptr))
+    // whole bss pages are demand-zero
+    if(mem_end > file_pages_end) {
+        if(!vmm_map((void*) file_pages_end, mem_end - file_pages_end, VMM_FLAGS_EXACT, mmu_flags, nullptr))
             return ENOMEM;
     }
 
     if(brk)
-        *brk = (void*) MAX((uintptr_t) *brk, ROUND_UP(mem_address, PAGE_SIZE));
+        *brk = (void*) MAX((uintptr_t) *brk, mem_end);
 
     return 0;
 }
@@ -148,7 +132,8 @@ int elf_load(struct vnode* node, void* base, void** entry, char** interpreter, E
     if((err = elf_read_exact(node, &header, sizeof(Elf64_Ehdr), 0)))
         return err;
 
-    if(!elf_validate_ehdr(&header, ET_EXEC))
+    // position independent objects are only loaded at a given base, i.e. the interpreter
+    if(!elf_validate_ehdr(&header, base ? ET_DYN : ET_EXEC))
         return ENOEXEC;
 
     auxv->null.a_type = AT_NULL;
@@ -156,10 +141,13 @@ int elf_load(struct vnode* node, void* base, void** entry, char** interpreter, E
     auxv->phnum.a_type = AT_PHNUM;
     auxv->phent.a_type = AT_PHENT;
     auxv->entry.a_type = AT_ENTRY;
+    auxv->base.a_type = AT_BASE;
 
     auxv->phnum.a_un.a_val = header.e_phnum;
     auxv->phent.a_un.a_val = header.e_phentsize;
-    auxv->entry.a_un.a_val = header.e_entry;
+    auxv->entry.a_un.a_val = header.e_entry + (uintptr_t) base;
+    auxv->base.a_un.a_val = 0;
+    auxv->phdr.a_un.a_val = 0;
 
     *entry = (void*)(header.e_entry + (uintptr_t) base);
 
@@ -190,6 +178,15 @@ int elf_load(struct vnode* node, void* base, void** entry, char** interpreter, E
             case PT_LOAD:
                 if((err = load(node, phdrs + i, brk)))
                     goto cleanup;
+
+                // without PT_PHDR, the headers are found in the segment loading them
+                if(!auxv->phdr.a_un.a_val && phdrs[i].p_offset <= header.e_phoff && header.e_phoff + phtable_size <= phdrs[i].p_offset + phdrs[i].p_filesz)
+                    auxv->phdr.a_un.a_val = phdrs[i].p_vaddr + header.e_phoff - phdrs[i].p_offset;
+                break;
+            case PT_GNU_STACK:
+            case PT_GNU_RELRO:
+            case PT_DYNAMIC:
+                // left to the interpreter
                 break;
             default:
                 klog(WARN, "ignored ELF program header %zx (type %d)", i, phdrs[i].p_type);
@@ -198,14 +195,25 @@ int elf_load(struct vnode* node, void* base, void** entry, char** interpreter, E
     }
 
     if(interpreter_phdr) {
+        if(!interpreter_phdr->p_filesz || interpreter_phdr->p_filesz > PAGE_SIZE) {
+            err = ENOEXEC;
+            goto cleanup;
+        }
+
         char* buff = kmalloc(interpreter_phdr->p_filesz);
         if(!buff) {
             err = ENOMEM;
             goto cleanup;
         }
 
-        if((err = elf_read_exact(node, buff, interpreter_phdr->p_filesz, interpreter_phdr->p_offset)))
+        err = elf_read_exact(node, buff, interpreter_phdr->p_filesz, interpreter_phdr->p_offset);
+        if(!err && buff[interpreter_phdr->p_filesz - 1] != '\0')
+            err = ENOEXEC;
+
+        if(err) {
+            kfree(buff);
             goto cleanup;
+        }
 
         *interpreter = buff;
     }
@@ -215,6 +223,31 @@ cleanup:
     return err;
 }
 
+int elf_load_interpreter(const char* path, void** entry, Elf64_auxv_list_t* auxv) {
+    struct vnode* node;
+    int err = vfs_open(vfs_root, path, 0, &node);
+    if(err)
+        return err;
+
+    Elf64_auxv_list_t interp_auxv;
+    char* interp_interp = nullptr;
+
+    err = elf_load(node, INTERPRETER_BASE, entry, &interp_interp, &interp_auxv, nullptr);
+    vop_release(&node);
+
+    // an interpreter has to stand on its own
+    if(interp_interp) {
+        kfree(interp_interp);
+        return ELIBBAD;
+    }
+
+    if(err)
+        return err == ENOEXEC ? ELIBBAD : err;
+
+    auxv->base.a_un.a_val = (uintptr_t) INTERPRETER_BASE;
+    return 0;
+}
+
 void* elf_prepare_stack(void* top, Elf64_auxv_list_t* auxv, char** argv, char** envp) {
     size_t argc, envc;
     size_t argv_size = 0, envp_size = 0;
@@ -4,8 +4,11 @@
 #include <drivers/pci/nvme.h>
 #include <drivers/pci/pci.h>
 #include <drivers/video/vga.h>
+#include <filesystem/dcache.h>
 #include <filesystem/devfs.h>
 #include <filesystem/initrd.h>
+#include <filesystem/readahead.h>
+#include <filesystem/tarfs.h>
 #include <filesystem/tmpfs.h>
 #include <filesystem/vfs.h>
 #include <init/cmdline.h>
@@ -13,7 +16,10 @@
 #include <io/pseudo_devices.h>
 #include <io/tty.h>
 #include <mem/heap.h>
+#include <mem/shrinker.h>
+#include <mem/slab.h>
 #include <mem/vmm.h>
+#include <sys/bench.h>
 #include <sys/fb.h>
 #include <sys/scheduler.h>
 #include <sys/subsystems/shard.h>
@@ -57,9 +63,13 @@ void kmain(size_t cmdline_size, const char* cmdline)
     syscall_log_set(cmdline_get("log-syscalls") != nullptr);
     
     vmm_cache_init();
+    slab_shrinker_init();
+    reclaim_init();
 
     vfs_init();
+    readahead_init();
     tmpfs_init();
+    tarfs_init();
     devfs_init();
 
     kmodule_init();
@@ -86,12 +96,27 @@ void kmain(size_t cmdline_size, const char* cmdline)
 
     klog(INFO, "mounting root (%s) on `/`", rootfs);
 
-    assert(vfs_mount(nullptr, vfs_root, "/", rootfs, nullptr) == 0);
-
-    initrd_unpack();
+    assert(initrd_mount_root(rootfs) == 0);
 
     shard_subsystem_init();
 
+    bench_run(cmdline_get("bench"));
+
+    if(cmdline_get("slabinfo"))
+        slab_dump_info();
+
+    if(cmdline_get("shrinkerinfo"))
+        shrinker_dump_info();
+
+    if(cmdline_get("readaheadinfo"))
+        readahead_dump_info();
+
+    if(cmdline_get("writebackinfo"))
+        vmm_writeback_dump_info();
+
+    if(cmdline_get("dcacheinfo"))
+        dcache_dump_info();
+
     const char *init = cmdline_get("init");
     if(!init)
         init = DEFAULT_INIT;
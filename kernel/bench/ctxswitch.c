@@ -0,0 +1,119 @@
+#include <sys/bench.h>
+#include <sys/scheduler.h>
+#include <sys/semaphore.h>
+#include <sys/thread.h>
+#include <mem/vmm.h>
+#include <cpu/interrupts.h>
+
+#include <assert.h>
+
+#define BENCH_ROUNDS 10'000
+
+// pages each side reads per round, few enough to fit the TLB together with the other side's
+#define BENCH_PAGES 32
+
+static struct {
+    semaphore_t ping;
+    semaphore_t pong;
+    semaphore_t done;
+    struct vmm_context* context;
+    cpuid_t cpu;
+} partner;
+
+static uint8_t* populate(void) {
+    uint8_t* base = vmm_map(USERSPACE_START, BENCH_PAGES * PAGE_SIZE, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    assert(base);
+    return base;
+}
+
+static void touch(volatile uint8_t* base) {
+    for(size_t i = 0; i < BENCH_PAGES; i++)
+        (void) base[i * PAGE_SIZE];
+}
+
+static __noreturn void partner_thread(void) {
+    sched_pin(partner.cpu);
+    vmm_switch_context(partner.context);
+
+    uint8_t* base = populate();
+    semaphore_signal(&partner.done);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        semaphore_wait(&partner.ping, false);
+        touch(base);
+        semaphore_signal(&partner.pong);
+    }
+
+    vmm_unmap(base, BENCH_PAGES * PAGE_SIZE, 0);
+
+    // the context gets destroyed as soon as `done` is signalled
+    vmm_switch_context(&vmm_kernel_context);
+    semaphore_signal(&partner.done);
+
+    sched_thread_exit();
+}
+
+// two threads pinned to one cpu, each in its own address space, alternately reading their working set
+static void ping_pong(const char* what, bool flush) {
+    struct vmm_context* old = current_vmm_context();
+    struct vmm_context* self = vmm_context_new();
+    partner.context = vmm_context_new();
+    assert(self && partner.context);
+
+    // the shared asid gets flushed on every switch, like without PCIDs
+    uint16_t asids[2] = { self->asid, partner.context->asid };
+    if(flush)
+        self->asid = partner.context->asid = MMU_ASID_SHARED;
+
+    semaphore_init(&partner.ping, 0);
+    semaphore_init(&partner.pong, 0);
+    semaphore_init(&partner.done, 0);
+
+    bool int_status = interrupt_set(false);
+    partner.cpu = _cpu()->id;
+    sched_pin(partner.cpu);
+    interrupt_set(int_status);
+
+    vmm_switch_context(self);
+    uint8_t* base = populate();
+
+    struct thread* thread = thread_create(partner_thread, PAGE_SIZE * 16, current_thread()->priority, nullptr, nullptr);
+    assert(thread);
+    sched_queue(thread);
+    semaphore_wait(&partner.done, false);
+
+    struct bench_timer timer;
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        touch(base);
+        semaphore_signal(&partner.ping);
+        semaphore_wait(&partner.pong, false);
+    }
+
+    uint64_t cycles = bench_stop(&timer);
+    semaphore_wait(&partner.done, false);
+
+    bench_report(what, BENCH_ROUNDS, cycles);
+
+    vmm_unmap(base, BENCH_PAGES * PAGE_SIZE, 0);
+    vmm_switch_context(old);
+    sched_pin(THREAD_UNPINNED);
+
+    self->asid = asids[0];
+    partner.context->asid = asids[1];
+    vmm_context_destroy(self);
+    vmm_context_destroy(partner.context);
+}
+
+static void bench_ctxswitch(void) {
+    if(!mmu_asids_enabled()) {
+        ping_pong("round trip without PCIDs", false);
+        return;
+    }
+
+    ping_pong("round trip with flushing switches", true);
+    ping_pong("round trip with per-space PCIDs", false);
+}
+
+_BENCH_REGISTER("ctxswitch", bench_ctxswitch, "address space switch ping-pong between two threads on one cpu");
@@ -0,0 +1,109 @@
+#include <sys/bench.h>
+#include <sys/thread.h>
+#include <mem/heap.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
+#include <filesystem/vfs.h>
+#include <encoding/elf.h>
+#include <init/cmdline.h>
+
+#include <assert.h>
+#include <kernelio.h>
+#include <string.h>
+
+#define BENCH_ROUNDS 64
+
+// address spaces running the same binary at once, to see how much of them is shared
+#define BENCH_COPIES 8
+
+#define BENCH_DEFAULT_BINARY "/bin/init"
+
+static struct vmm_context* load(struct vnode* node) {
+    struct vmm_context* context = vmm_context_new();
+    assert(context);
+
+    vmm_switch_context(context);
+
+    Elf64_auxv_list_t auxv;
+    char* interpreter = nullptr;
+    void* entry;
+    void* brk = nullptr;
+
+    int err = elf_load(node, nullptr, &entry, &interpreter, &auxv, &brk);
+    assert(err == 0);
+
+    if(interpreter)
+        kfree(interpreter);
+
+    return context;
+}
+
+// faults in every readable page, like a process running through all of its image
+static void touch(struct vmm_context* context) {
+    for(struct vmm_range* range = context->space.ranges; range; range = range->next) {
+        if(!(range->mmu_flags & MMU_FLAGS_READ))
+            continue;
+
+        for(size_t offset = 0; offset < range->size; offset += PAGE_SIZE)
+            (void) *(volatile uint8_t*) ((uintptr_t) range->start + offset);
+    }
+}
+
+static void bench_exec(void) {
+    const char* path = cmdline_get("init");
+    if(!path)
+        path = BENCH_DEFAULT_BINARY;
+
+    struct vnode* node;
+    int err = vfs_open(vfs_root, path, 0, &node);
+    if(err) {
+        klog(ERROR, "cannot open `%s`: %s (%d)", path, strerror(err), err);
+        return;
+    }
+
+    struct vmm_context* old_context = current_vmm_context();
+    struct bench_timer timer;
+    uint64_t load_cycles = 0, touch_cycles = 0, exit_cycles = 0;
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        bench_start(&timer);
+        struct vmm_context* context = load(node);
+        load_cycles += bench_stop(&timer);
+
+        bench_start(&timer);
+        touch(context);
+        touch_cycles += bench_stop(&timer);
+
+        vmm_switch_context(old_context);
+
+        bench_start(&timer);
+        vmm_context_destroy(context);
+        exit_cycles += bench_stop(&timer);
+    }
+
+    bench_report("elf_load", BENCH_ROUNDS, load_cycles);
+    bench_report("faulting in the whole image", BENCH_ROUNDS, touch_cycles);
+    bench_report("destroying the address space", BENCH_ROUNDS, exit_cycles);
+
+    // the file is cached by now, new frames are private copies and page tables
+    struct vmm_context* copies[BENCH_COPIES];
+    size_t resident = 0;
+    uintmax_t free_before = pmm_free_memory();
+
+    for(size_t i = 0; i < BENCH_COPIES; i++) {
+        copies[i] = load(node);
+        touch(copies[i]);
+        resident += copies[i]->space.rss;
+        vmm_switch_context(old_context);
+    }
+
+    uintmax_t allocated = free_before - pmm_free_memory();
+    klog(INFO, "  %d copies of `%s`: %zu KiB resident, %ju KiB newly allocated", BENCH_COPIES, path, resident * PAGE_SIZE / 1024, allocated / 1024);
+
+    for(size_t i = 0; i < BENCH_COPIES; i++)
+        vmm_context_destroy(copies[i]);
+
+    vop_release(&node);
+}
+
+_BENCH_REGISTER("exec", bench_exec, "loading and faulting in a binary (`init=` or /bin/init), and what copies of it share");
@@ -0,0 +1,54 @@
+#include <sys/bench.h>
+#include <sys/thread.h>
+#include <mem/vmm.h>
+
+#include <assert.h>
+#include <kernelio.h>
+
+#define BENCH_MAX_SIZE (64 * 1024 * 1024)
+#define BENCH_ROUNDS 16
+
+// anonymous allocations below 2 MiB stay on 4 KiB pages, which is what fork has to deal with most
+#define BENCH_CHUNK (1024 * 1024)
+
+static void bench_fork(void) {
+    uint8_t* base = vmm_map(USERSPACE_START, BENCH_MAX_SIZE, 0, MMU_FLAGS_READ | MMU_FLAGS_NOEXEC, nullptr);
+    assert(base);
+    vmm_unmap(base, BENCH_MAX_SIZE, 0);
+
+    size_t populated = 0;
+    for(size_t size = BENCH_CHUNK; size <= BENCH_MAX_SIZE; size *= 8) {
+        for(; populated < size; populated += BENCH_CHUNK) {
+            void* addr = vmm_map(base + populated, BENCH_CHUNK, VMM_FLAGS_EXACT | VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+            assert(addr);
+        }
+
+        struct bench_timer timer;
+        uint64_t fork_cycles = 0, exit_cycles = 0, cow_cycles = 0;
+
+        for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+            bench_start(&timer);
+            struct vmm_context* child = vmm_context_fork(current_vmm_context());
+            fork_cycles += bench_stop(&timer);
+            assert(child);
+
+            bench_start(&timer);
+            vmm_context_destroy(child);
+            exit_cycles += bench_stop(&timer);
+
+            // the child is gone, so every write fault finds the parent as the sole owner of the frame
+            bench_start(&timer);
+            for(size_t off = 0; off < size; off += PAGE_SIZE)
+                *(volatile uint8_t*) (base + off) = 1;
+            cow_cycles += bench_stop(&timer);
+        }
+
+        bench_report_n("fork with ", size / (1024 * 1024), " MiB", BENCH_ROUNDS, fork_cycles);
+        bench_report_n("exit with ", size / (1024 * 1024), " MiB", BENCH_ROUNDS, exit_cycles);
+        bench_report_n("cow fault after exit with ", size / (1024 * 1024), " MiB", BENCH_ROUNDS * (size / PAGE_SIZE), cow_cycles);
+    }
+
+    vmm_unmap(base, BENCH_MAX_SIZE, 0);
+}
+
+_BENCH_REGISTER("fork", bench_fork, "fork+exit of an address space with up to 64 MiB of populated memory");
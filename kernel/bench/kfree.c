@@ -0,0 +1,66 @@
+#include <sys/bench.h>
+#include <mem/heap.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
+
+#include <assert.h>
+#include <kernelio.h>
+
+#define BENCH_MAX_LIVE 100'000
+#define BENCH_SAMPLES 4096
+
+// kmalloc-512 and up are indirect slab caches
+#define BENCH_OBJECT_SIZE 512
+
+// frees absorbed by this cpu's two magazines and a full depot before the slab layer sees any
+#define BENCH_OVERFLOW (SLAB_MAGAZINE_SIZE * (SLAB_DEPOT_LIMIT + 2))
+
+static void bench_live(void** objs, size_t live) {
+    // free objects spread over the whole live set in one batch; only frees past the overflow are
+    // timed, these go through returnobject() instead of being parked in a magazine
+    size_t stride = live / (BENCH_OVERFLOW + BENCH_SAMPLES) ? live / (BENCH_OVERFLOW + BENCH_SAMPLES) : 1;
+    size_t freed = 0, samples = 0;
+    uint64_t cycles = 0;
+
+    struct bench_timer timer;
+    for(size_t i = 0; i < live && samples < BENCH_SAMPLES; i += stride, freed++) {
+        if(freed < BENCH_OVERFLOW) {
+            kfree(objs[i]);
+            continue;
+        }
+
+        bench_start(&timer);
+        kfree(objs[i]);
+        cycles += bench_stop(&timer);
+        samples++;
+    }
+
+    for(size_t i = 0, n = 0; n < freed; i += stride, n++) {
+        objs[i] = kmalloc(BENCH_OBJECT_SIZE);
+        assert(objs[i]);
+    }
+
+    bench_report_n("kfree into the slab layer with ", live, " live objects", samples, cycles);
+}
+
+static void bench_kfree(void) {
+    void** objs = vmm_map(nullptr, BENCH_MAX_LIVE * sizeof(void*), VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    assert(objs);
+
+    size_t live = 0;
+    for(size_t target = 1000; target <= BENCH_MAX_LIVE; target *= 10) {
+        for(; live < target; live++) {
+            objs[live] = kmalloc(BENCH_OBJECT_SIZE);
+            assert(objs[live]);
+        }
+
+        bench_live(objs, live);
+    }
+
+    for(size_t i = 0; i < live; i++)
+        kfree(objs[i]);
+
+    vmm_unmap(objs, BENCH_MAX_LIVE * sizeof(void*), 0);
+}
+
+_BENCH_REGISTER("kfree", bench_kfree, "kfree latency of indirect slab objects with growing live sets");
@@ -0,0 +1,119 @@
+#include <sys/bench.h>
+#include <encoding/lz4.h>
+#include <mem/vmm.h>
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#define BENCH_BLOCK_SIZE 65536
+#define BENCH_BLOCKS 64
+#define BENCH_SIZE (BENCH_BLOCK_SIZE * BENCH_BLOCKS)
+// literals that end every compressed block
+#define BENCH_TAIL 5
+#define BENCH_MATCH (BENCH_BLOCK_SIZE - BENCH_TAIL)
+#define BENCH_OFFSET 65535
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    for(int i = 0; i < 4; i++)
+        *p++ = value >> (8 * i);
+    return p;
+}
+
+// the first block is stored as is, every later one repeats the output 64 KiB back and appends a
+// few literals, so matches reach into the previous block
+static void fill_content(uint8_t* content) {
+    for(size_t i = 0; i < BENCH_BLOCK_SIZE; i++)
+        content[i] = i * 7 ^ i >> 9;
+
+    for(size_t i = BENCH_BLOCK_SIZE; i < BENCH_SIZE; i++)
+        content[i] = i % BENCH_BLOCK_SIZE < BENCH_MATCH ? content[i - BENCH_OFFSET] : i / BENCH_BLOCK_SIZE + i;
+}
+
+// one frame with 64 KiB blocks and a content checksum over `content`, returns its size
+static size_t build_frame(uint8_t* frame, const uint8_t* content) {
+    uint8_t* p = put32(frame, LZ4_FRAME_MAGIC);
+
+    // version 1 with a content checksum, 64 KiB blocks
+    *p++ = 0x44;
+    *p++ = 0x40;
+    *p = lz4_xxh32(p - 2, 2, 0) >> 8;
+    p++;
+
+    p = put32(p, BENCH_BLOCK_SIZE | 0x80000000u);
+    memcpy(p, content, BENCH_BLOCK_SIZE);
+    p += BENCH_BLOCK_SIZE;
+
+    for(size_t block = 1; block < BENCH_BLOCKS; block++) {
+        uint8_t* size = p;
+        p += 4;
+
+        // no literals, one match over all but the tail
+        *p++ = 15;
+        *p++ = BENCH_OFFSET & 0xff;
+        *p++ = BENCH_OFFSET >> 8;
+
+        size_t length = BENCH_MATCH - 4 - 15;
+        for(; length >= 255; length -= 255)
+            *p++ = 255;
+        *p++ = length;
+
+        *p++ = BENCH_TAIL << 4;
+        memcpy(p, content + (block + 1) * BENCH_BLOCK_SIZE - BENCH_TAIL, BENCH_TAIL);
+        p += BENCH_TAIL;
+
+        put32(size, p - size - 4);
+    }
+
+    p = put32(p, 0);
+    p = put32(p, lz4_xxh32(content, BENCH_SIZE, 0));
+    return p - frame;
+}
+
+// decodes like an initrd being unpacked: output behind the match window is unmapped as soon as
+// the decoder is past it, before the content checksum at the end of the frame is checked
+static void bench_lz4(void) {
+    uint8_t* content = vmm_map(nullptr, BENCH_SIZE, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    uint8_t* frame = vmm_map(nullptr, 2 * BENCH_BLOCK_SIZE, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    uint8_t* out = vmm_map(nullptr, BENCH_SIZE, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    assert(content && frame && out);
+
+    fill_content(content);
+    size_t frame_size = build_frame(frame, content);
+
+    size_t size;
+    assert(lz4_decoded_size(frame, frame_size, &size) == 0 && size == BENCH_SIZE);
+
+    struct lz4_stream stream;
+    lz4_stream_init(&stream, frame, frame_size, out, BENCH_SIZE);
+
+    struct bench_timer timer;
+    uint64_t cycles = 0;
+    size_t released = 0;
+    bool done = false;
+
+    while(!done) {
+        bench_start(&timer);
+        int err = lz4_stream_next(&stream, &done);
+        cycles += bench_stop(&timer);
+        assert(err == 0);
+
+        size_t unused = ROUND_DOWN(stream.dst_pos > LZ4_WINDOW_SIZE ? stream.dst_pos - LZ4_WINDOW_SIZE : 0, PAGE_SIZE);
+        if(unused > released) {
+            assert(memcmp(out + released, content + released, unused - released) == 0);
+            vmm_unmap(out + released, unused - released, 0);
+            released = unused;
+        }
+    }
+
+    assert(stream.dst_pos == BENCH_SIZE);
+    assert(memcmp(out + released, content + released, BENCH_SIZE - released) == 0);
+
+    bench_report("lz4: decode 64 KiB block (content checksum, output released)", BENCH_BLOCKS, cycles);
+
+    vmm_unmap(out + released, BENCH_SIZE - released, 0);
+    vmm_unmap(frame, 2 * BENCH_BLOCK_SIZE, 0);
+    vmm_unmap(content, BENCH_SIZE, 0);
+}
+
+_BENCH_REGISTER("lz4", bench_lz4, "streaming lz4 decode of a checksummed frame while releasing output");
@@ -0,0 +1,145 @@
+#include <sys/bench.h>
+#include <sys/spinlock.h>
+#include <mem/pmm.h>
+#include <mem/heap.h>
+#include <mem/vmm.h>
+
+#include <assert.h>
+#include <bitmap.h>
+#include <string.h>
+
+// one maximum-order buddy block, so the bitmap arena can be allocated contiguously
+#define BENCH_PAGES (1ul << PMM_MAX_ORDER)
+#define BENCH_ROUNDS 16
+
+static_assert(PMM_ZERO_POOL_SIZE <= BENCH_PAGES);
+
+static spinlock_t bitmap_lock;
+
+static void* bitmap_alloc_page(struct bitmap* bitmap) {
+    spinlock_acquire(&bitmap_lock);
+    void* phys = bitmap_allocate(bitmap, 1);
+    spinlock_release(&bitmap_lock);
+    return phys;
+}
+
+static void bitmap_free_page(struct bitmap* bitmap, void* phys) {
+    spinlock_acquire(&bitmap_lock);
+    bitmap_mark_blocks(bitmap, ((uintptr_t) phys - bitmap->mem_start) / BLOCK_SIZE, 1, 0);
+    spinlock_release(&bitmap_lock);
+}
+
+static void bench_bitmap(void** pages) {
+    void* arena = pmm_alloc(BENCH_PAGES, PMM_SECTION_DEFAULT);
+
+    struct bitmap bitmap = {
+        .block_cnt = BENCH_PAGES,
+        .byte_cnt = BENCH_PAGES / BLOCKS_PER_BYTE,
+        .last_deep_fragmented = 0,
+        .mem_start = (uintptr_t) arena
+    };
+
+    bitmap.bitmap = kmalloc(bitmap.byte_cnt);
+    assert(bitmap.bitmap);
+    memset(bitmap.bitmap, 0, bitmap.byte_cnt);
+    spinlock_init(bitmap_lock);
+
+    struct bench_timer timer;
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_PAGES; i++)
+            pages[i] = bitmap_alloc_page(&bitmap);
+        for(size_t i = 0; i < BENCH_PAGES; i++)
+            bitmap_free_page(&bitmap, pages[i]);
+    }
+
+    bench_report("bitmap: alloc/free (sequential)", BENCH_ROUNDS * BENCH_PAGES, bench_stop(&timer));
+
+    for(size_t i = 0; i < BENCH_PAGES; i++)
+        pages[i] = bitmap_alloc_page(&bitmap);
+
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_PAGES; i += 2)
+            bitmap_free_page(&bitmap, pages[i]);
+        for(size_t i = 0; i < BENCH_PAGES; i += 2)
+            pages[i] = bitmap_alloc_page(&bitmap);
+    }
+
+    bench_report("bitmap: alloc/free (fragmented)", BENCH_ROUNDS * BENCH_PAGES / 2, bench_stop(&timer));
+
+    kfree(bitmap.bitmap);
+    pmm_free(arena, BENCH_PAGES);
+}
+
+static void bench_buddy(void** pages) {
+    struct bench_timer timer;
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_PAGES; i++)
+            pages[i] = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
+        for(size_t i = 0; i < BENCH_PAGES; i++)
+            pmm_free_page(pages[i]);
+    }
+
+    bench_report("buddy: alloc/free (sequential)", BENCH_ROUNDS * BENCH_PAGES, bench_stop(&timer));
+
+    for(size_t i = 0; i < BENCH_PAGES; i++)
+        pages[i] = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
+
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_PAGES; i += 2)
+            pmm_free_page(pages[i]);
+        for(size_t i = 0; i < BENCH_PAGES; i += 2)
+            pages[i] = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
+    }
+
+    bench_report("buddy: alloc/free (fragmented)", BENCH_ROUNDS * BENCH_PAGES / 2, bench_stop(&timer));
+
+    for(size_t i = 0; i < BENCH_PAGES; i++)
+        pmm_free_page(pages[i]);
+
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS * 16; r++) {
+        void* block = pmm_alloc(16, PMM_SECTION_DEFAULT);
+        pmm_free(block, 16);
+    }
+
+    bench_report("buddy: alloc/free (16 pages)", BENCH_ROUNDS * 16, bench_stop(&timer));
+}
+
+static void bench_zeroed(void** pages) {
+    struct bench_timer timer;
+    bench_start(&timer);
+
+    for(size_t i = 0; i < PMM_ZERO_POOL_SIZE; i++)
+        pages[i] = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
+
+    bench_report("zeroed: alloc", PMM_ZERO_POOL_SIZE, bench_stop(&timer));
+
+    for(size_t i = 0; i < PMM_ZERO_POOL_SIZE; i++)
+        pmm_free_page(pages[i]);
+
+    struct pmm_zero_pool_stats stats;
+    pmm_zero_pool_stats(&stats);
+    klog(INFO, "  zero pool: %zu pages, %lu hits, %lu misses", stats.size, stats.hits, stats.misses);
+}
+
+static void bench_pmm(void) {
+    void** pages = kmalloc(BENCH_PAGES * sizeof(void*));
+    assert(pages);
+
+    bench_bitmap(pages);
+    bench_buddy(pages);
+    bench_zeroed(pages);
+
+    kfree(pages);
+}
+
+_BENCH_REGISTER("pmm", bench_pmm, "buddy allocator with per-cpu magazines vs. bitmap allocator");
@@ -0,0 +1,53 @@
+#include <sys/bench.h>
+#include <mem/heap.h>
+#include <mem/slab.h>
+
+#include <assert.h>
+
+#define BENCH_OBJECTS 1024
+#define BENCH_ROUNDS 64
+
+static void bench_slab(void) {
+    struct scache* cache = slab_newcache("bench-64", 64, 0, nullptr, nullptr);
+    assert(cache);
+
+    void** objs = kmalloc(BENCH_OBJECTS * sizeof(void*));
+    assert(objs);
+
+    struct bench_timer timer;
+    bench_start(&timer);
+
+    for(size_t i = 0; i < BENCH_ROUNDS * BENCH_OBJECTS; i++)
+        slab_free(cache, slab_alloc(cache));
+
+    bench_report("alloc/free (pairs)", BENCH_ROUNDS * BENCH_OBJECTS, bench_stop(&timer));
+
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_OBJECTS; i++)
+            objs[i] = slab_alloc(cache);
+        for(size_t i = 0; i < BENCH_OBJECTS; i++)
+            slab_free(cache, objs[i]);
+    }
+
+    bench_report("alloc/free (batches of 1024)", BENCH_ROUNDS * BENCH_OBJECTS, bench_stop(&timer));
+
+    bench_start(&timer);
+
+    for(size_t r = 0; r < BENCH_ROUNDS; r++) {
+        for(size_t i = 0; i < BENCH_OBJECTS; i++)
+            objs[i] = kmalloc(i % 256 + 1);
+        for(size_t i = 0; i < BENCH_OBJECTS; i++)
+            kfree(objs[i]);
+    }
+
+    bench_report("kmalloc/kfree (1-256 bytes)", BENCH_ROUNDS * BENCH_OBJECTS, bench_stop(&timer));
+
+    slab_dump_info();
+
+    kfree(objs);
+    slab_freecache(cache);
+}
+
+_BENCH_REGISTER("slab", bench_slab, "slab allocator with per-cpu magazines");
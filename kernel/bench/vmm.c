@@ -0,0 +1,62 @@
+#include <sys/bench.h>
+#include <mem/vmm.h>
+
+#include <assert.h>
+#include <kernelio.h>
+
+#define BENCH_MAPPINGS 10'000
+#define BENCH_SAMPLES 1024
+
+// every mapping is followed by an unmapped page, so neighbouring ranges never merge
+#define BENCH_STRIDE (2 * PAGE_SIZE)
+
+static void bench_faults(void) {
+    // find a free stretch of user space in the current context, the ranges get placed inside it
+    uint8_t* base = vmm_map(USERSPACE_START, BENCH_MAPPINGS * BENCH_STRIDE, 0, MMU_FLAGS_READ | MMU_FLAGS_NOEXEC, nullptr);
+    assert(base);
+    vmm_unmap(base, BENCH_MAPPINGS * BENCH_STRIDE, 0);
+
+    size_t mapped = 0;
+    for(size_t target = 100; target <= BENCH_MAPPINGS; target *= 10) {
+        struct bench_timer timer;
+        uint64_t map_cycles = 0;
+        size_t first = mapped;
+
+        for(; mapped < target; mapped++) {
+            bench_start(&timer);
+            void* addr = vmm_map(base + mapped * BENCH_STRIDE, PAGE_SIZE, VMM_FLAGS_EXACT, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+            map_cycles += bench_stop(&timer);
+            assert(addr);
+        }
+
+        bench_report_n("vmm_map with ", target, " mappings", target - first, map_cycles);
+
+        // first read of a lazily mapped page: range lookup + zero page mapping
+        size_t stride = (target - first) / BENCH_SAMPLES ? (target - first) / BENCH_SAMPLES : 1;
+        size_t samples = 0;
+        uint64_t fault_cycles = 0;
+
+        for(size_t i = first; i < target && samples < BENCH_SAMPLES; i += stride, samples++) {
+            volatile uint8_t* page = base + i * BENCH_STRIDE;
+            bench_start(&timer);
+            (void) *page;
+            fault_cycles += bench_stop(&timer);
+        }
+
+        bench_report_n("read fault with ", target, " mappings", samples, fault_cycles);
+    }
+
+    vmm_unmap(base, BENCH_MAPPINGS * BENCH_STRIDE, 0);
+
+    struct vmm_range_stats stats;
+    vmm_range_stats(&stats);
+    klog(INFO, "  range descriptors: %lu allocs, %lu frees, %lu refills, %lu flushes, %zu pages",
+        stats.allocs, stats.frees, stats.refills, stats.flushes, stats.pages);
+
+    struct mmu_tlb_stats tlb;
+    mmu_tlb_stats(&tlb);
+    klog(INFO, "  tlb shootdowns: %lu batches, %lu IPIs, %lu pages, %lu full flushes",
+        tlb.batches, tlb.ipis, tlb.pages, tlb.full_flushes);
+}
+
+_BENCH_REGISTER("vmm", bench_faults, "vmm_map and page fault latency with up to 10k mappings");
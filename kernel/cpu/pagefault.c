@@ -66,6 +66,7 @@ static bool handle_pagefault(void* addr, bool user, enum vmm_action actions) {
                     vop_lock(range->vnode);
                     assert(vop_mmap(range->vnode, addr, range->offset + map_offset, V_FFLAGS_READ | mmu_to_vnode_flags(range->mmu_flags) | (range->flags & VMM_FLAGS_SHARED ? V_FFLAGS_SHARED : 0), cred) == 0);
                     vop_unlock(range->vnode);
+                    space->rss++;
                     handled = true;
                 }
 
@@ -85,13 +86,29 @@ static bool handle_pagefault(void* addr, bool user, enum vmm_action actions) {
                 klog(ERROR, "could not map file into address space: Out of Memory");
                 page_release(page);
             }
+            else
+                space->rss++;
+        }
+        else if(actions & VMM_ACTION_WRITE) {
+            // anonymous memory written to first: skip the zero page and its copy-on-write fault
+            void* phys = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
+            handled = phys && mmu_map(current_vmm_context()->page_table, phys, addr, range->mmu_flags);
+            if(!handled) {
+                klog(ERROR, "could not map anonymous page into address space: Out of Memory");
+                if(phys)
+                    pmm_release(phys);
+            }
+            else
+                space->rss++;
         }
         else {
             handled = mmu_map(current_vmm_context()->page_table, pmm_zero_page, addr, range->mmu_flags & ~MMU_FLAGS_WRITE);
             if(!handled)
                 klog(ERROR, "could not map zero page into address space: Out of Memory");
-            else
+            else {
                 pmm_hold(pmm_zero_page);
+                space->rss++;
+            }
         }
     }
     else if(!mmu_is_writable(thread->vmm_context->page_table, addr)) {
@@ -100,12 +117,21 @@ static bool handle_pagefault(void* addr, bool user, enum vmm_action actions) {
         
         // TODO: remap page if it is part of shared memory / shard files
 
-        // copy on write
-        void* new_phys = pmm_alloc_page(PMM_SECTION_DEFAULT);
+        // copy on write; the last owner of an anonymous frame (the other side of a fork exited or
+        // copied it already) simply regains write access
+        if(old_phys != pmm_zero_page && pmm_is_exclusive(old_phys)) {
+            mmu_remap(current_vmm_context()->page_table, old_phys, addr, range->mmu_flags);
+            mmu_invalidate_range(addr, PAGE_SIZE);
+            handled = true;
+            goto cleanup;
+        }
+
+        void* new_phys = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
         if(new_phys) {
             memcpy(MAKE_HHDM(new_phys), MAKE_HHDM(old_phys), PAGE_SIZE);
             mmu_remap(current_vmm_context()->page_table, new_phys, addr, range->mmu_flags);
             mmu_invalidate_range(addr, PAGE_SIZE);
+            pmm_release(old_phys);
             handled = true;
         }
     }
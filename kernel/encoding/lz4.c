@@ -0,0 +1,357 @@
+#include <encoding/lz4.h>
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#define FLG_VERSION_SHIFT 6
+#define FLG_BLOCK_CHECKSUM 0x10
+#define FLG_CONTENT_SIZE 0x08
+#define FLG_CONTENT_CHECKSUM 0x04
+#define FLG_RESERVED 0x02
+#define FLG_DICT_ID 0x01
+
+#define BD_RESERVED 0x8f
+#define BD_BLOCK_MAX_SHIFT 4
+
+#define BLOCK_UNCOMPRESSED 0x80000000u
+#define MIN_MATCH 4
+
+#define PRIME32_1 0x9e3779b1u
+#define PRIME32_2 0x85ebca77u
+#define PRIME32_3 0xc2b2ae3du
+#define PRIME32_4 0x27d4eb2fu
+#define PRIME32_5 0x165667b1u
+
+static inline uint32_t read32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    return read32(p) | (uint64_t) read32(p + 4) << 32;
+}
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t xxh32_round(uint32_t acc, const uint8_t* p) {
+    return rotl32(acc + read32(p) * PRIME32_2, 13) * PRIME32_1;
+}
+
+void lz4_xxh32_init(struct lz4_xxh32* state, uint32_t seed) {
+    memset(state, 0, sizeof(struct lz4_xxh32));
+    state->seed = seed;
+    state->acc[0] = seed + PRIME32_1 + PRIME32_2;
+    state->acc[1] = seed + PRIME32_2;
+    state->acc[2] = seed;
+    state->acc[3] = seed - PRIME32_1;
+}
+
+static inline void xxh32_stripe(struct lz4_xxh32* state, const uint8_t* p) {
+    for(int i = 0; i < 4; i++)
+        state->acc[i] = xxh32_round(state->acc[i], p + 4 * i);
+}
+
+void lz4_xxh32_update(struct lz4_xxh32* state, const void* data, size_t size) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + size;
+    state->length += size;
+
+    if(state->buffered) {
+        size_t fill = MIN(sizeof(state->buffer) - state->buffered, size);
+        memcpy(state->buffer + state->buffered, p, fill);
+        state->buffered += fill;
+        p += fill;
+
+        if(state->buffered < sizeof(state->buffer))
+            return;
+
+        xxh32_stripe(state, state->buffer);
+        state->buffered = 0;
+    }
+
+    for(; end - p >= 16; p += 16)
+        xxh32_stripe(state, p);
+
+    memcpy(state->buffer, p, end - p);
+    state->buffered = end - p;
+}
+
+uint32_t lz4_xxh32_digest(const struct lz4_xxh32* state) {
+    const uint8_t* p = state->buffer;
+    const uint8_t* end = p + state->buffered;
+    uint32_t h;
+
+    if(state->length >= 16)
+        h = rotl32(state->acc[0], 1) + rotl32(state->acc[1], 7) + rotl32(state->acc[2], 12) + rotl32(state->acc[3], 18);
+    else
+        h = state->seed + PRIME32_5;
+
+    h += (uint32_t) state->length;
+
+    for(; p + 4 <= end; p += 4)
+        h = rotl32(h + read32(p) * PRIME32_3, 17) * PRIME32_4;
+
+    for(; p < end; p++)
+        h = rotl32(h + *p * PRIME32_5, 11) * PRIME32_1;
+
+    h ^= h >> 15;
+    h *= PRIME32_2;
+    h ^= h >> 13;
+    h *= PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t lz4_xxh32(const void* data, size_t size, uint32_t seed) {
+    struct lz4_xxh32 state;
+    lz4_xxh32_init(&state, seed);
+    lz4_xxh32_update(&state, data, size);
+    return lz4_xxh32_digest(&state);
+}
+
+void lz4_stream_init(struct lz4_stream* stream, const void* src, size_t src_size, void* dst, size_t dst_size) {
+    memset(stream, 0, sizeof(struct lz4_stream));
+    stream->src = src;
+    stream->src_size = src_size;
+    stream->dst = dst;
+    stream->dst_size = dst_size;
+}
+
+static int begin_frame(struct lz4_stream* stream) {
+    const uint8_t* p = stream->src + stream->src_pos;
+    size_t left = stream->src_size - stream->src_pos;
+    if(left < 7)
+        return EINVAL;
+
+    uint8_t flg = p[4];
+    uint8_t bd = p[5];
+    if(flg >> FLG_VERSION_SHIFT != 1 || (flg & FLG_RESERVED) || (bd & BD_RESERVED))
+        return EINVAL;
+
+    // only used for data compressed against a shared dictionary, nothing that could be an initrd
+    if(flg & FLG_DICT_ID)
+        return ENOTSUP;
+
+    unsigned block_max = (bd >> BD_BLOCK_MAX_SHIFT) & 7;
+    if(block_max < 4)
+        return EINVAL;
+
+    size_t descriptor_size = 2 + (flg & FLG_CONTENT_SIZE ? 8 : 0);
+    if(left < 4 + descriptor_size + 1)
+        return EINVAL;
+
+    if(((lz4_xxh32(p + 4, descriptor_size, 0) >> 8) & 0xff) != p[4 + descriptor_size])
+        return EBADMSG;
+
+    struct lz4_frame* frame = &stream->frame;
+    frame->block_checksum = flg & FLG_BLOCK_CHECKSUM;
+    frame->content_checksum = flg & FLG_CONTENT_CHECKSUM;
+    frame->has_content_size = flg & FLG_CONTENT_SIZE;
+    frame->content_size = frame->has_content_size ? read64(p + 6) : 0;
+    // 64 KiB, 256 KiB, 1 MiB or 4 MiB
+    frame->block_max = 1ul << (8 + 2 * block_max);
+    frame->start = stream->dst_pos;
+    lz4_xxh32_init(&frame->content_hash, 0);
+
+    stream->src_pos += 4 + descriptor_size + 1;
+    stream->in_frame = true;
+    return 0;
+}
+
+static int end_frame(struct lz4_stream* stream) {
+    struct lz4_frame* frame = &stream->frame;
+
+    if(frame->content_checksum) {
+        if(stream->src_size - stream->src_pos < 4)
+            return EINVAL;
+
+        if(stream->dst && lz4_xxh32_digest(&frame->content_hash) != read32(stream->src + stream->src_pos))
+            return EBADMSG;
+
+        stream->src_pos += 4;
+    }
+
+    if(frame->has_content_size) {
+        // the blocks were skipped when only counting
+        if(!stream->dst)
+            stream->dst_pos = frame->start + frame->content_size;
+        else if(stream->dst_pos - frame->start != frame->content_size)
+            return EINVAL;
+    }
+
+    stream->in_frame = false;
+    return 0;
+}
+
+static int read_length(const uint8_t** ip, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if(*ip >= end)
+            return EINVAL;
+
+        byte = *(*ip)++;
+        *length += byte;
+    } while(byte == 255);
+
+    return 0;
+}
+
+// a block is a series of sequences: literals to copy, then a match to repeat from earlier output
+static int decode_block(struct lz4_stream* stream, const uint8_t* ip, size_t size) {
+    const uint8_t* end = ip + size;
+    size_t out = stream->dst_pos;
+    size_t limit = out + stream->frame.block_max;
+    if(stream->dst)
+        limit = MIN(limit, stream->dst_size);
+
+    while(ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if(literals == 15 && read_length(&ip, end, &literals))
+            return EINVAL;
+
+        if(literals > (size_t) (end - ip) || literals > limit - out)
+            return EINVAL;
+
+        if(stream->dst)
+            memcpy(stream->dst + out, ip, literals);
+
+        ip += literals;
+        out += literals;
+
+        // the last sequence ends after its literals
+        if(ip == end)
+            break;
+
+        if(end - ip < 2)
+            return EINVAL;
+
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+
+        // matches may reach back into earlier blocks of the same frame
+        if(!offset || offset > out - stream->frame.start)
+            return EINVAL;
+
+        size_t length = token & 15;
+        if(length == 15 && read_length(&ip, end, &length))
+            return EINVAL;
+
+        length += MIN_MATCH;
+        if(length > limit - out)
+            return EINVAL;
+
+        if(stream->dst) {
+            uint8_t* dst = stream->dst + out;
+            const uint8_t* match = dst - offset;
+
+            // an overlapping match repeats the bytes it is producing
+            if(offset >= length)
+                memcpy(dst, match, length);
+            else {
+                for(size_t i = 0; i < length; i++)
+                    dst[i] = match[i];
+            }
+        }
+
+        out += length;
+    }
+
+    stream->dst_pos = out;
+    return 0;
+}
+
+int lz4_stream_next(struct lz4_stream* stream, bool* done) {
+    *done = false;
+
+    while(!stream->in_frame) {
+        size_t left = stream->src_size - stream->src_pos;
+        if(!left) {
+            *done = true;
+            return 0;
+        }
+
+        if(left < 4)
+            return EINVAL;
+
+        uint32_t magic = read32(stream->src + stream->src_pos);
+        if(magic == LZ4_FRAME_MAGIC)
+            return begin_frame(stream);
+
+        if((magic & LZ4_SKIPPABLE_MASK) != LZ4_SKIPPABLE_MAGIC || left < 8)
+            return EINVAL;
+
+        uint32_t size = read32(stream->src + stream->src_pos + 4);
+        if(size > left - 8)
+            return EINVAL;
+
+        stream->src_pos += 8 + size;
+    }
+
+    size_t left = stream->src_size - stream->src_pos;
+    if(left < 4)
+        return EINVAL;
+
+    uint32_t word = read32(stream->src + stream->src_pos);
+    stream->src_pos += 4;
+    left -= 4;
+
+    if(!word)
+        return end_frame(stream);
+
+    size_t size = word & ~BLOCK_UNCOMPRESSED;
+    size_t checksum_size = stream->frame.block_checksum ? 4 : 0;
+    if(size > stream->frame.block_max || size + checksum_size > left)
+        return EINVAL;
+
+    const uint8_t* block = stream->src + stream->src_pos;
+    if(checksum_size && lz4_xxh32(block, size, 0) != read32(block + size))
+        return EBADMSG;
+
+    stream->src_pos += size + checksum_size;
+
+    // counting frames that state their size is left to end_frame()
+    if(!stream->dst && stream->frame.has_content_size)
+        return 0;
+
+    size_t block_start = stream->dst_pos;
+
+    if(!(word & BLOCK_UNCOMPRESSED)) {
+        int err = decode_block(stream, block, size);
+        if(err)
+            return err;
+    }
+    else {
+        if(stream->dst) {
+            if(size > stream->dst_size - stream->dst_pos)
+                return EINVAL;
+            memcpy(stream->dst + stream->dst_pos, block, size);
+        }
+
+        stream->dst_pos += size;
+    }
+
+    // while the block is still in the window
+    if(stream->dst && stream->frame.content_checksum)
+        lz4_xxh32_update(&stream->frame.content_hash, stream->dst + block_start, stream->dst_pos - block_start);
+
+    return 0;
+}
+
+int lz4_decoded_size(const void* src, size_t src_size, size_t* size) {
+    struct lz4_stream stream;
+    lz4_stream_init(&stream, src, src_size, nullptr, 0);
+
+    int err;
+    bool done = false;
+    while(!done) {
+        if((err = lz4_stream_next(&stream, &done)))
+            return err;
+    }
+
+    *size = stream.dst_pos;
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include <encoding/tar.h>
 
+#include <cdefs.h>
+#include <string.h>
+
 const char* tar_entry_type_str(enum tar_entry_type type) {
     switch(type) {
         case TAR_FILE:
@@ -20,3 +23,56 @@ const char* tar_entry_type_str(enum tar_entry_type type) {
             return "<unknown>";
     }
 }
+
+static size_t convert(const char* buff, size_t len) {
+    size_t result = 0;
+    while(len--) {
+        result <<= 3;
+        result += *buff - '0';
+        buff++;
+    }
+
+    return result;
+}
+
+void tar_read_entry(struct tar_entry* entry, const void* addr) {
+    const struct tar_header* header = addr;
+
+    char* name_ptr = (char*) entry->name;
+    
+    if(*header->prefix) {
+        size_t len = __last(header->prefix) ? __len(header->prefix) : strlen((const char*) header->prefix);
+        memcpy(name_ptr, header->prefix, len);
+        name_ptr += len;
+        *name_ptr++ = '/';
+    }
+
+    size_t name_len = __last(header->name) ? __len(header->name) : strlen((const char*) header->name);
+    memcpy(name_ptr, header->name, name_len);
+    name_ptr[name_len] = '\0';
+
+#define CONVERT_FIELD(field) (convert((const char*) header->field, __len(header->field) - 1))
+
+    entry->mode = CONVERT_FIELD(mode);
+    entry->uid = CONVERT_FIELD(uid);
+    entry->gid = CONVERT_FIELD(gid);
+    entry->size = CONVERT_FIELD(size);
+    entry->modtime.s = CONVERT_FIELD(modtime);
+    entry->modtime.ns = 0;
+    entry->checksum = CONVERT_FIELD(checksum);
+    entry->type = convert((const char*) header->type, 1);
+    entry->devmajor = CONVERT_FIELD(devmajor);
+    entry->devminor = CONVERT_FIELD(devminor);
+
+#undef CONVERT_FIELD
+
+    if(__last(header->link)) {
+        memcpy(entry->link, header->link, __len(header->link));
+        __last(entry->link) = '\0';
+    }
+    else
+        strcpy((char*) entry->link, (const char*) header->link);
+
+    memcpy(entry->indicator, header->indicator, __len(header->indicator));
+    memcpy(entry->version, header->version, __len(header->version));
+}
@@ -0,0 +1,451 @@
+#include <filesystem/dcache.h>
+#include <filesystem/vfs.h>
+
+#include <mem/shrinker.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
+#include <sys/hash.h>
+#include <sys/mutex.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <kernelio.h>
+#include <math.h>
+#include <string.h>
+
+// Entries never change once they are published. Readers walk the hash chains without taking locks,
+// announcing themselves in `readers`; writers unlink entries with `lock` held and leave them in the
+// graveyard until no reader is left that could still be looking at them. Only then the vnode
+// references are dropped and the memory is freed.
+
+struct dentry {
+    struct dentry* next;      // hash chain, followed by lock-free readers
+    struct dentry* node_next; // chain of `node_buckets`, only used with `lock` held
+    struct dentry* lru_next;
+    struct dentry* lru_prev;
+    struct dentry* dead_next;
+
+    struct vnode* parent;
+    struct vnode* node;       // held, nullptr for a name that does not exist
+    uint64_t hash;
+    bool referenced;          // used since the eviction hand passed it last
+    uint8_t len;
+    char name[DCACHE_NAME_MAX + 1];
+};
+
+#define DENTRIES_PER_PAGE (PAGE_SIZE / sizeof(struct dentry))
+
+static struct scache* dentry_cache;
+
+static struct dentry* buckets[DCACHE_BUCKETS];
+// positive entries by the vnode they name, for reverse lookups
+static struct dentry* node_buckets[DCACHE_BUCKETS];
+
+static mutex_t lock;
+// most recently inserted entries at the head
+static struct dentry* lru_head;
+static struct dentry* lru_tail;
+static struct dentry* graveyard;
+
+static size_t entries;
+static size_t negative_entries;
+
+// lookups walking the hash chains right now
+static size_t readers;
+
+// bumped by every invalidation: a miss only caches its result if nothing was invalidated meanwhile
+static uintmax_t generation;
+
+static struct dcache_stats stats;
+
+static inline uint64_t name_hash(struct vnode* parent, const char* name, size_t len) {
+    return (fnv1ahash(name, len) ^ ((uintptr_t) parent >> 4)) * FNV1PRIME;
+}
+
+static inline uint64_t node_hash(struct vnode* node) {
+    return ((uintptr_t) node >> 4) * FNV1PRIME;
+}
+
+static inline size_t bucket_of(uint64_t hash) {
+    return (hash >> 32) % DCACHE_BUCKETS;
+}
+
+static void lru_push(struct dentry* dentry) {
+    dentry->lru_prev = nullptr;
+    dentry->lru_next = lru_head;
+
+    if(lru_head)
+        lru_head->lru_prev = dentry;
+    else
+        lru_tail = dentry;
+
+    lru_head = dentry;
+}
+
+static void lru_remove(struct dentry* dentry) {
+    if(dentry->lru_next)
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    else
+        lru_tail = dentry->lru_prev;
+
+    if(dentry->lru_prev)
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    else
+        lru_head = dentry->lru_next;
+}
+
+// `lock` must be held
+static void unlink_dentry(struct dentry* dentry) {
+    struct dentry** link = &buckets[bucket_of(dentry->hash)];
+    while(*link != dentry)
+        link = &(*link)->next;
+
+    // `dentry->next` stays intact for readers that are standing on this entry
+    __atomic_store_n(link, dentry->next, __ATOMIC_RELEASE);
+
+    if(dentry->node) {
+        link = &node_buckets[bucket_of(node_hash(dentry->node))];
+        while(*link != dentry)
+            link = &(*link)->node_next;
+
+        *link = dentry->node_next;
+    }
+    else
+        negative_entries--;
+
+    lru_remove(dentry);
+    dentry->parent->dentry_count--;
+    entries--;
+
+    dentry->dead_next = graveyard;
+    graveyard = dentry;
+}
+
+// `lock` must be held. Clock over the LRU list: entries used since they were last looked at get
+// another round at the head.
+static bool evict_one(void) {
+    while(lru_tail) {
+        struct dentry* dentry = lru_tail;
+
+        if(__atomic_exchange_n(&dentry->referenced, false, __ATOMIC_RELAXED)) {
+            lru_remove(dentry);
+            lru_push(dentry);
+            continue;
+        }
+
+        unlink_dentry(dentry);
+        __atomic_add_fetch(&stats.evictions, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    return false;
+}
+
+// frees the graveyard if no reader is active. Must be called without `lock` held, the vnodes
+// released here may go inactive and purge their own entries.
+static void reap(void) {
+    mutex_acquire(&lock);
+    struct dentry* dead = graveyard;
+    graveyard = nullptr;
+    mutex_release(&lock);
+
+    if(!dead)
+        return;
+
+    // every entry in `dead` is unlinked, only readers that started before that may still see it
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&readers, __ATOMIC_SEQ_CST)) {
+        struct dentry* last = dead;
+        while(last->dead_next)
+            last = last->dead_next;
+
+        mutex_acquire(&lock);
+        last->dead_next = graveyard;
+        graveyard = dead;
+        mutex_release(&lock);
+        return;
+    }
+
+    while(dead) {
+        struct dentry* next = dead->dead_next;
+
+        if(dead->node)
+            vop_release(&dead->node);
+
+        slab_free(dentry_cache, dead);
+        dead = next;
+    }
+}
+
+static bool cache_get(struct vnode* parent, const char* name, size_t len, uint64_t hash, struct vnode** node) {
+    bool found = false;
+
+    __atomic_add_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+
+    struct dentry* dentry = __atomic_load_n(&buckets[bucket_of(hash)], __ATOMIC_ACQUIRE);
+    for(; dentry; dentry = __atomic_load_n(&dentry->next, __ATOMIC_ACQUIRE)) {
+        if(dentry->hash != hash || dentry->parent != parent || dentry->len != len || memcmp(dentry->name, name, len))
+            continue;
+
+        // the entry's own reference keeps the vnode alive until the graveyard is reaped
+        *node = dentry->node;
+        if(*node)
+            vop_hold(*node);
+
+        if(!__atomic_load_n(&dentry->referenced, __ATOMIC_RELAXED))
+            __atomic_store_n(&dentry->referenced, true, __ATOMIC_RELAXED);
+
+        found = true;
+        break;
+    }
+
+    __atomic_sub_fetch(&readers, 1, __ATOMIC_SEQ_CST);
+    return found;
+}
+
+static void cache_put(struct vnode* parent, const char* name, size_t len, uint64_t hash, struct vnode* node, uintmax_t gen) {
+    struct dentry* dentry = slab_alloc(dentry_cache);
+    if(!dentry)
+        return;
+
+    dentry->parent = parent;
+    dentry->node = node;
+    dentry->hash = hash;
+    dentry->referenced = false;
+    dentry->len = len;
+    memcpy(dentry->name, name, len);
+    dentry->name[len] = '\0';
+
+    if(node)
+        vop_hold(node);
+
+    mutex_acquire(&lock);
+
+    // the name changed since the filesystem was asked, or another miss was faster
+    bool stale = generation != gen;
+    for(struct dentry* other = buckets[bucket_of(hash)]; other && !stale; other = other->next)
+        stale = other->hash == hash && other->parent == parent && other->len == len && memcmp(other->name, name, len) == 0;
+
+    if(stale) {
+        mutex_release(&lock);
+
+        // the caller holds `node` as well, this is never the last reference
+        if(node)
+            vop_release(&dentry->node);
+
+        slab_free(dentry_cache, dentry);
+        return;
+    }
+
+    size_t bucket = bucket_of(hash);
+    dentry->next = buckets[bucket];
+    __atomic_store_n(&buckets[bucket], dentry, __ATOMIC_RELEASE);
+
+    if(node) {
+        bucket = bucket_of(node_hash(node));
+        dentry->node_next = node_buckets[bucket];
+        node_buckets[bucket] = dentry;
+    }
+    else
+        negative_entries++;
+
+    lru_push(dentry);
+    parent->dentry_count++;
+
+    if(++entries > DCACHE_MAX_ENTRIES)
+        evict_one();
+
+    mutex_release(&lock);
+
+    reap();
+}
+
+int dcache_lookup(struct vnode* parent, const char* name, struct vnode** result, struct cred* cred) {
+    size_t len = strlen(name);
+
+    // "." and ".." would make directories hold each other
+    if(len > DCACHE_NAME_MAX || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return vop_lookup(parent, name, result, cred);
+
+    uint64_t hash = name_hash(parent, name, len);
+
+    struct vnode* node;
+    if(cache_get(parent, name, len, hash, &node)) {
+        if(!node) {
+            __atomic_add_fetch(&stats.negative_hits, 1, __ATOMIC_RELAXED);
+            return ENOENT;
+        }
+
+        __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+        *result = node;
+        return 0;
+    }
+
+    __atomic_add_fetch(&stats.misses, 1, __ATOMIC_RELAXED);
+
+    uintmax_t gen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+
+    int err = vop_lookup(parent, name, result, cred);
+    if(!err)
+        cache_put(parent, name, len, hash, *result, gen);
+    else if(err == ENOENT)
+        cache_put(parent, name, len, hash, nullptr, gen);
+
+    return err;
+}
+
+void dcache_invalidate(struct vnode* parent, const char* name) {
+    size_t len = strlen(name);
+    uint64_t hash = name_hash(parent, name, len);
+
+    mutex_acquire(&lock);
+
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+
+    for(struct dentry* dentry = buckets[bucket_of(hash)]; dentry; dentry = dentry->next) {
+        if(dentry->hash == hash && dentry->parent == parent && dentry->len == len && memcmp(dentry->name, name, len) == 0) {
+            unlink_dentry(dentry);
+            __atomic_add_fetch(&stats.invalidations, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    mutex_release(&lock);
+
+    reap();
+}
+
+void dcache_purge(struct vnode* parent) {
+    if(!__atomic_load_n(&parent->dentry_count, __ATOMIC_RELAXED))
+        return;
+
+    mutex_acquire(&lock);
+
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+
+    for(struct dentry* dentry = lru_head; dentry && parent->dentry_count;) {
+        struct dentry* next = dentry->lru_next;
+        if(dentry->parent == parent)
+            unlink_dentry(dentry);
+        dentry = next;
+    }
+
+    mutex_release(&lock);
+
+    reap();
+}
+
+void dcache_purge_vfs(struct vfs* vfs) {
+    mutex_acquire(&lock);
+
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+
+    for(struct dentry* dentry = lru_head; dentry;) {
+        struct dentry* next = dentry->lru_next;
+        if(dentry->parent->vfs == vfs)
+            unlink_dentry(dentry);
+        dentry = next;
+    }
+
+    mutex_release(&lock);
+
+    reap();
+}
+
+// a vnode whose count dropped to zero is already on its way to vfs_inactive()
+static bool hold_unless_inactive(struct vnode* node) {
+    int count = __atomic_load_n(&node->refcount, __ATOMIC_ACQUIRE);
+
+    do {
+        if(!count)
+            return false;
+    } while(!__atomic_compare_exchange_n(&node->refcount, &count, count + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return true;
+}
+
+int dcache_reverse(struct vnode* node, struct vnode** parent, char* name, size_t size) {
+    int err = ENOENT;
+
+    mutex_acquire(&lock);
+
+    for(struct dentry* dentry = node_buckets[bucket_of(node_hash(node))]; dentry; dentry = dentry->node_next) {
+        if(dentry->node != node)
+            continue;
+
+        if(dentry->len >= size) {
+            err = ENAMETOOLONG;
+            break;
+        }
+
+        if(!hold_unless_inactive(dentry->parent))
+            continue;
+
+        memcpy(name, dentry->name, dentry->len + 1);
+        *parent = dentry->parent;
+        err = 0;
+        break;
+    }
+
+    mutex_release(&lock);
+    return err;
+}
+
+static size_t shrinker_count(struct shrinker* shrinker __unused) {
+    return ROUND_UP_DIV(__atomic_load_n(&entries, __ATOMIC_RELAXED), DENTRIES_PER_PAGE);
+}
+
+// evicts the least recently used entries, which in turn may release the last reference to vnodes
+static size_t shrinker_scan(struct shrinker* shrinker __unused, struct shrink_control* sc) {
+    // releasing vnodes may sleep
+    if(sc->direct)
+        return 0;
+
+    size_t target = sc->nr_to_scan * DENTRIES_PER_PAGE;
+    size_t evicted = 0;
+
+    mutex_acquire(&lock);
+
+    while(evicted < target && evict_one())
+        evicted++;
+
+    mutex_release(&lock);
+
+    reap();
+
+    return evicted / DENTRIES_PER_PAGE;
+}
+
+static struct shrinker shrinker = {
+    .name = "dentry cache",
+    .count = shrinker_count,
+    .scan = shrinker_scan
+};
+
+void dcache_init(void) {
+    dentry_cache = slab_newcache("dentry", sizeof(struct dentry), 0, nullptr, nullptr);
+    assert(dentry_cache);
+
+    mutex_init(&lock);
+
+    shrinker_register(&shrinker);
+}
+
+void dcache_get_stats(struct dcache_stats* dest) {
+    dest->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    dest->negative_hits = __atomic_load_n(&stats.negative_hits, __ATOMIC_RELAXED);
+    dest->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+    dest->evictions = __atomic_load_n(&stats.evictions, __ATOMIC_RELAXED);
+    dest->invalidations = __atomic_load_n(&stats.invalidations, __ATOMIC_RELAXED);
+    dest->entries = __atomic_load_n(&entries, __ATOMIC_RELAXED);
+    dest->negative = __atomic_load_n(&negative_entries, __ATOMIC_RELAXED);
+}
+
+void dcache_dump_info(void) {
+    struct dcache_stats s;
+    dcache_get_stats(&s);
+
+    klog(INFO, "dcache: %zu entries (%zu negative), %lu hits, %lu negative hits, %lu misses, %lu evictions, %lu invalidations",
+        s.entries, s.negative, s.hits, s.negative_hits, s.misses, s.evictions, s.invalidations);
+}
@@ -1,4 +1,5 @@
 #include <filesystem/devfs.h>
+#include <filesystem/dcache.h>
 #include <filesystem/vfs.h>
 
 #include <amethyst/dirent.h>
@@ -51,7 +52,7 @@ static void ctor(struct scache* cache __unused, void* obj) {
 
 void devfs_init(void) {
     assert(hashtable_init(&dev_table, 50) == 0);
-    node_cache = slab_newcache(sizeof(struct dev_node), 0, ctor, ctor);
+    node_cache = slab_newcache("devfs_node", sizeof(struct dev_node), 0, ctor, ctor);
     assert(node_cache);
     mutex_init(&table_mutex);
     
@@ -131,6 +132,7 @@ void devfs_remove(const char* name, int major, int minor) {
     struct dev_node* node = tmp;
     assert(node->vattr.rdev_major == major && node->vattr.rdev_minor == minor);
     assert(hashtable_remove(&parent_dev_node->children, name_buffer, strlen(name_buffer)) == 0);
+    dcache_invalidate(parent, name_buffer);
 
     vop_unlock(parent);
 
@@ -1,5 +1,6 @@
 #include <filesystem/initrd.h>
 
+#include <encoding/lz4.h>
 #include <encoding/tar.h>
 #include <init/cmdline.h>
 #include <limine.h>
@@ -7,18 +8,37 @@
 #include <mem/pmm.h>
 #include <mem/heap.h>
 #include <filesystem/vfs.h>
+#include <filesystem/tarfs.h>
+#include <filesystem/tmpfs.h>
+#include <sys/scheduler.h>
+#include <sys/semaphore.h>
+#include <sys/thread.h>
+#include <sys/timekeeper.h>
 
 #include <math.h>
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
 
+#define ZSTD_FRAME_MAGIC 0xfd2fb528u
+
 static volatile struct limine_module_request module_request = {
     .id = LIMINE_MODULE_REQUEST,
     .revision = 0
 };
 
-static void build_entry(struct tar_entry* entry, void* addr);
+// decompression of a compressed initrd. It runs on its own thread, block by block, while the
+// archive is indexed or unpacked behind it.
+static struct {
+    struct lz4_stream lz4;
+    uintptr_t start;
+    uintptr_t released; // compressed input is given back up to here
+    uintmax_t free_before;
+    size_t available;   // bytes decompressed so far
+    bool done;
+    int err;
+    semaphore_t progress;
+} stream;
 
 int create_parent_dirs(const char *entry_name, struct vattr *entry_attr) {
     int err = 0;
@@ -52,43 +72,138 @@ cleanup:
     return err;
 }
 
-int initrd_unpack(void) {
-    const char* filename = cmdline_get("initrd");
-    if(!filename)
-        return ENOENT;
-
+static struct limine_file* find_module(const char* filename) {
     assert(module_request.response);
-    
-    struct limine_file* initrd = nullptr;
+
     for(uint64_t i = 0; i < module_request.response->module_count; i++) {
-        if(strcmp(module_request.response->modules[i]->path, filename) == 0) {
-            initrd = module_request.response->modules[i];
-            break;
+        if(strcmp(module_request.response->modules[i]->path, filename) == 0)
+            return module_request.response->modules[i];
+    }
+
+    return nullptr;
+}
+
+static __noreturn void decompress_thread(void) {
+    int err = 0;
+    bool done = false;
+
+    while(!done && !err) {
+        err = lz4_stream_next(&stream.lz4, &done);
+
+        // input behind the decoder is not needed anymore, matches only refer back into the output
+        uintptr_t consumed = ROUND_DOWN((uintptr_t) stream.lz4.src + stream.lz4.src_pos, PAGE_SIZE);
+        if(done || err)
+            consumed = ROUND_UP((uintptr_t) stream.lz4.src + stream.lz4.src_size, PAGE_SIZE);
+
+        // module memory was never handed to the pmm, pmm_free() would not take it
+        if(consumed > stream.released) {
+            pmm_reclaim(FROM_HHDM(stream.released), (consumed - stream.released) / PAGE_SIZE);
+            stream.released = consumed;
         }
+
+        __atomic_store_n(&stream.available, stream.lz4.dst_pos, __ATOMIC_RELEASE);
+        semaphore_signal(&stream.progress);
     }
 
-    if(!initrd) {
-        klog(ERROR, "Initrd file `%s` not found.", filename);
-        return EBADF;
+    // the output grows while the input shrinks, and unpacking gives back output at the same time
+    klog(INFO, "lz4 initrd: %zu KiB of input reclaimed, free memory %ju KiB before decompressing, %ju KiB after",
+        (stream.released - stream.start) / 1024, stream.free_before / 1024, pmm_free_memory() / 1024);
+
+    stream.err = err;
+    __atomic_store_n(&stream.done, true, __ATOMIC_RELEASE);
+    semaphore_signal(&stream.progress);
+
+    sched_thread_exit();
+}
+
+static size_t stream_wait(size_t needed) {
+    size_t available;
+    while((available = __atomic_load_n(&stream.available, __ATOMIC_ACQUIRE)) < needed && !__atomic_load_n(&stream.done, __ATOMIC_ACQUIRE))
+        semaphore_wait(&stream.progress, false);
+
+    return __atomic_load_n(&stream.available, __ATOMIC_ACQUIRE);
+}
+
+static int stream_finish(void) {
+    while(!__atomic_load_n(&stream.done, __ATOMIC_ACQUIRE))
+        semaphore_wait(&stream.progress, false);
+
+    return stream.err;
+}
+
+// starts decompressing the module into `image`, which is filled in the background
+static int decompress(struct limine_file* initrd, struct tarfs_image* image) {
+    stream.free_before = pmm_free_memory();
+
+    size_t size;
+    int err = lz4_decoded_size(initrd->address, initrd->size, &size);
+    if(err)
+        return err;
+
+    void* buffer = vmm_map(nullptr, MAX(size, 1), VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    if(!buffer)
+        return ENOMEM;
+
+    lz4_stream_init(&stream.lz4, initrd->address, initrd->size, buffer, size);
+    stream.start = (uintptr_t) initrd->address;
+    stream.released = stream.start;
+    stream.available = 0;
+    stream.done = false;
+    stream.err = 0;
+    semaphore_init(&stream.progress, 0);
+
+    struct thread* thread = thread_create(decompress_thread, PAGE_SIZE * 16, 0, nullptr, nullptr);
+    if(!thread) {
+        vmm_unmap(buffer, MAX(size, 1), 0);
+        return ENOMEM;
     }
 
-    klog(INFO, "`%s` at %p with size %Zu (%lu pages).", filename, initrd->address, (size_t) initrd->size, ROUND_UP(initrd->size, PAGE_SIZE) / PAGE_SIZE);
-    assert(((uintptr_t) initrd->address % PAGE_SIZE) == 0);
+    klog(INFO, "decompressing lz4 initrd: %zu bytes to %zu", (size_t) initrd->size, size);
+
+    image->address = buffer;
+    image->size = size;
+    image->wait = stream_wait;
+
+    sched_queue(thread);
+    return 0;
+}
+
+static bool image_has(struct tarfs_image* image, size_t bytes) {
+    if(bytes > image->size)
+        return false;
+
+    return !image->wait || image->wait(bytes) >= bytes;
+}
+
+// gives back the part of the image that was unpacked already
+static void release_image(struct tarfs_image* image, uintptr_t offset, size_t size) {
+    if(!size)
+        return;
+
+    void* start = (void*) ((uintptr_t) image->address + offset);
+    if(image->wait)
+        vmm_unmap(start, size, 0);
+    else
+        pmm_reclaim(FROM_HHDM(start), size / PAGE_SIZE);
+}
+
+// copies everything into the root filesystem, freeing the image as it goes
+static int unpack(struct tarfs_image* image) {
+    uint8_t* start = image->address;
+    size_t offset = 0;
+    size_t released = 0;
 
-    void* ptr = initrd->address;
     struct tar_entry entry;
-    void* cleanup = initrd->address;
-    size_t cleaned_bytes = 0;
-
-    while(true) {
-        if(cleaned_bytes >= PAGE_SIZE) {
-            size_t page_count = cleaned_bytes / PAGE_SIZE;
-            pmm_free(FROM_HHDM(cleanup), page_count);
-            cleanup = (void*)((uintptr_t) cleanup + ROUND_DOWN(cleaned_bytes, PAGE_SIZE));
-            cleaned_bytes %= PAGE_SIZE;
+
+    while(image_has(image, offset + TAR_BLOCKSIZE)) {
+        // the decompressor still copies matches out of the last window of output
+        size_t unused = image->wait ? (offset > LZ4_WINDOW_SIZE ? offset - LZ4_WINDOW_SIZE : 0) : offset;
+        if(ROUND_DOWN(unused, PAGE_SIZE) > released) {
+            release_image(image, released, ROUND_DOWN(unused, PAGE_SIZE) - released);
+            released = ROUND_DOWN(unused, PAGE_SIZE);
         }
 
-        build_entry(&entry, ptr);
+        tar_read_entry(&entry, start + offset);
 
         if(strncmp((const char*) entry.indicator, "ustar", 5))
             break;
@@ -100,9 +215,13 @@ int initrd_unpack(void) {
         entry_attr.uid = entry.uid;
         entry_attr.mode = entry.mode;
 
-        void* data_start = (void*)((uintptr_t) ptr + TAR_BLOCKSIZE);
-        ptr = (void*)((uintptr_t) data_start + ROUND_UP(entry.size, TAR_BLOCKSIZE));
-        cleaned_bytes += TAR_BLOCKSIZE;
+        void* data_start = start + offset + TAR_BLOCKSIZE;
+        offset += TAR_BLOCKSIZE + ROUND_UP(entry.size, TAR_BLOCKSIZE);
+
+        if(!image_has(image, offset)) {
+            klog(ERROR, "`%s` is cut off by the end of the initrd", entry.name);
+            break;
+        }
 
         int err = create_parent_dirs((const char*) entry.name, &entry_attr);
         if(err) {
@@ -114,7 +233,6 @@ int initrd_unpack(void) {
         size_t write_count;
         switch(entry.type) {
             case TAR_FILE:
-                cleaned_bytes += ROUND_UP(entry.size, TAR_BLOCKSIZE);
                 err = vfs_create(vfs_root, (const char*) entry.name, &entry_attr, V_TYPE_REGULAR, &node);
                 if(err)
                     break;
@@ -136,61 +254,88 @@ int initrd_unpack(void) {
             klog(ERROR, "failed to unpack %s: %s (%d)\n", entry.name, strerror(err), err);
     }
 
+    // the decompressor may still be writing the padding at the end
+    if(image->wait)
+        stream_finish();
+
     // free remaining pages
-    pmm_free(FROM_HHDM(cleanup), ROUND_UP(cleaned_bytes, PAGE_SIZE) / PAGE_SIZE);
+    release_image(image, released, ROUND_UP(image->size, PAGE_SIZE) - released);
 
     return 0;
 }
 
-static size_t convert(const char* buff, size_t len) {
-    size_t result = 0;
-    while(len--) {
-        result <<= 3;
-        result += *buff - '0';
-        buff++;
-    }
-
-    return result;
+static uint32_t image_magic(struct limine_file* initrd) {
+    const uint8_t* p = initrd->address;
+    return initrd->size < 4 ? 0 : p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
 }
 
-static void build_entry(struct tar_entry* entry, void* addr) {
-    struct tar_header* header = addr;
+int initrd_mount_root(const char* rootfs) {
+    const char* filename = cmdline_get("initrd");
+    if(!filename)
+        return vfs_mount(nullptr, vfs_root, "/", rootfs, nullptr);
 
-    char* name_ptr = (char*) entry->name;
-    
-    if(*header->prefix) {
-        size_t len = __last(header->prefix) ? __len(header->prefix) : strlen((const char*) header->prefix);
-        memcpy(name_ptr, header->prefix, len);
-        name_ptr += len;
-        *name_ptr++ = '/';
+    struct limine_file* initrd = find_module(filename);
+    if(!initrd) {
+        klog(ERROR, "Initrd file `%s` not found.", filename);
+        return vfs_mount(nullptr, vfs_root, "/", rootfs, nullptr);
     }
 
-    size_t name_len = __last(header->name) ? __len(header->name) : strlen((const char*) header->name);
-    memcpy(name_ptr, header->name, name_len);
-    name_ptr[name_len] = '\0';
+    klog(INFO, "`%s` at %p with size %Zu (%lu pages).", filename, initrd->address, (size_t) initrd->size, ROUND_UP(initrd->size, PAGE_SIZE) / PAGE_SIZE);
+    assert(((uintptr_t) initrd->address % PAGE_SIZE) == 0);
+
+    struct timespec start = timekeeper_time_from_boot();
 
-#define CONVERT_FIELD(field) (convert((const char*) header->field, __len(header->field) - 1))
+    struct tarfs_image image = {
+        .address = initrd->address,
+        .size = initrd->size,
+        .wait = nullptr
+    };
 
-    entry->mode = CONVERT_FIELD(mode);
-    entry->uid = CONVERT_FIELD(uid);
-    entry->gid = CONVERT_FIELD(gid);
-    entry->size = CONVERT_FIELD(size);
-    entry->modtime.s = CONVERT_FIELD(modtime);
-    entry->modtime.ns = 0;
-    entry->checksum = CONVERT_FIELD(checksum);
-    entry->type = convert((const char*) header->type, 1);
-    entry->devmajor = CONVERT_FIELD(devmajor);
-    entry->devminor = CONVERT_FIELD(devminor);
+    int err = 0;
 
-#undef CONVERT_FIELD
+    if(image_magic(initrd) == ZSTD_FRAME_MAGIC)
+        err = ENOTSUP;
+    else if(lz4_is_frame(initrd->address, initrd->size))
+        err = decompress(initrd, &image);
 
-    if(__last(header->link)) {
-        memcpy(entry->link, header->link, __len(header->link));
-        __last(entry->link) = '\0';
+    if(err) {
+        klog(ERROR, "cannot decompress `%s`: %s (%d)", filename, strerror(err), err);
+        return vfs_mount(nullptr, vfs_root, "/", rootfs, nullptr);
     }
-    else
-        strcpy((char*) entry->link, (const char*) header->link);
 
-    memcpy(entry->indicator, header->indicator, __len(header->indicator));
-    memcpy(entry->version, header->version, __len(header->version));
+    const char* how;
+
+    if(strcmp(rootfs, "tarfs") == 0) {
+        how = "mounted read-only";
+        err = vfs_mount(nullptr, vfs_root, "/", "tarfs", &image);
+    }
+    else if(strcmp(rootfs, "tmpfs") == 0 && !cmdline_get("initrd-unpack")) {
+        // the tmpfs on top keeps `/` writable, files are only copied up from the image when used
+        how = "mounted as overlay";
+        err = vfs_mount(nullptr, vfs_root, "/", "tarfs", &image);
+        if(!err)
+            err = vfs_mount(nullptr, vfs_root, "/", "tmpfs", TMPFS_MOUNT_OVERLAY);
+    }
+    else {
+        how = "unpacked";
+        err = vfs_mount(nullptr, vfs_root, "/", rootfs, nullptr);
+        if(!err)
+            err = unpack(&image);
+    }
+
+    if(image.wait) {
+        // a corrupt image leaves whatever was decompressed before the error
+        int stream_err = stream_finish();
+        if(stream_err)
+            klog(ERROR, "decompressing `%s` failed after %zu bytes: %s (%d)", filename, stream.available, strerror(stream_err), stream_err);
+    }
+
+    if(err)
+        return err;
+
+    struct timespec end = timekeeper_time_from_boot();
+    long elapsed_us = (end.s - start.s) * 1'000'000l + (end.ns - start.ns) / 1'000l;
+
+    klog(INFO, "initrd %s in %ld us", how, elapsed_us);
+    return 0;
 }
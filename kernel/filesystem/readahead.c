@@ -0,0 +1,151 @@
+#include <filesystem/readahead.h>
+#include <filesystem/vfs.h>
+
+#include <mem/vmm.h>
+#include <mem/page.h>
+#include <sys/scheduler.h>
+#include <sys/semaphore.h>
+#include <sys/spinlock.h>
+#include <sys/thread.h>
+
+#include <assert.h>
+#include <kernelio.h>
+#include <math.h>
+
+struct readahead_request {
+    struct vnode* node;
+    uintmax_t start;
+    size_t count;
+};
+
+static spinlock_t queue_lock;
+static semaphore_t queue_sem;
+static struct readahead_request queue[READAHEAD_QUEUE_SIZE];
+static size_t queue_head, queue_count;
+
+static struct thread* readahead_thread;
+
+static struct readahead_stats stats;
+
+static bool enqueue(struct vnode* node, uintmax_t start, size_t count) {
+    bool queued = false;
+
+    spinlock_acquire(&queue_lock);
+
+    if(queue_count < READAHEAD_QUEUE_SIZE) {
+        vop_hold(node);
+
+        struct readahead_request* req = &queue[(queue_head + queue_count) % READAHEAD_QUEUE_SIZE];
+        req->node = node;
+        req->start = start;
+        req->count = count;
+
+        queue_count++;
+        queued = true;
+    }
+
+    spinlock_release(&queue_lock);
+
+    if(queued)
+        semaphore_signal(&queue_sem);
+
+    return queued;
+}
+
+static __noreturn void readahead_thread_callback(void) {
+    for(;;) {
+        semaphore_wait(&queue_sem, false);
+
+        spinlock_acquire(&queue_lock);
+        assert(queue_count);
+        struct readahead_request req = queue[queue_head];
+        queue_head = (queue_head + 1) % READAHEAD_QUEUE_SIZE;
+        queue_count--;
+        spinlock_release(&queue_lock);
+
+        for(size_t i = 0; i < req.count; i++) {
+            struct page* page;
+            bool cached;
+
+            // the file may have shrunk in the meantime
+            if(vmm_cache_read_page(req.node, (req.start + i) * PAGE_SIZE, &page, &cached))
+                break;
+
+            if(!cached)
+                __atomic_add_fetch(&stats.pages, 1, __ATOMIC_RELAXED);
+
+            page_release(page);
+        }
+
+        vop_release(&req.node);
+    }
+}
+
+void readahead_init(void) {
+    spinlock_init(queue_lock);
+    semaphore_init(&queue_sem, 0);
+
+    readahead_thread = thread_create(readahead_thread_callback, PAGE_SIZE * 16, 0, nullptr, nullptr);
+    assert(readahead_thread);
+    sched_queue(readahead_thread);
+}
+
+void readahead_update(struct readahead* ra, struct vnode* node, uintmax_t offset, size_t size, size_t file_size) {
+    uintmax_t last = (offset + size - 1) / PAGE_SIZE;
+    uintmax_t end = ROUND_UP(file_size, PAGE_SIZE) / PAGE_SIZE;
+
+    bool sequential = offset == ra->prev_end;
+    ra->prev_end = offset + size;
+
+    if(!sequential) {
+        // random access, prefetching would only waste memory until a stream shows up again
+        ra->window = 0;
+        ra->marker = 0;
+        ra->ahead_end = 0;
+        return;
+    }
+
+    // a new stream starts small, one that keeps consuming its prefetched windows doubles them
+    if(!ra->window)
+        ra->window = READAHEAD_MIN_PAGES;
+    else if(last >= ra->marker)
+        ra->window = MIN(ra->window * 2, READAHEAD_MAX_PAGES);
+    else
+        return;
+
+    uintmax_t start = MAX(last + 1, ra->ahead_end);
+    if(start >= end)
+        return;
+
+    size_t count = MIN(ra->window, end - start);
+    ra->marker = start;
+    ra->ahead_end = start + count;
+
+    if(enqueue(node, start, count))
+        __atomic_add_fetch(&stats.windows, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+}
+
+void readahead_account(size_t hits, size_t misses) {
+    if(hits)
+        __atomic_add_fetch(&stats.hits, hits, __ATOMIC_RELAXED);
+    if(misses)
+        __atomic_add_fetch(&stats.misses, misses, __ATOMIC_RELAXED);
+}
+
+void readahead_get_stats(struct readahead_stats* dest) {
+    dest->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    dest->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+    dest->windows = __atomic_load_n(&stats.windows, __ATOMIC_RELAXED);
+    dest->pages = __atomic_load_n(&stats.pages, __ATOMIC_RELAXED);
+    dest->dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+}
+
+void readahead_dump_info(void) {
+    struct readahead_stats s;
+    readahead_get_stats(&s);
+
+    klog(INFO, "readahead: %lu hits, %lu misses, %lu windows (%lu dropped), %lu pages prefetched",
+        s.hits, s.misses, s.windows, s.dropped, s.pages);
+}
@@ -0,0 +1,541 @@
+#include <filesystem/tarfs.h>
+#include <filesystem/vfs.h>
+#include <filesystem/devfs.h>
+
+#include <amethyst/dirent.h>
+#include <encoding/tar.h>
+
+#include <mem/heap.h>
+#include <mem/slab.h>
+#include <mem/vmm.h>
+#include <mem/page.h>
+
+#include <math.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <hashtable.h>
+#include <kernelio.h>
+
+static int tarfs_mount(struct vfs** vfs, struct vnode* mount_point, struct vnode* backing, void* data);
+static int tarfs_unmount(struct vfs* vfs);
+static int tarfs_root(struct vfs* vfs, struct vnode** node);
+
+static int tarfs_access(struct vnode* node, mode_t mode, struct cred* cred);
+
+static int tarfs_create(struct vnode* parent, const char* name, struct vattr* attr, int type, struct vnode** result, struct cred* cred);
+
+static int tarfs_open(struct vnode** nodep, int flags, struct cred* cred);
+static int tarfs_close(struct vnode* node, int flags, struct cred* cred);
+static int tarfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, int flags, size_t* readc, struct cred* cred);
+
+static int tarfs_getattr(struct vnode* node, struct vattr* attr, struct cred* cred);
+static int tarfs_setattr(struct vnode* node, struct vattr* attr, int which, struct cred* cred);
+static int tarfs_resize(struct vnode* node, size_t size, struct cred* cred);
+static int tarfs_getpage(struct vnode* node, uintmax_t offset, struct page* page);
+static int tarfs_putpage(struct vnode* node, uintmax_t offset, struct page* page);
+
+static int tarfs_lookup(struct vnode* parent, const char* name, struct vnode** result, struct cred* cred);
+static int tarfs_readlink(struct vnode* node, char** link, struct cred* cred);
+static int tarfs_maxseek(struct vnode* node, size_t* max_offset);
+static int tarfs_getdents(struct vnode* node, struct amethyst_dirent *buffer, size_t count, uintmax_t offset, size_t *readcount);
+static int tarfs_inactive(struct vnode* node);
+
+static struct vfsops vfsops = {
+    .mount = tarfs_mount,
+    .unmount = tarfs_unmount,
+    .root = tarfs_root,
+};
+
+static struct vops vops = {
+    .access = tarfs_access,
+    .create = tarfs_create,
+    .open = tarfs_open,
+    .close = tarfs_close,
+    .read = tarfs_read,
+    .getattr = tarfs_getattr,
+    .setattr = tarfs_setattr,
+    .resize = tarfs_resize,
+    .getpage = tarfs_getpage,
+    .putpage = tarfs_putpage,
+    .lookup = tarfs_lookup,
+    .readlink = tarfs_readlink,
+    .getdents = tarfs_getdents,
+    .maxseek = tarfs_maxseek,
+    .inactive = tarfs_inactive,
+};
+
+static struct scache* node_cache;
+
+static uintmax_t id_counter = 0;
+
+void tarfs_init(void) {
+    assert(vfs_register(&vfsops, "tarfs") == 0);
+    node_cache = slab_newcache("tarfs_node", sizeof(struct tarfs_node), 0, nullptr, nullptr);
+    assert(node_cache);
+}
+
+static struct tarfs_node* tarfs_node_new(struct tarfs* fs, enum vtype type) {
+    struct tarfs_node* node = slab_alloc(node_cache);
+    if(!node)
+        return nullptr;
+
+    memset(node, 0, sizeof(struct tarfs_node));
+
+    if(type == V_TYPE_DIR) {
+        if(hashtable_init(&node->children, 32)) {
+            slab_free(node_cache, node);
+            return nullptr;
+        }
+
+        if(hashtable_set(&node->children, node, ".", 1, true)) {
+            hashtable_destroy(&node->children);
+            slab_free(node_cache, node);
+            return nullptr;
+        }
+    }
+
+    node->vattr.type = type;
+    node->vattr.inode = ++fs->inode_num;
+    node->vattr.nlinks = 1;
+    vop_init(&node->vnode, &vops, 0, type, &fs->vfs);
+
+    return node;
+}
+
+static struct tarfs_node* add_child(struct tarfs* fs, struct tarfs_node* dir, const char* name, enum vtype type) {
+    struct tarfs_node* node = tarfs_node_new(fs, type);
+    if(!node)
+        return nullptr;
+
+    struct vnode* vnode = &node->vnode;
+
+    if(type == V_TYPE_DIR && hashtable_set(&node->children, dir, "..", 2, true)) {
+        vop_release(&vnode);
+        return nullptr;
+    }
+
+    if(hashtable_set(&dir->children, node, name, strlen(name), true)) {
+        vop_release(&vnode);
+        return nullptr;
+    }
+
+    return node;
+}
+
+// finds the directory `path` is in, creating missing ones on the way if `create` is set. `path` is
+// cut into components in place and `*name` set to the last one.
+static int walk(struct tarfs* fs, char* path, bool create, struct tarfs_node** parent, char** name) {
+    struct tarfs_node* dir = (struct tarfs_node*) fs->vfs.root;
+
+    char* saveptr;
+    char* component = strtok_r(path, "/", &saveptr);
+    if(!component)
+        return EINVAL;
+
+    char* next;
+    while((next = strtok_r(nullptr, "/", &saveptr))) {
+        if(strcmp(component, "..") == 0)
+            return EINVAL;
+
+        if(strcmp(component, ".") != 0) {
+            struct tarfs_node* child;
+            if(hashtable_get(&dir->children, (void**) &child, component, strlen(component)) == 0) {
+                if(child->vnode.type != V_TYPE_DIR)
+                    return ENOTDIR;
+            }
+            else if(!create)
+                return ENOENT;
+            // archives do not always list directories before their contents
+            else if(!(child = add_child(fs, dir, component, V_TYPE_DIR)))
+                return ENOMEM;
+            else
+                child->vattr.mode = 0755;
+
+            dir = child;
+        }
+
+        component = next;
+    }
+
+    if(strcmp(component, "..") == 0)
+        return EINVAL;
+
+    *parent = dir;
+    *name = component;
+    return 0;
+}
+
+// file contents that start on a page boundary of the image are cached as the image's own frames.
+// A partial last page is copied like any other, the bytes past the end of the file have to read
+// back as zeroes.
+static void share_pages(struct tarfs* fs, struct tarfs_node* node) {
+    if((uintptr_t) node->data % PAGE_SIZE)
+        return;
+
+    for(size_t offset = 0; offset + PAGE_SIZE <= node->vattr.size; offset += PAGE_SIZE) {
+        void* physical = mmu_get_physical(vmm_kernel_context.page_table, (void*) ((uintptr_t) node->data + offset));
+        if(!physical)
+            break;
+
+        struct page* page = pmm_page(physical);
+        if(vmm_cache_insert(&node->vnode, offset, page))
+            break;
+
+        fs->shared_pages++;
+    }
+}
+
+static int add_hardlink(struct tarfs* fs, struct tarfs_node* dir, const char* name, char* target_path) {
+    struct tarfs_node* target_dir;
+    char* target_name;
+    int err = walk(fs, target_path, false, &target_dir, &target_name);
+    if(err)
+        return err;
+
+    struct tarfs_node* target;
+    if(hashtable_get(&target_dir->children, (void**) &target, target_name, strlen(target_name)))
+        return ENOENT;
+
+    if(target->vnode.type == V_TYPE_DIR)
+        return EPERM;
+
+    void* existing;
+    if(hashtable_get(&dir->children, &existing, name, strlen(name)) == 0)
+        return EEXIST;
+
+    if((err = hashtable_set(&dir->children, target, name, strlen(name), true)))
+        return err;
+
+    vop_hold(&target->vnode);
+    target->vattr.nlinks++;
+    return 0;
+}
+
+static int add_entry(struct tarfs* fs, struct tar_entry* entry, const void* data) {
+    char path[sizeof(entry->name)];
+    strcpy(path, (const char*) entry->name);
+
+    struct tarfs_node* dir;
+    char* name;
+    int err = walk(fs, path, true, &dir, &name);
+    if(err)
+        return err;
+
+    enum vtype type;
+    switch(entry->type) {
+        case TAR_FILE:
+            type = V_TYPE_REGULAR;
+            break;
+        case TAR_DIR:
+            type = V_TYPE_DIR;
+            break;
+        case TAR_SYMLINK:
+            type = V_TYPE_LINK;
+            break;
+        case TAR_CHARDEV:
+            type = V_TYPE_CHDEV;
+            break;
+        case TAR_BLOCK:
+            type = V_TYPE_BLKDEV;
+            break;
+        case TAR_HARDLINK:
+            return add_hardlink(fs, dir, name, (char*) entry->link);
+        default:
+            klog(ERROR, "unsupported TAR entry type `%s` (%hu)", tar_entry_type_str(entry->type), entry->type);
+            return ENOTSUP;
+    }
+
+    struct tarfs_node* node = nullptr;
+    size_t name_len = strlen(name);
+
+    if(strcmp(name, ".") == 0) {
+        if(type != V_TYPE_DIR)
+            return EISDIR;
+        node = dir;
+    }
+    else if(hashtable_get(&dir->children, (void**) &node, name, name_len) == 0) {
+        // later entries replace earlier ones of the same name, like extracting the archive would
+        if(node->vnode.type == V_TYPE_DIR) {
+            if(type != V_TYPE_DIR)
+                return EISDIR;
+        }
+        else {
+            struct vnode* old = &node->vnode;
+            hashtable_remove(&dir->children, name, name_len);
+            node->vattr.nlinks--;
+            vop_release(&old);
+            node = nullptr;
+        }
+    }
+
+    if(!node && !(node = add_child(fs, dir, name, type)))
+        return ENOMEM;
+
+    node->vattr.mode = entry->mode;
+    node->vattr.uid = entry->uid;
+    node->vattr.gid = entry->gid;
+    node->vattr.atime = entry->modtime;
+    node->vattr.mtime = entry->modtime;
+    node->vattr.ctime = entry->modtime;
+
+    switch(type) {
+        case V_TYPE_REGULAR:
+            node->data = data;
+            node->vattr.size = entry->size;
+            share_pages(fs, node);
+            break;
+        case V_TYPE_LINK:
+            if(!(node->link = kstrdup((const char*) entry->link)))
+                return ENOMEM;
+            node->vattr.size = strlen(node->link);
+            break;
+        case V_TYPE_CHDEV:
+        case V_TYPE_BLKDEV:
+            node->vattr.rdev_major = entry->devmajor;
+            node->vattr.rdev_minor = entry->devminor;
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static bool image_has(struct tarfs* fs, size_t bytes) {
+    if(bytes > fs->image.size)
+        return false;
+
+    return !fs->image.wait || fs->image.wait(bytes) >= bytes;
+}
+
+// builds the whole tree in one pass over the headers, file contents are left where they are
+static void index_image(struct tarfs* fs) {
+    uint8_t* start = fs->image.address;
+    size_t offset = 0;
+
+    struct tar_entry entry;
+
+    while(image_has(fs, offset + TAR_BLOCKSIZE)) {
+        tar_read_entry(&entry, start + offset);
+
+        if(strncmp((const char*) entry.indicator, "ustar", 5))
+            break;
+
+        const void* data = start + offset + TAR_BLOCKSIZE;
+        offset += TAR_BLOCKSIZE + ROUND_UP(entry.size, TAR_BLOCKSIZE);
+
+        if(!image_has(fs, offset)) {
+            klog(ERROR, "tarfs: `%s` is cut off by the end of the image", entry.name);
+            break;
+        }
+
+        int err = add_entry(fs, &entry, data);
+        if(err)
+            klog(ERROR, "tarfs: failed to add %s: %s (%d)", entry.name, strerror(err), err);
+        else
+            fs->entries++;
+    }
+}
+
+static int tarfs_mount(struct vfs** vfs, struct vnode* mount_point __unused, struct vnode* backing __unused, void* data) {
+    struct tarfs_image* image = data;
+    if(!image || (uintptr_t) image->address % PAGE_SIZE)
+        return EINVAL;
+
+    struct tarfs* fs = kmalloc(sizeof(struct tarfs));
+    if(!fs)
+        return ENOMEM;
+
+    memset(fs, 0, sizeof(struct tarfs));
+    fs->vfs.ops = &vfsops;
+    fs->image = *image;
+    fs->id = __atomic_fetch_add(&id_counter, 1, __ATOMIC_SEQ_CST);
+
+    struct tarfs_node* root = tarfs_node_new(fs, V_TYPE_DIR);
+    if(!root) {
+        kfree(fs);
+        return ENOMEM;
+    }
+
+    root->vattr.mode = 0755;
+    root->vnode.flags |= V_FLAGS_ROOT;
+    fs->vfs.root = &root->vnode;
+
+    index_image(fs);
+
+    klog(INFO, "tarfs: %zu entries in %zu bytes, %zu pages shared with the image", fs->entries, fs->image.size, fs->shared_pages);
+
+    *vfs = &fs->vfs;
+    return 0;
+}
+
+static int tarfs_unmount(struct vfs* vfs __unused) {
+    // the image backs cached pages, which may still be mapped anywhere
+    return EBUSY;
+}
+
+static int tarfs_root(struct vfs* vfs, struct vnode** node) {
+    *node = vfs->root;
+    return 0;
+}
+
+static int tarfs_access(struct vnode* node __unused, mode_t mode __unused, struct cred* cred __unused) {
+    return 0;
+}
+
+static int tarfs_create(struct vnode* parent __unused, const char* name __unused, struct vattr* attr __unused, int type __unused, struct vnode** result __unused, struct cred* cred __unused) {
+    return EROFS;
+}
+
+static int tarfs_open(struct vnode** nodep, int flags, struct cred* cred __unused) {
+    struct vnode* node = *nodep;
+    struct tarfs_node* tarnode = (struct tarfs_node*) node;
+
+    if(node->type == V_TYPE_CHDEV || node->type == V_TYPE_BLKDEV) {
+        struct vnode* devnode;
+        int err = devfs_getnode(node, tarnode->vattr.rdev_major, tarnode->vattr.rdev_minor, &devnode);
+        if(err)
+            return err;
+
+        vop_release(&node);
+        vop_hold(devnode);
+        *nodep = devnode;
+        return 0;
+    }
+
+    return flags & V_FFLAGS_WRITE ? EROFS : 0;
+}
+
+static int tarfs_close(struct vnode* node __unused, int flags __unused, struct cred* cred __unused) {
+    return 0;
+}
+
+// copies straight from the image without going through the page cache, for kernel buffers only
+static int tarfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, int flags __unused, size_t* readc, struct cred* cred __unused) {
+    struct tarfs_node* tarnode = (struct tarfs_node*) node;
+    if(node->type == V_TYPE_DIR)
+        return EISDIR;
+    if(node->type != V_TYPE_REGULAR)
+        return EINVAL;
+
+    *readc = 0;
+    if(offset >= tarnode->vattr.size)
+        return 0;
+
+    *readc = MIN(size, tarnode->vattr.size - offset);
+    memcpy(buffer, (const uint8_t*) tarnode->data + offset, *readc);
+    return 0;
+}
+
+static int tarfs_getattr(struct vnode* node, struct vattr* attr, struct cred* cred __unused) {
+    struct tarfs_node* tarnode = (struct tarfs_node*) node;
+    *attr = tarnode->vattr;
+    attr->blocks_used = ROUND_UP(attr->size, PAGE_SIZE) / PAGE_SIZE;
+    attr->dev_major = 0;
+    attr->dev_minor = ((struct tarfs*) node->vfs)->id;
+    return 0;
+}
+
+static int tarfs_setattr(struct vnode* node __unused, struct vattr* attr __unused, int which __unused, struct cred* cred __unused) {
+    return EROFS;
+}
+
+static int tarfs_resize(struct vnode* node __unused, size_t size __unused, struct cred* cred __unused) {
+    return EROFS;
+}
+
+static int tarfs_getpage(struct vnode* node, uintmax_t offset, struct page* page) {
+    struct tarfs_node* tarnode = (struct tarfs_node*) node;
+    if(offset >= tarnode->vattr.size)
+        return ENXIO;
+
+    // pages shared with the image never get here, they are cached from the start
+    memcpy(MAKE_HHDM(page_get_physical(page)), (const uint8_t*) tarnode->data + offset, MIN(PAGE_SIZE, tarnode->vattr.size - offset));
+    return 0;
+}
+
+static int tarfs_putpage(struct vnode* node __unused, uintmax_t offset __unused, struct page* page __unused) {
+    // nothing in a tarfs is ever written to
+    return 0;
+}
+
+static int tarfs_lookup(struct vnode* parent, const char* name, struct vnode** result, struct cred* cred __unused) {
+    if(parent->type != V_TYPE_DIR)
+        return ENOTDIR;
+
+    // the tree does not change after mounting, so there is nothing to lock
+    struct tarfs_node* tarparent = (struct tarfs_node*) parent;
+    struct vnode* child;
+    int err = hashtable_get(&tarparent->children, (void**) &child, name, strlen(name));
+    if(err)
+        return err;
+
+    vop_hold(child);
+    *result = child;
+    return 0;
+}
+
+static int tarfs_readlink(struct vnode* node, char** link, struct cred* cred __unused) {
+    if(node->type != V_TYPE_LINK)
+        return EINVAL;
+
+    *link = kstrdup(((struct tarfs_node*) node)->link);
+    return *link ? 0 : ENOMEM;
+}
+
+static int tarfs_maxseek(struct vnode* node, size_t* max_offset) {
+    *max_offset = ((struct tarfs_node*) node)->vattr.size;
+    return 0;
+}
+
+static int tarfs_getdents(struct vnode* vnode, struct amethyst_dirent *buffer, size_t count, uintmax_t offset, size_t *ents_read) {
+    if(vnode->type != V_TYPE_DIR)
+        return ENOTDIR;
+
+    struct tarfs_node* node = (struct tarfs_node*) vnode;
+    size_t current = 0;
+    *ents_read = 0;
+
+    HASHTABLE_FOREACH(&node->children, entry) {
+        if(current < offset) {
+            current++;
+            continue;
+        }
+
+        if(*ents_read >= count)
+            break;
+
+        struct tarfs_node* entry_node = entry->value;
+        struct amethyst_dirent* dent = buffer + *ents_read;
+        size_t name_len = MIN(entry->keysize, sizeof(dent->d_name) - 1);
+        dent->d_ino = entry_node->vattr.inode;
+        dent->d_off = offset + *ents_read;
+        dent->d_reclen = sizeof(struct amethyst_dirent);
+        dent->d_type = vfs_posix_type(entry_node->vnode.type);
+        memcpy(dent->d_name, entry->key, name_len);
+        dent->d_name[name_len] = '\0';
+
+        (*ents_read)++;
+    }
+
+    return 0;
+}
+
+static int tarfs_inactive(struct vnode* node) {
+    struct tarfs_node* tarnode = (struct tarfs_node*) node;
+
+    switch(node->type) {
+        case V_TYPE_DIR:
+            hashtable_destroy(&tarnode->children);
+            break;
+        case V_TYPE_LINK:
+            kfree(tarnode->link);
+            break;
+        default:
+            break;
+    }
+
+    slab_free(node_cache, tarnode);
+    return 0;
+}
@@ -37,6 +37,7 @@ static int tmpfs_mmap(struct vnode *node, void *addr, uintmax_t offset, int flag
 static int tmpfs_lookup(struct vnode* parent, const char* name, struct vnode** result, struct cred* cred);
 static int tmpfs_maxseek(struct vnode* node, size_t* max_offset);
 static int tmpfs_getdents(struct vnode* node, struct amethyst_dirent *buffer, size_t count, uintmax_t offset, size_t *readcount);
+static int tmpfs_inactive(struct vnode* node);
 
 static struct vfsops vfsops = {
     .mount = tmpfs_mount,
@@ -58,6 +59,7 @@ static struct vops vops = {
     .mmap = tmpfs_mmap,
     .getdents = tmpfs_getdents,
     .maxseek = tmpfs_maxseek,
+    .inactive = tmpfs_inactive,
 };
 
 static struct scache* node_cache;
@@ -66,7 +68,7 @@ static uintmax_t id_counter = 0;
 
 void tmpfs_init(void) {
     assert(vfs_register(&vfsops, "tmpfs") == 0);
-    node_cache = slab_newcache(sizeof(struct tmpfs_node), 0, nullptr, nullptr);
+    node_cache = slab_newcache("tmpfs_node", sizeof(struct tmpfs_node), 0, nullptr, nullptr);
     assert(node_cache);
 } 
 
@@ -100,7 +102,7 @@ static struct tmpfs_node* tmpfs_node_new(struct vfs* vfs, enum vtype type) {
     return node;
 }
 
-static int tmpfs_mount(struct vfs** vfs, struct vnode* mount_point __unused, struct vnode* backing __unused, void* data __unused) {
+static int tmpfs_mount(struct vfs** vfs, struct vnode* mount_point, struct vnode* backing __unused, void* data) {
     struct tmpfs* fs = kmalloc(sizeof(struct tmpfs));
     if(!fs)
         return ENOMEM;
@@ -108,6 +110,12 @@ static int tmpfs_mount(struct vfs** vfs, struct vnode* mount_point __unused, str
     *vfs = (struct vfs*) fs;
     fs->vfs.ops = &vfsops;
     fs->id = __atomic_fetch_add(&id_counter, 1, __ATOMIC_SEQ_CST);
+    fs->lower = nullptr;
+
+    if(data && strcmp(data, TMPFS_MOUNT_OVERLAY) == 0) {
+        vop_hold(mount_point);
+        fs->lower = mount_point;
+    }
 
     return 0;
 };
@@ -141,6 +149,106 @@ static int tmpfs_root(struct vfs* vfs, struct vnode** node) {
 
     tmpnode->vnode.flags |= V_FLAGS_ROOT;
 
+    // the overlaid directory's reference goes to the root
+    tmpnode->lower = ((struct tmpfs*) vfs)->lower;
+    ((struct tmpfs*) vfs)->lower = nullptr;
+
+    return 0;
+}
+
+static int copy_up_entry(struct tmpfs_node* dir, const char* name, struct vnode* lower) {
+    struct vattr attr;
+    int err = vop_getattr(lower, &attr, &kernel_cred);
+    if(err)
+        return err;
+
+    struct tmpfs_node* tmpnode = tmpfs_node_new(dir->vnode.vfs, lower->type);
+    if(!tmpnode)
+        return errno;
+
+    struct vnode* node = (struct vnode*) tmpnode;
+
+    ino_t inode = tmpnode->vattr.inode;
+    tmpnode->vattr = attr;
+    tmpnode->vattr.type = lower->type;
+    tmpnode->vattr.inode = inode;
+    tmpnode->vattr.nlinks = 1;
+
+    switch(lower->type) {
+        case V_TYPE_DIR:
+            tmpnode->vattr.size = 0;
+            if((err = hashtable_set(&tmpnode->children, dir, "..", 2, true)))
+                break;
+
+            vop_hold(lower);
+            tmpnode->lower = lower;
+            break;
+        case V_TYPE_REGULAR:
+            vop_hold(lower);
+            tmpnode->lower = lower;
+            tmpnode->lower_size = attr.size;
+            break;
+        case V_TYPE_LINK:
+            err = lower->ops->readlink ? lower->ops->readlink(lower, &tmpnode->link, &kernel_cred) : ENOTSUP;
+            break;
+        default:
+            // devices are described by their attributes alone
+            break;
+    }
+
+    if(!err)
+        err = hashtable_set(&dir->children, tmpnode, name, strlen(name), true);
+
+    if(err) {
+        vop_release(&node);
+        return err;
+    }
+
+    if(lower->type == V_TYPE_DIR)
+        vop_hold(&dir->vnode);
+
+    return 0;
+}
+
+// overlay: copies the entries of the lower directory up, `dir` has to be locked. What they hold is
+// only read from the lower filesystem once it is needed.
+static int copy_up(struct tmpfs_node* dir) {
+    struct vnode* lower = dir->lower;
+    if(!lower)
+        return 0;
+
+    struct amethyst_dirent* dent = kmalloc(sizeof(struct amethyst_dirent));
+    if(!dent)
+        return ENOMEM;
+
+    int err;
+    size_t count;
+    for(uintmax_t offset = 0; !(err = vop_getdents(lower, dent, 1, offset, &count)) && count; offset++) {
+        if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        // left over from an earlier attempt that ran out of memory
+        void* existing;
+        if(hashtable_get(&dir->children, &existing, dent->d_name, strlen(dent->d_name)) == 0)
+            continue;
+
+        struct vnode* child;
+        if((err = vop_lookup(lower, dent->d_name, &child, &kernel_cred)))
+            break;
+
+        err = copy_up_entry(dir, dent->d_name, child);
+        vop_release(&child);
+        if(err)
+            break;
+    }
+
+    kfree(dent);
+
+    if(err)
+        return err;
+
+    dir->lower = nullptr;
+    vop_release(&lower);
     return 0;
 }
 
@@ -154,6 +262,13 @@ static int tmpfs_create(struct vnode* parent, const char* name, struct vattr* at
     void* v;
 
     vop_lock(parent);
+
+    int err = copy_up(parent_tmpnode);
+    if(err) {
+        vop_unlock(parent);
+        return err;
+    }
+
     if(hashtable_get(&parent_tmpnode->children, &v, name, name_len) == 0) {
         vop_unlock(parent);
         return EEXIST;
@@ -177,7 +292,7 @@ static int tmpfs_create(struct vnode* parent, const char* name, struct vattr* at
     tmpattr.size = 0;
     tmpattr.type = type;
 
-    int err = tmpfs_setattr(node, &tmpattr, V_ATTR_ALL, cred);
+    err = tmpfs_setattr(node, &tmpattr, V_ATTR_ALL, cred);
     tmpnode->vattr.nlinks = 1;
 
     if(err) {
@@ -280,6 +395,14 @@ static int tmpfs_resize(struct vnode* node, size_t size, struct cred* cred __unu
         if(tmpnode->vattr.size > size)
             vmm_cache_truncate(node, size);
 
+        // the cut off part must not show through again once the file grows
+        tmpnode->lower_size = MIN(tmpnode->lower_size, size);
+        if(tmpnode->lower && !tmpnode->lower_size) {
+            struct vnode* lower = tmpnode->lower;
+            tmpnode->lower = nullptr;
+            vop_release(&lower);
+        }
+
         tmpnode->vattr.size = size;
     }
 
@@ -295,25 +418,41 @@ static int tmpfs_getpage(struct vnode* node, uintmax_t offset, struct page* page
     if(offset >= tmpnode->vattr.size)
         err = ENXIO;
 
+    struct vnode* lower = offset < tmpnode->lower_size ? tmpnode->lower : nullptr;
+    size_t lower_size = tmpnode->lower_size;
+    if(lower)
+        vop_hold(lower);
+
     vop_unlock(node);
+
+    // the page cache hands out zeroed pages, which is all a new tmpfs page holds unless it is
+    // copied up from an overlaid file
+    if(!err && lower) {
+        void* buffer = MAKE_HHDM(page_get_physical(page));
+        size_t count = MIN(PAGE_SIZE, lower_size - offset);
+        size_t readc;
+
+        // lower filesystems that can read around their page cache spare it a second copy
+        if(lower->ops->read)
+            err = vop_read(lower, buffer, count, offset, 0, &readc, &kernel_cred);
+        else
+            err = vfs_read(lower, buffer, count, offset, &readc, 0, nullptr);
+    }
+
+    if(lower)
+        vop_release(&lower);
+
     if(err)
         return err;
 
-    void* phy = page_get_physical(page);
-    void* phy_hhdm = MAKE_HHDM(phy);
-
     page_hold(page);
     page->flags |= PAGE_FLAGS_PINNED;
-    memset(phy_hhdm, 0, PAGE_SIZE);
 
     return 0;
 }
 
-static int tmpfs_putpage(struct vnode* node, uintmax_t offset, struct page* page) {
-    (void) node;
-    (void) offset;
-    (void) page;
-    unimplemented();
+static int tmpfs_putpage(struct vnode* node __unused, uintmax_t offset __unused, struct page* page __unused) {
+    // the pinned cache pages are tmpfs' storage, there is nowhere else to write them to
     return 0;
 }
 
@@ -334,7 +473,9 @@ static int tmpfs_lookup(struct vnode* parent, const char* name, struct vnode** r
         return ENOTDIR;
 
     vop_lock(parent);
-    int err = hashtable_get(&tmpparent->children, (void**) &child, name, strlen(name));
+    int err = copy_up(tmpparent);
+    if(!err)
+        err = hashtable_get(&tmpparent->children, (void**) &child, name, strlen(name));
     if(err) {
         vop_unlock(parent);
         return err;
@@ -370,6 +511,12 @@ static int tmpfs_getdents(struct vnode* vnode, struct amethyst_dirent *buffer, s
     size_t current = 0;
     *ents_read = 0;
 
+    vop_lock(vnode);
+    int err = copy_up(node);
+    vop_unlock(vnode);
+    if(err)
+        return err;
+
     HASHTABLE_FOREACH(&node->children, entry) {
         if(current < offset) {
             current++;
@@ -381,14 +528,37 @@ static int tmpfs_getdents(struct vnode* vnode, struct amethyst_dirent *buffer, s
 
         struct tmpfs_node* entry_node = entry->value;
         struct amethyst_dirent* dent = buffer + *ents_read;
+        size_t name_len = MIN(entry->keysize, sizeof(dent->d_name) - 1);
         dent->d_ino = entry_node->vattr.inode;
         dent->d_off = offset + *ents_read;
         dent->d_reclen = sizeof(struct amethyst_dirent);
         dent->d_type = vfs_posix_type(entry_node->vnode.type);
-        memcpy(dent->d_name, entry->key, MIN(entry->keysize, sizeof(dent->d_name)));
+        memcpy(dent->d_name, entry->key, name_len);
+        dent->d_name[name_len] = '\0';
 
         (*ents_read)++;
     }
 
     return 0;
 }
+
+static int tmpfs_inactive(struct vnode* node) {
+    struct tmpfs_node* tmpnode = (struct tmpfs_node*) node;
+
+    if(tmpnode->lower)
+        vop_release(&tmpnode->lower);
+
+    switch(node->type) {
+        case V_TYPE_DIR:
+            hashtable_destroy(&tmpnode->children);
+            break;
+        case V_TYPE_LINK:
+            kfree(tmpnode->link);
+            break;
+        default:
+            break;
+    }
+
+    slab_free(node_cache, tmpnode);
+    return 0;
+}
@@ -1,14 +1,18 @@
 #include <filesystem/vfs.h>
+#include <filesystem/dcache.h>
+#include <filesystem/readahead.h>
 
 #include <cpu/cpu.h>
 #include <mem/heap.h>
 #include <mem/vmm.h>
 #include <mem/page.h>
+#include <mem/user.h>
 #include <sys/spinlock.h>
 #include <sys/mutex.h>
 #include <sys/semaphore.h>
 #include <sys/thread.h>
 #include <sys/proc.h>
+#include <sys/timekeeper.h>
 
 #include <kernelio.h>
 #include <assert.h>
@@ -21,12 +25,13 @@
 
 struct vnode* vfs_root = nullptr;
 
-spinlock_t list_lock;
+// mount list, a mutex as sync() calls into the filesystems while walking it
+mutex_t list_lock;
 struct vfs* vfs_list;
 
 static hashtable_t fs_table;
 
-static struct cred kernel_cred = {
+struct cred kernel_cred = {
     .gid = 0,
     .uid = 0
 };
@@ -39,7 +44,9 @@ void vfs_init(void) {
     vfs_root = kmalloc(sizeof(struct vnode));
     assert(vfs_root);
 
-    spinlock_init(list_lock);
+    mutex_init(&list_lock);
+
+    dcache_init();
 
     vfs_root->type = V_TYPE_DIR;
     vfs_root->refcount = 1;
@@ -79,6 +86,13 @@ void vfs_inactive(struct vnode *node) {
     if(node->socketbinding)
         unimplemented();
 //        localsock_leavebinding(vnode);
+
+    // the pages would otherwise point to a freed vnode
+    if(node->type == V_TYPE_REGULAR || node->type == V_TYPE_BLKDEV)
+        vmm_cache_forget(node);
+    // as do names cached below a directory
+    else if(node->type == V_TYPE_DIR)
+        dcache_purge(node);
     node->ops->inactive(node);
 }
 
@@ -133,10 +147,7 @@ int vfs_lookup(struct vnode** dest, struct vnode* src, const char* path, char* l
     if(err)
         return err;
 
-    char* comp_buffer = kmalloc(path_len + 1);
-    if(!comp_buffer)
-        return ENOMEM;
-
+    char comp_buffer[MAX_PATH_NAME + 1];
     strcpy(comp_buffer, path);
 
     for(size_t i = 0; i < path_len; i++) {
@@ -193,7 +204,7 @@ int vfs_lookup(struct vnode** dest, struct vnode* src, const char* path, char* l
             }
         }
 
-        err = vop_lookup(current, component, &next, get_cred());
+        err = dcache_lookup(current, component, &next, get_cred());
         if(err)
             break;
 
@@ -225,46 +236,132 @@ int vfs_lookup(struct vnode** dest, struct vnode* src, const char* path, char* l
     else
         *dest = current;
 
-    kfree(comp_buffer);
     return err;
 }
 
-int vfs_realpath(struct vnode* node, char** dest_path, size_t* dest_size, enum vfs_lookup_flags flags) {
-    struct vnode *current;
-    int err = highest_node_in_mp(node, &current);
+// finds the directory containing `node` and the name it has there. Tries the dentry cache first,
+// otherwise looks up ".." and searches it, which leaves the answer in the cache for next time.
+static int name_in_parent(struct vnode* node, struct vnode** parent, char* name, size_t size) {
+    if(dcache_reverse(node, parent, name, size) == 0)
+        return 0;
+
+    if(node->type != V_TYPE_DIR)
+        return ENOENT;
+
+    struct vnode* dir;
+    int err = vop_lookup(node, "..", &dir, get_cred());
     if(err)
         return err;
 
+    struct amethyst_dirent* dirent = kmalloc(sizeof(struct amethyst_dirent));
+    if(!dirent) {
+        vop_release(&dir);
+        return ENOMEM;
+    }
+
+    err = ENOENT;
+
+    for(uintmax_t offset = 0;; offset++) {
+        size_t count;
+        if(vop_getdents(dir, dirent, 1, offset, &count) || !count)
+            break;
+
+        if(strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+            continue;
+
+        struct vnode* child;
+        if(dcache_lookup(dir, dirent->d_name, &child, get_cred()))
+            continue;
+
+        bool found = child == node;
+        vop_release(&child);
+
+        if(found) {
+            if(strlen(dirent->d_name) >= size)
+                err = ENAMETOOLONG;
+            else {
+                strcpy(name, dirent->d_name);
+                err = 0;
+            }
+            break;
+        }
+    }
+
+    kfree(dirent);
+
+    if(err)
+        vop_release(&dir);
+    else
+        *parent = dir;
+
+    return err;
+}
+
+int vfs_realpath(struct vnode* node, char** dest_path, size_t* dest_size, enum vfs_lookup_flags flags __unused) {
+    // TODO: dereference symlinks unless VFS_LOOKUP_NOLINK is given
+    struct vnode* root;
+    int err = highest_node_in_mp(vfs_root, &root);
+    if(err)
+        return err;
+
+    struct vnode* current;
+    if((err = highest_node_in_mp(node, &current)))
+        return err;
+
+    char* path = kmalloc(MAX_PATH_NAME + 1);
+    if(!path)
+        return ENOMEM;
+
+    // the path is built from its end
+    size_t start = MAX_PATH_NAME;
+    path[start] = '\0';
+
+    char name[MAX_PATH_NAME + 1];
     vop_hold(current);
 
-    // check if we are in root
-    if(current == node) {
-        *dest_size += 1;
-        *dest_path = kmalloc(*dest_size * sizeof(char));
-        *dest_path[0] = PATH_SEPARATOR;
-        *dest_path[1] = '\0';
+    while(current != root && current != vfs_root) {
+        // the root of a mounted filesystem is named by the directory it covers
+        if(current->flags & V_FLAGS_ROOT) {
+            struct vnode* covered = lowest_node_in_mp(current);
+            if(covered != current) {
+                vop_hold(covered);
+                vop_release(&current);
+                current = covered;
+                continue;
+            }
+        }
+
+        struct vnode* parent;
+        if((err = name_in_parent(current, &parent, name, sizeof(name))))
+            break;
 
         vop_release(&current);
-        return 0;
-    }
+        current = parent;
 
-    // if the root is of a mounted fs, go to it
-    if(current->flags & V_FLAGS_ROOT) {
-        struct vnode* next = lowest_node_in_mp(current);
-        if(next != current) {
-            vop_hold(next);
-            vop_release(&current);
-            current = next;
+        size_t len = strlen(name);
+        if(len + 1 > start) {
+            err = ENAMETOOLONG;
+            break;
         }
-    }
 
-    if(current->type == V_TYPE_LINK && (flags & VFS_LOOKUP_NOLINK) == 0) {
-        // TODO: dereference symlinks
-        unimplemented();
+        start -= len;
+        memcpy(path + start, name, len);
+        path[--start] = PATH_SEPARATOR;
     }
 
-    unimplemented();
     vop_release(&current);
+
+    if(err) {
+        kfree(path);
+        return err;
+    }
+
+    if(start == MAX_PATH_NAME)
+        path[--start] = PATH_SEPARATOR;
+
+    *dest_size = MAX_PATH_NAME + 1 - start;
+    memmove(path, path + start, *dest_size);
+    *dest_path = path;
     return 0;
 }
 
@@ -277,6 +374,9 @@ int vfs_create(struct vnode* ref, const char* path, struct vattr* attr, enum vty
 
     struct vnode* ret;
     err = vop_create(parent, component, attr, type, &ret, get_cred());
+    if(!err)
+        dcache_invalidate(parent, component);
+
     vop_release(&parent);
     if(err)
         goto cleanup;
@@ -291,6 +391,56 @@ cleanup:
     return err;
 }
 
+// pages pinned at a time by direct I/O
+#define DIRECT_BATCH_PAGES 16
+
+// direct I/O moves whole pages between the caller's frames and a filesystem that can read into and
+// write from frames outside the page cache; anything else goes through the cache
+static bool direct_possible(struct vnode* node, void* buffer, size_t size, uintmax_t offset) {
+    return (node->flags & V_FLAGS_DIRECTIO) && node->type == V_TYPE_REGULAR && is_userspace_addr(buffer)
+        && (uintptr_t) buffer % PAGE_SIZE == 0 && size % PAGE_SIZE == 0 && offset % PAGE_SIZE == 0;
+}
+
+// transfers `size` bytes at `offset` between the file and `buffer` without copying. Returns ENOTSUP
+// once a part of the buffer cannot be pinned, `*done` tells how far it got.
+static int direct_io(struct vnode* node, void* buffer, size_t size, uintmax_t offset, bool write, size_t* done) {
+    struct page* pages[DIRECT_BATCH_PAGES];
+    *done = 0;
+
+    // dirty cached pages would otherwise be read stale or later overwrite what is written here
+    int err = vmm_cache_sync_range(node, offset, size);
+    if(err)
+        return err;
+
+    size_t total = ROUND_UP(size, PAGE_SIZE) / PAGE_SIZE;
+
+    for(size_t first = 0; first < total && !err; first += DIRECT_BATCH_PAGES) {
+        size_t count = MIN(total - first, DIRECT_BATCH_PAGES);
+
+        // reading the file writes to the buffer
+        if((err = user_pin_pages((void*) ((uintptr_t) buffer + first * PAGE_SIZE), count, !write, pages)))
+            break;
+
+        for(size_t i = 0; i < count && !err; i++) {
+            uintmax_t page_offset = offset + (first + i) * PAGE_SIZE;
+
+            if(write) {
+                if(!(err = vop_putpage(node, page_offset, pages[i])))
+                    vmm_cache_overwrite(node, page_offset, pages[i]);
+            }
+            else
+                err = vop_getpage(node, page_offset, pages[i]);
+
+            if(!err)
+                *done += MIN(PAGE_SIZE, size - *done);
+        }
+
+        user_unpin_pages(pages, count);
+    }
+
+    return err;
+}
+
 int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* written, int flags) {
     if(node->type != V_TYPE_REGULAR && node->type != V_TYPE_BLKDEV) {
         // when `node` is a speical file, don't buffer
@@ -309,6 +459,7 @@ int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, s
     mutex_acquire(&node->size_lock);
     
     int err = 0;
+    size_t direct = 0;
     struct vattr attr;
     if((err = vop_getattr(node, &attr, get_cred())))
         goto leave;
@@ -324,6 +475,25 @@ int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, s
         unimplemented();
     }
 
+    if((flags & V_FFLAGS_NOCACHE) && direct_possible(node, buffer, size, offset)) {
+        err = direct_io(node, buffer, size, offset, true, &direct);
+
+        if(direct) {
+            struct vattr mtime;
+            mtime.mtime = timekeeper_time();
+            vop_setattr(node, &mtime, V_ATTR_MTIME, nullptr);
+        }
+
+        if(err != ENOTSUP)
+            goto leave;
+
+        // the rest of the buffer could not be pinned, it goes through the cache
+        err = 0;
+        buffer = (void*) ((uintptr_t) buffer + direct);
+        offset += direct;
+        size -= direct;
+    }
+
     uintptr_t page_offset, page_count, start_offset;
     bytes_to_pages(offset, size, &page_offset, &page_count, &start_offset);
     
@@ -344,9 +514,6 @@ int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, s
         page_offset += 1;
         page_count -= 1;
 
-        if(flags & V_FFLAGS_NOCACHE)
-            unimplemented();
-        
         page_release(page);
     }
     
@@ -361,23 +528,22 @@ int vfs_write(struct vnode* node, void* buffer, size_t size, uintmax_t offset, s
         vmm_cache_make_dirty(page);
         *written += write_size;
 
-        if(flags & V_FFLAGS_NOCACHE)
-            unimplemented();
-
         page_release(page);
     }
 
 leave:
+    *written += direct;
     mutex_release(&node->size_lock);
     return err;
 }
 
-int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* bytes_read, int flags) {
+int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, size_t* bytes_read, int flags, struct readahead* ra) {
     if(node->type != V_TYPE_REGULAR && node->type != V_TYPE_BLKDEV)
         // special file
         return vop_read(node, buffer, size, offset, flags, bytes_read, get_cred());
 
     int err = 0;
+    size_t hits = 0, misses = 0, direct = 0;
     
     *bytes_read = 0;
     if(!size)
@@ -402,17 +568,39 @@ int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, si
     if(offset >= node_size)
         goto leave;
 
+    // the alignment is checked before clipping: the last page is transferred whole
+    if((flags & V_FFLAGS_NOCACHE) && direct_possible(node, buffer, size, offset)) {
+        size = MIN(offset + size, node_size) - offset;
+        err = direct_io(node, buffer, size, offset, false, &direct);
+        if(err != ENOTSUP)
+            goto leave;
+
+        err = 0;
+        buffer = (void*) ((uintptr_t) buffer + direct);
+        offset += direct;
+        size -= direct;
+        if(!size)
+            goto leave;
+    }
+
     size = MIN(offset + size, node_size) - offset;
 
+    // queue the pages following this read before waiting for its own
+    if(ra && !(flags & V_FFLAGS_NOCACHE))
+        readahead_update(ra, node, offset, size, node_size);
+
     uintmax_t page_offset, page_count, start_offset;
     bytes_to_pages(offset, size, &page_offset, &page_count, &start_offset);
     struct page* page = nullptr;
+    bool cached;
 
     if(start_offset) {
         // unaligned first page
-        if((err = vmm_cache_get_page(node, page_offset * PAGE_SIZE, &page)))
+        if((err = vmm_cache_read_page(node, page_offset * PAGE_SIZE, &page, &cached)))
             goto leave;
 
+        cached ? hits++ : misses++;
+
         size_t read_size = MIN(PAGE_SIZE - start_offset, size);
         void* address = MAKE_HHDM(page_get_physical(page));
 
@@ -421,34 +609,28 @@ int vfs_read(struct vnode* node, void* buffer, size_t size, uintmax_t offset, si
         page_offset++;
         page_count--;
 
-        if(flags & V_FFLAGS_NOCACHE) {
-            // remove page from vmm cache
-            unimplemented();
-        }
-
         page_release(page);
     }
 
     for(uintmax_t offset = 0; offset < page_count * PAGE_SIZE; offset += PAGE_SIZE) {
         // remaining pages
-        if((err = vmm_cache_get_page(node, page_offset * PAGE_SIZE + offset, &page)))
+        if((err = vmm_cache_read_page(node, page_offset * PAGE_SIZE + offset, &page, &cached)))
             goto leave;
 
+        cached ? hits++ : misses++;
+
         size_t read_size = MIN(PAGE_SIZE, size - *bytes_read);
         void* address = MAKE_HHDM(page_get_physical(page));
 
         memcpy((void*)((uintptr_t) buffer + *bytes_read), address, read_size);
         *bytes_read += read_size;
 
-        if(flags & V_FFLAGS_NOCACHE) {
-            // remove page from vmm cache
-            unimplemented();
-        }
-
         page_release(page);
     }
 
 leave:
+    *bytes_read += direct;
+    readahead_account(hits, misses);
     mutex_release(&node->size_lock);
     return err;
 }
@@ -457,6 +639,36 @@ int vfs_getdents(struct vnode* node, struct amethyst_dirent *buffer, size_t coun
     return vop_getdents(node, buffer, count, offset, readcount);
 }
 
+int vfs_fsync(struct vnode* node, bool data_only) {
+    int err = 0;
+
+    if(node->type == V_TYPE_REGULAR || node->type == V_TYPE_BLKDEV)
+        err = vmm_cache_sync(node);
+
+    if(!err && !data_only)
+        err = vop_sync(node);
+
+    return err;
+}
+
+int vfs_sync(void) {
+    int err = vmm_cache_sync_all(nullptr);
+
+    mutex_acquire(&list_lock);
+
+    for(struct vfs* vfs = vfs_list; vfs; vfs = vfs->next) {
+        if(!vfs->ops->sync)
+            continue;
+
+        int vfs_err = vfs->ops->sync(vfs);
+        if(vfs_err)
+            err = vfs_err;
+    }
+
+    mutex_release(&list_lock);
+    return err;
+}
+
 int vfs_mount(struct vnode* backing, struct vnode* path_ref, const char* path, const char* fs_name, void* data) {
     struct vfsops* ops;
     int err = hashtable_get(&fs_table, (void**) &ops, fs_name, strlen(fs_name));
@@ -480,7 +692,7 @@ int vfs_mount(struct vnode* backing, struct vnode* path_ref, const char* path, c
         return err;
     }
 
-    spinlock_acquire(&list_lock);
+    mutex_acquire(&list_lock);
 
     vfs->next = vfs_list;
     if(vfs->next)
@@ -488,7 +700,7 @@ int vfs_mount(struct vnode* backing, struct vnode* path_ref, const char* path, c
     vfs->prev = nullptr;
     vfs_list = vfs;
 
-    spinlock_release(&list_lock);
+    mutex_release(&list_lock);
 
     mount_point->vfsmounted = vfs;
     vfs->node_covered = mount_point;
@@ -516,21 +728,30 @@ int vfs_umount(struct vnode* path_ref, const char* path) {
     if(mount_fs_root != cover_dir) // cover_dir is not mount point
         return EINVAL;
 
+    // nothing may be left for the writeback thread once the filesystem is gone, and the cached
+    // names hold its vnodes
+    if((err = vmm_cache_sync_all(vfs)))
+        return err;
+
+    dcache_purge_vfs(vfs);
+
     err = vfs->ops->unmount(vfs);
     if(err)
         return err;
 
-    spinlock_acquire(&list_lock);
+    mutex_acquire(&list_lock);
 
     if(vfs->next)
         vfs->next->prev = vfs->prev;
     if(vfs->prev)
         vfs->prev->next = vfs->next;
+    else
+        vfs_list = vfs->next;
 
     vfs->prev = nullptr;
     vfs->next = nullptr;
 
-    spinlock_release(&list_lock);
+    mutex_release(&list_lock);
 
     mount_point->vfsmounted = nullptr;
     vfs->node_covered = nullptr;
@@ -563,6 +784,11 @@ int vfs_link(struct vnode* dest_ref, const char* dest_path, struct vnode* link_r
     else
         err = vop_symlink(parent, component, attr, dest_path, get_cred());
 
+    if(!err)
+        dcache_invalidate(parent, component);
+
+    vop_release(&parent);
+
 cleanup:
     kfree(component);
     return err;
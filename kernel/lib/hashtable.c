@@ -26,7 +26,7 @@ static struct hashentry* get_entry(hashtable_t *table, const void *key, size_t k
 
 int hashtable_init(hashtable_t *table, size_t size) {
     if(!hash_entry_cache) {
-        hash_entry_cache = slab_newcache(sizeof(struct hashentry), 0, nullptr, nullptr);
+        hash_entry_cache = slab_newcache("hashentry", sizeof(struct hashentry), 0, nullptr, nullptr);
         if(!hash_entry_cache)
             return ENOMEM;
     }
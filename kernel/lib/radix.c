@@ -0,0 +1,234 @@
+#include <radix.h>
+#include <cdefs.h>
+
+#include <mem/slab.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+static struct scache* node_cache = nullptr;
+
+static struct radix_node* new_node(struct radix_node* parent, unsigned shift, unsigned offset) {
+    if(!node_cache) {
+        node_cache = slab_newcache("radix_node", sizeof(struct radix_node), 0, nullptr, nullptr);
+        if(!node_cache)
+            return nullptr;
+    }
+
+    struct radix_node* node = slab_alloc(node_cache);
+    if(!node)
+        return nullptr;
+
+    memset(node, 0, sizeof(struct radix_node));
+    node->parent = parent;
+    node->shift = shift;
+    node->offset = offset;
+    return node;
+}
+
+static __always_inline unsigned slot_of(struct radix_node* node, uintmax_t index) {
+    return (index >> node->shift) & (RADIX_SLOTS - 1);
+}
+
+static __always_inline uintmax_t max_index(struct radix_node* node) {
+    return ((uintmax_t) 1 << (node->shift + RADIX_SHIFT)) - 1;
+}
+
+// node holding the item slot of `index`, nullptr if the path does not exist
+static struct radix_node* find_leaf(struct radix_tree* tree, uintmax_t index) {
+    struct radix_node* node = tree->root;
+    if(!node || index > max_index(node))
+        return nullptr;
+
+    while(node && node->shift)
+        node = node->slots[slot_of(node, index)];
+
+    return node;
+}
+
+// frees empty nodes from `node` upwards
+static void prune(struct radix_tree* tree, struct radix_node* node) {
+    while(node && !node->count) {
+        struct radix_node* parent = node->parent;
+
+        if(parent) {
+            parent->slots[node->offset] = nullptr;
+            parent->count--;
+        }
+        else
+            tree->root = nullptr;
+
+        slab_free(node_cache, node);
+        node = parent;
+    }
+}
+
+static void propagate_clear(struct radix_node* node, unsigned slot, unsigned tag) {
+    for(; node; slot = node->offset, node = node->parent) {
+        node->tags[tag] &= ~(1ul << slot);
+
+        // siblings below still carry the tag
+        if(node->tags[tag])
+            break;
+    }
+}
+
+void* radix_lookup(struct radix_tree* tree, uintmax_t index) {
+    struct radix_node* leaf = find_leaf(tree, index);
+    return leaf ? leaf->slots[slot_of(leaf, index)] : nullptr;
+}
+
+int radix_insert(struct radix_tree* tree, uintmax_t index, void* item) {
+    assert(item);
+    assert(index <= RADIX_MAX_INDEX);
+
+    if(!tree->root && !(tree->root = new_node(nullptr, 0, 0)))
+        return ENOMEM;
+
+    // grow upwards until the root covers `index`
+    while(index > max_index(tree->root)) {
+        struct radix_node* root = tree->root;
+
+        struct radix_node* new_root = new_node(nullptr, root->shift + RADIX_SHIFT, 0);
+        if(!new_root)
+            return ENOMEM;
+
+        new_root->slots[0] = root;
+        new_root->count = 1;
+        for(unsigned tag = 0; tag < RADIX_TAGS; tag++)
+            new_root->tags[tag] = root->tags[tag] ? 1 : 0;
+
+        root->parent = new_root;
+        root->offset = 0;
+        tree->root = new_root;
+    }
+
+    struct radix_node* node = tree->root;
+    while(node->shift) {
+        unsigned slot = slot_of(node, index);
+
+        if(!node->slots[slot]) {
+            struct radix_node* child = new_node(node, node->shift - RADIX_SHIFT, slot);
+            if(!child) {
+                prune(tree, node);
+                return ENOMEM;
+            }
+
+            node->slots[slot] = child;
+            node->count++;
+        }
+
+        node = node->slots[slot];
+    }
+
+    unsigned slot = slot_of(node, index);
+    if(node->slots[slot])
+        return EEXIST;
+
+    node->slots[slot] = item;
+    node->count++;
+    return 0;
+}
+
+void* radix_delete(struct radix_tree* tree, uintmax_t index) {
+    struct radix_node* leaf = find_leaf(tree, index);
+    if(!leaf)
+        return nullptr;
+
+    unsigned slot = slot_of(leaf, index);
+    void* item = leaf->slots[slot];
+    if(!item)
+        return nullptr;
+
+    for(unsigned tag = 0; tag < RADIX_TAGS; tag++)
+        if(leaf->tags[tag] & (1ul << slot))
+            propagate_clear(leaf, slot, tag);
+
+    leaf->slots[slot] = nullptr;
+    leaf->count--;
+    prune(tree, leaf);
+
+    return item;
+}
+
+// depth-first search below `node`, which covers indices from `base` on
+static void* scan(struct radix_node* node, uintmax_t base, uintmax_t start, uintmax_t last, int tag, uintmax_t* found) {
+    unsigned first = start > base ? (start - base) >> node->shift : 0;
+
+    for(unsigned i = first; i < RADIX_SLOTS; i++) {
+        uintmax_t child_base = base + ((uintmax_t) i << node->shift);
+        if(child_base > last)
+            return nullptr;
+
+        void* slot = node->slots[i];
+        if(!slot || (tag >= 0 && !(node->tags[tag] & (1ul << i))))
+            continue;
+
+        if(!node->shift) {
+            *found = child_base;
+            return slot;
+        }
+
+        void* item = scan(slot, child_base, MAX(start, child_base), last, tag, found);
+        if(item)
+            return item;
+    }
+
+    return nullptr;
+}
+
+static void* next(struct radix_tree* tree, uintmax_t* index, uintmax_t last, int tag) {
+    if(!tree->root || *index > last || *index > max_index(tree->root))
+        return nullptr;
+
+    return scan(tree->root, 0, *index, last, tag, index);
+}
+
+void* radix_next(struct radix_tree* tree, uintmax_t* index, uintmax_t last) {
+    return next(tree, index, last, -1);
+}
+
+void* radix_next_tagged(struct radix_tree* tree, uintmax_t* index, uintmax_t last, unsigned tag) {
+    assert(tag < RADIX_TAGS);
+    return next(tree, index, last, (int) tag);
+}
+
+bool radix_tag_set(struct radix_tree* tree, uintmax_t index, unsigned tag) {
+    assert(tag < RADIX_TAGS);
+
+    struct radix_node* leaf = find_leaf(tree, index);
+    if(!leaf || !leaf->slots[slot_of(leaf, index)])
+        return false;
+
+    unsigned slot = slot_of(leaf, index);
+    for(struct radix_node* node = leaf; node; slot = node->offset, node = node->parent) {
+        if(node->tags[tag] & (1ul << slot))
+            break;
+        node->tags[tag] |= 1ul << slot;
+    }
+
+    return true;
+}
+
+bool radix_tag_clear(struct radix_tree* tree, uintmax_t index, unsigned tag) {
+    assert(tag < RADIX_TAGS);
+
+    struct radix_node* leaf = find_leaf(tree, index);
+    if(!leaf || !leaf->slots[slot_of(leaf, index)])
+        return false;
+
+    unsigned slot = slot_of(leaf, index);
+    if(leaf->tags[tag] & (1ul << slot))
+        propagate_clear(leaf, slot, tag);
+
+    return true;
+}
+
+bool radix_tag_get(struct radix_tree* tree, uintmax_t index, unsigned tag) {
+    assert(tag < RADIX_TAGS);
+
+    struct radix_node* leaf = find_leaf(tree, index);
+    return leaf && (leaf->tags[tag] & (1ul << slot_of(leaf, index)));
+}
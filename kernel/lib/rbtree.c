@@ -0,0 +1,251 @@
+#include <rbtree.h>
+#include <cdefs.h>
+
+static void replace_child(struct rb_tree* tree, struct rb_node* parent, struct rb_node* old, struct rb_node* new) {
+    if(!parent)
+        tree->root = new;
+    else if(parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rotate_left(struct rb_tree* tree, struct rb_node* x, rb_update_t update) {
+    struct rb_node* y = x->right;
+
+    x->right = y->left;
+    if(y->left)
+        y->left->parent = x;
+
+    y->parent = x->parent;
+    replace_child(tree, x->parent, x, y);
+
+    y->left = x;
+    x->parent = y;
+
+    if(update) {
+        update(x);
+        update(y);
+    }
+}
+
+static void rotate_right(struct rb_tree* tree, struct rb_node* x, rb_update_t update) {
+    struct rb_node* y = x->left;
+
+    x->left = y->right;
+    if(y->right)
+        y->right->parent = x;
+
+    y->parent = x->parent;
+    replace_child(tree, x->parent, x, y);
+
+    y->right = x;
+    x->parent = y;
+
+    if(update) {
+        update(x);
+        update(y);
+    }
+}
+
+static __always_inline bool is_red(struct rb_node* node) {
+    return node && node->red;
+}
+
+void rb_propagate(struct rb_node* node, rb_update_t update) {
+    if(!update)
+        return;
+
+    for(; node; node = node->parent)
+        update(node);
+}
+
+void rb_insert(struct rb_tree* tree, struct rb_node* node, struct rb_node* parent, struct rb_node** link, rb_update_t update) {
+    node->parent = parent;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->red = true;
+    *link = node;
+
+    rb_propagate(node, update);
+
+    while(is_red(node->parent)) {
+        parent = node->parent;
+        struct rb_node* grandparent = parent->parent;
+
+        if(parent == grandparent->left) {
+            struct rb_node* uncle = grandparent->right;
+            if(is_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                grandparent->red = true;
+                node = grandparent;
+                continue;
+            }
+
+            if(node == parent->right) {
+                rotate_left(tree, parent, update);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = false;
+            grandparent->red = true;
+            rotate_right(tree, grandparent, update);
+        }
+        else {
+            struct rb_node* uncle = grandparent->left;
+            if(is_red(uncle)) {
+                parent->red = false;
+                uncle->red = false;
+                grandparent->red = true;
+                node = grandparent;
+                continue;
+            }
+
+            if(node == parent->left) {
+                rotate_right(tree, parent, update);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->red = false;
+            grandparent->red = true;
+            rotate_left(tree, grandparent, update);
+        }
+    }
+
+    tree->root->red = false;
+}
+
+// `node` may be nullptr (a black leaf), so its parent is passed explicitly
+static void erase_fixup(struct rb_tree* tree, struct rb_node* node, struct rb_node* parent, rb_update_t update) {
+    while(node != tree->root && !is_red(node)) {
+        if(node == parent->left) {
+            struct rb_node* sibling = parent->right;
+            if(is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_left(tree, parent, update);
+                sibling = parent->right;
+            }
+
+            if(!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if(!is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                rotate_right(tree, sibling, update);
+                sibling = parent->right;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            rotate_left(tree, parent, update);
+            node = tree->root;
+        }
+        else {
+            struct rb_node* sibling = parent->left;
+            if(is_red(sibling)) {
+                sibling->red = false;
+                parent->red = true;
+                rotate_right(tree, parent, update);
+                sibling = parent->left;
+            }
+
+            if(!is_red(sibling->left) && !is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if(!is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                rotate_left(tree, sibling, update);
+                sibling = parent->left;
+            }
+
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            rotate_right(tree, parent, update);
+            node = tree->root;
+        }
+    }
+
+    if(node)
+        node->red = false;
+}
+
+void rb_erase(struct rb_tree* tree, struct rb_node* node, rb_update_t update) {
+    struct rb_node* child;
+    struct rb_node* parent;
+    bool removed_red;
+
+    if(!node->left || !node->right) {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+
+        if(child)
+            child->parent = parent;
+        replace_child(tree, parent, node, child);
+    }
+    else {
+        // replace the node by its in-order successor
+        struct rb_node* successor = node->right;
+        while(successor->left)
+            successor = successor->left;
+
+        child = successor->right;
+        removed_red = successor->red;
+
+        if(successor->parent == node)
+            parent = successor;
+        else {
+            parent = successor->parent;
+
+            if(child)
+                child->parent = parent;
+            parent->left = child;
+
+            successor->right = node->right;
+            node->right->parent = successor;
+        }
+
+        successor->parent = node->parent;
+        replace_child(tree, node->parent, node, successor);
+
+        successor->left = node->left;
+        node->left->parent = successor;
+        successor->red = node->red;
+    }
+
+    // `parent` is the lowest node that lost a descendant, everything above it has to be recomputed
+    rb_propagate(parent, update);
+
+    if(!removed_red)
+        erase_fixup(tree, child, parent, update);
+}
+
+struct rb_node* rb_first(struct rb_tree* tree) {
+    struct rb_node* node = tree->root;
+    while(node && node->left)
+        node = node->left;
+    return node;
+}
+
+struct rb_node* rb_last(struct rb_tree* tree) {
+    struct rb_node* node = tree->root;
+    while(node && node->right)
+        node = node->right;
+    return node;
+}
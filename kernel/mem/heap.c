@@ -6,13 +6,24 @@
 
 #include <assert.h>
 #include <kernelio.h>
+#include <math.h>
 #include <string.h>
 
 #define ALIGN(size) (((size) / KERNEL_HEAP_ALLOC_ALIGN + 1) * KERNEL_HEAP_ALLOC_ALIGN)
 
 #define CACHE_COUNT 12
+#define MIN_CACHE_SHIFT 5 // 32 bytes
+
+#define HEADER_SIZE (sizeof(size_t) * 2)
+
+// allocations bigger than the largest cache are mapped directly
+#define LARGE_ALLOC_MIN (allocsizes[CACHE_COUNT - 1] + 1)
 
 static size_t allocsizes[CACHE_COUNT] = {32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
+static const char* cachenames[CACHE_COUNT] = {
+    "kmalloc-32", "kmalloc-64", "kmalloc-128", "kmalloc-256", "kmalloc-512", "kmalloc-1k",
+    "kmalloc-2k", "kmalloc-4k", "kmalloc-8k", "kmalloc-16k", "kmalloc-32k", "kmalloc-64k"
+};
 static struct scache* caches[CACHE_COUNT];
 
 static void init_area(struct scache* cache, void* obj) {
@@ -25,26 +36,64 @@ static void dtor(struct scache* cache, void* obj) {
     init_area(cache, obj);
 }
 
+// index of the smallest power-of-two class >= size, starting at 32 bytes
+static __always_inline unsigned size_to_index(size_t size) {
+    return 64 - __builtin_clzl((size - !!size) | ((1ul << MIN_CACHE_SHIFT) - 1)) - MIN_CACHE_SHIFT;
+}
+
 static struct scache* get_cache_from_size(size_t size) {
-    struct scache* cache = NULL;
-    for (int i = 0; i < CACHE_COUNT; ++i) {
-		if (size <= allocsizes[i]) {
-			cache = caches[i];
-			break;
-		}
-	}
-    assert(cache);
-    return cache;
+    unsigned i = size_to_index(size);
+    assert(i < CACHE_COUNT);
+    return caches[i];
+}
+
+static __always_inline bool is_large(size_t capacity) {
+    return capacity >= LARGE_ALLOC_MIN;
+}
+
+// [0]: usable bytes of the mapping, [1]: requested size
+static void* large_alloc(size_t size) {
+    size_t mapped = ROUND_UP(size + HEADER_SIZE, PAGE_SIZE);
+    size_t* ret = vmm_map(nullptr, mapped, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+    if(!ret)
+        return nullptr;
+
+    ret[0] = mapped - HEADER_SIZE;
+    ret[1] = size;
+    return ret + 2;
+}
+
+static void large_free(size_t* start) {
+    vmm_unmap(start, start[0] + HEADER_SIZE, 0);
+}
+
+// tries to extend the mapping behind a large allocation without moving it
+static bool large_grow(size_t* start, size_t size) {
+    size_t mapped = start[0] + HEADER_SIZE;
+    size_t needed = ROUND_UP(size + HEADER_SIZE, PAGE_SIZE);
+
+    void* top = (void*)((uintptr_t) start + mapped);
+    if(vmm_map(top, needed - mapped, VMM_FLAGS_ALLOCATE | VMM_FLAGS_EXACT, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr) != top)
+        return false;
+
+    start[0] = needed - HEADER_SIZE;
+    return true;
 }
 
 void kernel_heap_init(void) {
+    for(int i = 0; i < CACHE_COUNT; i++)
+        assert(allocsizes[i] == 1ul << (i + MIN_CACHE_SHIFT));
+
     for(int i = 0; i < CACHE_COUNT; i++) {
-        caches[i] = slab_newcache(allocsizes[i] + sizeof(size_t) * 2, 0, init_area, dtor);
+        caches[i] = slab_newcache(cachenames[i], allocsizes[i] + sizeof(size_t) * 2, 0, init_area, dtor);
         assert(caches[i]);
     }
 }
 
 void* kmalloc(size_t size) {
+    if(is_large(size))
+        return large_alloc(size);
+
     struct scache* cache = get_cache_from_size(size);
     size_t* ret = slab_alloc(cache);
     if(!ret)
@@ -57,6 +106,9 @@ void* kmalloc(size_t size) {
 }
 
 void* krealloc(void* ptr, size_t size) {
+    if(!ptr)
+        return kmalloc(size);
+
     size_t *start = ((size_t*) ptr) - 2;
     size_t current_size = start[1];
 
@@ -65,6 +117,32 @@ void* krealloc(void* ptr, size_t size) {
         return ptr;
     }
 
+    if(is_large(start[0])) {
+        if(size <= start[0] || large_grow(start, size)) {
+            memset((void*)((uintptr_t) ptr + current_size), 0, size - current_size);
+            start[1] = size;
+            return ptr;
+        }
+
+        size_t* new = large_alloc(size);
+        if(!new)
+            return nullptr;
+
+        memcpy(new, ptr, current_size);
+        large_free(start);
+        return new;
+    }
+
+    if(is_large(size)) {
+        void* new = large_alloc(size);
+        if(!new)
+            return nullptr;
+
+        memcpy(new, ptr, current_size);
+        kfree(ptr);
+        return new;
+    }
+
     struct scache* old_cache = get_cache_from_size(start[0]);
     struct scache* new_cache = get_cache_from_size(size);
 
@@ -93,6 +171,11 @@ void kfree(void* ptr) {
 
     size_t* start = ((size_t*) ptr) - 2;
     size_t size = start[0];
+    if(is_large(size)) {
+        large_free(start);
+        return;
+    }
+
     struct scache* cache = get_cache_from_size(size);
     slab_free(cache, start);
 }
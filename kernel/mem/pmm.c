@@ -1,51 +1,341 @@
 #include <mem/pmm.h>
 #include <mem/vmm.h>
 #include <mem/mmap.h>
+#include <mem/page.h>
+#include <mem/shrinker.h>
 #include <sys/spinlock.h>
+#include <cpu/cpu.h>
+#include <cpu/smp.h>
+#include <cpu/interrupts.h>
 
 #include <assert.h>
-#include <bitmap.h>
-#include <hashtable.h>
 #include <kernelio.h>
 #include <math.h>
 #include <string.h>
 
 #include <limine.h>
 
-static struct bitmap physical;
-static spinlock_t pmm_lock;
+#define INVALID_FRAME ((uintmax_t) -1)
+
+#define SECTION_1MB_TOP (0x100000ul / PAGE_SIZE)
+#define SECTION_4GB_TOP (0x100000000ul / PAGE_SIZE)
+
+struct page* pmm_pages;
 
-static hashtable_t refcounts;
-static spinlock_t refcount_lock;
+static struct pmm_section sections[PMM_SECTION_COUNT];
+static uintmax_t frame_count;
+// only ever held with interrupts disabled, the magazines take it from their irq-off sections
+static spinlock_t pmm_lock;
 
 static struct mmap pmm_mmap;
 
+static uintmax_t watermarks[PMM_WATERMARK_COUNT];
+
+// free pages zeroed by idle cpus, linked through `free_next`
+static struct page* zero_pool;
+static size_t zero_pool_count;
+static spinlock_t zero_pool_lock;
+
+static uintmax_t zero_pool_hits;
+static uintmax_t zero_pool_misses;
+
 void* pmm_zero_page;
 
-static inline void refcount_table_init(void) {
-    assert(hashtable_init(&refcounts, 0x2000 /* arbitrary */) == 0);
+static __always_inline enum pmm_section_type frame_section(uintmax_t frame) {
+    if(frame < SECTION_1MB_TOP)
+        return PMM_SECTION_1MB;
+    if(frame < SECTION_4GB_TOP)
+        return PMM_SECTION_4GB;
+    return PMM_SECTION_DEFAULT;
 }
 
-static inline size_t get_refcount(void* addr) {
-    assert((uintptr_t) addr % PAGE_SIZE == 0);
+static void push_block(struct pmm_section* section, uintmax_t frame, unsigned order) {
+    struct page* page = &pmm_pages[frame];
+    page->free_prev = nullptr;
+    page->free_next = section->free_lists[order];
+    if(page->free_next)
+        page->free_next->free_prev = page;
+    section->free_lists[order] = page;
+
+    page->flags = PAGE_FLAGS_FREE;
+    page->order = order;
+}
+
+static void remove_block(struct pmm_section* section, uintmax_t frame, unsigned order) {
+    struct page* page = &pmm_pages[frame];
+    if(page->free_prev)
+        page->free_prev->free_next = page->free_next;
+    else
+        section->free_lists[order] = page->free_next;
 
-    if(!refcounts.capacity)
-        return 0;
+    if(page->free_next)
+        page->free_next->free_prev = page->free_prev;
 
-    void* rc;
-    int err = hashtable_get(&refcounts, &rc, &addr, sizeof(void*));
-    if(err)
-        return 0;
-    return (size_t) rc;
+    page->flags &= ~PAGE_FLAGS_FREE;
 }
 
-static inline void set_refcount(void* addr, size_t rc) {
-    if(!refcounts.capacity)
-        refcount_table_init();
+static __always_inline bool is_free_block(uintmax_t frame, unsigned order) {
+    return (pmm_pages[frame].flags & PAGE_FLAGS_FREE) && pmm_pages[frame].order == order;
+}
 
-    assert((uintptr_t) addr % PAGE_SIZE == 0);
+// pmm_lock must be held
+static uintmax_t buddy_alloc(struct pmm_section* section, unsigned order) {
+    unsigned current = order;
+    while(current <= PMM_MAX_ORDER && !section->free_lists[current])
+        current++;
+
+    if(current > PMM_MAX_ORDER)
+        return INVALID_FRAME;
+
+    uintmax_t frame = section->free_lists[current] - pmm_pages;
+    remove_block(section, frame, current);
+
+    // split off the upper halves until the block has the requested order
+    while(current > order) {
+        current--;
+        push_block(section, frame + (1ul << current), current);
+    }
+
+    return frame;
+}
+
+// pmm_lock must be held; falls back to lower sections when the requested one is exhausted.
+// The 1MiB section is kept for explicit requests only.
+static uintmax_t section_alloc(enum pmm_section_type type, unsigned order) {
+    enum pmm_section_type lowest = type == PMM_SECTION_1MB ? PMM_SECTION_1MB : PMM_SECTION_4GB;
+
+    for(int i = type; i >= (int) lowest; i--) {
+        uintmax_t frame = buddy_alloc(&sections[i], order);
+        if(frame != INVALID_FRAME)
+            return frame;
+    }
+
+    return INVALID_FRAME;
+}
+
+// pmm_lock must be held
+static void buddy_free(uintmax_t frame, unsigned order) {
+    assert(!(pmm_pages[frame].flags & PAGE_FLAGS_FREE) && "double free of physical page");
+
+    struct pmm_section* section = &sections[frame_section(frame)];
+
+    while(order < PMM_MAX_ORDER) {
+        uintmax_t buddy = frame ^ (1ul << order);
+        if(buddy < section->base_id || buddy + (1ul << order) > section->top_id || !is_free_block(buddy, order))
+            break;
+
+        remove_block(section, buddy, order);
+        frame = MIN(frame, buddy);
+        order++;
+    }
+
+    push_block(section, frame, order);
+}
+
+// pmm_lock must be held; splits [frame, frame + count) into maximal aligned blocks.
+// The range must not cross a section boundary.
+static void free_frames(uintmax_t frame, size_t count) {
+    assert(frame + count <= frame_count);
+
+    while(count) {
+        unsigned order = frame ? MIN(__builtin_ctzl(frame), PMM_MAX_ORDER) : PMM_MAX_ORDER;
+        while((1ul << order) > count)
+            order--;
+
+        buddy_free(frame, order);
+        frame += 1ul << order;
+        count -= 1ul << order;
+    }
+}
+
+static __always_inline void account_alloc(uintmax_t frame, size_t count) {
+    struct pmm_section* section = &sections[frame_section(frame)];
+    __atomic_add_fetch(&section->used, count, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&section->free, count, __ATOMIC_RELAXED);
+}
+
+static __always_inline void account_free(uintmax_t frame, size_t count) {
+    struct pmm_section* section = &sections[frame_section(frame)];
+    __atomic_sub_fetch(&section->used, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&section->free, count, __ATOMIC_RELAXED);
+}
+
+static void init_pages(uintmax_t frame, size_t count) {
+    account_alloc(frame, count);
+    memset(&pmm_pages[frame], 0, count * sizeof(struct page));
+
+    for(size_t i = 0; i < count; i++)
+        pmm_pages[frame + i].refcount = 1;
+}
+
+static inline unsigned size_to_order(size_t size) {
+    return size <= 1 ? 0 : 64 - __builtin_clzl(size - 1);
+}
+
+static void* alloc_contiguous(size_t size, enum pmm_section_type section) {
+    unsigned order = size_to_order(size);
+    if(order > PMM_MAX_ORDER)
+        return nullptr;
+
+    bool istate = spinlock_acquire_irqsave(&pmm_lock);
+
+    uintmax_t frame = section_alloc(section, order);
+    if(frame != INVALID_FRAME && (1ul << order) > size)
+        free_frames(frame + size, (1ul << order) - size);
+
+    spinlock_release_irqrestore(&pmm_lock, istate);
+
+    if(frame == INVALID_FRAME)
+        return nullptr;
+
+    init_pages(frame, size);
+    return (void*) (frame * PAGE_SIZE);
+}
+
+static void* magazine_alloc(void) {
+    bool istate = interrupt_set(false);
+    struct pmm_magazine* mag = &_cpu()->pmm_magazine;
+    spinlock_acquire(&mag->lock);
+
+    if(!mag->count) {
+        spinlock_acquire(&pmm_lock);
+
+        while(mag->count < PMM_MAGAZINE_BATCH) {
+            uintmax_t frame = section_alloc(PMM_SECTION_DEFAULT, 0);
+            if(frame == INVALID_FRAME)
+                break;
+            mag->pages[mag->count++] = (void*) (frame * PAGE_SIZE);
+        }
+
+        spinlock_release(&pmm_lock);
+    }
+
+    void* phys = mag->count ? mag->pages[--mag->count] : nullptr;
+
+    spinlock_release(&mag->lock);
+    interrupt_set(istate);
+
+    if(phys)
+        init_pages((uintptr_t) phys / PAGE_SIZE, 1);
+    return phys;
+}
+
+static void magazine_free(void* addr) {
+    bool istate = interrupt_set(false);
+    struct pmm_magazine* mag = &_cpu()->pmm_magazine;
+    spinlock_acquire(&mag->lock);
+
+    if(mag->count == PMM_MAGAZINE_SIZE) {
+        spinlock_acquire(&pmm_lock);
+
+        while(mag->count > PMM_MAGAZINE_SIZE - PMM_MAGAZINE_BATCH)
+            buddy_free((uintptr_t) mag->pages[--mag->count] / PAGE_SIZE, 0);
+
+        spinlock_release(&pmm_lock);
+    }
+
+    mag->pages[mag->count++] = addr;
+
+    spinlock_release(&mag->lock);
+    interrupt_set(istate);
+}
+
+static void free_pages(void* addr, size_t count) {
+    uintmax_t frame = (uintptr_t) addr / PAGE_SIZE;
+    account_free(frame, count);
+
+    // magazines only serve PMM_SECTION_DEFAULT requests, keep low memory out of them
+    if(count == 1 && frame_section(frame) != PMM_SECTION_1MB) {
+        magazine_free(addr);
+        return;
+    }
+
+    bool istate = spinlock_acquire_irqsave(&pmm_lock);
+    free_frames(frame, count);
+    spinlock_release_irqrestore(&pmm_lock, istate);
+}
+
+// hands frames the pmm did not manage so far to the free lists, split along section boundaries.
+// pmm_lock must be held once other cpus may allocate.
+static void release_range(uintmax_t frame, uintmax_t end) {
+    for(int i = 0; i < PMM_SECTION_COUNT; i++) {
+        struct pmm_section* section = &sections[i];
+        uintmax_t start = MAX(frame, section->base_id);
+        uintmax_t stop = MIN(end, section->top_id);
+        if(start >= stop)
+            continue;
+
+        memset(&pmm_pages[start], 0, (stop - start) * sizeof(struct page));
+        free_frames(start, stop - start);
+        __atomic_add_fetch(&section->total, stop - start, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&section->free, stop - start, __ATOMIC_RELAXED);
+    }
+}
+
+static void* zero_pool_take(void) {
+    if(!__atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED))
+        return nullptr;
+
+    bool istate = spinlock_acquire_irqsave(&zero_pool_lock);
 
-    assert(hashtable_set(&refcounts, (void*) rc, &addr, sizeof(void*), true) == 0);
+    struct page* page = zero_pool;
+    if(page) {
+        zero_pool = page->free_next;
+        __atomic_sub_fetch(&zero_pool_count, 1, __ATOMIC_RELAXED);
+    }
+
+    spinlock_release_irqrestore(&zero_pool_lock, istate);
+
+    if(!page)
+        return nullptr;
+
+    init_pages(page - pmm_pages, 1);
+    return page_get_physical(page);
+}
+
+// returns the pages cached in every cpu's magazine and in the zero pool to the buddy lists,
+// where contiguous and low memory requests can find them
+static size_t drain_caches(void) {
+    size_t drained = 0;
+
+    for(unsigned i = 0; i < smp_cpus_awake; i++) {
+        struct pmm_magazine* mag = &smp_get_cpu(i)->pmm_magazine;
+
+        bool istate = spinlock_acquire_irqsave(&mag->lock);
+        spinlock_acquire(&pmm_lock);
+
+        drained += mag->count;
+        while(mag->count)
+            buddy_free((uintptr_t) mag->pages[--mag->count] / PAGE_SIZE, 0);
+
+        spinlock_release(&pmm_lock);
+        spinlock_release_irqrestore(&mag->lock, istate);
+    }
+
+    // zero pool pages are accounted as free already
+    bool istate = spinlock_acquire_irqsave(&zero_pool_lock);
+    struct page* page = zero_pool;
+    zero_pool = nullptr;
+    __atomic_store_n(&zero_pool_count, 0, __ATOMIC_RELAXED);
+    spinlock_release_irqrestore(&zero_pool_lock, istate);
+
+    istate = spinlock_acquire_irqsave(&pmm_lock);
+
+    for(; page; drained++) {
+        struct page* next = page->free_next;
+        buddy_free(page - pmm_pages, 0);
+        page = next;
+    }
+
+    spinlock_release_irqrestore(&pmm_lock, istate);
+    return drained;
+}
+
+static inline bool is_ram(uint64_t type) {
+    return type == LIMINE_MEMMAP_USABLE
+        || type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE
+        || type == LIMINE_MEMMAP_KERNEL_AND_MODULES
+        || type == LIMINE_MEMMAP_ACPI_RECLAIMABLE;
 }
 
 uintptr_t hhdm_base;
@@ -63,117 +353,256 @@ void pmm_init(struct mmap* mmap) {
 
     klog(INFO, "total memory: 0x%zx bytes (%Zu)", mmap->total_memory, mmap->total_memory);
 
-    physical.block_cnt = ROUND_UP_DIV(mmap->total_memory, BLOCK_SIZE);
-    physical.byte_cnt = ROUND_UP_DIV(physical.block_cnt, 8);
-    
-    struct limine_memmap_entry* mm = 0;
+    uintptr_t top = 0;
+    for(size_t i = 0; i < mmap->map->entry_count; i++) {
+        struct limine_memmap_entry* entry = mmap->map->entries[i];
+        if(is_ram(entry->type))
+            top = MAX(top, entry->base + entry->length);
+    }
+
+    frame_count = ROUND_UP_DIV(top, PAGE_SIZE);
+    size_t pages_size = ROUND_UP(frame_count * sizeof(struct page), PAGE_SIZE);
+
+    struct limine_memmap_entry* mm = nullptr;
 
     for(size_t i = 0; i < mmap->map->entry_count; i++) {
         struct limine_memmap_entry* entry = mmap->map->entries[i];
-        if(entry->type != LIMINE_MEMMAP_USABLE || entry->length < physical.byte_cnt)
+        if(entry->type != LIMINE_MEMMAP_USABLE || entry->base < SECTION_1MB_TOP * PAGE_SIZE || entry->length < pages_size)
             continue;
         mm = entry;
         break;
     }
 
     if(!mm)
-        panic("Out of Memory (pmm bitmap[%zu])", physical.byte_cnt);
-    
-    klog(INFO, "Using %zu bytes (%Zu) for pmm bitmap.", physical.byte_cnt, physical.byte_cnt);
+        panic("Out of Memory (pmm frame table[%zu])", pages_size);
 
-    void* bitmap_start_phys = (void*) mm->base;
-    physical.bitmap = MAKE_HHDM(bitmap_start_phys);
-    memset(physical.bitmap, 0xff, physical.byte_cnt);
+    klog(INFO, "Using %zu bytes (%Zu) for %zu page descriptors.", pages_size, pages_size, (size_t) frame_count);
 
-    for(size_t i = 0; i < mmap->map->entry_count; i++) {
-        struct limine_memmap_entry* entry = mmap->map->entries[i];
-        if(entry->type == LIMINE_MEMMAP_USABLE)
-            bitmap_mark_region(&physical, (void*) entry->base, entry->length, 0);
+    pmm_pages = MAKE_HHDM(mm->base);
+    memset(pmm_pages, 0, frame_count * sizeof(struct page));
+
+    // only usable memory gets released into the buddy lists below
+    for(uintmax_t i = 0; i < frame_count; i++)
+        pmm_pages[i].flags = PAGE_FLAGS_RESERVED;
+
+    spinlock_init(pmm_lock);
+    spinlock_init(zero_pool_lock);
+
+    const uintmax_t section_tops[PMM_SECTION_COUNT] = {
+        [PMM_SECTION_1MB] = SECTION_1MB_TOP,
+        [PMM_SECTION_4GB] = SECTION_4GB_TOP,
+        [PMM_SECTION_DEFAULT] = UINTMAX_MAX
+    };
+
+    for(int i = 0; i < PMM_SECTION_COUNT; i++) {
+        sections[i].base_id = i ? sections[i - 1].top_id : 0;
+        sections[i].top_id = MAX(MIN(section_tops[i], frame_count), sections[i].base_id);
     }
 
     for(size_t i = 0; i < mmap->map->entry_count; i++) {
         struct limine_memmap_entry* entry = mmap->map->entries[i];
         if(entry->type != LIMINE_MEMMAP_USABLE)
-            bitmap_mark_region(&physical, (void*) entry->base, entry->length, 1);
+            continue;
+
+        uintmax_t frame = ROUND_UP_DIV(entry->base, PAGE_SIZE);
+        uintmax_t end = (entry->base + entry->length) / PAGE_SIZE;
+        if(entry == mm)
+            frame += pages_size / PAGE_SIZE;
+
+        // physical address 0 doubles as the allocation failure value
+        frame = MAX(frame, 1);
+
+        if(frame < end)
+            release_range(frame, end);
     }
 
-    bitmap_mark_region(&physical, bitmap_start_phys, physical.byte_cnt, 1);
+    uintmax_t usable = 0;
+    for(int i = 0; i < PMM_SECTION_COUNT; i++)
+        usable += sections[i].total;
 
-    spinlock_init(pmm_lock);
-    spinlock_init(refcount_lock);
+    watermarks[PMM_WATERMARK_LOW] = MAX(usable / PMM_WATERMARK_DIVISOR, PMM_WATERMARK_MIN);
+    watermarks[PMM_WATERMARK_HIGH] = watermarks[PMM_WATERMARK_LOW] * 2;
 
-    pmm_zero_page = pmm_alloc_page(PMM_SECTION_DEFAULT);
-    memset(MAKE_HHDM(pmm_zero_page), 0, PAGE_SIZE);
+    klog(INFO, "pmm sections: 1MiB: %Zu, 4GiB: %Zu, default: %Zu",
+        (size_t) sections[PMM_SECTION_1MB].total * PAGE_SIZE,
+        (size_t) sections[PMM_SECTION_4GB].total * PAGE_SIZE,
+        (size_t) sections[PMM_SECTION_DEFAULT].total * PAGE_SIZE
+    );
+
+    pmm_zero_page = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
 }
 
 void* pmm_alloc(size_t size, enum pmm_section_type section) {
-    assert(section == PMM_SECTION_DEFAULT && "1MiB and 4GiB PMM sections are not yet implemented.");
+    void* phys = pmm_try_alloc(size, section);
+
+    // shrink caches synchronously before giving up
+    if(!phys && size && reclaim_direct(size))
+        phys = pmm_try_alloc(size, section);
+
+    // free pages may still sit in other cpus' magazines or the zero pool
+    if(!phys && size && drain_caches())
+        phys = pmm_try_alloc(size, section);
+
+    if(!phys && size)
+        panic("Out of memory!");
+
+    return phys;
+}
+
+void* pmm_try_alloc(size_t size, enum pmm_section_type section) {
+    assert(section >= 0 && section < PMM_SECTION_COUNT);
     if(!size)
         return nullptr;
 
-    spinlock_acquire(&pmm_lock);
-    void* phys = bitmap_allocate(&physical, size);
-    spinlock_release(&pmm_lock);
+    void* phys = size == 1 && section == PMM_SECTION_DEFAULT ? magazine_alloc() : alloc_contiguous(size, section);
 
-    if(!phys)
-        panic("Out of memory!");
-    
+    // give back pages held by the zero pool before giving up; they may lie anywhere above 1MiB
+    if(!phys && size == 1 && section == PMM_SECTION_DEFAULT)
+        phys = zero_pool_take();
+
+    if(!phys || pmm_under_watermark(PMM_WATERMARK_LOW))
+        reclaim_wake();
+
+    return phys;
+}
+
+void* pmm_alloc_page(enum pmm_section_type section, bool zeroed) {
+    if(zeroed && section == PMM_SECTION_DEFAULT) {
+        void* phys = zero_pool_take();
+        if(phys) {
+            __atomic_add_fetch(&zero_pool_hits, 1, __ATOMIC_RELAXED);
+            return phys;
+        }
+
+        __atomic_add_fetch(&zero_pool_misses, 1, __ATOMIC_RELAXED);
+    }
+
+    void* phys = pmm_alloc(1, section);
+    if(phys && zeroed)
+        memset(MAKE_HHDM(phys), 0, PAGE_SIZE);
     return phys;
 }
 
+bool pmm_zero_pool_fill(void) {
+    if(__atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED) >= PMM_ZERO_POOL_SIZE)
+        return false;
+
+    // take the frame straight from the buddy lists, it stays accounted as free
+    bool istate = spinlock_acquire_irqsave(&pmm_lock);
+    uintmax_t frame = section_alloc(PMM_SECTION_DEFAULT, 0);
+    spinlock_release_irqrestore(&pmm_lock, istate);
+
+    if(frame == INVALID_FRAME)
+        return false;
+
+    memset(MAKE_HHDM(frame * PAGE_SIZE), 0, PAGE_SIZE);
+
+    istate = spinlock_acquire_irqsave(&zero_pool_lock);
+
+    pmm_pages[frame].free_next = zero_pool;
+    zero_pool = &pmm_pages[frame];
+    __atomic_add_fetch(&zero_pool_count, 1, __ATOMIC_RELAXED);
+
+    spinlock_release_irqrestore(&zero_pool_lock, istate);
+    return true;
+}
+
+void pmm_zero_pool_stats(struct pmm_zero_pool_stats* stats) {
+    stats->size = __atomic_load_n(&zero_pool_count, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&zero_pool_hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&zero_pool_misses, __ATOMIC_RELAXED);
+}
+
 void pmm_free(void* addr, size_t count) {
-    spinlock_acquire(&pmm_lock);
+    if(!count)
+        return;
 
-    size_t rc = get_refcount(addr);
+    // single pages may be shared, only free them once the last reference is gone
+    if(count == 1) {
+        pmm_release(addr);
+        return;
+    }
 
-    if(rc <= 1)
-        bitmap_mark_region(&physical, addr, count * BLOCK_SIZE, 0);
-    else
-        set_refcount(addr, rc - 1);
+    // frames never counted as used would wrap the section counters, those go through pmm_reclaim()
+    for(size_t i = 0; i < count; i++) {
+        assert(!(pmm_page(addr)[i].flags & (PAGE_FLAGS_RESERVED | PAGE_FLAGS_FREE)) && "pmm_free() of memory not allocated by the pmm");
+        pmm_page(addr)[i].refcount = 0;
+    }
 
-    spinlock_release(&pmm_lock);
+    free_pages(addr, count);
+}
+
+void pmm_reclaim(void* addr, size_t count) {
+    uintmax_t frame = (uintptr_t) addr / PAGE_SIZE;
+    assert((uintptr_t) addr % PAGE_SIZE == 0);
+    assert(frame + count <= frame_count);
+
+    for(size_t i = 0; i < count; i++)
+        assert((pmm_pages[frame + i].flags & PAGE_FLAGS_RESERVED) && "reclaim of memory the pmm already manages");
+
+    bool istate = spinlock_acquire_irqsave(&pmm_lock);
+    release_range(frame, frame + count);
+    spinlock_release_irqrestore(&pmm_lock, istate);
 }
 
 uintmax_t pmm_total_memory(void) {
     return (uintmax_t) pmm_mmap.total_memory;
 }
 
-uintmax_t pmm_free_memroy(void) {
-    return 0;
+uintmax_t pmm_free_memory(void) {
+    uintmax_t free = 0;
+    for(int i = 0; i < PMM_SECTION_COUNT; i++)
+        free += __atomic_load_n(&sections[i].free, __ATOMIC_RELAXED);
+    return free * PAGE_SIZE;
 }
 
-void pmm_hold(void* addr) {
-    assert((uintptr_t) addr % PAGE_SIZE == 0);
+void pmm_section_stats(enum pmm_section_type section, struct pmm_section_stats* stats) {
+    assert(section >= 0 && section < PMM_SECTION_COUNT);
+    stats->total = sections[section].total;
+    stats->free = __atomic_load_n(&sections[section].free, __ATOMIC_RELAXED);
+    stats->used = __atomic_load_n(&sections[section].used, __ATOMIC_RELAXED);
+}
 
-    spinlock_acquire(&refcount_lock);
- 
-    if(!refcounts.capacity)
-        refcount_table_init();
+uintmax_t pmm_watermark(enum pmm_watermark watermark) {
+    assert(watermark < PMM_WATERMARK_COUNT);
+    return watermarks[watermark];
+}
 
-    size_t rc = 0;
-    int err = hashtable_get(&refcounts, (void**) &rc, &addr, sizeof(void*));
-    if(err) {
-        if(bitmap_get(&physical, (size_t) addr))
-            rc += 1;
-    }
+bool pmm_under_watermark(enum pmm_watermark watermark) {
+    return pmm_free_memory() / PAGE_SIZE < watermarks[watermark];
+}
 
-    set_refcount(addr, rc + 1);
+void pmm_hold(void* addr) {
+    assert((uintptr_t) addr % PAGE_SIZE == 0);
+    if((uintptr_t) addr / PAGE_SIZE >= frame_count)
+        return;
 
-    spinlock_release(&refcount_lock);
+    struct page* page = pmm_page(addr);
+    if(!(page->flags & PAGE_FLAGS_RESERVED))
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
 }
 
 void pmm_release(void* addr) {
-    spinlock_acquire(&refcount_lock);
+    assert((uintptr_t) addr % PAGE_SIZE == 0);
+    if((uintptr_t) addr / PAGE_SIZE >= frame_count)
+        return;
+
+    // mappings of reserved memory (mmio, framebuffers, ...) never own the frame
+    struct page* page = pmm_page(addr);
+    if(page->flags & PAGE_FLAGS_RESERVED)
+        return;
+
+    uint32_t refcount = __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+    assert(refcount != UINT32_MAX && "release of unreferenced physical page");
+    if(refcount == 0)
+        free_pages(addr, 1);
+}
 
-    size_t rc = get_refcount(addr);
-    if(rc == 0)
-        pmm_free_page(addr);
-    else if(rc == 1) {
-        hashtable_remove(&refcounts, &addr, sizeof(void*));
-        pmm_free_page(addr);
-    }
-    else
-        set_refcount(addr, rc - 1);
-        
-    spinlock_release(&refcount_lock);
+bool pmm_is_exclusive(void* addr) {
+    assert((uintptr_t) addr % PAGE_SIZE == 0);
+    if((uintptr_t) addr / PAGE_SIZE >= frame_count)
+        return false;
+
+    struct page* page = pmm_page(addr);
+    return !(page->flags & PAGE_FLAGS_RESERVED) && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) == 1;
 }
@@ -0,0 +1,134 @@
+#include <mem/shrinker.h>
+#include <mem/pmm.h>
+#include <mem/vmm.h>
+#include <sys/mutex.h>
+#include <sys/scheduler.h>
+#include <sys/thread.h>
+
+#include <assert.h>
+#include <kernelio.h>
+#include <math.h>
+
+static struct shrinker* shrinkers;
+// shrinkers get registered before anything could initialize the lock
+static mutex_t shrinkers_lock = MUTEX_INITIALIZER;
+
+static struct thread* reclaim_thread;
+static semaphore_t reclaim_sem;
+static bool reclaim_pending;
+
+static uintmax_t reclaim_wakeups;
+static uintmax_t direct_reclaims;
+
+void shrinker_register(struct shrinker* shrinker) {
+    shrinker->calls = 0;
+    shrinker->freed = 0;
+
+    mutex_acquire(&shrinkers_lock);
+    shrinker->next = shrinkers;
+    shrinkers = shrinker;
+    mutex_release(&shrinkers_lock);
+}
+
+void shrinker_unregister(struct shrinker* shrinker) {
+    mutex_acquire(&shrinkers_lock);
+
+    struct shrinker** link = &shrinkers;
+    while(*link && *link != shrinker)
+        link = &(*link)->next;
+
+    assert(*link && "shrinker was never registered");
+    *link = shrinker->next;
+
+    mutex_release(&shrinkers_lock);
+}
+
+static size_t shrink_all(size_t pages, bool direct) {
+    size_t freed = 0;
+
+    // direct reclaim must not sleep; if the registry is busy, background reclaim is already running
+    if(direct) {
+        if(!mutex_try(&shrinkers_lock))
+            return 0;
+    }
+    else
+        mutex_acquire(&shrinkers_lock);
+
+    for(struct shrinker* shrinker = shrinkers; shrinker && freed < pages; shrinker = shrinker->next) {
+        if(!shrinker->count(shrinker))
+            continue;
+
+        struct shrink_control sc = {
+            .nr_to_scan = pages - freed,
+            .direct = direct
+        };
+
+        size_t n = shrinker->scan(shrinker, &sc);
+
+        __atomic_add_fetch(&shrinker->calls, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shrinker->freed, n, __ATOMIC_RELAXED);
+        freed += n;
+    }
+
+    mutex_release(&shrinkers_lock);
+    return freed;
+}
+
+size_t reclaim_direct(size_t pages) {
+    __atomic_add_fetch(&direct_reclaims, 1, __ATOMIC_RELAXED);
+    return shrink_all(pages, true);
+}
+
+void reclaim_wake(void) {
+    if(!reclaim_thread || __atomic_exchange_n(&reclaim_pending, true, __ATOMIC_ACQ_REL))
+        return;
+
+    semaphore_signal(&reclaim_sem);
+}
+
+static __noreturn void reclaim_thread_callback(void) {
+    for(;;) {
+        semaphore_wait(&reclaim_sem, false);
+        __atomic_add_fetch(&reclaim_wakeups, 1, __ATOMIC_RELAXED);
+
+        // reclaim until the high watermark is met or the shrinkers run dry
+        while(pmm_under_watermark(PMM_WATERMARK_HIGH)) {
+            size_t free_pages = pmm_free_memory() / PAGE_SIZE;
+            size_t target = pmm_watermark(PMM_WATERMARK_HIGH) - MIN(free_pages, pmm_watermark(PMM_WATERMARK_HIGH));
+
+            if(!target || !shrink_all(target, false))
+                break;
+        }
+
+        __atomic_store_n(&reclaim_pending, false, __ATOMIC_RELEASE);
+    }
+}
+
+void reclaim_init(void) {
+    semaphore_init(&reclaim_sem, 0);
+
+    struct thread* thread = thread_create(reclaim_thread_callback, PAGE_SIZE * 16, 0, nullptr, nullptr);
+    assert(thread);
+
+    __atomic_store_n(&reclaim_thread, thread, __ATOMIC_RELEASE);
+    sched_queue(thread);
+
+    klog(INFO, "reclaim: watermarks: low: %Zu, high: %Zu",
+        (size_t) pmm_watermark(PMM_WATERMARK_LOW) * PAGE_SIZE,
+        (size_t) pmm_watermark(PMM_WATERMARK_HIGH) * PAGE_SIZE
+    );
+}
+
+void shrinker_dump_info(void) {
+    klog(INFO, "shrinkers: %lu background wakeups, %lu direct reclaims",
+        __atomic_load_n(&reclaim_wakeups, __ATOMIC_RELAXED), __atomic_load_n(&direct_reclaims, __ATOMIC_RELAXED));
+    klog(INFO, "  name, reclaimable pages, calls, freed pages");
+
+    mutex_acquire(&shrinkers_lock);
+
+    for(struct shrinker* shrinker = shrinkers; shrinker; shrinker = shrinker->next)
+        klog(INFO, "  %s: %zu, %lu, %lu", shrinker->name, shrinker->count(shrinker),
+            __atomic_load_n(&shrinker->calls, __ATOMIC_RELAXED), __atomic_load_n(&shrinker->freed, __ATOMIC_RELAXED));
+
+    mutex_release(&shrinkers_lock);
+}
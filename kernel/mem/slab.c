@@ -1,5 +1,11 @@
 #include <mem/slab.h>
 #include <mem/vmm.h>
+#include <mem/page.h>
+#include <mem/shrinker.h>
+#include <sys/mutex.h>
+#include <cpu/cpu.h>
+#include <cpu/interrupts.h>
+#include <cpu/smp.h>
 
 #include <math.h>
 #include <kernelio.h>
@@ -13,12 +19,48 @@
 
 #define GET_SLAB(x) ((struct slab*) (ROUND_DOWN((uintptr_t) (x), PAGE_SIZE) + SLAB_PAGE_OFFSET))
 
-static struct scache self_cache = {
-    .size = sizeof(struct scache),
-    .align = 8,
-    .true_size = ROUND_UP(sizeof(struct scache) + sizeof(void**), 8),
-    .slab_obj_count = SLAB_DATA_SIZE / ROUND_UP(sizeof(struct scache) + sizeof(void**), 8)
-};
+#define STATIC_CACHE(_name, _type, _next) {                                        \
+    .name = (_name),                                                             \
+    .size = sizeof(_type),                                                       \
+    .align = 8,                                                                  \
+    .true_size = ROUND_UP(sizeof(_type) + sizeof(void**), 8),                    \
+    .slab_obj_count = SLAB_DATA_SIZE / ROUND_UP(sizeof(_type) + sizeof(void**), 8), \
+    .cpu_index = SLAB_NO_CPU_CACHE,                                              \
+    .next = (_next)                                                              \
+}
+
+static_assert(sizeof(struct scache) < SLAB_INDIRECT_CUTOFF);
+static_assert(sizeof(struct slab_magazine) < SLAB_INDIRECT_CUTOFF);
+
+// magazines come from a cache without magazines of its own
+static struct scache magazine_cache = STATIC_CACHE("slab_magazine", struct slab_magazine, nullptr);
+static struct scache self_cache = STATIC_CACHE("scache", struct scache, &magazine_cache);
+
+static struct scache* cache_list = &self_cache;
+// caches may be created before anything could initialize the lock
+static mutex_t cache_list_lock = MUTEX_INITIALIZER;
+
+// pages held by empty slabs and magazines parked in depots, both given back by the shrinker
+static size_t empty_slab_pages;
+static size_t depot_magazines;
+
+// slots in `struct cpu`'s slab_caches, returned by slab_freecache()
+static uint64_t cpu_index_used;
+static_assert(SLAB_MAX_CPU_CACHES <= 64);
+
+static void lock_cache(struct scache* cache, spinlock_t* lock) {
+	if (spinlock_try(lock))
+		return;
+
+	__atomic_add_fetch(&cache->contention, 1, __ATOMIC_RELAXED);
+	spinlock_acquire(lock);
+}
+
+static __always_inline size_t slab_pages(struct scache* cache) {
+	if (cache->size < SLAB_INDIRECT_CUTOFF)
+		return 1;
+	return 1 + ROUND_UP_DIV(cache->slab_obj_count * cache->true_size, PAGE_SIZE);
+}
 
 static void init_direct(struct scache* cache, struct slab* slab, void* base) {
 	slab->free = nullptr;
@@ -58,12 +100,20 @@ static bool growcache(struct scache* cache) {
 	if (cache->size < SLAB_INDIRECT_CUTOFF) {
 		init_direct(cache, slab, _slab);
 	} else {
-		void* base = vmm_map(nullptr, cache->slab_obj_count * cache->true_size, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
+		size_t size = cache->slab_obj_count * cache->true_size;
+		void* base = vmm_map(nullptr, size, VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
 		if (base == nullptr) {
 			vmm_unmap(_slab, PAGE_SIZE, 0);
 			return false;
 		}
 		init_indirect(cache, slab, _slab, base);
+
+		// let returnobject() find the slab through the frames backing the data
+		for (uintptr_t offset = 0; offset < size; offset += PAGE_SIZE) {
+			struct page* page = pmm_page(mmu_get_physical(vmm_kernel_context.page_table, (void*)((uintptr_t)base + offset)));
+			page->slab = slab;
+			page->flags |= PAGE_FLAGS_SLAB;
+		}
 	}
 
 
@@ -72,6 +122,7 @@ static bool growcache(struct scache* cache) {
 	if (slab->next)
 		slab->next->prev = slab;
 	cache->empty = slab;
+	__atomic_add_fetch(&empty_slab_pages, slab_pages(cache), __ATOMIC_RELAXED);
 	return true;
 }
 
@@ -99,28 +150,15 @@ static struct slab* returnobject(struct scache* cache, void* obj) {
 		freeptr = (void**)((uintptr_t)obj + cache->size);
 		assert(*freeptr == nullptr);
 	} else {
-		bool partial = cache->full == nullptr;
-		slab = partial ? cache->partial : cache->full;
-		while (slab) {
-			void* top = (void*)((uintptr_t)slab->base + cache->slab_obj_count*  cache->true_size);
-			if (obj >= slab->base && obj < top)
-				break;
-			if (slab->next == nullptr && partial == false) {
-				slab = cache->partial;
-				partial = true;
-			} else {
-				slab = slab->next;
-			}
-		}
-		assert(slab);
+		struct page* page = pmm_page(mmu_get_physical(vmm_kernel_context.page_table, obj));
+		assert(page->flags & PAGE_FLAGS_SLAB);
+		slab = page->slab;
+		assert(obj >= slab->base && (uintptr_t)obj < (uintptr_t)slab->base + cache->slab_obj_count * cache->true_size);
 		uintmax_t objn = ((uintptr_t)obj - (uintptr_t)slab->base) / cache->true_size;
 		void** base = (void**)ROUND_DOWN((uintptr_t)slab, PAGE_SIZE);
 		freeptr = &base[objn];
 	}
 
-	if (cache->dtor)
-		cache->dtor(cache, obj);
-
 	*freeptr = slab->free;
 	slab->free = freeptr;
 	--slab->used;
@@ -128,8 +166,8 @@ static struct slab* returnobject(struct scache* cache, void* obj) {
 	return slab;
 }
 
-void* slab_alloc(struct scache* cache) {
-	spinlock_acquire(&cache->lock);
+static void* cache_alloc(struct scache* cache) {
+	lock_cache(cache, &cache->lock);
 	struct slab* slab = nullptr;
 	if (cache->partial != nullptr)
 		slab = cache->partial;
@@ -151,6 +189,7 @@ void* slab_alloc(struct scache* cache) {
 		cache->empty = slab->next;
 		if (slab->next)
 			slab->next->prev = nullptr;
+		__atomic_sub_fetch(&empty_slab_pages, slab_pages(cache), __ATOMIC_RELAXED);
 
 		if (cache->partial)
 			cache->partial->prev = slab;
@@ -177,8 +216,8 @@ void* slab_alloc(struct scache* cache) {
 	return ret;
 }
 
-void slab_free(struct scache* cache, void* addr) {
-	spinlock_acquire(&cache->lock);
+static void cache_free(struct scache* cache, void* addr) {
+	lock_cache(cache, &cache->lock);
 
 	struct slab* slab = returnobject(cache, addr);
 	assert(slab);
@@ -197,6 +236,7 @@ void slab_free(struct scache* cache, void* addr) {
 		if (slab->next)
 			slab->next->prev = slab;
 		cache->empty = slab;
+		__atomic_add_fetch(&empty_slab_pages, slab_pages(cache), __ATOMIC_RELAXED);
 	}
 	
 	if (slab->used == cache->slab_obj_count - 1) {
@@ -217,7 +257,171 @@ void slab_free(struct scache* cache, void* addr) {
 	spinlock_release(&cache->lock);
 }
 
-struct scache* slab_newcache(size_t size, size_t align, void (*ctor)(struct scache* , void*), void (*dtor)(struct scache* , void*)) {
+static __always_inline struct slab_cpu_cache* cpu_cache(struct scache* cache) {
+	return &_cpu()->slab_caches[cache->cpu_index];
+}
+
+static __always_inline void push_magazine(struct slab_magazine** list, size_t* count, struct slab_magazine* magazine) {
+	magazine->next = *list;
+	*list = magazine;
+	++*count;
+	__atomic_add_fetch(&depot_magazines, 1, __ATOMIC_RELAXED);
+}
+
+static __always_inline struct slab_magazine* pop_magazine(struct slab_magazine** list, size_t* count) {
+	struct slab_magazine* magazine = *list;
+	if (magazine) {
+		*list = magazine->next;
+		--*count;
+		__atomic_sub_fetch(&depot_magazines, 1, __ATOMIC_RELAXED);
+	}
+	return magazine;
+}
+
+static void* magazine_alloc(struct scache* cache) {
+	void* obj = nullptr;
+	bool istate = interrupt_set(false);
+	struct slab_cpu_cache* cc = cpu_cache(cache);
+
+	if (cc->loaded && cc->loaded->rounds)
+		obj = cc->loaded->objs[--cc->loaded->rounds];
+	else if (cc->previous && cc->previous->rounds) {
+		struct slab_magazine* tmp = cc->loaded;
+		cc->loaded = cc->previous;
+		cc->previous = tmp;
+		obj = cc->loaded->objs[--cc->loaded->rounds];
+	} else {
+		// both magazines are empty, trade one for a full magazine from the depot
+		lock_cache(cache, &cache->depot_lock);
+
+		struct slab_magazine* full = pop_magazine(&cache->depot_full, &cache->depot_full_count);
+		if (full) {
+			if (cc->previous)
+				push_magazine(&cache->depot_empty, &cache->depot_empty_count, cc->previous);
+			cc->previous = cc->loaded;
+			cc->loaded = full;
+			obj = full->objs[--full->rounds];
+			++cache->refills;
+		}
+
+		spinlock_release(&cache->depot_lock);
+	}
+
+	if (obj)
+		++cc->hits;
+	else
+		++cc->misses;
+
+	interrupt_set(istate);
+	return obj;
+}
+
+static bool magazine_free(struct scache* cache, void* obj) {
+	bool istate = interrupt_set(false);
+	struct slab_cpu_cache* cc = cpu_cache(cache);
+
+	for (;;) {
+		if (cc->loaded && cc->loaded->rounds < SLAB_MAGAZINE_SIZE)
+			break;
+
+		if (cc->previous && cc->previous->rounds == 0) {
+			struct slab_magazine* tmp = cc->loaded;
+			cc->loaded = cc->previous;
+			cc->previous = tmp;
+			break;
+		}
+
+		// both magazines are full (or missing), trade one for an empty magazine from the depot
+		lock_cache(cache, &cache->depot_lock);
+
+		struct slab_magazine* empty = pop_magazine(&cache->depot_empty, &cache->depot_empty_count);
+		if (empty) {
+			if (cc->previous)
+				push_magazine(&cache->depot_full, &cache->depot_full_count, cc->previous);
+			cc->previous = cc->loaded;
+			cc->loaded = empty;
+			++cache->refills;
+		}
+
+		bool depot_full = cache->depot_full_count >= SLAB_DEPOT_LIMIT;
+		spinlock_release(&cache->depot_lock);
+
+		if (empty)
+			break;
+
+		if (depot_full) {
+			interrupt_set(istate);
+			return false;
+		}
+
+		// the depot ran dry, allocate a new magazine with interrupts enabled and retry
+		interrupt_set(istate);
+
+		empty = cache_alloc(&magazine_cache);
+		if (empty == nullptr)
+			return false;
+		empty->rounds = 0;
+
+		// the depot lock is only ever held with interrupts disabled
+		istate = interrupt_set(false);
+		cc = cpu_cache(cache);
+
+		lock_cache(cache, &cache->depot_lock);
+		push_magazine(&cache->depot_empty, &cache->depot_empty_count, empty);
+		spinlock_release(&cache->depot_lock);
+	}
+
+	cc->loaded->objs[cc->loaded->rounds++] = obj;
+
+	interrupt_set(istate);
+	return true;
+}
+
+// returns all objects of the magazine to the slab layer
+static void drain_magazine(struct scache* cache, struct slab_magazine* magazine) {
+	while (magazine->rounds)
+		cache_free(cache, magazine->objs[--magazine->rounds]);
+	cache_free(&magazine_cache, magazine);
+}
+
+void* slab_alloc(struct scache* cache) {
+	void* obj = nullptr;
+	if (cache->cpu_index != SLAB_NO_CPU_CACHE)
+		obj = magazine_alloc(cache);
+
+	return obj ? obj : cache_alloc(cache);
+}
+
+static int take_cpu_index(void) {
+	uint64_t used = __atomic_load_n(&cpu_index_used, __ATOMIC_RELAXED);
+	for (;;) {
+		if (used == UINT64_MAX)
+			return SLAB_NO_CPU_CACHE;
+
+		int index = __builtin_ctzl(~used);
+		if (index >= SLAB_MAX_CPU_CACHES)
+			return SLAB_NO_CPU_CACHE;
+
+		if (__atomic_compare_exchange_n(&cpu_index_used, &used, used | (1ul << index), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			return index;
+	}
+}
+
+static void put_cpu_index(int index) {
+	__atomic_and_fetch(&cpu_index_used, ~(1ul << index), __ATOMIC_RELEASE);
+}
+
+void slab_free(struct scache* cache, void* addr) {
+	if (cache->dtor)
+		cache->dtor(cache, addr);
+
+	if (cache->cpu_index != SLAB_NO_CPU_CACHE && magazine_free(cache, addr))
+		return;
+
+	cache_free(cache, addr);
+}
+
+struct scache* slab_newcache(const char* name, size_t size, size_t align, void (*ctor)(struct scache* , void*), void (*dtor)(struct scache* , void*)) {
 	if (align == 0)
 		align = 8;
 
@@ -225,6 +429,7 @@ struct scache* slab_newcache(size_t size, size_t align, void (*ctor)(struct scac
 	if (cache == nullptr)
 		return nullptr;
 
+	cache->name = name;
 	cache->size = size;
 	cache->align = align;
 	size_t freeptrsize = size < SLAB_INDIRECT_CUTOFF ? sizeof(void**) : 0;
@@ -237,39 +442,221 @@ struct scache* slab_newcache(size_t size, size_t align, void (*ctor)(struct scac
 	cache->partial = nullptr;
 	spinlock_init(cache->lock);
 
-	klog(DEBUG, "new cache: size: %lu -- align: %lu -- true_size: %lu -- objcount: %lu", cache->size, cache->align, cache->true_size, cache->slab_obj_count);
+	spinlock_init(cache->depot_lock);
+	cache->depot_full = nullptr;
+	cache->depot_empty = nullptr;
+	cache->depot_full_count = 0;
+	cache->depot_empty_count = 0;
+	cache->refills = 0;
+	cache->contention = 0;
+
+	cache->cpu_index = take_cpu_index();
+
+	mutex_acquire(&cache_list_lock);
+	cache->next = cache_list;
+	cache_list = cache;
+	mutex_release(&cache_list_lock);
+
+	klog(DEBUG, "new cache %s: size: %lu -- align: %lu -- true_size: %lu -- objcount: %lu", cache->name, cache->size, cache->align, cache->true_size, cache->slab_obj_count);
 
 	return cache;
 }
 
-static size_t purge(struct scache* cache, size_t maxcount){
-	struct slab* slab = cache->empty;
-	for (size_t done = 0; done < maxcount; ++done) {
-		if (slab == nullptr)
-			return done;
+// detaches up to `maxcount` empty slabs, cache->lock must be held
+static struct slab* take_empty(struct scache* cache, size_t maxcount) {
+	struct slab* taken = nullptr;
+	for (size_t done = 0; done < maxcount && cache->empty; ++done) {
+		struct slab* slab = cache->empty;
+		cache->empty = slab->next;
+		if (cache->empty)
+			cache->empty->prev = nullptr;
+
+		slab->next = taken;
+		taken = slab;
+		__atomic_sub_fetch(&empty_slab_pages, slab_pages(cache), __ATOMIC_RELAXED);
+	}
+
+	return taken;
+}
 
+// unmaps slabs detached by take_empty() and returns the number of pages released
+static size_t purge(struct scache* cache, struct slab* slab) {
+	size_t pages = 0;
+	while (slab) {
 		struct slab* next = slab->next;
-		if (next)
-			next->prev = nullptr;
 
 		if (cache->size >= SLAB_INDIRECT_CUTOFF)
 			vmm_unmap(slab->base, cache->slab_obj_count * cache->true_size, 0);
 
 		vmm_unmap(slab, PAGE_SIZE, 0);
 
-		slab = cache->empty;
-		cache->empty = next;
+		pages += slab_pages(cache);
+		slab = next;
 	}
 
-	return maxcount;
+	return pages;
 }
 
 void slab_freecache(struct scache* cache) {
+	mutex_acquire(&cache_list_lock);
+	struct scache** link = &cache_list;
+	while (*link != cache)
+		link = &(*link)->next;
+	*link = cache->next;
+	mutex_release(&cache_list_lock);
+
+	// the cache is no longer used by anyone, so the magazines of every cpu can be taken from here
+	struct slab_magazine* cpu_magazines = nullptr;
+	bool istate = spinlock_acquire_irqsave(&cache->depot_lock);
+
+	if (cache->cpu_index != SLAB_NO_CPU_CACHE) {
+		for (unsigned i = 0; i < smp_cpus_awake; i++) {
+			struct slab_cpu_cache* cc = &smp_get_cpu(i)->slab_caches[cache->cpu_index];
+			if (cc->loaded) {
+				cc->loaded->next = cpu_magazines;
+				cpu_magazines = cc->loaded;
+			}
+			if (cc->previous) {
+				cc->previous->next = cpu_magazines;
+				cpu_magazines = cc->previous;
+			}
+
+			// the slot is handed to the next cache created
+			*cc = (struct slab_cpu_cache){};
+		}
+	}
+
+	struct slab_magazine* full_magazines = cache->depot_full;
+	struct slab_magazine* empty_magazines = cache->depot_empty;
+	size_t full_count = cache->depot_full_count;
+	size_t empty_count = cache->depot_empty_count;
+	cache->depot_full = cache->depot_empty = nullptr;
+	cache->depot_full_count = cache->depot_empty_count = 0;
+
+	spinlock_release_irqrestore(&cache->depot_lock, istate);
+
+	if (cache->cpu_index != SLAB_NO_CPU_CACHE)
+		put_cpu_index(cache->cpu_index);
+
+	while (cpu_magazines) {
+		struct slab_magazine* next = cpu_magazines->next;
+		drain_magazine(cache, cpu_magazines);
+		cpu_magazines = next;
+	}
+
+	struct slab_magazine* magazine;
+	while ((magazine = pop_magazine(&full_magazines, &full_count)))
+		drain_magazine(cache, magazine);
+	while ((magazine = pop_magazine(&empty_magazines, &empty_count)))
+		drain_magazine(cache, magazine);
+
 	spinlock_acquire(&cache->lock);
 	assert(cache->partial == nullptr);
 	assert(cache->full == nullptr);
 
-	purge(cache, (size_t)-1);
+	struct slab* empty = take_empty(cache, (size_t)-1);
+	spinlock_release(&cache->lock);
+
+	purge(cache, empty);
 
 	slab_free(&self_cache, cache);
 }
+
+static size_t count_objects(struct slab* slab) {
+	size_t count = 0;
+	for (; slab; slab = slab->next)
+		count += slab->used;
+	return count;
+}
+
+static size_t count_slabs(struct slab* slab) {
+	size_t count = 0;
+	for (; slab; slab = slab->next)
+		count++;
+	return count;
+}
+
+void slab_dump_info(void) {
+	klog(INFO, "slabinfo: name, objsize, active/total objs, slabs, hits, misses, refills, contention, depot full/empty");
+
+	mutex_acquire(&cache_list_lock);
+
+	for (struct scache* cache = cache_list; cache; cache = cache->next) {
+		uintmax_t hits = 0, misses = 0;
+		if (cache->cpu_index != SLAB_NO_CPU_CACHE) {
+			for (unsigned i = 0; i < smp_cpus_awake; i++) {
+				struct slab_cpu_cache* cc = &smp_get_cpu(i)->slab_caches[cache->cpu_index];
+				hits += __atomic_load_n(&cc->hits, __ATOMIC_RELAXED);
+				misses += __atomic_load_n(&cc->misses, __ATOMIC_RELAXED);
+			}
+		}
+
+		spinlock_acquire(&cache->lock);
+		size_t active = count_objects(cache->partial) + count_objects(cache->full);
+		size_t slabs = count_slabs(cache->partial) + count_slabs(cache->full) + count_slabs(cache->empty);
+		spinlock_release(&cache->lock);
+
+		klog(INFO, "  %s: %zu, %zu/%zu, %zu, %lu, %lu, %lu, %lu, %zu/%zu",
+			cache->name, cache->size, active, slabs * cache->slab_obj_count, slabs, hits, misses,
+			__atomic_load_n(&cache->refills, __ATOMIC_RELAXED), __atomic_load_n(&cache->contention, __ATOMIC_RELAXED),
+			cache->depot_full_count, cache->depot_empty_count);
+	}
+
+	mutex_release(&cache_list_lock);
+}
+
+static size_t shrinker_count(struct shrinker* shrinker __unused) {
+	return __atomic_load_n(&empty_slab_pages, __ATOMIC_RELAXED) + __atomic_load_n(&depot_magazines, __ATOMIC_RELAXED);
+}
+
+// flushes the magazine depots and unmaps empty slabs; unmapping sleeps, so direct reclaim is skipped
+static size_t shrinker_scan(struct shrinker* shrinker __unused, struct shrink_control* sc) {
+	if (sc->direct)
+		return 0;
+
+	size_t freed = 0;
+
+	mutex_acquire(&cache_list_lock);
+
+	// magazine_cache is the last entry, so its slabs emptied by the drains below get purged in the same pass
+	for (struct scache* cache = cache_list; cache && freed < sc->nr_to_scan; cache = cache->next) {
+		struct slab_magazine* full = nullptr;
+		struct slab_magazine* empty = nullptr;
+		size_t full_count = 0, empty_count = 0;
+
+		bool istate = spinlock_acquire_irqsave(&cache->depot_lock);
+		full = cache->depot_full;
+		empty = cache->depot_empty;
+		full_count = cache->depot_full_count;
+		empty_count = cache->depot_empty_count;
+		cache->depot_full = cache->depot_empty = nullptr;
+		cache->depot_full_count = cache->depot_empty_count = 0;
+		spinlock_release_irqrestore(&cache->depot_lock, istate);
+
+		struct slab_magazine* magazine;
+		while ((magazine = pop_magazine(&full, &full_count)))
+			drain_magazine(cache, magazine);
+		while ((magazine = pop_magazine(&empty, &empty_count)))
+			drain_magazine(cache, magazine);
+
+		lock_cache(cache, &cache->lock);
+		size_t per_slab = slab_pages(cache);
+		struct slab* slabs = take_empty(cache, ROUND_UP_DIV(sc->nr_to_scan - freed, per_slab));
+		spinlock_release(&cache->lock);
+
+		freed += purge(cache, slabs);
+	}
+
+	mutex_release(&cache_list_lock);
+	return freed;
+}
+
+static struct shrinker slab_shrinker = {
+	.name = "slab",
+	.count = shrinker_count,
+	.scan = shrinker_scan
+};
+
+void slab_shrinker_init(void) {
+	shrinker_register(&slab_shrinker);
+}
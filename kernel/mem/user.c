@@ -1,8 +1,11 @@
 #include <memory.h>
 
 #include <mem/user.h>
+#include <mem/page.h>
+#include <mem/vmm.h>
 #include <cpu/cpu.h>
 #include <sys/thread.h>
+#include <assert.h>
 #include <errno.h>
 
 //
@@ -78,3 +81,95 @@ int user_strlen(const char* user_str, size_t* size) {
     return _context_save_and_call(_strlen, nullptr, &desc);
 }
 
+
+//
+// page pinning
+//
+
+struct touch_desc {
+    uint8_t* start;
+    size_t count;
+    bool write;
+};
+
+// faults every page of the buffer in, for writing if the kernel is going to write to it
+static void _touch(struct cpu_context* ctx, void* userp) {
+    struct touch_desc* desc = userp;
+
+    for(size_t i = 0; i < desc->count; i++) {
+        uint8_t* byte = desc->start + i * PAGE_SIZE;
+
+        // a locked no-op write breaks copy-on-write sharing without racing with the user's stores
+        if(desc->write)
+            __atomic_fetch_add(byte, 0, __ATOMIC_RELAXED);
+        else
+            (void) *(volatile uint8_t*) byte;
+    }
+
+    CPU_RET(ctx) = 0;
+}
+
+int user_pin_pages(void* user_addr, size_t count, bool write, struct page** pages) {
+    assert((uintptr_t) user_addr % PAGE_SIZE == 0);
+
+    uint8_t* start = user_addr;
+    if(!count)
+        return 0;
+    if(!is_userspace_addr(start) || !is_userspace_addr(start + count * PAGE_SIZE - 1))
+        return EFAULT;
+
+    struct vmm_space* space = vmm_get_space(start);
+    page_table_ptr_t table = current_vmm_context()->page_table;
+
+    struct touch_desc desc = {
+        .start = start,
+        .count = count,
+        .write = write
+    };
+
+    for(int attempt = 0;; attempt++) {
+        int err = _context_save_and_call(_touch, nullptr, &desc);
+        if(err)
+            return err;
+
+        size_t pinned = 0;
+
+        mutex_acquire(&space->lock);
+
+        for(; pinned < count; pinned++) {
+            void* addr = start + pinned * PAGE_SIZE;
+
+            // frames inside huge pages are not reference counted on their own
+            if(mmu_get_page_size(table, addr) != PAGE_SIZE) {
+                err = ENOTSUP;
+                break;
+            }
+
+            if(!mmu_is_present(table, addr) || (write && !mmu_is_writable(table, addr)))
+                break;
+
+            void* phys = mmu_get_physical(table, addr);
+            pmm_hold(phys);
+            pages[pinned] = pmm_page(phys);
+        }
+
+        mutex_release(&space->lock);
+
+        if(pinned == count)
+            return 0;
+
+        user_unpin_pages(pages, pinned);
+
+        if(err)
+            return err;
+
+        // another thread unmapped or protected part of the buffer in between
+        if(attempt)
+            return EFAULT;
+    }
+}
+
+void user_unpin_pages(struct page** pages, size_t count) {
+    for(size_t i = 0; i < count; i++)
+        page_release(pages[i]);
+}
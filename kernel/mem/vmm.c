@@ -5,6 +5,8 @@
 #include <mem/page.h>
 
 #include <filesystem/vfs.h>
+#include <cpu/interrupts.h>
+#include <cpu/smp.h>
 #include <sys/proc.h>
 #include <sys/thread.h>
 
@@ -13,10 +15,10 @@
 #include <math.h>
 #include <cdefs.h>
 #include <string.h>
-#include <hashtable.h>
 #include <kernelio.h>
 
 #define RANGE_TOP(range) ((void*) ((uintptr_t) (range)->start + (range)->size))
+#define NODE_RANGE(rb) rb_entry_safe((rb), struct vmm_range, node)
 
 struct vmm_context vmm_kernel_context;
 struct vmm_space vmm_kernel_space = {
@@ -31,28 +33,31 @@ extern uint8_t _RODATA_END_[];
 extern uint8_t _DATA_START_[];
 extern uint8_t _DATA_END_[];
 
-struct scache* page_meta_cache;
-
-struct hashtable_t* page_meta_table;
-
-static struct vmm_cache* cache_list;
 static struct scache* ctx_cache;
 
-static struct vmm_cache* new_cache(void);
+// range descriptors are carved out of hhdm pages: taking them from a slab cache would recurse into vmm_map().
+// Free descriptors not held by a cpu magazine are linked through `next`.
+static struct vmm_range* free_ranges;
+static size_t free_range_pages;
+static spinlock_t free_ranges_lock;
 
 static void free_range(struct vmm_range* range);
 static struct vmm_range* alloc_range(void);
-static void* get_free_range(struct vmm_space* space, void* addr, size_t offset);
+static void* get_free_range(struct vmm_space* space, void* addr, size_t size, size_t align);
 static void insert_range(struct vmm_space* space, struct vmm_range* range);
-static int change_map(struct vmm_space* space, void* addr, size_t size, bool free, enum vmm_flags flags, enum mmu_flags new_mmu_flags);
+static void remove_range(struct vmm_space* space, struct vmm_range* range);
+static void update_gap(struct vmm_space* space, struct vmm_range* range);
+static int change_map(struct vmm_space* space, void* addr, size_t size, bool free, enum vmm_flags flags, enum mmu_flags new_mmu_flags, struct mmu_tlb_batch* batch);
+static size_t unmap_pages(void* start, size_t size, bool release);
 
 void vmm_init(struct mmap* mmap) {
     mutex_init(&vmm_kernel_space.lock);
     mutex_init(&vmm_kernel_space.pflock);
 
-    cache_list = new_cache();
+    spinlock_init(free_ranges_lock);
+
     vmm_kernel_context.page_table = mmu_new_table();
-    assert(cache_list && vmm_kernel_context.page_table);
+    assert(vmm_kernel_context.page_table);
 
     vmm_kernel_context.space.start = USERSPACE_START;
     vmm_kernel_context.space.end = USERSPACE_END;
@@ -72,8 +77,6 @@ void vmm_init(struct mmap* mmap) {
     
     // null page
     vmm_map(MAKE_HHDM((void*) nullptr), PAGE_SIZE, VMM_FLAGS_EXACT, MMU_FLAGS_NOEXEC, nullptr);
-
-    page_meta_cache = slab_newcache(sizeof(struct page), alignof(struct page), nullptr, nullptr);
 }
 
 void vmm_apinit(void) {
@@ -89,6 +92,11 @@ static void ctx_ctor(struct scache* cache __unused, void* obj) {
     mutex_init(&ctx->space.lock);
     mutex_init(&ctx->space.pflock);
     ctx->space.ranges = nullptr;
+    ctx->space.tree.root = nullptr;
+    ctx->space.vsz = 0;
+    ctx->space.rss = 0;
+
+    memset(&ctx->active_cpus, 0, sizeof(struct mmu_cpu_set));
 }
 
 // dtor as alias to ctor
@@ -96,7 +104,7 @@ static void (*ctx_dtor)(struct scache*, void*) = &ctx_ctor;
 
 struct vmm_context* vmm_context_new(void) { 
     if(!ctx_cache)
-        assert(ctx_cache = slab_newcache(sizeof(struct vmm_context), 0, ctx_ctor, ctx_dtor));
+        assert(ctx_cache = slab_newcache("vmm_context", sizeof(struct vmm_context), 0, ctx_ctor, ctx_dtor));
 
     struct vmm_context* ctx = slab_alloc(ctx_cache);
     if(!ctx)
@@ -106,6 +114,8 @@ struct vmm_context* vmm_context_new(void) {
         slab_free(ctx_cache, ctx);
         return nullptr;
     }
+
+    ctx->asid = mmu_asid_alloc();
     
     memset(&ctx->brk, 0, sizeof(struct brk));
 
@@ -118,12 +128,22 @@ void vmm_context_destroy(struct vmm_context* context) {
     if(!context)
         return;
 
-    klog(WARN, "deleting VMM context at %p", context);
+    klog(DEBUG, "deleting VMM context at %p", context);
 
     struct vmm_context* old_ctx = current_vmm_context();
     vmm_switch_context(context);
     vmm_unmap(context->space.start, context->space.end - context->space.start, 0);
     vmm_switch_context(old_ctx);
+
+    // cpus that ran the space may still cache its translations and paging structures under the asid
+    if(context->asid != MMU_ASID_KERNEL) {
+        struct mmu_tlb_batch batch;
+        mmu_tlb_batch_init(&batch, context);
+        mmu_tlb_batch_add(&batch, nullptr, 0);
+        mmu_tlb_batch_flush(&batch);
+        mmu_asid_free(context->asid);
+    }
+
     mmu_destroy_table(context->page_table);
     slab_free(ctx_cache, context);
 }
@@ -138,6 +158,8 @@ struct vmm_context* vmm_context_fork(struct vmm_context* old) {
 
     memcpy(&new->brk, &old->brk, sizeof(struct brk));
 
+    // keeps other threads from faulting pages in (or sole-owner reusing them) while the tables are shared
+    mutex_acquire(&old->space.lock);
     mutex_acquire(&new->space.lock);
 
     struct vmm_range* range = old->space.ranges;
@@ -149,22 +171,16 @@ struct vmm_context* vmm_context_fork(struct vmm_context* old) {
         memcpy(new_range, range, sizeof(struct vmm_range));
 
         insert_range(&new->space, new_range);
+        new->space.vsz += range->size;
         if(range->flags & VMM_FLAGS_FILE)
             vop_hold(range->vnode);
 
-        for(uintptr_t off = 0; off < new_range->size; off += PAGE_SIZE) {
-            void* vaddr = (void*)((uintptr_t) new_range->start + off);
-            void* phys = mmu_get_physical(old->page_table, vaddr);
-            if(!phys)
-                continue;
-
-            if(!mmu_map(new->page_table, phys, vaddr, new_range->mmu_flags & ~MMU_FLAGS_WRITE))
-                goto error;
-
-            pmm_hold(phys);
-
-            mmu_remap(old->page_table, phys, vaddr, new_range->mmu_flags & ~MMU_FLAGS_WRITE);
-        }
+        // on failure, `pages` still counts what was shared so far and gets released with the new context
+        size_t pages;
+        bool ok = mmu_fork_range(new->page_table, old->page_table, new_range->start, new_range->size, &pages);
+        new->space.rss += pages;
+        if(!ok)
+            goto error;
 
         range = range->next;
     }
@@ -172,20 +188,47 @@ struct vmm_context* vmm_context_fork(struct vmm_context* old) {
     mmu_invalidate_range(nullptr, 0);
 
     mutex_release(&new->space.lock);
+    mutex_release(&old->space.lock);
     return new;
     
 error:
+    // entries of the old table may already be write-protected
+    mmu_invalidate_range(nullptr, 0);
+
     mutex_release(&new->space.lock);
+    mutex_release(&old->space.lock);
     vmm_context_destroy(new);
     return nullptr;
 }
 
+// address space a shootdown in `space` targets, nullptr for the kernel's shared by all of them
+static struct vmm_context* space_context(struct vmm_space* space) {
+    if(space == &vmm_kernel_space)
+        return nullptr;
+
+    return (struct vmm_context*) ((uintptr_t) space - offsetof(struct vmm_context, space));
+}
+
 void vmm_switch_context(struct vmm_context* context) {
+    bool int_status = interrupt_set(false);
+
     struct thread* thread = current_thread();
     if(thread)
         thread->vmm_context = context;
-    _cpu()->vmm_context = context;
-    mmu_switch(context->page_table);
+
+    struct cpu* cpu = _cpu();
+    struct vmm_context* old = cpu->vmm_context;
+
+    // join the new set before loading the table, so no shootdown in between can miss this cpu
+    mmu_cpu_set_add(&context->active_cpus, cpu->id);
+    cpu->vmm_context = context;
+    mmu_switch_asid(context->page_table, context->asid);
+
+    // with ASIDs the old space's entries outlive the switch, the cpu leaves its set on the next shootdown
+    if(old && old != context && !mmu_asids_enabled())
+        mmu_cpu_set_remove(&old->active_cpus, cpu->id);
+
+    interrupt_set(int_status);
 }
 
 void* vmm_map(void* addr, size_t size, enum vmm_flags flags, enum mmu_flags mmu_flags, void* private) {
@@ -205,10 +248,16 @@ void* vmm_map(void* addr, size_t size, enum vmm_flags flags, enum mmu_flags mmu_
     if(!space)
         return nullptr;
 
+    // large anonymous and physical mappings get huge pages automatically
+    if((flags & (VMM_FLAGS_ALLOCATE | VMM_FLAGS_PHYSICAL)) && size >= MMU_PAGE_SIZE_2M)
+        flags |= VMM_FLAGS_HUGE;
+
+    size_t align = (flags & VMM_FLAGS_HUGE) && !(flags & VMM_FLAGS_EXACT) ? MMU_PAGE_SIZE_2M : PAGE_SIZE;
+
     mutex_acquire(&space->lock);
     struct vmm_range* range = nullptr;
 
-    void* start = get_free_range(space, addr, size);
+    void* start = get_free_range(space, addr, size, align);
     void* ret_addr = nullptr;
 
     if(((flags & VMM_FLAGS_EXACT) && start != addr) || !start)
@@ -232,43 +281,66 @@ void* vmm_map(void* addr, size_t size, enum vmm_flags flags, enum mmu_flags mmu_
     }
 
     if(flags & VMM_FLAGS_PHYSICAL) {
-        for(uintmax_t i = 0; i < size; i += PAGE_SIZE) {
-            if(mmu_map(_cpu()->vmm_context->page_table, (void*)((uintptr_t) private + i), (void*)((uintptr_t) start + i), mmu_flags))
+        for(uintmax_t i = 0; i < size;) {
+            void* vaddr = (void*)((uintptr_t) start + i);
+            void* paddr = (void*)((uintptr_t) private + i);
+            size_t page_size = flags & VMM_FLAGS_HUGE ? mmu_huge_page_size(vaddr, paddr, size - i) : PAGE_SIZE;
+
+            bool mapped = page_size > PAGE_SIZE
+                ? mmu_map_huge(_cpu()->vmm_context->page_table, paddr, vaddr, page_size, mmu_flags)
+                : mmu_map(_cpu()->vmm_context->page_table, paddr, vaddr, mmu_flags);
+
+            if(mapped) {
+                i += page_size;
                 continue;
-                
-            for(uintmax_t j = 0; j < size; j += PAGE_SIZE)
-                mmu_unmap(_cpu()->vmm_context->page_table, (void*)((uintptr_t) start + j)) ;
+            }
 
+            unmap_pages(start, i, false);
+            mmu_invalidate_range(start, size);
             goto cleanup;
         }
     }
     else if(flags & VMM_FLAGS_ALLOCATE) {
-        for(uintmax_t i = 0; i < size; i += PAGE_SIZE) {
-            void* allocated = pmm_alloc_page(PMM_SECTION_DEFAULT);
-            if(!allocated)
+        for(uintmax_t i = 0; i < size;) {
+            void* vaddr = (void*)((uintptr_t) start + i);
+            size_t page_size = PAGE_SIZE;
+            void* allocated = nullptr;
+
+            // buddy blocks are naturally aligned, so 2 MiB worth of frames form a huge page
+            if((flags & VMM_FLAGS_HUGE) && (uintptr_t) vaddr % MMU_PAGE_SIZE_2M == 0 && size - i >= MMU_PAGE_SIZE_2M
+                && (allocated = pmm_try_alloc(MMU_PAGE_SIZE_2M / PAGE_SIZE, PMM_SECTION_DEFAULT))) {
+                page_size = MMU_PAGE_SIZE_2M;
+                memset(MAKE_HHDM(allocated), 0, MMU_PAGE_SIZE_2M);
+            }
+            else if(!(allocated = pmm_alloc_page(PMM_SECTION_DEFAULT, true))) {
+                unmap_pages(start, i, true);
+                mmu_invalidate_range(start, size);
                 goto cleanup;
+            }
 
-            if(!mmu_map(_cpu()->vmm_context->page_table, allocated, (void*)((uintptr_t) start + i), mmu_flags)) {
-                for(uintmax_t j = 0; j < size; j += PAGE_SIZE) {
-                    void* virt = (void*)((uintptr_t) start + i);
-                    void* phys = mmu_get_physical(_cpu()->vmm_context->page_table, virt);
+            bool mapped = page_size > PAGE_SIZE
+                ? mmu_map_huge(_cpu()->vmm_context->page_table, allocated, vaddr, page_size, mmu_flags)
+                : mmu_map(_cpu()->vmm_context->page_table, allocated, vaddr, mmu_flags);
 
-                    if(phys) {
-                        pmm_release(phys);
-                        mmu_unmap(_cpu()->vmm_context->page_table, virt);
-                    }
-                }
+            if(!mapped) {
+                for(size_t j = 0; j < page_size; j += PAGE_SIZE)
+                    pmm_release((void*)((uintptr_t) allocated + j));
 
+                unmap_pages(start, i, true);
                 mmu_invalidate_range(start, size);
                 goto cleanup;
             }
 
-            memset(MAKE_HHDM(allocated), 0, PAGE_SIZE);
+            i += page_size;
         }
     }
 
     insert_range(space, range);
 
+    space->vsz += size;
+    if(flags & (VMM_FLAGS_ALLOCATE | VMM_FLAGS_PHYSICAL))
+        space->rss += size / PAGE_SIZE;
+
     ret_addr = start;
 
 cleanup:
@@ -294,10 +366,14 @@ void vmm_unmap(void* addr, size_t size, enum vmm_flags flags) {
     if(!space)
         return;
 
+    struct mmu_tlb_batch batch;
+    mmu_tlb_batch_init(&batch, space_context(space));
+
+    // revoke access first and flush once, so no cpu can still use a frame once it is freed
     mutex_acquire(&space->lock);
-    change_map(space, addr, size, false, flags, 0);
-    mmu_invalidate_range(addr, size);
-    change_map(space, addr, size, true, flags, 0);
+    change_map(space, addr, size, false, flags, 0, &batch);
+    mmu_tlb_batch_flush(&batch);
+    change_map(space, addr, size, true, flags, 0, nullptr);
     mutex_release(&space->lock);
 }
 
@@ -316,36 +392,19 @@ int vmm_change_mmu_flags(void* addr, size_t size, enum mmu_flags mmu_flags, enum
     if(!space)
         return ENOMEM;
 
+    struct mmu_tlb_batch batch;
+    mmu_tlb_batch_init(&batch, space_context(space));
+
     mutex_acquire(&space->lock);
 
-    int err = change_map(space, addr, size, false, flags, mmu_flags);
-    mmu_invalidate_range(addr, size);
+    int err = change_map(space, addr, size, false, flags, mmu_flags, &batch);
+    mmu_tlb_batch_flush(&batch);
 
     mutex_release(&space->lock);
 
     return err;
 }
 
-static struct vmm_cache* new_cache(void) {
-    struct vmm_cache* ptr = pmm_alloc_page(PMM_SECTION_DEFAULT);
-    if(!ptr)
-        return nullptr;
-
-    ptr = MAKE_HHDM(ptr);
-    ptr->header.free_count = VMM_RANGES_PER_CACHE;
-    ptr->header.first_free = 0;
-    ptr->header.next = nullptr;
-
-    mutex_init(&ptr->header.lock);
-
-    for(uintmax_t i = 0; i < VMM_RANGES_PER_CACHE; i++) {
-        ptr->ranges[i].size = 0;
-        ptr->ranges[i].next = nullptr;
-    }
-
-    return ptr;
-}
-
 struct vmm_space* vmm_get_space(void* vaddr) {
     if(USERSPACE_START <= vaddr && vaddr < USERSPACE_END)
         return &_cpu()->vmm_context->space;
@@ -356,197 +415,313 @@ struct vmm_space* vmm_get_space(void* vaddr) {
 }
 
 struct vmm_range* vmm_get_range(struct vmm_space* space, void* addr) {
-    struct vmm_range* range = space->ranges;
-    while(range) {
-        if(addr >= range->start && addr < RANGE_TOP(range))
-            break;
-        range = range->next;
+    struct rb_node* node = space->tree.root;
+    while(node) {
+        struct vmm_range* range = NODE_RANGE(node);
+        if(addr < range->start)
+            node = node->left;
+        else if(addr >= RANGE_TOP(range))
+            node = node->right;
+        else
+            return range;
     }
-    return range;
+    return nullptr;
+}
+
+// first range ending above `addr`
+static struct vmm_range* range_above(struct vmm_space* space, void* addr) {
+    struct vmm_range* found = nullptr;
+    struct rb_node* node = space->tree.root;
+    while(node) {
+        struct vmm_range* range = NODE_RANGE(node);
+        if(addr < RANGE_TOP(range)) {
+            found = range;
+            node = node->left;
+        }
+        else
+            node = node->right;
+    }
+    return found;
+}
+
+#define ALIGN_ADDR(addr, align) ((void*) ROUND_UP((uintptr_t) (addr), (align)))
+
+// lowest `align`ed address >= `addr` in a gap in front of a range of this subtree; `addr` is aligned
+static void* find_gap(struct rb_node* node, void* addr, size_t size, size_t align) {
+    struct vmm_range* range = NODE_RANGE(node);
+    if(!range || range->subtree_gap < size)
+        return nullptr;
+
+    // gaps in the left subtree and in front of this range all end at `range->start`
+    if(addr < range->start) {
+        void* found = find_gap(node->left, addr, size, align);
+        if(found)
+            return found;
+
+        void* start = MAX(addr, ALIGN_ADDR((uintptr_t) range->start - range->gap, align));
+        if(start < range->start && (uintptr_t) range->start - (uintptr_t) start >= size)
+            return start;
+    }
+
+    return find_gap(node->right, addr, size, align);
 }
 
-static void* get_free_range(struct vmm_space* space, void* addr, size_t size) {
-    struct vmm_range* range = space->ranges;
+static void* get_free_range(struct vmm_space* space, void* addr, size_t size, size_t align) {
     if(!addr)
         addr = space->start;
 
-    if(!range)
-        return addr;
+    addr = ALIGN_ADDR(addr, align);
+
+    void* found = find_gap(space->tree.root, addr, size, align);
+    if(found)
+        return found;
+
+    // the space behind the last range is not tracked by any gap
+    struct vmm_range* last = NODE_RANGE(rb_last(&space->tree));
+    if(last && addr < RANGE_TOP(last))
+        addr = ALIGN_ADDR(RANGE_TOP(last), align);
 
-    if(range->start != space->start && addr < range->start && (uintptr_t) range->start - (uintptr_t) addr >= size)
+    if(addr < space->end && (uintptr_t) space->end - (uintptr_t) addr >= size)
         return addr;
 
-    while(range->next) {
-        void* range_top = RANGE_TOP(range);
-        if(addr < range_top)
-            addr = range_top;
+    return nullptr;
+}
+
+// unmaps [start, start + size), huge pages only partially covered get split; returns the number of pages unmapped
+static size_t unmap_pages(void* start, size_t size, bool release) {
+    page_table_ptr_t page_table = _cpu()->vmm_context->page_table;
+    size_t unmapped = 0;
 
-        if(addr < range->next->start) {
-            size_t free_size = (uintptr_t) range->next->start - (uintptr_t) addr;
-            if(free_size >= size)
-                return addr;
+    for(uintmax_t offset = 0; offset < size;) {
+        void* virt_addr = (void*) ((uintptr_t) start + offset);
+        size_t page_size = mmu_get_page_size(page_table, virt_addr);
+        if(!page_size) {
+            offset += PAGE_SIZE;
+            continue;
         }
 
-        range = range->next;
-    }
+        void* phys_addr = mmu_get_physical(page_table, virt_addr);
 
-    void* range_top = RANGE_TOP(range);
-    if(addr < range_top)
-        addr = range_top;
+        if(page_size > PAGE_SIZE && (uintptr_t) virt_addr % page_size == 0 && size - offset >= page_size)
+            mmu_unmap_huge(page_table, virt_addr, page_size);
+        else {
+            page_size = PAGE_SIZE;
+            mmu_unmap(page_table, virt_addr);
+        }
 
-    if(addr != space->end && (uintptr_t) space->end - (uintptr_t) addr >= size)
-        return addr;
+        // TODO: vfs caching if range->flags & VM_FLAGS_FILE and range is cacheable!
 
-    return nullptr;
-}
+        if(release) {
+            for(size_t i = 0; i < page_size; i += PAGE_SIZE)
+                pmm_release((void*)((uintptr_t) phys_addr + i));
+        }
 
-static uintmax_t get_entry_number(struct vmm_cache* cache) {
-    for(uintmax_t i = cache->header.first_free; i < VMM_RANGES_PER_CACHE; i++) {
-        if(cache->ranges[i].size == 0)
-            return i;
+        unmapped += page_size / PAGE_SIZE;
+        offset += page_size;
     }
-     
-    // get_entry_number() called on full cache
-    unreachable();
+
+    return unmapped;
 }
 
-static void destroy_range(struct vmm_range* range, uintmax_t start_offset, size_t size, int flags __unused) {
-    uintmax_t top = start_offset + size;
+static void destroy_range(struct vmm_space* space, struct vmm_range* range, uintmax_t start_offset, size_t size, int flags __unused) {
+    space->rss -= unmap_pages((void*) ((uintptr_t) range->start + start_offset), size, (range->flags & VMM_FLAGS_PHYSICAL) == 0);
+    space->vsz -= size;
 
-    for(uintmax_t offset = start_offset; offset < top; offset += PAGE_SIZE) {
-        void* virt_addr = (void*) ((uintptr_t) range->start + offset);
-        void* phys_addr = mmu_get_physical(_cpu()->vmm_context->page_table, virt_addr);
+    if((range->flags & VMM_FLAGS_FILE) && range->size == size)
+        vop_release(&range->vnode);
+}
 
-        if(!phys_addr)
-            continue;
+// free_ranges_lock must be held; carves a new page into descriptors when the free list ran dry
+static bool refill_magazine(struct vmm_range_magazine* mag) {
+    if(!free_ranges) {
+        void* phys = pmm_try_alloc(1, PMM_SECTION_DEFAULT);
+        if(!phys)
+            return false;
+
+        struct vmm_range* ranges = MAKE_HHDM(phys);
+        for(size_t i = 0; i < PAGE_SIZE / sizeof(struct vmm_range); i++) {
+            ranges[i].next = free_ranges;
+            free_ranges = &ranges[i];
+        }
 
-        /*struct thread* thread = current_thread();
-        struct proc* proc = current_proc();
-        struct cred* cred = proc ? &proc->cred : nullptr;*/
+        free_range_pages++;
+    }
 
-        // TODO: vfs caching if range->flags & VM_FLAGS_FILE and range is cacheable!
-        
-        mmu_unmap(_cpu()->vmm_context->page_table, virt_addr);
-        if((range->flags & VMM_FLAGS_PHYSICAL) == 0)
-            pmm_release(phys_addr);
-        //    pmm_free_page(phys_addr); // FIXME: works ?
+    while(free_ranges && mag->count < VMM_RANGE_MAGAZINE_BATCH) {
+        mag->ranges[mag->count++] = free_ranges;
+        free_ranges = free_ranges->next;
     }
 
-    if((range->flags & VMM_FLAGS_FILE) && range->size == size)
-        vop_release(&range->vnode);
+    mag->refills++;
+    return true;
 }
 
 static void free_range(struct vmm_range* range) {
-    struct vmm_cache* cache = (struct vmm_cache*) ROUND_DOWN((uintptr_t) range, PAGE_SIZE);
-    mutex_acquire(&cache->header.lock);
+    bool istate = interrupt_set(false);
+    struct vmm_range_magazine* mag = &_cpu()->vmm_range_magazine;
+
+    if(mag->count == VMM_RANGE_MAGAZINE_SIZE) {
+        spinlock_acquire(&free_ranges_lock);
+
+        while(mag->count > VMM_RANGE_MAGAZINE_SIZE - VMM_RANGE_MAGAZINE_BATCH) {
+            struct vmm_range* flushed = mag->ranges[--mag->count];
+            flushed->next = free_ranges;
+            free_ranges = flushed;
+        }
+
+        spinlock_release(&free_ranges_lock);
+        mag->flushes++;
+    }
 
-    uintptr_t range_offset = ((uintptr_t) range - (uintptr_t) cache->ranges) / sizeof(struct vmm_range);
     range->size = 0;
-    cache->header.free_count++;
-    if(cache->header.first_free > range_offset)
-        cache->header.first_free = range_offset;
+    mag->ranges[mag->count++] = range;
+    mag->frees++;
 
-    mutex_release(&cache->header.lock);
+    interrupt_set(istate);
 }
 
 static struct vmm_range* alloc_range(void) {
-    struct vmm_cache* cache = cache_list;
     struct vmm_range* range = nullptr;
 
-    while(cache) {
-        mutex_acquire(&cache->header.lock);
-        if(cache->header.free_count > 0) {
-            cache->header.free_count--;
-            uintmax_t r = get_entry_number(cache);
-            cache->header.first_free = r + 1;
-            range = &cache->ranges[r];
-            range->size = -1;
-            mutex_release(&cache->header.lock);
-            break;
-        }
-        else if(!cache->header.next)
-            cache->header.next = new_cache();
+    bool istate = interrupt_set(false);
+    struct vmm_range_magazine* mag = &_cpu()->vmm_range_magazine;
 
-        struct vmm_cache* next = cache->header.next;
-        mutex_release(&cache->header.lock);
-        cache = next;
+    if(!mag->count) {
+        spinlock_acquire(&free_ranges_lock);
+        refill_magazine(mag);
+        spinlock_release(&free_ranges_lock);
     }
 
+    if(mag->count) {
+        range = mag->ranges[--mag->count];
+        mag->allocs++;
+    }
+
+    interrupt_set(istate);
     return range;
 }
 
-static void insert_range(struct vmm_space* space, struct vmm_range* new_range) {
-    struct vmm_range* range = space->ranges;
+void vmm_range_stats(struct vmm_range_stats* stats) {
+    memset(stats, 0, sizeof(struct vmm_range_stats));
 
-    if(!range) {
-        space->ranges = new_range;
-        new_range->next = nullptr;
-        new_range->prev = nullptr;
-        return;
+    for(unsigned i = 0; i < smp_cpus_awake; i++) {
+        struct vmm_range_magazine* mag = &smp_get_cpu(i)->vmm_range_magazine;
+        stats->allocs += __atomic_load_n(&mag->allocs, __ATOMIC_RELAXED);
+        stats->frees += __atomic_load_n(&mag->frees, __ATOMIC_RELAXED);
+        stats->refills += __atomic_load_n(&mag->refills, __ATOMIC_RELAXED);
+        stats->flushes += __atomic_load_n(&mag->flushes, __ATOMIC_RELAXED);
     }
 
-    void* new_range_top = RANGE_TOP(new_range);
+    stats->pages = __atomic_load_n(&free_range_pages, __ATOMIC_RELAXED);
+}
 
-    if(new_range_top <= range->start) {
-        space->ranges = new_range;
-        new_range->next = range;
-        range->prev = new_range;
-        new_range->prev = nullptr;
-        goto fragmentation_check;
-    }
+static void update_subtree_gap(struct rb_node* node) {
+    struct vmm_range* range = NODE_RANGE(node);
+    size_t gap = range->gap;
+    if(node->left)
+        gap = MAX(gap, NODE_RANGE(node->left)->subtree_gap);
+    if(node->right)
+        gap = MAX(gap, NODE_RANGE(node->right)->subtree_gap);
+    range->subtree_gap = gap;
+}
+
+// recomputes the gap in front of `range` after it or its predecessor changed
+static void update_gap(struct vmm_space* space, struct vmm_range* range) {
+    void* prev_top = range->prev ? RANGE_TOP(range->prev) : space->start;
+    range->gap = (uintptr_t) range->start - (uintptr_t) prev_top;
+    rb_propagate(&range->node, update_subtree_gap);
+}
+
+static void remove_range(struct vmm_space* space, struct vmm_range* range) {
+    if(range->prev)
+        range->prev->next = range->next;
+    else
+        space->ranges = range->next;
+
+    if(range->next)
+        range->next->prev = range->prev;
+
+    rb_erase(&space->tree, &range->node, update_subtree_gap);
+
+    if(range->next)
+        update_gap(space, range->next);
+}
+
+static __always_inline bool can_merge(struct vmm_range* lower, struct vmm_range* upper) {
+    return RANGE_TOP(lower) == upper->start && lower->flags == upper->flags && lower->mmu_flags == upper->mmu_flags
+        && ((lower->flags & VMM_FLAGS_FILE) == 0 || (lower->vnode == upper->vnode && lower->offset + lower->size == upper->offset));
+}
 
-    while(range->next) {
-        if(new_range->start >= RANGE_TOP(range) && new_range->start < range->next->start) {
-            new_range->next = range->next;
-            new_range->prev = range;
-            range->next = new_range;
-            goto fragmentation_check;
+static void insert_range(struct vmm_space* space, struct vmm_range* new_range) {
+    struct rb_node** link = &space->tree.root;
+    struct rb_node* parent = nullptr;
+    struct vmm_range* prev = nullptr;
+
+    while(*link) {
+        parent = *link;
+        if(new_range->start < NODE_RANGE(parent)->start)
+            link = &parent->left;
+        else {
+            prev = NODE_RANGE(parent);
+            link = &parent->right;
         }
-        range = range->next;
     }
 
-    range->next = new_range;
-    new_range->prev = range;
-    new_range->next = nullptr;
+    new_range->gap = 0;
+    new_range->subtree_gap = 0;
+    rb_insert(&space->tree, &new_range->node, parent, link, update_subtree_gap);
 
-fragmentation_check:
-    
-    if(new_range->next && new_range->next->start == new_range_top && new_range->flags == new_range->next->flags && new_range->mmu_flags == new_range->next->mmu_flags
-        && ((new_range->flags & VMM_FLAGS_FILE) == 0 || (new_range->vnode == new_range->next->vnode && new_range->offset + new_range->size == new_range->next->offset))) {
+    new_range->prev = prev;
+    new_range->next = prev ? prev->next : space->ranges;
+    if(new_range->next)
+        new_range->next->prev = new_range;
+
+    if(prev)
+        prev->next = new_range;
+    else
+        space->ranges = new_range;
+
+    update_gap(space, new_range);
+    if(new_range->next)
+        update_gap(space, new_range->next);
+
+    // fragmentation check
+    if(new_range->next && can_merge(new_range, new_range->next)) {
         struct vmm_range* old_range = new_range->next;
         new_range->size += old_range->size;
-        new_range->next = old_range->next;
-        if(old_range->next)
-            old_range->next->prev = new_range;
+        remove_range(space, old_range);
 
         free_range(old_range);
         if(new_range->flags & VMM_FLAGS_FILE)
             vop_release(&new_range->vnode);
     }
 
-    if(new_range->prev && RANGE_TOP(new_range->prev) == new_range->start && new_range->flags == new_range->prev->flags && new_range->mmu_flags == new_range->prev->mmu_flags
-        && ((new_range->flags & VMM_FLAGS_FILE) == 0 || (new_range->vnode == new_range->prev->vnode && new_range->prev->offset + new_range->prev->size == new_range->offset))) {
+    if(new_range->prev && can_merge(new_range->prev, new_range)) {
         struct vmm_range* old_range = new_range->prev;
         old_range->size += new_range->size;
-        old_range->next = new_range->next;
-
-        if(new_range->next)
-            new_range->next->prev = old_range;
+        remove_range(space, new_range);
 
         free_range(new_range);
         if(old_range->flags & VMM_FLAGS_FILE)
             vop_release(&old_range->vnode);
     }
-
 }
+
 #define CHANGE_MASK_CHECK(m, f, c, n) \
 	if (((n) & (f)) == 0 && ((c) & (f))) \
 			m |= f;
 
-static void change_mmu_range(struct vmm_range* range __unused, void* base, size_t size, enum mmu_flags new_flags) {
-    for(uintmax_t offset = 0; offset < size; offset += PAGE_SIZE) {
+static void change_mmu_range(struct vmm_range* range __unused, void* base, size_t size, enum mmu_flags new_flags, struct mmu_tlb_batch* batch) {
+    for(uintmax_t offset = 0; offset < size;) {
         void* address = (void*)((uintptr_t) base + offset);
 
+        // huge pages only partially covered by the change get split by mmu_remap()
+        size_t page_size = mmu_get_page_size(_cpu()->vmm_context->page_table, address);
+        if(page_size <= PAGE_SIZE || (uintptr_t) address % page_size || size - offset < page_size)
+            page_size = PAGE_SIZE;
+
+        offset += page_size;
+
         enum mmu_flags current_flags;
         if(!mmu_get_flags(_cpu()->vmm_context->page_table, address, &current_flags))
             continue;
@@ -561,8 +736,15 @@ static void change_mmu_range(struct vmm_range* range __unused, void* base, size_
 
         // TODO: handle cached vfs entries
         
-        if(mask)
+        if(!mask)
+            continue;
+
+        if(page_size > PAGE_SIZE)
+            mmu_remap_huge(_cpu()->vmm_context->page_table, physical, address, page_size, current_flags & ~mask);
+        else
             mmu_remap(_cpu()->vmm_context->page_table, physical, address, current_flags & ~mask);
+
+        mmu_tlb_batch_add(batch, address, page_size);
     }
 }
 
@@ -573,9 +755,10 @@ static __always_inline bool vnode_writable(struct vmm_range* range) {
     return err == 0;
 }
 
-static int change_map(struct vmm_space* space, void* addr, size_t size, bool free, enum vmm_flags __unused flags, enum mmu_flags new_mmu_flags) {
+// pages whose translation changed are collected in `batch`, the caller flushes it
+static int change_map(struct vmm_space* space, void* addr, size_t size, bool free, enum vmm_flags __unused flags, enum mmu_flags new_mmu_flags, struct mmu_tlb_batch* batch) {
     void* top = addr + size;
-    struct vmm_range* range = space->ranges;
+    struct vmm_range* range = range_above(space, addr);
     struct vmm_range* new_range = nullptr;
 
     if(!free) {
@@ -585,25 +768,30 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
     }
 
     int err = 0;
-    bool check_wr = !free && (range->flags & VMM_FLAGS_CREDCHECK) && (range->flags & VMM_FLAGS_SHARED) && (range->flags & VMM_FLAGS_FILE);
+    bool check_wr = !free && range && (range->flags & VMM_FLAGS_CREDCHECK) && (range->flags & VMM_FLAGS_SHARED) && (range->flags & VMM_FLAGS_FILE);
     
-    while(range) {
+    // ranges are sorted, nothing past `top` is affected
+    while(range && range->start < top) {
         assert(range != space->ranges || !range->prev);
         void* range_top = RANGE_TOP(range);
 
+        // nothing to split, re-inserting parts would merge them right back
+        if(!free && range->mmu_flags == new_mmu_flags) {
+            range = range->next;
+            continue;
+        }
+
         // change entire range
         if(range->start >= addr && range_top <= top) {
             if(free) {
-                if(range->prev)
-                    range->prev->next = range->next;
-                else
-                    space->ranges = range->next;
-
-                if(range->next)
-                    range->next->prev = range->prev;
+                struct vmm_range* next = range->next;
+                remove_range(space, range);
 
-                destroy_range(range, 0, range->size, 0);
+                destroy_range(space, range, 0, range->size, 0);
                 free_range(range);
+
+                range = next;
+                continue;
             }
             else {
                 if(check_wr && !vnode_writable(range)) {
@@ -611,7 +799,7 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
                     goto finish;
                 }
 
-                change_mmu_range(range, range->start, range->size, new_mmu_flags);
+                change_mmu_range(range, range->start, range->size, new_mmu_flags, batch);
                 range->mmu_flags = new_mmu_flags;
             }
         }
@@ -623,37 +811,33 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
             }
 
             struct vmm_range* new = alloc_range();
-            if(!range) {
+            if(!new) {
                 err = ENOMEM;
                 goto finish;
             }
 
             *new = *range;
             if(free)
-                destroy_range(range, (uintptr_t) addr - (uintptr_t) range->start, size, 0);
+                destroy_range(space, range, (uintptr_t) addr - (uintptr_t) range->start, size, 0);
 
             new->start = top;
             new->size = (uintptr_t) range_top - (uintptr_t) new->start;
             range->size = (uintptr_t) addr - (uintptr_t) range->start;
 
-            if(range->next)
-                range->next->prev = new;
-
-            new->prev = range;
-            range->next = new;
-
             if(range->flags & VMM_FLAGS_FILE) {
                 vop_hold(range->vnode);
                 new->offset += range->size + size;
             }
 
+            insert_range(space, new);
+
             if(!free) {
                 new_range->start = addr;
                 new_range->size = size;
                 new_range->flags = range->flags;
                 new_range->mmu_flags = new_mmu_flags;
 
-                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags);
+                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags, batch);
 
                 if(range->flags & VMM_FLAGS_FILE) {
                     new_range->vnode = range->vnode;
@@ -678,10 +862,11 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
 
             size_t diff = (uintptr_t) top - (uintptr_t) range->start;
             if(free)
-                destroy_range(range, 0, diff, 0);
+                destroy_range(space, range, 0, diff, 0);
 
             range->start = (void*)((uintptr_t) range->start + diff);
             range->size -= diff;
+            update_gap(space, range);
 
             if(range->flags & VMM_FLAGS_FILE)
                 range->offset += diff;
@@ -692,7 +877,7 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
                 new_range->flags = range->flags;
                 new_range->mmu_flags = new_mmu_flags;
 
-                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags);
+                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags, batch);
 
                 if(range->flags & VMM_FLAGS_FILE) {
                     new_range->vnode = range->vnode;
@@ -717,19 +902,22 @@ static int change_map(struct vmm_space* space, void* addr, size_t size, bool fre
 
             size_t diff = (uintptr_t) range_top - (uintptr_t) addr;
             range->size -= diff;
+            if(range->next)
+                update_gap(space, range->next);
+
             if(free)
-                destroy_range(range, range->size, diff, 0);
+                destroy_range(space, range, range->size, diff, 0);
             else {
-                new_range->start = (void*)((uintptr_t) range->start + diff);
+                new_range->start = addr;
                 new_range->size = diff;
                 new_range->flags = range->flags;
                 new_range->mmu_flags = new_mmu_flags;
 
-                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags);
+                change_mmu_range(range, new_range->start, new_range->size, new_range->mmu_flags, batch);
 
                 if(range->flags & VMM_FLAGS_FILE) {
                     new_range->vnode = range->vnode;
-                    new_range->offset = range->offset + diff;
+                    new_range->offset = range->offset + range->size;
                     vop_hold(range->vnode);
                 }
 
@@ -751,18 +939,3 @@ finish:
 
     return err;
 } 
-
-struct page* vmm_alloc_page_meta(void* physical_addr) {
-    assert(page_meta_cache != nullptr);
-
-    struct page* page = slab_alloc(page_meta_cache);
-    if(!page)
-        return nullptr;
-
-    memset(page, 0, sizeof(struct page));
-    page->physical_addr = physical_addr;
-    page->refcount = 1;
-
-    return page;
-}
-
@@ -1,123 +1,276 @@
 #include <mem/vmm.h>
 
 #include <mem/page.h>
+#include <mem/shrinker.h>
 #include <filesystem/vfs.h>
+#include <cpu/cpu.h>
+#include <cpu/interrupts.h>
+#include <sys/scheduler.h>
+#include <sys/semaphore.h>
+#include <sys/thread.h>
 #include <sys/timekeeper.h>
+#include <sys/timer.h>
 #include <sys/mutex.h>
-#include <sys/hash.h>
 
 #include <assert.h>
-#include <string.h>
 #include <errno.h>
+#include <kernelio.h>
+#include <math.h>
+#include <string.h>
 
-#define TABLE_SIZE 4096
+// lock order: vnode->writeback_lock, then vnode->pages_lock, then vnodes_lock or dirty_lock
 
-static mutex_t mutex;
-static semaphore_t sync;
+// radix tree tag of dirty pages
+#define TAG_DIRTY 0
 
-static struct page** table;
+// vnodes that have cached pages, the shrinker rotates through them
+static mutex_t vnodes_lock;
+static struct vnode* vnodes_head;
+static struct vnode* vnodes_tail;
 
-static struct page* dirty_pages;
+// vnodes with dirty pages, oldest first. Each one holds a reference to its vnode.
+static mutex_t dirty_lock;
+static struct vnode* dirty_head;
+static struct vnode* dirty_tail;
+static size_t dirty_vnodes;
 
 size_t cached_pages = 0;
+static size_t dirty_pages = 0;
 
-static uintptr_t get_entry(struct vnode* vnode, uintptr_t offset) {
-    struct {
-        struct vnode* vnode;
-        uintptr_t offset;
-    } tmp = { vnode, offset };
+static semaphore_t writeback_sem;
+static bool writeback_pending;
+static struct thread* writeback_thread;
+static struct timer_entry writeback_timer;
+static size_t writeback_background_pages;
+
+static struct vmm_writeback_stats writeback_stats;
 
-    return fnv1ahash(&tmp, sizeof(tmp)) % TABLE_SIZE;
+// pages become visible in the tree before they are filled; readers finding one sleep here until
+// the filler marks it READY or ERROR. Pages share buckets, so a wakeup only means "check again".
+#define PAGE_WAIT_BUCKETS 64
+
+static struct page_wait {
+    spinlock_t lock;
+    size_t waiters;
+    semaphore_t sem; // starts at 0, which is what zero-initialization gives
+} page_waits[PAGE_WAIT_BUCKETS];
+
+static __always_inline struct page_wait* page_wait_bucket(struct page* page) {
+    return &page_waits[(size_t) (page - pmm_pages) % PAGE_WAIT_BUCKETS];
 }
 
-static struct page* find_page(struct vnode* vnode, uintptr_t offset) {
-    uintptr_t entry = get_entry(vnode, offset);
+static __always_inline bool page_settled(struct page* page) {
+    return __atomic_load_n(&page->flags, __ATOMIC_ACQUIRE) & (PAGE_FLAGS_READY | PAGE_FLAGS_ERROR);
+}
 
-    struct page* page = table[entry];
-    while(page) {
-        if(page->backing == vnode && page->offset == offset)
-            break;
-        page = page->hash_next;
+static void wait_page(struct page* page) {
+    struct page_wait* wait = page_wait_bucket(page);
+
+    for(;;) {
+        bool istate = spinlock_acquire_irqsave(&wait->lock);
+        if(page_settled(page)) {
+            spinlock_release_irqrestore(&wait->lock, istate);
+            return;
+        }
+
+        wait->waiters++;
+        spinlock_release_irqrestore(&wait->lock, istate);
+
+        semaphore_wait(&wait->sem, false);
     }
+}
 
-    return page;
+// sets READY or ERROR on a page that was filled outside of pages_lock and wakes its waiters
+static void settle_page(struct page* page, enum page_flags flag) {
+    struct page_wait* wait = page_wait_bucket(page);
+    __atomic_or_fetch(&page->flags, flag, __ATOMIC_RELEASE);
+
+    bool istate = spinlock_acquire_irqsave(&wait->lock);
+    size_t waiters = wait->waiters;
+    wait->waiters = 0;
+    spinlock_release_irqrestore(&wait->lock, istate);
+
+    while(waiters--)
+        semaphore_signal(&wait->sem);
 }
 
-static void put_page(struct page* page) {
-    uintmax_t entry = get_entry(page->backing, page->offset);
+static void vnode_list_append(struct vnode* vnode) {
+    vnode->cache_next = nullptr;
+    vnode->cache_prev = vnodes_tail;
 
-    page->hash_prev = nullptr;
-    page->hash_next = table[entry];
-    if(table[entry])
-        table[entry]->hash_prev = page;
+    if(vnodes_tail)
+        vnodes_tail->cache_next = vnode;
+    else
+        vnodes_head = vnode;
 
-    table[entry] = page;
+    vnodes_tail = vnode;
+}
 
-    page->vnode_prev = nullptr;
-    page->vnode_next = page->backing->pages;
+static void vnode_list_remove(struct vnode* vnode) {
+    if(vnode->cache_next)
+        vnode->cache_next->cache_prev = vnode->cache_prev;
+    else
+        vnodes_tail = vnode->cache_prev;
 
-    if(page->backing->pages)
-        page->backing->pages->vnode_prev = page;
+    if(vnode->cache_prev)
+        vnode->cache_prev->cache_next = vnode->cache_next;
+    else
+        vnodes_head = vnode->cache_next;
 
-    page->backing->pages = page;
+    vnode->cache_next = nullptr;
+    vnode->cache_prev = nullptr;
+}
 
-    cached_pages++;
+// vnode->pages_lock must be held
+static int put_page(struct vnode* vnode, struct page* page) {
+    int err = radix_insert(&vnode->pages, page->offset / PAGE_SIZE, page);
+    if(err)
+        return err;
+
+    if(vnode->page_count++ == 0) {
+        mutex_acquire(&vnodes_lock);
+        vnode_list_append(vnode);
+        mutex_release(&vnodes_lock);
+    }
+
+    __atomic_add_fetch(&cached_pages, 1, __ATOMIC_RELAXED);
+    return 0;
 }
 
-static void remove_page(struct page* page) {
-    uintmax_t entry = get_entry(page->backing, page->offset);
+// vnode->pages_lock must be held; the cache's reference is left to the caller
+static void remove_page(struct vnode* vnode, struct page* page) {
+    struct page* removed = radix_delete(&vnode->pages, page->offset / PAGE_SIZE);
+    assert(removed == page);
+
+    if(--vnode->page_count == 0) {
+        mutex_acquire(&vnodes_lock);
+        vnode_list_remove(vnode);
+        mutex_release(&vnodes_lock);
+    }
 
-    // remove from table
-    if(page->hash_next)
-        page->hash_next->hash_prev = page->hash_prev;
-    
-    if(page->hash_prev)
-        page->hash_prev->hash_next = page->hash_next;
+    __atomic_sub_fetch(&cached_pages, 1, __ATOMIC_RELAXED);
+}
+
+static void dirty_list_append(struct vnode* vnode) {
+    vnode->dirty_next = nullptr;
+    vnode->dirty_prev = dirty_tail;
+
+    if(dirty_tail)
+        dirty_tail->dirty_next = vnode;
     else
-        table[entry] = page->hash_next;
+        dirty_head = vnode;
 
-    page->hash_next = nullptr;
-    page->hash_prev = nullptr;
+    dirty_tail = vnode;
+    dirty_vnodes++;
+}
 
-    // remove from vnode
-    if(page->vnode_next)
-        page->vnode_next->vnode_prev = page->vnode_prev;
+static void dirty_list_remove(struct vnode* vnode) {
+    if(vnode->dirty_next)
+        vnode->dirty_next->dirty_prev = vnode->dirty_prev;
+    else
+        dirty_tail = vnode->dirty_prev;
 
-    if(page->vnode_prev)
-        page->vnode_prev->vnode_next = page->vnode_next;
+    if(vnode->dirty_prev)
+        vnode->dirty_prev->dirty_next = vnode->dirty_next;
     else
-        page->backing->pages = page->vnode_next;
+        dirty_head = vnode->dirty_next;
+
+    vnode->dirty_next = nullptr;
+    vnode->dirty_prev = nullptr;
+    dirty_vnodes--;
+}
 
-    page->vnode_next = nullptr;
-    page->vnode_prev = nullptr;
+// vnode->pages_lock must be held. Returns true if this was the vnode's last dirty page: the vnode
+// left the dirty list and the caller has to drop the list's reference once the lock is released.
+static bool undirty_page(struct vnode* vnode, struct page* page) {
+    if(!(page->flags & PAGE_FLAGS_DIRTY))
+        return false;
 
-    cached_pages--;
+    page->flags &= ~PAGE_FLAGS_DIRTY;
+    radix_tag_clear(&vnode->pages, page->offset / PAGE_SIZE, TAG_DIRTY);
+    __atomic_sub_fetch(&dirty_pages, 1, __ATOMIC_RELAXED);
+
+    if(--vnode->dirty_count)
+        return false;
+
+    mutex_acquire(&dirty_lock);
+    dirty_list_remove(vnode);
+    mutex_release(&dirty_lock);
+    return true;
 }
 
-int vmm_cache_truncate(struct vnode* vnode __unused, uintmax_t offset __unused) {
-    unimplemented();
+// drops a page removed from its vnode's tree
+static void drop_page(struct page* page) {
+    page->flags |= PAGE_FLAGS_TRUNCATED;
+
+    // filesystems pin pages without backing store by holding a reference, which goes with the page
+    if(page->flags & PAGE_FLAGS_PINNED) {
+        page->flags &= ~PAGE_FLAGS_PINNED;
+        page_release(page);
+    }
+
+    page->backing = nullptr;
+    page->offset = 0;
+    page_release(page);
 }
 
-int vmm_cache_get_page(struct vnode* vnode, uintptr_t offset, struct page** res) {
+int vmm_cache_truncate(struct vnode* vnode, uintmax_t offset) {
+    assert(vnode->type == V_TYPE_REGULAR || vnode->type == V_TYPE_BLKDEV);
+
+    mutex_acquire(&vnode->pages_lock);
+
+    // the partial page stays, but its tail must read back as zeroes once the file grows again
+    if(offset % PAGE_SIZE) {
+        struct page* page = radix_lookup(&vnode->pages, offset / PAGE_SIZE);
+        if(page)
+            memset(MAKE_HHDM(page_get_physical(page)) + offset % PAGE_SIZE, 0, PAGE_SIZE - offset % PAGE_SIZE);
+    }
+
+    struct page* page;
+    bool clean = false;
+    uintmax_t index = ROUND_UP(offset, PAGE_SIZE) / PAGE_SIZE;
+    for(; (page = radix_next(&vnode->pages, &index, RADIX_MAX_INDEX)); index++) {
+        clean |= undirty_page(vnode, page);
+        remove_page(vnode, page);
+        drop_page(page);
+    }
+
+    mutex_release(&vnode->pages_lock);
+
+    // the caller still holds the vnode, this never drops the last reference
+    if(clean)
+        __atomic_sub_fetch(&vnode->refcount, 1, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+void vmm_cache_forget(struct vnode* vnode) {
+    // dirty pages hold a reference to their vnode, so there are none left
+    vmm_cache_truncate(vnode, 0);
+    assert(radix_empty(&vnode->pages));
+}
+
+int vmm_cache_read_page(struct vnode* vnode, uintptr_t offset, struct page** res, bool* cached) {
     if(!vnode)
         return EINVAL;
     assert(vnode->type == V_TYPE_REGULAR || vnode->type == V_TYPE_BLKDEV);
     assert((offset % PAGE_SIZE) == 0);
 
+    uintmax_t index = offset / PAGE_SIZE;
+
 retry:
-    mutex_acquire(&mutex);
-    
-    struct page* new_page = nullptr;
-    volatile struct page* page = find_page(vnode, offset);
+    mutex_acquire(&vnode->pages_lock);
+
+    volatile struct page* page = radix_lookup(&vnode->pages, index);
 
     if(page) {
         page_hold((struct page*) page);
-        mutex_release(&mutex);
-
-        if(new_page)
-            page_release(new_page);
+        mutex_release(&vnode->pages_lock);
 
-        // FIXME: TODO: wait for page update
+        // still being filled (most likely by readahead), its contents are not there yet
+        bool waited = !page_settled((struct page*) page);
+        if(waited)
+            wait_page((struct page*) page);
 
         if(page->flags & PAGE_FLAGS_ERROR) {
             page_release((struct page*) page);
@@ -125,96 +278,493 @@ retry:
         }
 
         *res = (struct page*) page;
+        *cached = !waited;
+        return 0;
     }
-    else {
-        mutex_release(&mutex);
 
-        void* addr = pmm_alloc_page(PMM_SECTION_DEFAULT);
-        if(!addr)
-            return ENOMEM;
+    mutex_release(&vnode->pages_lock);
 
-        new_page = vmm_alloc_page_meta(addr);
+    // page cache pages start out zeroed, filesystems only fill in what they store
+    void* addr = pmm_alloc_page(PMM_SECTION_DEFAULT, true);
+    if(!addr)
+        return ENOMEM;
 
-        mutex_acquire(&mutex);
+    struct page* new_page = pmm_page(addr);
 
-        page = find_page(vnode, offset);
-        if(page)
-            goto retry;
+    mutex_acquire(&vnode->pages_lock);
+
+    if(radix_lookup(&vnode->pages, index)) {
+        mutex_release(&vnode->pages_lock);
+        page_release(new_page);
+        goto retry;
+    }
 
-        new_page->backing = vnode;
-        new_page->offset = offset;
+    new_page->backing = vnode;
+    new_page->offset = offset;
 
-        put_page(new_page);
+    int err = put_page(vnode, new_page);
+    if(err) {
+        mutex_release(&vnode->pages_lock);
+        new_page->backing = nullptr;
+        new_page->offset = 0;
+        page_release(new_page);
+        return err;
+    }
 
-        mutex_release(&mutex);
+    // the allocation reference belongs to the cache, this one to the caller
+    page_hold(new_page);
 
-        int err = vop_getpage(vnode, offset, new_page);
-        if(err) {
-            mutex_acquire(&mutex);
+    mutex_release(&vnode->pages_lock);
 
-            remove_page(new_page);
+    err = vop_getpage(vnode, offset, new_page);
+    if(err) {
+        mutex_acquire(&vnode->pages_lock);
 
-            new_page->flags |= PAGE_FLAGS_ERROR;
+        // a truncate while the page was being filled already took it out and dropped the cache's reference
+        bool in_cache = new_page->backing == vnode && !(new_page->flags & PAGE_FLAGS_TRUNCATED);
+        if(in_cache) {
+            remove_page(vnode, new_page);
             new_page->backing = nullptr;
             new_page->offset = 0;
+        }
 
-            mutex_release(&mutex);
+        mutex_release(&vnode->pages_lock);
+
+        // waiters drop their own references and retry
+        settle_page(new_page, PAGE_FLAGS_ERROR);
+
+        if(in_cache)
             page_release(new_page);
-            // TODO: signal event
-            return err;
-        }
+        page_release(new_page);
+        return err;
+    }
 
-        new_page->flags |= PAGE_FLAGS_READY;
-        // TODO: signal event
-        *res = new_page;
+    settle_page(new_page, PAGE_FLAGS_READY);
+    *res = new_page;
+    *cached = false;
+
+    return 0;
+}
+
+int vmm_cache_get_page(struct vnode* vnode, uintptr_t offset, struct page** res) {
+    bool cached;
+    return vmm_cache_read_page(vnode, offset, res, &cached);
+}
+
+int vmm_cache_insert(struct vnode* vnode, uintptr_t offset, struct page* page) {
+    assert(vnode->type == V_TYPE_REGULAR || vnode->type == V_TYPE_BLKDEV);
+    assert((offset % PAGE_SIZE) == 0);
+
+    mutex_acquire(&vnode->pages_lock);
+
+    if(radix_lookup(&vnode->pages, offset / PAGE_SIZE)) {
+        mutex_release(&vnode->pages_lock);
+        return EEXIST;
     }
 
-    mutex_release(&mutex);
+    page->backing = vnode;
+    page->offset = offset;
+
+    int err = put_page(vnode, page);
+    if(err) {
+        page->backing = nullptr;
+        page->offset = 0;
+        mutex_release(&vnode->pages_lock);
+        return err;
+    }
+
+    // one reference for the cache and one for the pin, both dropped by drop_page()
+    page_hold(page);
+    page_hold(page);
+    page->flags |= PAGE_FLAGS_PINNED | PAGE_FLAGS_READY;
+
+    mutex_release(&vnode->pages_lock);
     return 0;
 }
 
-int vmm_cache_make_dirty(struct page* page) {
-    bool dirty = false;
+static void writeback_wake(void) {
+    if(!writeback_thread || __atomic_exchange_n(&writeback_pending, true, __ATOMIC_ACQ_REL))
+        return;
 
-    mutex_acquire(&mutex);
+    semaphore_signal(&writeback_sem);
+}
+
+// vnode->pages_lock must be held. Marks the page dirty and puts the vnode on the dirty list, the
+// timestamp and waking writeback are left to the caller. Returns false if there was nothing to do.
+static bool dirty_page(struct vnode* vnode, struct page* page) {
+    if(page->backing != vnode || (page->flags & (PAGE_FLAGS_DIRTY | PAGE_FLAGS_TRUNCATED | PAGE_FLAGS_PINNED)))
+        return false;
 
-    if(!(page->flags & (PAGE_FLAGS_DIRTY | PAGE_FLAGS_TRUNCATED))) {
-        dirty = true;
-        page->flags |= PAGE_FLAGS_DIRTY;
+    page->flags |= PAGE_FLAGS_DIRTY;
+    radix_tag_set(&vnode->pages, page->offset / PAGE_SIZE, TAG_DIRTY);
 
-        page->write_prev = nullptr;
-        page->write_next = dirty_pages;
+    if(vnode->dirty_count++ == 0) {
+        vnode->dirtied_when = timekeeper_time_from_boot();
+        vop_hold(vnode);
 
-        if(dirty_pages)
-            dirty_pages->write_prev = page;
+        mutex_acquire(&dirty_lock);
+        dirty_list_append(vnode);
+        mutex_release(&dirty_lock);
+    }
 
-        dirty_pages = page;
+    __atomic_add_fetch(&dirty_pages, 1, __ATOMIC_RELAXED);
+    return true;
+}
 
-        page_hold(page);
-        assert(page->backing);
-        vop_hold(page->backing);
+int vmm_cache_make_dirty(struct page* page) {
+    struct vnode* vnode = page->backing;
+    if(!vnode)
+        return 0;
+
+    // pinned pages have no backing store to write to, they only need the timestamp
+    bool update_mtime = page->flags & PAGE_FLAGS_PINNED;
+
+    mutex_acquire(&vnode->pages_lock);
+
+    if(dirty_page(vnode, page)) {
+        update_mtime = true;
+        if(__atomic_load_n(&dirty_pages, __ATOMIC_RELAXED) > writeback_background_pages)
+            writeback_wake();
     }
 
-    mutex_release(&mutex);
+    mutex_release(&vnode->pages_lock);
 
-    if(dirty) {
+    if(update_mtime) {
         struct vattr attr;
         attr.mtime = timekeeper_time();
-        vop_setattr(page->backing, &attr, V_ATTR_MTIME, nullptr);
+        vop_setattr(vnode, &attr, V_ATTR_MTIME, nullptr);
     }
 
     return 0;
 }
 
-void vmm_cache_init(void) {
-    mutex_init(&mutex);
-    
-    table = vmm_map(nullptr, TABLE_SIZE * sizeof(struct page), VMM_FLAGS_ALLOCATE, MMU_FLAGS_READ | MMU_FLAGS_WRITE | MMU_FLAGS_NOEXEC, nullptr);
-    assert(table);
-    memset(table, 0, TABLE_SIZE * sizeof(struct page));
+void vmm_cache_overwrite(struct vnode* vnode, uintmax_t offset, struct page* data) {
+    assert((offset % PAGE_SIZE) == 0);
+
+    bool evict = false;
+
+    mutex_acquire(&vnode->pages_lock);
+
+    struct page* page = radix_lookup(&vnode->pages, offset / PAGE_SIZE);
+    if(page) {
+        // only the cache references it: the next access reads the new data from the filesystem
+        evict = (page->flags & (PAGE_FLAGS_DIRTY | PAGE_FLAGS_PINNED)) == 0
+            && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) == 1;
+
+        if(evict)
+            remove_page(vnode, page);
+        else if(page->flags & PAGE_FLAGS_READY)
+            // mapped or in use, keep it coherent with what was written
+            memcpy(MAKE_HHDM(page_get_physical(page)), MAKE_HHDM(page_get_physical(data)), PAGE_SIZE);
+    }
+
+    mutex_release(&vnode->pages_lock);
+
+    if(evict)
+        drop_page(page);
+}
+
+static inline uintmax_t timespec_ns(struct timespec ts) {
+    return ts.s * 1'000'000'000ul + ts.ns;
+}
+
+// writes back up to `max` dirty pages of `vnode` with an index in [first, last] in ascending offset
+// order, in batches of VMM_WRITEBACK_BATCH_PAGES. The caller holds a reference to `vnode`.
+static int writeback_vnode(struct vnode* vnode, uintmax_t first, uintmax_t last, size_t max) {
+    struct {
+        struct page* page;
+        uintmax_t offset;
+    } batch[VMM_WRITEBACK_BATCH_PAGES];
+
+    int err = 0;
+    uintmax_t index = first;
+
+    // one writer per vnode, fsync() has to wait for pages the writeback thread is still writing
+    mutex_acquire(&vnode->writeback_lock);
+
+    while(max) {
+        size_t count = 0;
+        bool clean = false;
+        struct page* page;
+
+        mutex_acquire(&vnode->pages_lock);
+
+        for(; count < MIN(max, VMM_WRITEBACK_BATCH_PAGES) && (page = radix_next_tagged(&vnode->pages, &index, last, TAG_DIRTY)); index++) {
+            // clean before writing: a write racing with the I/O dirties the page again
+            clean |= undirty_page(vnode, page);
+            page_hold(page);
+
+            batch[count].page = page;
+            batch[count].offset = page->offset;
+            count++;
+        }
+
+        mutex_release(&vnode->pages_lock);
+
+        // the caller's reference keeps the vnode alive
+        if(clean)
+            __atomic_sub_fetch(&vnode->refcount, 1, __ATOMIC_SEQ_CST);
+
+        if(!count)
+            break;
+
+        max -= count;
+
+        uintmax_t start = timespec_ns(timekeeper_time_from_boot());
+        size_t written = 0;
+
+        for(size_t i = 0; i < count; i++) {
+            page = batch[i].page;
+
+            // truncated while the lock was dropped
+            if(page->backing != vnode || (page->flags & PAGE_FLAGS_TRUNCATED)) {
+                page_release(page);
+                continue;
+            }
+
+            int page_err = vop_putpage(vnode, batch[i].offset, page);
+            if(page_err) {
+                // keep the data around for the next attempt. The contents did not change, so neither
+                // does mtime, and the vnode counts as freshly dirtied: it is retried once it expires
+                // again instead of right away by a writeback woken up here.
+                err = page_err;
+
+                mutex_acquire(&vnode->pages_lock);
+                dirty_page(vnode, page);
+                vnode->dirtied_when = timekeeper_time_from_boot();
+                mutex_release(&vnode->pages_lock);
+
+                __atomic_add_fetch(&writeback_stats.errors, 1, __ATOMIC_RELAXED);
+            }
+            else
+                written++;
+
+            page_release(page);
+        }
+
+        uintmax_t elapsed = timespec_ns(timekeeper_time_from_boot()) - start;
+
+        __atomic_add_fetch(&writeback_stats.batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&writeback_stats.pages, written, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&writeback_stats.ns, elapsed, __ATOMIC_RELAXED);
+
+        // the rest would most likely fail the same way, back off until the next pass
+        if(err)
+            break;
+    }
+
+    mutex_release(&vnode->writeback_lock);
+    return err;
+}
+
+int vmm_cache_sync(struct vnode* vnode) {
+    assert(vnode->type == V_TYPE_REGULAR || vnode->type == V_TYPE_BLKDEV);
+    return writeback_vnode(vnode, 0, RADIX_MAX_INDEX, SIZE_MAX);
+}
+
+int vmm_cache_sync_range(struct vnode* vnode, uintmax_t offset, size_t size) {
+    assert(vnode->type == V_TYPE_REGULAR || vnode->type == V_TYPE_BLKDEV);
+    if(!size)
+        return 0;
+
+    return writeback_vnode(vnode, offset / PAGE_SIZE, (offset + size - 1) / PAGE_SIZE, SIZE_MAX);
+}
+
+// picks the oldest dirty vnode matching `vfs` (any if nullptr) and moves it to the back of the list,
+// so a vnode that keeps getting dirtied doesn't starve the others
+static struct vnode* next_dirty_vnode(struct vfs* vfs, bool expired_only, bool* expired) {
+    uintmax_t now = timespec_ns(timekeeper_time_from_boot());
+    struct vnode* vnode;
+
+    mutex_acquire(&dirty_lock);
+
+    for(vnode = dirty_head; vnode && vfs && vnode->vfs != vfs; vnode = vnode->dirty_next);
+
+    if(vnode) {
+        *expired = now - timespec_ns(vnode->dirtied_when) >= VMM_WRITEBACK_EXPIRE_US * 1'000;
+
+        if(expired_only && !*expired)
+            vnode = nullptr;
+        else {
+            dirty_list_remove(vnode);
+            dirty_list_append(vnode);
+            vop_hold(vnode);
+        }
+    }
+
+    mutex_release(&dirty_lock);
+    return vnode;
+}
+
+int vmm_cache_sync_all(struct vfs* vfs) {
+    int err = 0;
+
+    // vnodes dirtied from here on are not waited for
+    mutex_acquire(&dirty_lock);
+    size_t count = dirty_vnodes;
+    mutex_release(&dirty_lock);
+
+    for(; count; count--) {
+        bool expired;
+        struct vnode* vnode = next_dirty_vnode(vfs, false, &expired);
+        if(!vnode)
+            break;
+
+        int vnode_err = writeback_vnode(vnode, 0, RADIX_MAX_INDEX, SIZE_MAX);
+        if(vnode_err)
+            err = vnode_err;
+
+        vop_release(&vnode);
+    }
+
+    __atomic_add_fetch(&writeback_stats.syncs, 1, __ATOMIC_RELAXED);
+    return err;
+}
+
+// writes back vnodes dirty for longer than VMM_WRITEBACK_EXPIRE_US, and more while the amount of
+// dirty memory is above the background threshold
+static void writeback_pass(void) {
+    mutex_acquire(&dirty_lock);
+    size_t count = dirty_vnodes;
+    mutex_release(&dirty_lock);
+
+    for(; count; count--) {
+        bool over = __atomic_load_n(&dirty_pages, __ATOMIC_RELAXED) > writeback_background_pages;
+
+        // the list is sorted by age, once the oldest vnode is young enough the pass is done
+        bool expired;
+        struct vnode* vnode = next_dirty_vnode(nullptr, !over, &expired);
+        if(!vnode)
+            break;
+
+        // expired vnodes are written completely, the others a chunk at a time to spread the I/O
+        writeback_vnode(vnode, 0, RADIX_MAX_INDEX, expired ? SIZE_MAX : VMM_WRITEBACK_CHUNK_PAGES);
+        vop_release(&vnode);
+    }
+}
 
-    semaphore_init(&sync, 0);
+static void writeback_tick(struct cpu_context* __unused, dpc_arg_t __unused) {
+    writeback_wake();
+}
+
+static __noreturn void writeback_thread_callback(void) {
+    // interrupts stay off so the entry lands in the timer of the cpu that arms it
+    bool int_state = interrupt_set(false);
+    timer_insert(_cpu()->timer, &writeback_timer, writeback_tick, nullptr, VMM_WRITEBACK_INTERVAL_US, true);
+    interrupt_set(int_state);
 
-    // TODO: sync thread...
+    for(;;) {
+        semaphore_wait(&writeback_sem, false);
+        __atomic_store_n(&writeback_pending, false, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&writeback_stats.wakeups, 1, __ATOMIC_RELAXED);
+
+        writeback_pass();
+    }
 }
 
+void vmm_writeback_stats(struct vmm_writeback_stats* stats) {
+    stats->dirty_pages = __atomic_load_n(&dirty_pages, __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&writeback_stats.wakeups, __ATOMIC_RELAXED);
+    stats->syncs = __atomic_load_n(&writeback_stats.syncs, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&writeback_stats.batches, __ATOMIC_RELAXED);
+    stats->pages = __atomic_load_n(&writeback_stats.pages, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&writeback_stats.errors, __ATOMIC_RELAXED);
+    stats->ns = __atomic_load_n(&writeback_stats.ns, __ATOMIC_RELAXED);
+}
+
+void vmm_writeback_dump_info(void) {
+    struct vmm_writeback_stats stats;
+    vmm_writeback_stats(&stats);
+
+    // KiB per second, from the time spent in putpage
+    uintmax_t throughput = stats.ns ? stats.pages * (PAGE_SIZE / 1024) * 1'000'000'000ul / stats.ns : 0;
+
+    klog(INFO, "writeback: %zu dirty pages (background threshold %zu), %lu wakeups, %lu syncs",
+        stats.dirty_pages, writeback_background_pages, stats.wakeups, stats.syncs);
+    klog(INFO, "writeback: %lu pages in %lu batches, %lu errors, %lu KiB/s",
+        stats.pages, stats.batches, stats.errors, throughput);
+}
+
+// only the cache itself references the page: not mapped, not in use by read()/write() and not
+// kept around by the filesystem (tmpfs pins its pages, they have no backing store)
+static inline bool is_evictable(struct page* page) {
+    return (page->flags & (PAGE_FLAGS_READY | PAGE_FLAGS_DIRTY | PAGE_FLAGS_PINNED | PAGE_FLAGS_ERROR)) == PAGE_FLAGS_READY
+        && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) == 1;
+}
+
+static size_t shrinker_count(struct shrinker* shrinker __unused) {
+    return __atomic_load_n(&cached_pages, __ATOMIC_RELAXED);
+}
+
+// evicts clean, unreferenced pages vnode by vnode, moving every scanned vnode to the back of the list
+static size_t shrinker_scan(struct shrinker* shrinker __unused, struct shrink_control* sc) {
+    if(sc->direct) {
+        if(!mutex_try(&vnodes_lock))
+            return 0;
+    }
+    else
+        mutex_acquire(&vnodes_lock);
+
+    size_t freed = 0;
+    struct vnode* last = vnodes_tail;
+
+    for(struct vnode* vnode = vnodes_head; vnode && freed < sc->nr_to_scan;) {
+        struct vnode* next = vnode == last ? nullptr : vnode->cache_next;
+
+        // the lock order is the other way round, skip vnodes that are busy
+        if(!mutex_try(&vnode->pages_lock)) {
+            vnode = next;
+            continue;
+        }
+
+        struct page* page;
+        uintmax_t index = 0;
+
+        for(; freed < sc->nr_to_scan && (page = radix_next(&vnode->pages, &index, RADIX_MAX_INDEX)); index++) {
+            // new references are only taken with the lock held, so the page stays unreferenced
+            if(!is_evictable(page))
+                continue;
+
+            radix_delete(&vnode->pages, index);
+            vnode->page_count--;
+            __atomic_sub_fetch(&cached_pages, 1, __ATOMIC_RELAXED);
+
+            page->backing = nullptr;
+            page->offset = 0;
+            page_release(page);
+            freed++;
+        }
+
+        // remove_page() would take vnodes_lock, which is already held here
+        vnode_list_remove(vnode);
+        if(vnode->page_count)
+            vnode_list_append(vnode);
+
+        mutex_release(&vnode->pages_lock);
+
+        vnode = next;
+    }
+
+    mutex_release(&vnodes_lock);
+    return freed;
+}
+
+static struct shrinker shrinker = {
+    .name = "page cache",
+    .count = shrinker_count,
+    .scan = shrinker_scan
+};
+
+void vmm_cache_init(void) {
+    mutex_init(&vnodes_lock);
+    mutex_init(&dirty_lock);
+
+    shrinker_register(&shrinker);
+
+    writeback_background_pages = pmm_total_memory() / PAGE_SIZE * VMM_WRITEBACK_BACKGROUND_PERCENT / 100;
+
+    semaphore_init(&writeback_sem, 0);
+    writeback_thread = thread_create(writeback_thread_callback, PAGE_SIZE * 16, 0, nullptr, nullptr);
+    assert(writeback_thread);
+    sched_queue(writeback_thread);
+}
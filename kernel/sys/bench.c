@@ -0,0 +1,49 @@
+#include <sys/bench.h>
+
+#include <kernelio.h>
+#include <string.h>
+
+extern const struct bench_entry _STATIC_BENCHMARKS_START_[];
+extern const struct bench_entry _STATIC_BENCHMARKS_END_[];
+
+static bool is_selected(const char* which, const char* name) {
+    if(strcmp(which, "all") == 0 || strcmp(which, "bench") == 0)
+        return true;
+
+    size_t name_len = strlen(name);
+    const char* cur = which;
+    while(*cur) {
+        const char* end = strchr(cur, ',');
+        size_t len = end ? (size_t) (end - cur) : strlen(cur);
+
+        if(len == name_len && strncmp(cur, name, len) == 0)
+            return true;
+
+        if(!end)
+            break;
+        cur = end + 1;
+    }
+
+    return false;
+}
+
+void bench_run(const char* which) {
+    if(!which)
+        return;
+
+    for(const struct bench_entry* entry = _STATIC_BENCHMARKS_START_; entry < _STATIC_BENCHMARKS_END_; entry++) {
+        if(!is_selected(which, entry->name))
+            continue;
+
+        klog(INFO, "\e[1mbenchmark `%s`\e[0m: %s", entry->name, entry->description);
+        entry->func();
+    }
+}
+
+void bench_report(const char* what, size_t iterations, uint64_t cycles) {
+    klog(INFO, "  %s: %zu iterations, %lu cycles (%lu cycles/op)", what, iterations, cycles, iterations ? cycles / iterations : 0);
+}
+
+void bench_report_n(const char* prefix, size_t n, const char* suffix, size_t iterations, uint64_t cycles) {
+    klog(INFO, "  %s%zu%s: %zu iterations, %lu cycles (%lu cycles/op)", prefix, n, suffix, iterations, cycles, iterations ? cycles / iterations : 0);
+}
@@ -0,0 +1,120 @@
+#include <sys/exec.h>
+
+#include <mem/vmm.h>
+#include <mem/user.h>
+#include <mem/heap.h>
+#include <sys/thread.h>
+#include <filesystem/vfs.h>
+#include <encoding/elf.h>
+
+#include <errno.h>
+
+int exec_copy_path(const char* u_path, char** path) {
+    if(!is_userspace_addr(u_path))
+        return EFAULT;
+
+    size_t len;
+    int err = user_strlen(u_path, &len);
+    if(err)
+        return err;
+
+    char* buf = kmalloc(len + 1);
+    if(!buf)
+        return ENOMEM;
+
+    if((err = memcpy_from_user(buf, u_path, len))) {
+        kfree(buf);
+        return err;
+    }
+
+    buf[len] = '\0';
+    *path = buf;
+    return 0;
+}
+
+int exec_copy_args(const char* const u_args[], char*** args) {
+    if(!is_userspace_addr(u_args))
+        return EFAULT;
+
+    int err;
+    size_t count = 0;
+    for(;;) {
+        const char* arg;
+        if((err = memcpy_from_user(&arg, &u_args[count], sizeof(char*))))
+            return err;
+        if(!arg)
+            break;
+        count++;
+    }
+
+    char** vec = kmalloc((count + 1) * sizeof(char*));
+    if(!vec)
+        return ENOMEM;
+
+    // keep the vector terminated at all times, so exec_free_args() can clean up after a partial copy
+    vec[0] = nullptr;
+
+    for(size_t i = 0; i < count; i++) {
+        const char* u_arg;
+        if((err = memcpy_from_user(&u_arg, &u_args[i], sizeof(char*))) || (err = exec_copy_path(u_arg, &vec[i]))) {
+            exec_free_args(vec);
+            return err;
+        }
+
+        vec[i + 1] = nullptr;
+    }
+
+    *args = vec;
+    return 0;
+}
+
+void exec_free_args(char** args) {
+    if(!args)
+        return;
+
+    for(char** arg = args; *arg; arg++)
+        kfree(*arg);
+    kfree(args);
+}
+
+int exec_load(struct vnode* node, char** argv, char** envp, struct exec_image* image) {
+    struct vmm_context* old_ctx = current_vmm_context();
+    struct vmm_context* ctx = vmm_context_new();
+    if(!ctx)
+        return ENOMEM;
+
+    Elf64_auxv_list_t auxv;
+    char* interpreter = nullptr;
+    void* entry;
+    void* brk = nullptr;
+    void* stack = nullptr;
+
+    vmm_switch_context(ctx);
+
+    // TODO: shebang support!
+    int err = elf_load(node, nullptr, &entry, &interpreter, &auxv, &brk);
+    if(!err && interpreter)
+        err = elf_load_interpreter(interpreter, &entry, &auxv);
+    if(!err && !(stack = elf_prepare_stack(STACK_TOP, &auxv, argv, envp)))
+        err = ENOMEM;
+
+    vmm_switch_context(old_ctx);
+
+    if(interpreter)
+        kfree(interpreter);
+
+    if(err) {
+        vmm_context_destroy(ctx);
+        return err;
+    }
+
+    ctx->brk = (struct brk){
+        .base = brk,
+        .top = brk
+    };
+
+    image->vmm_context = ctx;
+    image->entry = entry;
+    image->stack = stack;
+    return 0;
+}
@@ -99,7 +99,7 @@ static int fb_mmap(int minor, void* addr, uintmax_t offset, int flags) {
     }
 
     size_t size = offset + PAGE_SIZE < end ? PAGE_SIZE : end - offset;
-    void* paddr = pmm_alloc_page(PMM_SECTION_DEFAULT);
+    void* paddr = pmm_alloc_page(PMM_SECTION_DEFAULT, false);
     if(!paddr)
         return ENOMEM;
 
@@ -9,6 +9,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 struct scache* file_cache = nullptr;
 
@@ -18,6 +19,7 @@ static void file_ctor(struct scache* __unused, void* obj) {
     mutex_init(&file->mutex); 
     file->ref_count = 1;
     file->offset = 0;
+    readahead_reset(&file->ra);
 }
 
 static int get_free_fd(struct proc* proc, int start) {
@@ -44,7 +46,7 @@ static int grow_fd_table(struct proc* proc, int new_count) {
 
 struct file* fd_allocate(void) {
     if(!file_cache) {
-        file_cache = slab_newcache(sizeof(struct file), 0, file_ctor, file_ctor);
+        file_cache = slab_newcache("file", sizeof(struct file), 0, file_ctor, file_ctor);
         assert(file_cache);
     }
 
@@ -234,18 +236,18 @@ int fd_clone(struct proc* dest) {
     int err = 0;
     mutex_acquire(&proc->fd_mutex);
 
-    dest->fd_count = proc->fd_count;
-    dest->fd_first = proc->fd_first;
-    dest->fd = kmalloc(proc->fd_count * sizeof(struct fd));
-    if(!dest->fd) {
+    struct fd* table = kmalloc(proc->fd_count * sizeof(struct fd));
+    if(!table) {
         err = ENOMEM;
         goto cleanup;
     }
 
-    for(size_t i = 0; i < dest->fd_count; i++) {
-        if(!proc->fd[i].file)
-            continue;
+    kfree(dest->fd);
+    dest->fd = table;
+    dest->fd_count = proc->fd_count;
+    dest->fd_first = proc->fd_first;
 
+    for(size_t i = 0; i < dest->fd_count; i++) {
         dest->fd[i] = proc->fd[i];
         fd_hold(dest->fd[i].file);
     }
@@ -255,3 +257,124 @@ cleanup:
     return err;
 }
 
+int fd_install(struct proc* proc, int fd, struct file* file, int flags) {
+    if(fd < 0)
+        return EBADF;
+
+    int err = 0;
+    mutex_acquire(&proc->fd_mutex);
+
+    if(fd >= (int) proc->fd_count) {
+        size_t old_count = proc->fd_count;
+        if((err = grow_fd_table(proc, fd + 1)))
+            goto cleanup;
+
+        memset(proc->fd + old_count, 0, (proc->fd_count - old_count) * sizeof(struct fd));
+    }
+
+    struct file* old = proc->fd[fd].file;
+    proc->fd[fd].file = file;
+    proc->fd[fd].flags = flags;
+
+    mutex_release(&proc->fd_mutex);
+
+    fd_release(old);
+    return 0;
+
+cleanup:
+    mutex_release(&proc->fd_mutex);
+    return err;
+}
+
+int fd_remove(struct proc* proc, int fd) {
+    mutex_acquire(&proc->fd_mutex);
+
+    struct file* file = fd >= 0 && fd < (int) proc->fd_count ? proc->fd[fd].file : nullptr;
+    if(file) {
+        proc->fd[fd].file = nullptr;
+        if((int) proc->fd_first > fd)
+            proc->fd_first = fd;
+    }
+
+    mutex_release(&proc->fd_mutex);
+
+    if(!file)
+        return EBADF;
+
+    fd_release(file);
+    return 0;
+}
+
+int fd_open(struct file* file, const char* path, int flags, mode_t mode) {
+    // O_RDONLY, O_WRONLY and O_RDWR become FILE_READ, FILE_WRITE and both
+    flags++;
+
+    struct vnode* ref = path[0] == '/' ? proc_get_root() : proc_get_cwd();
+    assert(ref != nullptr);
+
+    struct vnode* vnode = nullptr;
+    int err;
+
+retry:
+    err = vfs_open(ref, path, file_to_vnode_flags(flags), &vnode);
+    if(err == 0 && (flags & O_CREAT) && (flags & O_EXCL)) {
+        err = EEXIST;
+        goto cleanup;
+    }
+
+    if(err == ENOENT && (flags & O_CREAT)) {
+        // Create a new file
+        struct vattr attr = {
+            .mode = umask(mode),
+            .gid = current_proc()->cred.gid,
+            .uid = current_proc()->cred.uid
+        };
+
+        err = vfs_create(ref, path, &attr, V_TYPE_REGULAR, &vnode);
+        if(err == EEXIST && (flags & O_EXCL) == 0)
+            goto retry;
+        if(err == 0)
+            vop_unlock(vnode);
+    }
+
+    if(err)
+        goto cleanup;
+
+    if((flags & O_DIRECTORY) && vnode->type != V_TYPE_DIR) {
+        err = ENOTDIR;
+        goto cleanup;
+    }
+
+    struct vattr attr;
+    vop_lock(vnode);
+    err = vop_getattr(vnode, &attr, &current_proc()->cred);
+    vop_unlock(vnode);
+    if(err)
+        goto cleanup;
+
+    if(vnode->type == V_TYPE_REGULAR && (flags & O_TRUNC) && (flags & FILE_WRITE)) {
+        mutex_acquire(&vnode->size_lock);
+        vop_lock(vnode);
+
+        err = vop_resize(vnode, 0, &current_proc()->cred);
+
+        vop_unlock(vnode);
+        mutex_release(&vnode->size_lock);
+        if(err)
+            goto cleanup;
+    }
+
+    file->vnode = vnode;
+    file->flags = flags;
+    file->offset = 0;
+    file->mode = attr.mode;
+
+cleanup:
+    if(vnode && err) {
+        vfs_close(vnode, file_to_vnode_flags(flags));
+        vop_release(&vnode);
+    }
+
+    vop_release(&ref);
+    return err;
+}
@@ -1,5 +1,6 @@
 #include <sys/loadavg.h>
 #include <sys/scheduler.h>
+#include <cpu/smp.h>
 
 static uintmax_t calc_load_tasks;
 
@@ -42,6 +43,6 @@ void calc_global_load_tick(void) {
     __atomic_add_fetch(&calc_load_tasks, active, __ATOMIC_SEQ_CST);
 
     // task one cpu to calculate the 'final' global load
-    if(_cpu()->id == 0)
+    if(smp_is_bsp(_cpu()))
         calc_global_load();
 }
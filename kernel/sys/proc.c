@@ -39,7 +39,7 @@ static inline void change_vnode(struct proc* proc, struct vnode** vnode_ptr, str
 }
 
 void proc_init(void) {
-    proc_cache = slab_newcache(sizeof(struct proc), 0, nullptr, nullptr);
+    proc_cache = slab_newcache("proc", sizeof(struct proc), 0, nullptr, nullptr);
     assert(proc_cache);
 
     assert(hashtable_init(&pid_table, 100) == 0);
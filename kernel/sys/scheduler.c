@@ -6,6 +6,8 @@
 #include <filesystem/devfs.h>
 #include <filesystem/vfs.h>
 
+#include <mem/heap.h>
+#include <mem/pmm.h>
 #include <mem/slab.h>
 #include <mem/vmm.h>
 
@@ -62,7 +64,9 @@ static void cpu_idle_thread(void) {
 
     interrupt_set(true);
     while(1) {
-        hlt_until_int();
+        // prepare zeroed pages while there is nothing else to do
+        if(!pmm_zero_pool_fill())
+            hlt_until_int();
         sched_yield();
     }
 }
@@ -489,7 +493,7 @@ static void sched_proc_exit(void) {
     PROC_RELEASE(proc);
 }
 
-static __noreturn void sched_thread_exit(void) {
+__noreturn void sched_thread_exit(void) {
     struct thread* thread = current_thread();
     assert(thread);
 
@@ -567,27 +571,6 @@ extern __syscall void _sched_userspace_check(struct cpu_context* context, bool s
     _wcpu()->interrupt_status = int_status;
 }
 
-static int load_interpreter(const char* interpreter, void** entry) {
-    if(!interpreter)
-        return 0;
-
-    int err;
-    struct vnode* interp_node;
-
-    if((err = vfs_open(vfs_root, interpreter, 0, &interp_node)))
-        return err;
-
-    Elf64_auxv_list_t interp_auxv;
-    char* interp_interp = nullptr;
-    void* interp_brk;
-
-    if((err = elf_load(interp_node, INTERPRETER_BASE, entry, &interp_interp, &interp_auxv, &interp_brk)))
-        return err;
-
-    assert(!interp_interp);
-    return 0;
-}
-
 int scheduler_exec(const char* path, char* argv[], char* envp[]) {
     klog(INFO, "executing `%s`", path);
 
@@ -613,8 +596,12 @@ int scheduler_exec(const char* path, char* argv[], char* envp[]) {
     if((err = elf_load(exec_node, nullptr, &entry, &interpreter, &auxv, &brk)))
         return err;
 
-    if((err = load_interpreter(interpreter, &entry)))
-        return err;
+    if(interpreter) {
+        err = elf_load_interpreter(interpreter, &entry, &auxv);
+        kfree(interpreter);
+        if(err)
+            return err;
+    }
 
     if(brk)
         klog(DEBUG, "break: %p", brk);
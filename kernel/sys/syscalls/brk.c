@@ -39,7 +39,8 @@ __syscall syscallret_t _sys_brk(struct cpu_context* __unused, void* addr) {
     if(diff > 0) {
         size_t alloc_size = (new_break - old_break) / PAGE_SIZE;
 
-        if(!vmm_map((void*) old_break, alloc_size, VMM_FLAGS_EXACT | VMM_FLAGS_ALLOCATE | VMM_FLAGS_PAGESIZE, BRK_MMU_FLAGS, nullptr)) {
+        // populated lazily by page faults
+        if(!vmm_map((void*) old_break, alloc_size, VMM_FLAGS_EXACT | VMM_FLAGS_PAGESIZE, BRK_MMU_FLAGS, nullptr)) {
             ret._errno = ENOMEM;
             return ret;
         }
@@ -0,0 +1,34 @@
+#include <sys/syscall.h>
+#include <sys/fd.h>
+
+#include <errno.h>
+
+static syscallret_t do_fsync(int fd, bool data_only) {
+    syscallret_t ret = {
+        .ret = -1
+    };
+
+    struct file* file = fd_get(fd);
+    if(!file) {
+        ret._errno = EBADF;
+        return ret;
+    }
+
+    ret._errno = vfs_fsync(file->vnode, data_only);
+    if(!ret._errno)
+        ret.ret = 0;
+
+    fd_release(file);
+    return ret;
+}
+
+__syscall syscallret_t _sys_fsync(struct cpu_context* __unused, int fd) {
+    return do_fsync(fd, false);
+}
+
+__syscall syscallret_t _sys_fdatasync(struct cpu_context* __unused, int fd) {
+    return do_fsync(fd, true);
+}
+
+_SYSCALL_REGISTER(SYS_fsync, _sys_fsync, "fsync", "%d");
+_SYSCALL_REGISTER(SYS_fdatasync, _sys_fdatasync, "fdatasync", "%d");
@@ -32,8 +32,12 @@ __syscall syscallret_t _sys_getcwd(struct cpu_context* __unused, char* user_cwd,
     if((ret._errno = vfs_realpath(cwd_node, &cwd, &cwd_size, VFS_LOOKUP_NOLINK)))
         return ret;
 
-    cwd_size = MIN(cwd_size, user_cwd_size - 1);
-    
+    // cwd_size includes the terminating null byte
+    if(user_cwd_size < cwd_size) {
+        ret._errno = ERANGE;
+        goto cleanup;
+    }
+
     if((ret._errno = memcpy_to_user(user_cwd, cwd, cwd_size)))
         goto cleanup;
 
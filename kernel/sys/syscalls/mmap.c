@@ -31,7 +31,7 @@ __syscall syscallret_t _sys_mmap(struct cpu_context* __unused, void* addr, size_
     struct file* file = nullptr;
 
     if(as_file) {
-        if(offset & PAGE_SIZE) {
+        if(offset < 0 || offset % PAGE_SIZE) {
             ret._errno = EINVAL;
             return ret;
         }
@@ -52,7 +52,8 @@ __syscall syscallret_t _sys_mmap(struct cpu_context* __unused, void* addr, size_
         vfd.node = file->vnode;
         vfd.offset = offset;
     }
-    else
+    // anonymous memory is populated by page faults unless the caller asks for it up front
+    else if(flags & MAP_POPULATE)
         vmm_flags |= VMM_FLAGS_ALLOCATE;
 
     addr = MAX(MIN(addr, USERSPACE_END), USERSPACE_START);
@@ -28,7 +28,7 @@ __syscall syscallret_t _sys_read(struct cpu_context* ctx __unused, int fd, void*
     }
 
     size_t bytes_read;
-    ret._errno = vfs_read(file->vnode, buffer, size, file->offset, &bytes_read, file_to_vnode_flags(file->flags));
+    ret._errno = vfs_read(file->vnode, buffer, size, file->offset, &bytes_read, file_to_vnode_flags(file->flags), &file->ra);
 
     if(ret._errno)
         goto cleanup;
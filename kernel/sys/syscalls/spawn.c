@@ -0,0 +1,222 @@
+#include <sys/syscall.h>
+
+#include <amethyst/spawn.h>
+
+#include <mem/vmm.h>
+#include <mem/user.h>
+#include <mem/heap.h>
+
+#include <sys/exec.h>
+#include <sys/thread.h>
+#include <sys/proc.h>
+#include <sys/scheduler.h>
+
+#include <errno.h>
+
+static int copy_actions(const struct spawn_action* u_actions, size_t count, struct spawn_action** actions) {
+    *actions = nullptr;
+    if(!count)
+        return 0;
+
+    if(count > SPAWN_ACTIONS_MAX)
+        return EINVAL;
+
+    if(!is_userspace_addr(u_actions))
+        return EFAULT;
+
+    struct spawn_action* buf = kmalloc(count * sizeof(struct spawn_action));
+    if(!buf)
+        return ENOMEM;
+
+    int err = memcpy_from_user(buf, u_actions, count * sizeof(struct spawn_action));
+    if(err) {
+        kfree(buf);
+        return err;
+    }
+
+    // only paths that were copied below may get freed
+    for(size_t i = 0; i < count; i++) {
+        const char* u_path = buf[i].path;
+        buf[i].path = nullptr;
+
+        if(buf[i].type == SPAWN_ACTION_OPEN && !err)
+            err = exec_copy_path(u_path, (char**) &buf[i].path);
+    }
+
+    *actions = buf;
+    return err;
+}
+
+static void free_actions(struct spawn_action* actions, size_t count) {
+    if(!actions)
+        return;
+
+    for(size_t i = 0; i < count; i++) {
+        if(actions[i].path)
+            kfree((char*) actions[i].path);
+    }
+
+    kfree(actions);
+}
+
+static int apply_action(struct proc* child, const struct spawn_action* action) {
+    int err;
+
+    switch(action->type) {
+    case SPAWN_ACTION_OPEN: {
+        struct file* file = fd_allocate();
+        if(!file)
+            return ENOMEM;
+
+        // relative paths resolve against the parent's cwd, which the child inherits
+        if((err = fd_open(file, action->path, action->oflag, action->mode))) {
+            fd_free(file);
+            return err;
+        }
+
+        if((err = fd_install(child, action->fd, file, action->oflag & O_CLOEXEC)))
+            fd_release(file);
+        return err;
+    }
+    case SPAWN_ACTION_CLOSE:
+        return fd_remove(child, action->fd);
+    case SPAWN_ACTION_DUP2: {
+        mutex_acquire(&child->fd_mutex);
+
+        struct file* file = action->fd >= 0 && action->fd < (int) child->fd_count ? child->fd[action->fd].file : nullptr;
+        fd_hold(file);
+
+        mutex_release(&child->fd_mutex);
+
+        if(!file)
+            return EBADF;
+
+        // like dup2(), the new descriptor shares the open file and never inherits O_CLOEXEC
+        if((err = fd_install(child, action->new_fd, file, 0)))
+            fd_release(file);
+        return err;
+    }
+    default:
+        return EINVAL;
+    }
+}
+
+static int setup_fds(struct proc* child, const struct spawn_action* actions, size_t action_count) {
+    int err;
+    if((err = fd_clone(child)))
+        return err;
+
+    for(size_t i = 0; i < action_count; i++) {
+        if((err = apply_action(child, &actions[i])))
+            return err;
+    }
+
+    // the child starts out past its execve()
+    for(size_t fd = 0; fd < child->fd_count; fd++) {
+        if(child->fd[fd].file && (child->fd[fd].flags & O_CLOEXEC))
+            fd_remove(child, (int) fd);
+    }
+
+    return 0;
+}
+
+// creates a child process running `u_path` directly, without duplicating the caller's address space first
+__syscall syscallret_t _sys_spawn(struct cpu_context* __unused, const char* u_path, const char* const u_argv[], const char* const u_envp[], const struct spawn_action* u_actions, size_t action_count) {
+    syscallret_t ret = {
+        .ret = -1,
+        ._errno = 0
+    };
+
+    char* path = nullptr;
+    char** argv = nullptr;
+    char** envp = nullptr;
+    struct spawn_action* actions = nullptr;
+
+    struct vnode* ref = nullptr;
+    struct vnode* node = nullptr;
+
+    struct exec_image image = { .vmm_context = nullptr };
+    struct proc* proc = current_proc();
+    struct proc* new_proc = nullptr;
+
+    if((ret._errno = exec_copy_path(u_path, &path))
+        || (ret._errno = exec_copy_args(u_argv, &argv))
+        || (ret._errno = exec_copy_args(u_envp, &envp))
+        || (ret._errno = copy_actions(u_actions, action_count, &actions)))
+        goto cleanup;
+
+    ref = *path == '/' ? proc_get_root() : proc_get_cwd();
+
+    if((ret._errno = vfs_lookup(&node, ref, path, nullptr, 0))
+        || (ret._errno = exec_load(node, argv, envp, &image)))
+        goto cleanup;
+
+    if(!(new_proc = proc_create())) {
+        ret._errno = ENOMEM;
+        goto cleanup;
+    }
+
+    new_proc->umask = proc->umask;
+    new_proc->cred = proc->cred;
+
+    if((ret._errno = setup_fds(new_proc, actions, action_count)))
+        goto cleanup;
+
+    struct thread* new_thread = thread_create(image.entry, PAGE_SIZE * 16, 1, new_proc, image.stack);
+    if(!new_thread) {
+        ret._errno = ENOMEM;
+        goto cleanup;
+    }
+
+    new_thread->vmm_context = image.vmm_context;
+    image.vmm_context = nullptr;
+
+    new_proc->root = proc_get_root();
+    new_proc->cwd = proc_get_cwd();
+
+    mutex_acquire(&proc->mutex);
+
+    new_proc->parent = proc;
+    new_proc->sibling = proc->child;
+    proc->child = new_proc;
+
+    mutex_release(&proc->mutex);
+
+    // TODO: signals
+
+    ret.ret = new_proc->pid;
+
+    sched_queue(new_thread);
+
+    klog(DEBUG, "thread [tid %d] spawned `%s` [tid %d]", current_thread()->tid, path, new_thread->tid);
+
+cleanup:
+    if(new_proc) {
+        if(ret._errno) {
+            for(size_t fd = 0; fd < new_proc->fd_count; fd++)
+                fd_remove(new_proc, (int) fd);
+        }
+
+        PROC_RELEASE(new_proc);
+    }
+
+    if(image.vmm_context)
+        vmm_context_destroy(image.vmm_context);
+
+    if(path)
+        kfree(path);
+
+    exec_free_args(argv);
+    exec_free_args(envp);
+    free_actions(actions, action_count);
+
+    if(ref)
+        vop_release(&ref);
+
+    if(node)
+        vop_release(&node);
+
+    return ret;
+}
+
+_SYSCALL_REGISTER(SYS_spawn, _sys_spawn, "spawn", "%p, %p, %p, %p, %zu");
@@ -0,0 +1,10 @@
+#include <sys/syscall.h>
+#include <filesystem/vfs.h>
+
+__syscall syscallret_t _sys_sync(struct cpu_context* __unused) {
+    // sync(2) cannot fail, errors only show up in a later fsync()
+    vfs_sync();
+    return (syscallret_t) {.ret = 0, ._errno = 0};
+}
+
+_SYSCALL_REGISTER(SYS_sync, _sys_sync, "sync", "");
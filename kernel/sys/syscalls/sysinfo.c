@@ -3,6 +3,7 @@
 #include <amethyst/sysinfo.h>
 #include <mem/pmm.h>
 #include <mem/user.h>
+#include <mem/vmm.h>
 #include <sys/proc.h>
 #include <sys/timekeeper.h>
 #include <sys/loadavg.h>
@@ -27,10 +28,24 @@ __syscall syscallret_t _sys_sysinfo(struct cpu_context*, struct sysinfo* u_sysin
     sysinfo.uptime = ts.s;
 
     sysinfo.totalram = pmm_total_memory();
-    sysinfo.freeram = pmm_free_memroy();
+    sysinfo.freeram = pmm_free_memory();
+
+    static_assert((int) SYSINFO_ZONE_COUNT == (int) PMM_SECTION_COUNT);
+    for(int i = 0; i < SYSINFO_ZONE_COUNT; i++) {
+        struct pmm_section_stats stats;
+        pmm_section_stats(i, &stats);
+
+        sysinfo.zones[i].total = stats.total * PAGE_SIZE;
+        sysinfo.zones[i].free = stats.free * PAGE_SIZE;
+        sysinfo.zones[i].used = stats.used * PAGE_SIZE;
+    }
 
     sysinfo.procs = proc_count();
 
+    struct vmm_space* space = &current_vmm_context()->space;
+    sysinfo.self_rss = __atomic_load_n(&space->rss, __ATOMIC_RELAXED) * PAGE_SIZE;
+    sysinfo.self_vsz = __atomic_load_n(&space->vsz, __ATOMIC_RELAXED);
+
     assert(AVENRUN_COUNT >= 3);
     memcpy(sysinfo.loads, avenrun, 3);
 
@@ -10,7 +10,7 @@
 static struct scache* thread_cache;
 
 void thread_init(void) {
-    thread_cache = slab_newcache(sizeof(struct thread), 0, nullptr, nullptr);
+    thread_cache = slab_newcache("thread", sizeof(struct thread), 0, nullptr, nullptr);
     assert(thread_cache);
 }
 
@@ -15,12 +15,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <spawn.h>
 #include <stdio.h>
 
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
+extern char** environ;
+
 static struct shard_value builtin_debug_dump(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args);
 static struct shard_value builtin_debug_println(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args);
 static struct shard_value builtin_debug_unimplemented(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args);
@@ -345,13 +348,10 @@ static struct shard_value builtin_proc_spawn(volatile struct shard_evaluator* e,
 
     struct shard_value return_val = {.type=SHARD_VAL_INT, .integer = 255};
 
-    pid_t pid = fork();
-    if(pid == 0) {
-        execvp(exec.string, argv);
-        exit(255);
-    }
-    else if(pid < 0)
-        errno = -pid;
+    pid_t pid;
+    int spawn_err = posix_spawnp(&pid, exec.string, NULL, NULL, argv, environ);
+    if(spawn_err)
+        errno = spawn_err;
     else if(do_wait.boolean) {
         int pid_status;
         waitpid(pid, &pid_status, 0);
@@ -416,24 +416,30 @@ static struct shard_value builtin_proc_spawnPipe(volatile struct shard_evaluator
     assert(pipe(stdout_pipe) >= 0);
     assert(pipe(stderr_pipe) >= 0);
 
-    pid_t pid = fork();
-    if(pid == 0) {
-        close(stdout_pipe[0]);
-        close(stderr_pipe[0]);
-        close(stdin_pipe[1]);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
 
-        dup2(stdout_pipe[1], STDOUT_FILENO);
-        dup2(stderr_pipe[1], STDERR_FILENO);
-        dup2(stdin_pipe[1], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO);
 
-        close(stdout_pipe[1]);
-        close(stderr_pipe[1]);
+    int* pipes[] = {stdin_pipe, stdout_pipe, stderr_pipe};
+    for(size_t i = 0; i < sizeof(pipes) / sizeof(*pipes); i++) {
+        posix_spawn_file_actions_addclose(&actions, pipes[i][0]);
+        posix_spawn_file_actions_addclose(&actions, pipes[i][1]);
+    }
 
-        execvp(exec.string, argv);
-        exit(255);
+    pid_t pid;
+    int spawn_err = posix_spawnp(&pid, exec.string, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if(spawn_err) {
+        errno = spawn_err;
+        for(size_t i = 0; i < sizeof(pipes) / sizeof(*pipes); i++) {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
     }
-    else if(pid < 0)
-        errno = -pid;
     else {
         close(stdout_pipe[1]);
         close(stderr_pipe[1]);
@@ -125,7 +125,7 @@ static struct shard_value builtin_asyncProcess(volatile struct shard_evaluator*
     return INT_VAL(shell_resume(pid.integer));
 }
 
-static struct shard_value builtin_redirect(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args) {
+static struct shard_value builtin_pipe(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args) {
     struct shard_value streams = shard_builtin_eval_arg(e, builtin, args, 0);
     struct shard_value dest = shard_builtin_eval_arg(e, builtin, args, 1);
     struct shard_value source = shard_builtin_eval_arg(e, builtin, args, 2);
@@ -137,7 +137,7 @@ static struct shard_value builtin_redirect(volatile struct shard_evaluator* e, s
     return INT_VAL(source.integer);
 }
 
-static struct shard_value builtin_pipe(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args) {
+static struct shard_value builtin_redirect(volatile struct shard_evaluator* e, struct shard_builtin* builtin, struct shard_lazy_value** args) {
     struct shard_value streams = shard_builtin_eval_arg(e, builtin, args, 0);
     struct shard_value dest = shard_builtin_eval_arg(e, builtin, args, 1);
     struct shard_value source = shard_builtin_eval_arg(e, builtin, args, 2);
@@ -12,8 +12,13 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <string.h>
 
+extern char** environ;
+
 /*int shell_process(size_t argc, char** argv, enum shell_process_flags flags) {
     pid_t pid = fork();
     
@@ -57,48 +62,215 @@ void install_signal_handlers(void) {
     signal(SIGINT, sigint_handler);
 }
 
+// Processes are started lazily with posix_spawn(): redirections and pipes become file actions
+// of the pending child, which is only created once it gets resumed or waited for. This avoids
+// duplicating the shell's address space just to replace it with execve() right after.
+struct shell_process {
+    struct shell_process* next;
+    int64_t id;
+    pid_t pid; // 0 until started
+
+    char** argv;
+    posix_spawn_file_actions_t actions;
+
+    // pipe ends the shell keeps open until this process has inherited them
+    int parent_fds[3];
+    int parent_fd_count;
+};
+
+static struct shell_process* processes = NULL;
+static int64_t next_process_id = 1;
+
+static struct shell_process* find_process(int64_t id) {
+    for(struct shell_process* proc = processes; proc; proc = proc->next)
+        if(proc->id == id)
+            return proc;
+    return NULL;
+}
+
+static void release_spawn_data(struct shell_process* proc) {
+    if(!proc->argv)
+        return;
+
+    for(char** arg = proc->argv; *arg; arg++)
+        free(*arg);
+    free(proc->argv);
+    proc->argv = NULL;
+
+    posix_spawn_file_actions_destroy(&proc->actions);
+
+    for(int i = 0; i < proc->parent_fd_count; i++)
+        close(proc->parent_fds[i]);
+    proc->parent_fd_count = 0;
+}
+
+static void remove_process(struct shell_process* proc) {
+    struct shell_process** link = &processes;
+    while(*link != proc)
+        link = &(*link)->next;
+    *link = proc->next;
+
+    release_spawn_data(proc);
+    free(proc);
+}
+
+static int start_process(struct shell_process* proc) {
+    if(proc->pid)
+        return 0;
+
+    int err = posix_spawnp(&proc->pid, proc->argv[0], &proc->actions, NULL, proc->argv, environ);
+    if(err)
+        errorf("%s: %s", proc->argv[0], err == ENOENT ? "command not found" : strerror(err));
+
+    release_spawn_data(proc);
+    return err;
+}
+
 int shell_create_process(int argc, char** argv) {
     assert(argc > 0);
 
-    pid_t pid = fork();
-    
-    if(pid == 0) {
-        if(raise(SIGSTOP))
-            errorf("%s: failed stopping", argv[0]);
+    struct shell_process* proc = calloc(1, sizeof(struct shell_process));
+    if(!proc)
+        return -ENOMEM;
 
-        execvp(argv[0], argv);
+    proc->argv = calloc(argc + 1, sizeof(char*));
+    if(!proc->argv) {
+        free(proc);
+        return -ENOMEM;
+    }
 
-        errorf("%s: command not found", argv[0]);
-        exit(255);
+    for(int i = 0; i < argc; i++) {
+        if(!(proc->argv[i] = strdup(argv[i]))) {
+            release_spawn_data(proc);
+            free(proc);
+            return -ENOMEM;
+        }
     }
-    else if(pid < 0)
-        return pid;
 
-    int status;
-    waitpid(pid, &status, WUNTRACED);
+    posix_spawn_file_actions_init(&proc->actions);
 
-    if(!WIFSTOPPED(status)) {
-        assert(false && "???");
+    // pipe ends the shell still holds for other pending processes are not this one's
+    for(struct shell_process* other = processes; other; other = other->next) {
+        for(int i = 0; i < other->parent_fd_count; i++) {
+            if(posix_spawn_file_actions_addclose(&proc->actions, other->parent_fds[i])) {
+                release_spawn_data(proc);
+                free(proc);
+                return -ENOMEM;
+            }
+        }
     }
 
-    return pid;
+    proc->id = next_process_id++;
+    proc->next = processes;
+    processes = proc;
+
+    return proc->id;
 }
 
-int shell_pipe(int64_t src_pid, int64_t dst_pid, enum shell_iostream ios) {
-    assert(!"unimplemented");
+static int add_stream_actions(struct shell_process* proc, int fd, enum shell_iostream ios, bool input) {
+    static const struct { enum shell_iostream ios; int fd; } streams[] = {
+        {SHELL_STDIN,  STDIN_FILENO},
+        {SHELL_STDOUT, STDOUT_FILENO},
+        {SHELL_STDERR, STDERR_FILENO}
+    };
+
+    for(size_t i = 0; i < sizeof(streams) / sizeof(*streams); i++) {
+        if(!(ios & streams[i].ios) || (streams[i].fd == STDIN_FILENO) != input)
+            continue;
+
+        int err = posix_spawn_file_actions_adddup2(&proc->actions, fd, streams[i].fd);
+        if(err)
+            return err;
+    }
+
+    return 0;
 }
 
-int shell_redirect(int64_t src_pid, const char* restrict dst_path, enum shell_iostream ios) {
-    assert(!"unimplemented");
+// pipe ends are inherited by every child, so each pending one closes them after its dup2()s;
+// a reader would never see end of file while some process still holds the write end
+static int close_pending(int fd) {
+    for(struct shell_process* proc = processes; proc; proc = proc->next) {
+        if(proc->pid)
+            continue;
+
+        int err = posix_spawn_file_actions_addclose(&proc->actions, fd);
+        if(err)
+            return err;
+    }
+
+    return 0;
 }
 
-int shell_waitpid(int64_t pid) {
-    assert(shell.fg_pid == 0);
+int shell_pipe(int64_t src_id, int64_t dst_id, enum shell_iostream ios) {
+    struct shell_process* src = find_process(src_id);
+    struct shell_process* dst = find_process(dst_id);
+    if(!src || !dst || src->pid || dst->pid)
+        return ESRCH;
 
-    int err = shell_resume(pid);
-    if(err)
+    if(src->parent_fd_count >= 3 || dst->parent_fd_count >= 3)
+        return EMFILE;
+
+    int fds[2];
+    if(pipe(fds) < 0)
+        return errno;
+
+    int err;
+    if((err = add_stream_actions(src, fds[1], ios, false)) || (err = add_stream_actions(dst, fds[0], SHELL_STDIN, true))
+            || (err = close_pending(fds[0])) || (err = close_pending(fds[1]))) {
+        close(fds[0]);
+        close(fds[1]);
+        return err;
+    }
+
+    src->parent_fds[src->parent_fd_count++] = fds[1];
+    dst->parent_fds[dst->parent_fd_count++] = fds[0];
+    return 0;
+}
+
+int shell_redirect(int64_t src_id, const char* restrict dst_path, enum shell_iostream ios) {
+    struct shell_process* src = find_process(src_id);
+    if(!src || src->pid)
+        return ESRCH;
+
+    int err;
+    if(ios & SHELL_STDIN && (err = posix_spawn_file_actions_addopen(&src->actions, STDIN_FILENO, dst_path, O_RDONLY, 0)))
         return err;
 
+    // open the file once and share it between stdout and stderr, like `>&`
+    int out_fd = -1;
+    if(ios & SHELL_STDOUT) {
+        out_fd = STDOUT_FILENO;
+        if((err = posix_spawn_file_actions_addopen(&src->actions, out_fd, dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)))
+            return err;
+    }
+
+    if(ios & SHELL_STDERR) {
+        err = out_fd < 0
+            ? posix_spawn_file_actions_addopen(&src->actions, STDERR_FILENO, dst_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+            : posix_spawn_file_actions_adddup2(&src->actions, out_fd, STDERR_FILENO);
+        if(err)
+            return err;
+    }
+
+    return 0;
+}
+
+int shell_waitpid(int64_t id) {
+    assert(shell.fg_pid == 0);
+
+    struct shell_process* proc = find_process(id);
+    if(!proc)
+        return ESRCH;
+
+    // a command that could not be started fails like a child exiting with 255 after a failed execvp()
+    if(shell_resume(id)) {
+        remove_process(proc);
+        return 255;
+    }
+
+    pid_t pid = proc->pid;
+    remove_process(proc);
+
     shell.fg_pid = pid;
 
     int status;
@@ -112,24 +284,34 @@ int shell_waitpid(int64_t pid) {
     else if(WIFSIGNALED(status)) {
         shell.fg_pid = 0;
         int sig = WTERMSIG(status);
-        errorf("[%ld] %s", pid, strsignal(sig));
+        errorf("[%d] %s", pid, strsignal(sig));
         return 128 + sig;
     }
     else if(WIFSTOPPED(status)) {
         shell.fg_pid = 0;
         int sig = WSTOPSIG(status);
-        errorf("[%ld] %s", pid, strsignal(sig));
+        errorf("[%d] %s", pid, strsignal(sig));
         return 128 + sig;
     }
 
     assert(!"unreachable");
 }
 
-int shell_resume(int64_t pid) {
-    return kill(pid, SIGCONT) < 0 ? errno : 0;
-}
+int shell_resume(int64_t id) {
+    struct shell_process* proc = find_process(id);
+    if(!proc)
+        return ESRCH;
 
-int shell_suspend(int64_t pid) {
-    return kill(pid, SIGSTOP) < 0 ? errno : 0;
+    if(!proc->pid)
+        return start_process(proc);
+
+    return kill(proc->pid, SIGCONT) < 0 ? errno : 0;
 }
 
+int shell_suspend(int64_t id) {
+    struct shell_process* proc = find_process(id);
+    if(!proc || !proc->pid)
+        return ESRCH;
+
+    return kill(proc->pid, SIGSTOP) < 0 ? errno : 0;
+}
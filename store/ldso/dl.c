@@ -0,0 +1,578 @@
+#include "ldso.h"
+
+// libraries are placed from here upwards, well away from the program's break
+#define LIBRARY_AREA ((void*) 0x00000c0000000000)
+
+#define ROUND_DOWN(x, a) ((x) & ~((uintptr_t) (a) - 1))
+#define ROUND_UP(x, a) ROUND_DOWN((x) + (a) - 1, (a))
+#define IS_ERR(x) ((uintptr_t) (x) > -4096ul)
+
+extern Elf64_Dyn _DYNAMIC[] __attribute__((visibility("hidden")));
+
+void _dl_runtime_resolve(void);
+
+static struct dso objects[LDSO_MAX_OBJECTS];
+static size_t object_count;
+
+// the program, heading the list every symbol is looked up in
+static struct dso* program;
+
+static const char* library_path;
+static bool bind_now;
+
+void ldso_fail(const char* what, const char* name) {
+    ldso_print(LDSO_NAME ": ");
+    ldso_print(what);
+    if(name) {
+        ldso_print(" `");
+        ldso_print(name);
+        ldso_print("`");
+    }
+    ldso_print("\n");
+    ldso_exit(127);
+}
+
+// runs before anything else: the linker is linked -Bsymbolic with hidden symbols, which leaves
+// nothing but relative relocations
+static void relocate_self(uintptr_t base) {
+    const Elf64_Rela* rela = NULL;
+    size_t size = 0;
+
+    for(Elf64_Dyn* dyn = _DYNAMIC; dyn->d_tag != DT_NULL; dyn++) {
+        if(dyn->d_tag == DT_RELA)
+            rela = (const Elf64_Rela*) (base + dyn->d_un.d_ptr);
+        else if(dyn->d_tag == DT_RELASZ)
+            size = dyn->d_un.d_val;
+    }
+
+    for(size_t i = 0; i < size / sizeof(Elf64_Rela); i++) {
+        if(ELF64_R_TYPE(rela[i].r_info) == R_X86_64_RELATIVE)
+            *(uintptr_t*) (base + rela[i].r_offset) = base + rela[i].r_addend;
+    }
+}
+
+static const char* getenv(char** envp, const char* name) {
+    size_t len = strlen(name);
+    for(; *envp; envp++) {
+        if(strncmp(*envp, name, len) == 0 && (*envp)[len] == '=')
+            return *envp + len + 1;
+    }
+    return NULL;
+}
+
+static struct dso* new_object(const char* name) {
+    if(object_count == LDSO_MAX_OBJECTS)
+        ldso_fail("too many shared objects, cannot load", name);
+
+    struct dso* dso = &objects[object_count++];
+    dso->name = name;
+
+    if(object_count > 1)
+        objects[object_count - 2].next = dso;
+    return dso;
+}
+
+static void parse_dynamic(struct dso* dso) {
+    for(Elf64_Dyn* dyn = dso->dynamic; dyn->d_tag != DT_NULL; dyn++) {
+        uintptr_t ptr = dso->base + dyn->d_un.d_ptr;
+
+        switch(dyn->d_tag) {
+            case DT_SYMTAB:
+                dso->symtab = (const Elf64_Sym*) ptr;
+                break;
+            case DT_STRTAB:
+                dso->strtab = (const char*) ptr;
+                break;
+            case DT_HASH:
+                dso->hash = (const uint32_t*) ptr;
+                break;
+            case DT_GNU_HASH:
+                dso->gnu_hash = (const uint32_t*) ptr;
+                break;
+            case DT_RELA:
+                dso->rela = (const Elf64_Rela*) ptr;
+                break;
+            case DT_RELASZ:
+                dso->rela_size = dyn->d_un.d_val;
+                break;
+            case DT_JMPREL:
+                dso->jmprel = (const Elf64_Rela*) ptr;
+                break;
+            case DT_PLTRELSZ:
+                dso->jmprel_size = dyn->d_un.d_val;
+                break;
+            case DT_PLTGOT:
+                dso->pltgot = (uintptr_t*) ptr;
+                break;
+            case DT_INIT:
+                dso->init = (void (*)(void)) ptr;
+                break;
+            case DT_INIT_ARRAY:
+                dso->init_array = (void (**)(void)) ptr;
+                break;
+            case DT_INIT_ARRAYSZ:
+                dso->init_array_size = dyn->d_un.d_val / sizeof(void*);
+                break;
+            case DT_BIND_NOW:
+                dso->bind_now = true;
+                break;
+            case DT_FLAGS:
+                dso->bind_now |= (dyn->d_un.d_val & DF_BIND_NOW) != 0;
+                break;
+            case DT_FLAGS_1:
+                dso->bind_now |= (dyn->d_un.d_val & DF_1_NOW) != 0;
+                break;
+            case DT_PLTREL:
+                if(dyn->d_un.d_val != DT_RELA)
+                    ldso_fail("REL style PLT relocations are not supported in", dso->name);
+                break;
+            case DT_REL:
+                ldso_fail("REL relocations are not supported in", dso->name);
+            case DT_TEXTREL:
+                ldso_fail("text relocations are not supported in", dso->name);
+        }
+    }
+
+    if(!dso->symtab || !dso->strtab || !(dso->gnu_hash || dso->hash))
+        ldso_fail("no symbol table in", dso->name);
+}
+
+// maps the file part of a segment from the page cache and gives it a private copy only where
+// the bss starts within the last page
+static void map_segment(int fd, const char* path, uintptr_t base, const Elf64_Phdr* phdr) {
+    int prot = (phdr->p_flags & PF_R ? PROT_READ : 0)
+        | (phdr->p_flags & PF_W ? PROT_WRITE : 0)
+        | (phdr->p_flags & PF_X ? PROT_EXEC : 0);
+
+    uintptr_t start = ROUND_DOWN(base + phdr->p_vaddr, LDSO_PAGE_SIZE);
+    uintptr_t file_end = base + phdr->p_vaddr + phdr->p_filesz;
+    uintptr_t file_pages_end = phdr->p_filesz ? ROUND_UP(file_end, LDSO_PAGE_SIZE) : start;
+    uintptr_t mem_end = ROUND_UP(base + phdr->p_vaddr + phdr->p_memsz, LDSO_PAGE_SIZE);
+
+    bool zero_tail = file_end != file_pages_end && phdr->p_memsz > phdr->p_filesz;
+
+    if(file_pages_end > start) {
+        void* mapped = ldso_mmap((void*) start, file_pages_end - start, zero_tail ? prot | PROT_WRITE : prot,
+            MAP_PRIVATE | MAP_FIXED, fd, ROUND_DOWN(phdr->p_offset, LDSO_PAGE_SIZE));
+        if(IS_ERR(mapped))
+            ldso_fail("cannot map", path);
+
+        if(zero_tail) {
+            memset((void*) file_end, 0, file_pages_end - file_end);
+            if(!(prot & PROT_WRITE))
+                ldso_mprotect((void*) start, file_pages_end - start, prot);
+        }
+    }
+
+    if(mem_end > file_pages_end) {
+        void* mapped = ldso_mmap((void*) file_pages_end, mem_end - file_pages_end, prot, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
+        if(IS_ERR(mapped))
+            ldso_fail("out of memory loading", path);
+    }
+}
+
+static void map_library(int fd, const char* path, struct dso* dso) {
+    Elf64_Ehdr ehdr;
+    if(ldso_pread(fd, &ehdr, sizeof(Elf64_Ehdr), 0) != sizeof(Elf64_Ehdr)
+        || strncmp((const char*) ehdr.e_ident, ELFMAG, SELFMAG) || ehdr.e_type != ET_DYN || ehdr.e_machine != EM_X86_64
+        || ehdr.e_phentsize != sizeof(Elf64_Phdr) || ehdr.e_phnum > LDSO_MAX_PHDRS)
+        ldso_fail("not a shared object:", path);
+
+    Elf64_Phdr phdrs[LDSO_MAX_PHDRS];
+    long phdrs_size = ehdr.e_phnum * sizeof(Elf64_Phdr);
+    if(ldso_pread(fd, phdrs, phdrs_size, ehdr.e_phoff) != phdrs_size)
+        ldso_fail("cannot read program headers of", path);
+
+    uintptr_t low = UINTPTR_MAX, high = 0;
+    for(size_t i = 0; i < ehdr.e_phnum; i++) {
+        if(phdrs[i].p_type != PT_LOAD)
+            continue;
+
+        if(phdrs[i].p_vaddr % LDSO_PAGE_SIZE != phdrs[i].p_offset % LDSO_PAGE_SIZE || phdrs[i].p_filesz > phdrs[i].p_memsz)
+            ldso_fail("malformed segment in", path);
+
+        uintptr_t start = ROUND_DOWN(phdrs[i].p_vaddr, LDSO_PAGE_SIZE);
+        uintptr_t end = ROUND_UP(phdrs[i].p_vaddr + phdrs[i].p_memsz, LDSO_PAGE_SIZE);
+        low = start < low ? start : low;
+        high = end > high ? end : high;
+    }
+
+    if(low >= high)
+        ldso_fail("nothing to load in", path);
+
+    // find room for the whole object, the segments are then placed into it
+    void* area = ldso_mmap(LIBRARY_AREA, high - low, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(IS_ERR(area))
+        ldso_fail("out of memory loading", path);
+
+    ldso_munmap(area, high - low);
+    dso->base = (uintptr_t) area - low;
+
+    for(size_t i = 0; i < ehdr.e_phnum; i++) {
+        switch(phdrs[i].p_type) {
+            case PT_LOAD:
+                map_segment(fd, path, dso->base, &phdrs[i]);
+                break;
+            case PT_DYNAMIC:
+                dso->dynamic = (Elf64_Dyn*) (dso->base + phdrs[i].p_vaddr);
+                break;
+            case PT_GNU_RELRO:
+                dso->relro_start = dso->base + phdrs[i].p_vaddr;
+                dso->relro_size = phdrs[i].p_memsz;
+                break;
+        }
+    }
+
+    if(!dso->dynamic)
+        ldso_fail("no dynamic section in", path);
+}
+
+static int open_library(const char* name, char* path, size_t path_size) {
+    if(strlen(name) >= path_size)
+        return -1;
+
+    for(const char* c = name; *c; c++) {
+        if(*c == '/') {
+            memcpy(path, name, strlen(name) + 1);
+            return ldso_open(path);
+        }
+    }
+
+    const char* search[] = { library_path, LDSO_DEFAULT_PATH };
+    for(size_t i = 0; i < sizeof(search) / sizeof(*search); i++) {
+        for(const char* dir = search[i]; dir && *dir;) {
+            size_t dir_len = 0;
+            while(dir[dir_len] && dir[dir_len] != ':')
+                dir_len++;
+
+            size_t name_len = strlen(name);
+            if(dir_len && dir_len + name_len + 2 <= path_size) {
+                memcpy(path, dir, dir_len);
+                path[dir_len] = '/';
+                memcpy(path + dir_len + 1, name, name_len + 1);
+
+                int fd = ldso_open(path);
+                if(fd >= 0)
+                    return fd;
+            }
+
+            dir += dir_len;
+            if(*dir == ':')
+                dir++;
+        }
+    }
+
+    return -1;
+}
+
+static bool is_loaded(const char* name) {
+    for(size_t i = 0; i < object_count; i++) {
+        if(strcmp(objects[i].name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// breadth first, so lookups find symbols in the closest dependency first
+static void load_dependencies(void) {
+    char path[512];
+
+    for(struct dso* dso = program; dso; dso = dso->next) {
+        for(Elf64_Dyn* dyn = dso->dynamic; dyn->d_tag != DT_NULL; dyn++) {
+            if(dyn->d_tag != DT_NEEDED)
+                continue;
+
+            const char* name = dso->strtab + dyn->d_un.d_val;
+            if(is_loaded(name))
+                continue;
+
+            int fd = open_library(name, path, sizeof(path));
+            if(fd < 0)
+                ldso_fail("cannot find library", name);
+
+            struct dso* library = new_object(name);
+            map_library(fd, path, library);
+            ldso_close(fd);
+
+            parse_dynamic(library);
+        }
+    }
+}
+
+static uint32_t gnu_hash(const char* name) {
+    uint32_t h = 5381;
+    for(; *name; name++)
+        h = h * 33 + (unsigned char) *name;
+    return h;
+}
+
+static uint32_t sysv_hash(const char* name) {
+    uint32_t h = 0;
+    for(; *name; name++) {
+        h = (h << 4) + (unsigned char) *name;
+        h ^= (h >> 24) & 0xf0;
+    }
+    return h & 0x0fffffff;
+}
+
+static bool defines(const struct dso* dso, const Elf64_Sym* sym, const char* name) {
+    if(sym->st_shndx == SHN_UNDEF)
+        return false;
+
+    unsigned bind = ELF64_ST_BIND(sym->st_info);
+    unsigned type = ELF64_ST_TYPE(sym->st_info);
+    if((bind != STB_GLOBAL && bind != STB_WEAK)
+        || (type != STT_NOTYPE && type != STT_OBJECT && type != STT_FUNC && type != STT_COMMON))
+        return false;
+
+    return strcmp(dso->strtab + sym->st_name, name) == 0;
+}
+
+// GNU hash table: a bloom filter ruling out most misses, then a bucket of symbols sorted by
+// their hash, with the low bit of each marking the end of a chain
+static const Elf64_Sym* gnu_lookup(const struct dso* dso, const char* name, uint32_t hash) {
+    const uint32_t* table = dso->gnu_hash;
+    uint32_t bucket_count = table[0];
+    uint32_t sym_offset = table[1];
+    uint32_t bloom_size = table[2];
+    uint32_t bloom_shift = table[3];
+
+    const uint64_t* bloom = (const uint64_t*) (table + 4);
+    const uint32_t* buckets = (const uint32_t*) (bloom + bloom_size);
+    const uint32_t* chain = buckets + bucket_count;
+
+    uint64_t word = bloom[(hash / 64) % bloom_size];
+    uint64_t mask = (1ul << (hash % 64)) | (1ul << ((hash >> bloom_shift) % 64));
+    if((word & mask) != mask)
+        return NULL;
+
+    uint32_t index = buckets[hash % bucket_count];
+    if(index < sym_offset)
+        return NULL;
+
+    for(;; index++) {
+        uint32_t chain_hash = chain[index - sym_offset];
+        if((chain_hash | 1) == (hash | 1) && defines(dso, &dso->symtab[index], name))
+            return &dso->symtab[index];
+
+        if(chain_hash & 1)
+            return NULL;
+    }
+}
+
+static const Elf64_Sym* sysv_lookup(const struct dso* dso, const char* name, uint32_t hash) {
+    uint32_t bucket_count = dso->hash[0];
+    const uint32_t* buckets = dso->hash + 2;
+    const uint32_t* chain = buckets + bucket_count;
+
+    for(uint32_t index = buckets[hash % bucket_count]; index; index = chain[index]) {
+        if(defines(dso, &dso->symtab[index], name))
+            return &dso->symtab[index];
+    }
+
+    return NULL;
+}
+
+// first definition in load order, starting at `from`
+static const Elf64_Sym* lookup(const char* name, struct dso* from, struct dso** found) {
+    uint32_t gnu = gnu_hash(name);
+    uint32_t sysv = 0;
+
+    for(struct dso* dso = from; dso; dso = dso->next) {
+        const Elf64_Sym* sym;
+        if(dso->gnu_hash)
+            sym = gnu_lookup(dso, name, gnu);
+        else {
+            if(!sysv)
+                sysv = sysv_hash(name);
+            sym = sysv_lookup(dso, name, sysv);
+        }
+
+        if(sym) {
+            *found = dso;
+            return sym;
+        }
+    }
+
+    return NULL;
+}
+
+static uintptr_t symbol_address(struct dso* dso, uint32_t index, struct dso* from, const Elf64_Sym** def) {
+    const Elf64_Sym* sym = &dso->symtab[index];
+    const char* name = dso->strtab + sym->st_name;
+
+    struct dso* found;
+    *def = lookup(name, from, &found);
+    if(*def)
+        return found->base + (*def)->st_value;
+
+    if(ELF64_ST_BIND(sym->st_info) == STB_WEAK)
+        return 0;
+
+    ldso_print(LDSO_NAME ": ");
+    ldso_print(dso->name);
+    ldso_print(": undefined symbol `");
+    ldso_print(name);
+    ldso_print("`\n");
+    ldso_exit(127);
+}
+
+static void relocate(struct dso* dso, const Elf64_Rela* rela, size_t size) {
+    for(size_t i = 0; i < size / sizeof(Elf64_Rela); i++) {
+        uintptr_t* where = (uintptr_t*) (dso->base + rela[i].r_offset);
+        uint32_t type = ELF64_R_TYPE(rela[i].r_info);
+        uint32_t index = ELF64_R_SYM(rela[i].r_info);
+        const Elf64_Sym* def;
+
+        switch(type) {
+            case R_X86_64_NONE:
+                break;
+            case R_X86_64_RELATIVE:
+                *where = dso->base + rela[i].r_addend;
+                break;
+            case R_X86_64_64:
+                *where = symbol_address(dso, index, program, &def) + rela[i].r_addend;
+                break;
+            case R_X86_64_GLOB_DAT:
+            case R_X86_64_JUMP_SLOT:
+                *where = symbol_address(dso, index, program, &def);
+                break;
+            case R_X86_64_COPY: {
+                // the program's copy of a library variable, the library's own accesses go through its GOT
+                uintptr_t src = symbol_address(dso, index, dso->next, &def);
+                if(def)
+                    memcpy(where, (const void*) src, def->st_size < dso->symtab[index].st_size ? def->st_size : dso->symtab[index].st_size);
+                break;
+            }
+            default:
+                ldso_fail("unsupported relocation type in", dso->name);
+        }
+    }
+}
+
+// PLT entries start out pointing at the code pushing their index, the first call ends up in
+// ldso_bind() through the trampoline in GOT[2]
+static void prepare_plt(struct dso* dso) {
+    if(!dso->jmprel_size)
+        return;
+
+    if(bind_now || dso->bind_now || !dso->pltgot) {
+        relocate(dso, dso->jmprel, dso->jmprel_size);
+        return;
+    }
+
+    for(size_t i = 0; i < dso->jmprel_size / sizeof(Elf64_Rela); i++) {
+        const Elf64_Rela* rela = &dso->jmprel[i];
+        if(ELF64_R_TYPE(rela->r_info) != R_X86_64_JUMP_SLOT)
+            ldso_fail("unsupported PLT relocation type in", dso->name);
+
+        *(uintptr_t*) (dso->base + rela->r_offset) += dso->base;
+    }
+
+    dso->pltgot[1] = (uintptr_t) dso;
+    dso->pltgot[2] = (uintptr_t) _dl_runtime_resolve;
+}
+
+uintptr_t ldso_bind(struct dso* dso, size_t index) {
+    const Elf64_Rela* rela = &dso->jmprel[index];
+    const Elf64_Sym* def;
+
+    uintptr_t address = symbol_address(dso, ELF64_R_SYM(rela->r_info), program, &def);
+    *(uintptr_t*) (dso->base + rela->r_offset) = address;
+    return address;
+}
+
+static void initialize(struct dso* dso) {
+    if(dso->init)
+        dso->init();
+
+    for(size_t i = 0; i < dso->init_array_size; i++) {
+        void (*fn)(void) = dso->init_array[i];
+        if(fn && (uintptr_t) fn != UINTPTR_MAX)
+            fn();
+    }
+}
+
+uintptr_t ldso_main(uintptr_t* sp) {
+    size_t argc = sp[0];
+    char** argv = (char**) (sp + 1);
+    char** envp = argv + argc + 1;
+
+    char** env_end = envp;
+    while(*env_end)
+        env_end++;
+
+    Elf64_auxv_t* auxv = (Elf64_auxv_t*) (env_end + 1);
+    uintptr_t self_base = 0, entry = 0, phdr = 0;
+    size_t phnum = 0;
+
+    for(; auxv->a_type != AT_NULL; auxv++) {
+        switch(auxv->a_type) {
+            case AT_BASE:
+                self_base = auxv->a_val;
+                break;
+            case AT_ENTRY:
+                entry = auxv->a_val;
+                break;
+            case AT_PHDR:
+                phdr = auxv->a_val;
+                break;
+            case AT_PHNUM:
+                phnum = auxv->a_val;
+                break;
+        }
+    }
+
+    if(!self_base || !phdr || !entry)
+        ldso_fail("has to be started by the kernel as a program interpreter", NULL);
+
+    relocate_self(self_base);
+
+    library_path = getenv(envp, "LD_LIBRARY_PATH");
+    const char* bind_now_env = getenv(envp, "LD_BIND_NOW");
+    bind_now = bind_now_env && *bind_now_env;
+
+    program = new_object(argc ? argv[0] : "program");
+
+    const Elf64_Phdr* phdrs = (const Elf64_Phdr*) phdr;
+    for(size_t i = 0; i < phnum; i++) {
+        if(phdrs[i].p_type == PT_PHDR)
+            program->base = phdr - phdrs[i].p_vaddr;
+    }
+
+    for(size_t i = 0; i < phnum; i++) {
+        if(phdrs[i].p_type == PT_DYNAMIC)
+            program->dynamic = (Elf64_Dyn*) (program->base + phdrs[i].p_vaddr);
+        else if(phdrs[i].p_type == PT_GNU_RELRO) {
+            program->relro_start = program->base + phdrs[i].p_vaddr;
+            program->relro_size = phdrs[i].p_memsz;
+        }
+    }
+
+    // nothing to link
+    if(!program->dynamic)
+        return entry;
+
+    parse_dynamic(program);
+    load_dependencies();
+
+    // libraries before the program, so copy relocations see their initialized data
+    for(size_t i = object_count; i-- > 0;) {
+        struct dso* dso = &objects[i];
+        relocate(dso, dso->rela, dso->rela_size);
+        prepare_plt(dso);
+
+        if(dso->relro_size) {
+            uintptr_t start = ROUND_DOWN(dso->relro_start, LDSO_PAGE_SIZE);
+            uintptr_t end = ROUND_DOWN(dso->relro_start + dso->relro_size, LDSO_PAGE_SIZE);
+            if(end > start)
+                ldso_mprotect((void*) start, end - start, PROT_READ);
+        }
+    }
+
+    // the program's own constructors are left to its startup code, as in static programs
+    for(size_t i = object_count; i-- > 1;)
+        initialize(&objects[i]);
+
+    return entry;
+}
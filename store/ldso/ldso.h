@@ -0,0 +1,81 @@
+#ifndef _LDSO_H
+#define _LDSO_H
+
+#include "elf.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LDSO_NAME "ld.so"
+
+// search path for libraries named without a `/`, after LD_LIBRARY_PATH
+#define LDSO_DEFAULT_PATH "/lib:/usr/lib"
+
+#define LDSO_MAX_OBJECTS 32
+#define LDSO_MAX_PHDRS 16
+#define LDSO_PAGE_SIZE 4096
+
+// mmap(2) arguments, as in <sys/mman.h>
+#define PROT_NONE 0
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+
+#define O_RDONLY 0
+
+// a loaded object: the program, or one of the libraries it needs
+struct dso {
+    struct dso* next; // load order, which is also the order symbols are looked up in
+    const char* name;
+    uintptr_t base;   // added to every address in the object
+
+    Elf64_Dyn* dynamic;
+
+    const Elf64_Sym* symtab;
+    const char* strtab;
+
+    const uint32_t* hash;     // DT_HASH
+    const uint32_t* gnu_hash; // DT_GNU_HASH, preferred
+
+    const Elf64_Rela* rela;
+    size_t rela_size;
+    const Elf64_Rela* jmprel;
+    size_t jmprel_size;
+    uintptr_t* pltgot;
+
+    void (*init)(void);
+    void (**init_array)(void);
+    size_t init_array_size;
+
+    uintptr_t relro_start;
+    size_t relro_size;
+
+    bool bind_now;
+};
+
+// dl.c
+__attribute__((noreturn)) void ldso_fail(const char* what, const char* name);
+
+// util.c
+size_t strlen(const char* s);
+int strcmp(const char* a, const char* b);
+int strncmp(const char* a, const char* b, size_t n);
+void* memcpy(void* restrict dest, const void* restrict src, size_t n);
+void* memset(void* dest, int c, size_t n);
+
+void ldso_print(const char* s);
+__attribute__((noreturn)) void ldso_exit(int status);
+
+int ldso_open(const char* path);
+int ldso_close(int fd);
+long ldso_pread(int fd, void* buf, size_t count, long offset);
+void* ldso_mmap(void* addr, size_t len, int prot, int flags, int fd, long offset);
+int ldso_munmap(void* addr, size_t len);
+int ldso_mprotect(void* addr, size_t len, int prot);
+
+#endif /* _LDSO_H */
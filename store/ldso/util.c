@@ -0,0 +1,81 @@
+#include "ldso.h"
+
+#include <amethyst/syscall.h>
+#include <arch/syscall.h>
+
+// nothing here may depend on being relocated, the dynamic linker runs these before it is
+
+size_t strlen(const char* s) {
+    size_t n = 0;
+    while(s[n])
+        n++;
+    return n;
+}
+
+int strcmp(const char* a, const char* b) {
+    while(*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char) *a - (unsigned char) *b;
+}
+
+int strncmp(const char* a, const char* b, size_t n) {
+    for(; n; n--, a++, b++) {
+        if(*a != *b || !*a)
+            return (unsigned char) *a - (unsigned char) *b;
+    }
+    return 0;
+}
+
+void* memcpy(void* restrict dest, const void* restrict src, size_t n) {
+    unsigned char* d = dest;
+    const unsigned char* s = src;
+    while(n--)
+        *d++ = *s++;
+    return dest;
+}
+
+void* memset(void* dest, int c, size_t n) {
+    unsigned char* d = dest;
+    while(n--)
+        *d++ = (unsigned char) c;
+    return dest;
+}
+
+void ldso_print(const char* s) {
+    __syscall3(SYS_write, 2, (long) s, (long) strlen(s));
+}
+
+void ldso_exit(int status) {
+    for(;;)
+        __syscall1(SYS_exit, status);
+}
+
+int ldso_open(const char* path) {
+    return __syscall3(SYS_open, (long) path, O_RDONLY, 0);
+}
+
+int ldso_close(int fd) {
+    return __syscall1(SYS_close, fd);
+}
+
+long ldso_pread(int fd, void* buf, size_t count, long offset) {
+    long ret = __syscall3(SYS_lseek, fd, offset, 0 /* SEEK_SET */);
+    if(ret < 0)
+        return ret;
+
+    return __syscall3(SYS_read, fd, (long) buf, (long) count);
+}
+
+void* ldso_mmap(void* addr, size_t len, int prot, int flags, int fd, long offset) {
+    return (void*) __syscall6(SYS_mmap, (long) addr, (long) len, prot, flags, fd, offset);
+}
+
+int ldso_munmap(void* addr, size_t len) {
+    return __syscall2(SYS_munmap, (long) addr, (long) len);
+}
+
+int ldso_mprotect(void* addr, size_t len, int prot) {
+    return __syscall3(SYS_mprotect, (long) addr, (long) len, prot);
+}
@@ -15,6 +15,7 @@ extern "C" {
 #define O_TRUNC 01000
 #define O_APPEND 02000
 #define O_NONBLOCK 04000
+#define O_DIRECT 040000
 #define O_DIRECTORY 0100000
 #define O_CLOEXEC 02000000
 
@@ -0,0 +1,18 @@
+#ifndef _FCNTL_H
+#define _FCNTL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <bits/alltypes.h>
+#include <bits/fcntl.h>
+
+// amethyst has no fcntl() yet, descriptor flags can only be given to open()
+int open(const char* pathname, int flags, mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FCNTL_H */
@@ -0,0 +1,58 @@
+#ifndef _SPAWN_H
+#define _SPAWN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <bits/alltypes.h>
+
+#include <amethyst/spawn.h>
+
+// attribute flags; amethyst has neither process groups nor a scheduler policy interface,
+// so posix_spawn() rejects every flag with ENOTSUP for now
+#define POSIX_SPAWN_RESETIDS      0x01
+#define POSIX_SPAWN_SETPGROUP     0x02
+#define POSIX_SPAWN_SETSIGDEF     0x04
+#define POSIX_SPAWN_SETSIGMASK    0x08
+#define POSIX_SPAWN_SETSCHEDPARAM 0x10
+#define POSIX_SPAWN_SETSCHEDULER  0x20
+
+typedef struct {
+    short __flags;
+} posix_spawnattr_t;
+
+typedef struct {
+    int __count;
+    int __capacity;
+    struct spawn_action* __actions;
+} posix_spawn_file_actions_t;
+
+int posix_spawn(pid_t *restrict pid, const char *restrict path,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *restrict attrp,
+                char *const argv[restrict], char *const envp[restrict]);
+
+int posix_spawnp(pid_t *restrict pid, const char *restrict file,
+                 const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *restrict attrp,
+                 char *const argv[restrict], char *const envp[restrict]);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *restrict file_actions, int fd, const char *restrict path, int oflag, mode_t mode);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int new_fd);
+
+int posix_spawnattr_init(posix_spawnattr_t *attr);
+int posix_spawnattr_destroy(posix_spawnattr_t *attr);
+
+int posix_spawnattr_getflags(const posix_spawnattr_t *restrict attr, short *restrict flags);
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SPAWN_H */
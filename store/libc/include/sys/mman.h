@@ -14,6 +14,7 @@ extern "C" {
 #define MAP_FIXED   0x10
 #define MAP_ANON    0x20
 #define MAP_ANONYMOUS MAP_ANON
+#define MAP_POPULATE 0x8000
 
 #define MREMAP_MAYMOVE   1
 #define MREMAP_FIXED     2
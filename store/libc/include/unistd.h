@@ -23,6 +23,7 @@ extern "C" {
 #define O_TRUNC     01000
 #define O_APPEND    02000
 #define O_NONBLOCK  04000
+#define O_DIRECT    040000
 #define O_DIRECTORY 0100000
 #define O_CLOEXEC   02000000
 
@@ -60,6 +61,10 @@ ssize_t write(int fd, const void* buf, size_t size);
 
 off_t lseek(int fd, off_t offset, int whence);
 
+int fsync(int fd);
+int fdatasync(int fd);
+void sync(void);
+
 _Noreturn void _exit(int status);
 
 // include <sys/syscalls.h> for syscall numbers
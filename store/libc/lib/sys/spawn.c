@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+
+#include <spawn.h>
+
+#include <sys/syscall.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_PATH "/usr/local/bin:/bin:/usr/bin"
+
+int posix_spawn(pid_t *restrict pid, const char *restrict path,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *restrict attrp,
+                char *const argv[restrict], char *const envp[restrict]) {
+    if(attrp && attrp->__flags)
+        return ENOTSUP;
+
+    long ret = syscall(SYS_spawn, path, argv, envp ? envp : environ,
+        file_actions ? file_actions->__actions : NULL,
+        file_actions ? (size_t) file_actions->__count : 0);
+
+    if(ret < 0)
+        return errno;
+
+    if(pid)
+        *pid = (pid_t) ret;
+    return 0;
+}
+
+int posix_spawnp(pid_t *restrict pid, const char *restrict file,
+                 const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *restrict attrp,
+                 char *const argv[restrict], char *const envp[restrict]) {
+    if(strchr(file, '/'))
+        return posix_spawn(pid, file, file_actions, attrp, argv, envp);
+
+    const char* search = getenv("PATH");
+    if(!search)
+        search = DEFAULT_PATH;
+
+    size_t file_len = strlen(file);
+    char buf[PATH_MAX];
+    int err = ENOENT;
+
+    for(const char* dir = search; *dir;) {
+        const char* end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t) (end - dir) : strlen(dir);
+
+        if(dir_len + file_len + 2 <= sizeof(buf)) {
+            memcpy(buf, dir, dir_len);
+            buf[dir_len] = '/';
+            memcpy(buf + dir_len + 1, file, file_len + 1);
+
+            err = posix_spawn(pid, buf, file_actions, attrp, argv, envp);
+            if(err != ENOENT && err != ENOTDIR && err != EACCES)
+                return err;
+        }
+
+        if(!end)
+            break;
+        dir = end + 1;
+    }
+
+    return err;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions) {
+    file_actions->__count = 0;
+    file_actions->__capacity = 0;
+    file_actions->__actions = NULL;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions) {
+    for(int i = 0; i < file_actions->__count; i++)
+        free((char*) file_actions->__actions[i].path);
+
+    free(file_actions->__actions);
+    return posix_spawn_file_actions_init(file_actions);
+}
+
+static struct spawn_action* add_action(posix_spawn_file_actions_t *file_actions, int type, int fd) {
+    if(file_actions->__count == file_actions->__capacity) {
+        int capacity = file_actions->__capacity ? file_actions->__capacity * 2 : 4;
+        if(capacity > SPAWN_ACTIONS_MAX)
+            return NULL;
+
+        struct spawn_action* actions = realloc(file_actions->__actions, capacity * sizeof(struct spawn_action));
+        if(!actions)
+            return NULL;
+
+        file_actions->__actions = actions;
+        file_actions->__capacity = capacity;
+    }
+
+    struct spawn_action* action = &file_actions->__actions[file_actions->__count++];
+    memset(action, 0, sizeof(struct spawn_action));
+    action->type = type;
+    action->fd = fd;
+    return action;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *restrict file_actions, int fd, const char *restrict path, int oflag, mode_t mode) {
+    if(fd < 0)
+        return EBADF;
+
+    char* path_copy = strdup(path);
+    if(!path_copy)
+        return ENOMEM;
+
+    struct spawn_action* action = add_action(file_actions, SPAWN_ACTION_OPEN, fd);
+    if(!action) {
+        free(path_copy);
+        return ENOMEM;
+    }
+
+    action->path = path_copy;
+    action->oflag = oflag;
+    action->mode = mode;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd) {
+    if(fd < 0)
+        return EBADF;
+
+    return add_action(file_actions, SPAWN_ACTION_CLOSE, fd) ? 0 : ENOMEM;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int new_fd) {
+    if(fd < 0 || new_fd < 0)
+        return EBADF;
+
+    struct spawn_action* action = add_action(file_actions, SPAWN_ACTION_DUP2, fd);
+    if(!action)
+        return ENOMEM;
+
+    action->new_fd = new_fd;
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t *attr) {
+    attr->__flags = 0;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t *attr) {
+    (void) attr;
+    return 0;
+}
+
+int posix_spawnattr_getflags(const posix_spawnattr_t *restrict attr, short *restrict flags) {
+    *flags = attr->__flags;
+    return 0;
+}
+
+int posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags) {
+    attr->__flags = flags;
+    return 0;
+}
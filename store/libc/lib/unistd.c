@@ -36,6 +36,18 @@ off_t lseek(int fd, off_t offset, int whence) {
     return syscall(SYS_lseek, fd, offset, whence);
 }
 
+int fsync(int fd) {
+    return syscall(SYS_fsync, fd);
+}
+
+int fdatasync(int fd) {
+    return syscall(SYS_fdatasync, fd);
+}
+
+void sync(void) {
+    syscall(SYS_sync);
+}
+
 _Noreturn void _exit(int status) {
     _Exit(status);
 }